@@ -41,6 +41,14 @@ namespace pen
     void  memory_free_align(void* mem);
     void  memory_zero(void* dest, size_t size_bytes);
 
+    // Reserved address space committed in place, memory_reserve returns nullptr where virtual memory is unavailable.
+    void* memory_reserve(size_t size_bytes);
+    bool  memory_commit(void* mem, size_t size_bytes);
+    void  memory_release(void* mem, size_t size_bytes);
+
+    // Maps a file copy on write over committed, page aligned memory. false if the file has to be read instead.
+    bool memory_map_file(void* mem, size_t size_bytes, const c8* filename, size_t offset);
+
     // Implementation
 
     inline void* memory_alloc(size_t size_bytes)
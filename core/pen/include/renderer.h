@@ -369,6 +369,60 @@ namespace pen
         float padding_0, padding_1;
     };
 
+    struct cmd_buffer_stats
+    {
+        u32    cmd_count;              // commands submitted in the last frame
+        size_t cmd_bytes;              // bytes written to the cmd stream in the last frame
+        u32    elided_cmd_count;       // redundant binds dropped by the front end shadow state in the last frame
+        size_t payload_bytes;          // command payload bytes allocated in the last frame
+        size_t payload_peak_bytes;     // largest payload_bytes seen
+        size_t payload_overflow_bytes; // payload bytes in the last frame which did not fit the arena
+    };
+
+    static const u32 k_max_renderer_cmd_types = 64;
+
+    // submitted by the front end during a single frame, published when the frame is handed to the render thread
+    struct renderer_frame_stats
+    {
+        u64    frame_index;
+        u32    cmd_count[k_max_renderer_cmd_types]; // commands by opcode, see renderer_get_cmd_name
+        size_t cmd_bytes;                           // bytes written to the cmd stream
+        size_t cmd_fixed_bytes;                     // bytes the same commands took as fixed size renderer_cmd structs
+        u32    draw_calls;
+        u32    instances;
+        u64    primitives;
+        u32    state_changes;           // shader, input layout, buffer, texture, target and fixed function binds
+        u64    cbuffer_bytes;           // bytes uploaded to constant buffers
+        u64    texture_bytes_created;   // estimated from dimensions and format when no data is supplied
+        u64    texture_bytes_released;
+        size_t cmd_buffer_peak_bytes;   // peak occupancy of the cmd stream
+        size_t cmd_buffer_capacity;
+        u32    release_buffer_peak;     // peak number of deferred releases waiting for the gpu
+        u32    release_buffer_capacity;
+        u32    frames_in_flight;
+        f32    frame_latency_ms; // from the game thread starting a frame to the render thread presenting it
+        f32    frame_wait_ms;    // game thread blocked in renderer_consume_cmd_buffer waiting for frames in flight
+    };
+
+#ifdef PEN_RENDERER_NULL
+    struct null_renderer_stats
+    {
+        u32 draws;             // draw calls of all types
+        u32 dispatches;        // compute dispatches
+        u64 vertices;          // vertices or indices submitted, multiplied by instance count
+        u32 shader_binds;      // set_shader calls
+        u32 buffer_binds;      // vertex, index, constant and structured buffer binds
+        u32 texture_binds;     // texture and sampler binds
+        u32 state_binds;       // raster, blend, depth stencil, input layout, viewport and scissor binds
+        u32 target_binds;      // set_targets calls
+        u64 bytes_uploaded;    // buffer, texture and shader data sent to the device
+        u32 validation_errors; // invalid handles or state, the first few are logged
+    };
+
+    // counts for the last presented frame, only available when building with the null renderer
+    void renderer_get_null_stats(null_renderer_stats& stats);
+#endif
+
     // general accessors
     const c8*            renderer_get_shader_platform();
     bool                 renderer_viewport_vup();
@@ -381,6 +435,13 @@ namespace pen
     void renderer_test_run();
     void renderer_test_enable();
 
+    // capture records every command executed by the render thread for num_frames presents, including payload data,
+    // enable before renderer_init (from pen_entry or with -capture <file> <frames>) so resource creation is included.
+    // replay executes a capture on the render thread in place of the user thread as fast as the backend allows and
+    // logs per command timing histograms (-replay <file>), captures can be replayed on any backend including null.
+    void renderer_capture_enable(const c8* filename, u32 num_frames);
+    void renderer_replay_enable(const c8* filename);
+
     // public-api will buffer all commands for dispatch on dedicated thread
     void       renderer_new_frame();
     void       renderer_set_current_ctx(render_ctx ctx);
@@ -444,6 +505,27 @@ namespace pen
     void       renderer_consume_cmd_buffer();
     void       renderer_update_queries();
     void       renderer_get_present_time(f32& cpu_ms, f32& gpu_ms);
+    void       renderer_get_cmd_buffer_stats(cmd_buffer_stats& stats);
+    const c8*  renderer_get_cmd_name(u32 cmd_index);
+
+    // transient constant buffers, per draw constants are written into a per frame ring and bound by offset so draws do
+    // not need a buffer each. writes since the last transient bind are uploaded with a single update, offsets are only
+    // valid for the frame they were written in. a frame which overflows the ring chains extra pages, so writes always
+    // succeed. the set returns false without binding anything only for PEN_INVALID_HANDLE or a stale offset.
+    static const u32 k_transient_cbuffer_alignment = 256;
+    u32              renderer_write_transient_cbuffer(const void* data, u32 size); // returns offset to bind
+    bool             renderer_set_transient_cbuffer(u32 offset, u32 size, u32 unit, u32 flags);
+
+    // frames in flight, how many presented frames the game thread may run ahead of the render thread before
+    // renderer_consume_cmd_buffer blocks. 1 is the default, more trades latency for throughput when game and render
+    // thread frame times are uneven. see renderer_frame_stats frame_latency_ms.
+    static const u32 k_max_renderer_frames_in_flight = 3;
+    void             renderer_set_frames_in_flight(u32 num_frames);
+    u32              renderer_get_frames_in_flight();
+
+    // the last completed frame, readable from any thread without locking. a read which overlaps the next publish
+    // copies again so the result is never torn
+    renderer_frame_stats renderer_get_frame_stats();
 
     namespace direct
     {
@@ -475,6 +557,7 @@ namespace pen
                                          const u32* offsets);
         void renderer_set_index_buffer(u32 buffer_index, u32 format, u32 offset);
         void renderer_set_constant_buffer(u32 buffer_index, u32 unit, u32 flags);
+        void renderer_set_constant_buffer_range(u32 buffer_index, u32 unit, u32 flags, u32 offset, u32 size);
         void renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags);
         void renderer_update_buffer(u32 buffer_index, const void* data, u32 data_size, u32 offset);
 
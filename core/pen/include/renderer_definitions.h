@@ -129,7 +129,8 @@ enum bind_flags
 enum cpu_access_flags
 {
     PEN_CPU_ACCESS_WRITE = 1 << 0,
-    PEN_CPU_ACCESS_READ = 1 << 1
+    PEN_CPU_ACCESS_READ = 1 << 1,
+    PEN_CPU_ACCESS_NO_OVERWRITE = 1 << 2 // updates at an offset keep the rest of the buffer, caller avoids data in flight
 };
 
 enum texture_address_mode
@@ -18,6 +18,9 @@ namespace pen
     typedef void (*completion_callback)(void*);
     typedef void* (*dispatch_thread)(void*);
     typedef loop_t (*single_thread_update_func)();
+    typedef void (*task_func)(void* user_data);
+    typedef void (*parallel_for_func)(u32 start, u32 end, void* user_data);
+    typedef u32 task_handle;
 
     // A Job is just a thread with some user data, a callback
     // and some syncronisation semaphores
@@ -71,6 +74,40 @@ namespace pen
     void jobs_create_single_thread_update(single_thread_update_func func);
     void jobs_run_single_threaded();
 
+    // Tasks
+    // Short lived units of work executed by a pool of worker threads (one per core) each with its own work stealing
+    // deque. Workers are created lazily on first use, on single threaded platforms tasks are executed inline.
+    // A task created with a parent must finish before the parent is considered complete, dependencies must be added
+    // before jobs_run_task is called on the dependent task. Threads waiting on a task help by executing other tasks.
+    // Single threaded builds return PEN_INVALID_HANDLE from jobs_create_task when every task is created but not yet run,
+    // the other task functions ignore an invalid handle.
+
+    struct task_stats
+    {
+        u64 executed;
+        u64 stolen;
+    };
+
+    u32         jobs_get_num_workers();
+    void        jobs_set_num_active_workers(u32 num_workers);
+    task_handle jobs_create_task(task_func func, void* user_data, task_handle parent = PEN_INVALID_HANDLE);
+    void        jobs_add_dependency(task_handle task, task_handle depends_on);
+    void        jobs_run_task(task_handle task);
+    void        jobs_wait_task(task_handle task);
+    bool        jobs_task_complete(task_handle task);
+    void        jobs_get_task_stats(task_stats& stats);
+    void        jobs_reset_task_stats();
+
+    // Splits [start, end) into chunks of at least grain_size and calls func for each chunk on the worker pool,
+    // returns once all chunks have completed.
+    void parallel_for(u32 start, u32 end, u32 grain_size, parallel_for_func func, void* user_data);
+
+    template <typename T>
+    void parallel_for(u32 start, u32 end, u32 grain_size, const T& func)
+    {
+        parallel_for(start, end, grain_size, [](u32 s, u32 e, void* ud) { (*(const T*)ud)(s, e); }, (void*)&func);
+    }
+
     // Mutex
     mutex* mutex_create();
     void   mutex_destroy(mutex* p_mutex);
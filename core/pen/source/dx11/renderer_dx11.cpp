@@ -60,6 +60,9 @@ namespace
     ID3D11DeviceContext1*   s_immediate_context_1 = nullptr;
     u64                     s_frame = 0; // to remove
 
+    // without d3d11.1 a constant buffer range is copied into a scratch buffer per unit and bound whole
+    ID3D11Buffer* s_cbuffer_range_scratch[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {0};
+
     D3D11_FILL_MODE to_d3d11_fill_mode(u32 pen_fill_mode)
     {
         switch (pen_fill_mode)
@@ -792,6 +795,8 @@ namespace pen
         ID3D11Buffer*              buf;
         ID3D11UnorderedAccessView* uav;
         ID3D11ShaderResourceView*  srv;
+        u32                        cpu_access_flags;
+        u8*                        shadow; // cpu copy of no overwrite cbuffers bound by range without d3d11.1
     };
 
     struct resource_allocation
@@ -1115,7 +1120,21 @@ namespace pen
         bd.CPUAccessFlags = to_d3d11_cpu_access_flags(params.cpu_access_flags);
         bd.ByteWidth = params.buffer_size;
 
-        if (bd.BindFlags & PEN_BIND_SHADER_WRITE)
+        ua_buffer& gb = _res_pool[resource_index].generic_buffer;
+        gb.cpu_access_flags = params.cpu_access_flags;
+        gb.shadow = nullptr;
+
+        if ((params.cpu_access_flags & PEN_CPU_ACCESS_NO_OVERWRITE) && (params.bind_flags & PEN_BIND_CONSTANT_BUFFER) &&
+            !s_immediate_context_1)
+        {
+            gb.shadow = (u8*)memory_alloc(params.buffer_size);
+            if (params.data)
+                memcpy(gb.shadow, params.data, params.buffer_size);
+        }
+
+        // structured buffers can be read only when written from the cpu, or read write when bound for shader write
+        bool structured = params.stride && (params.bind_flags & (PEN_BIND_SHADER_WRITE | PEN_BIND_SHADER_RESOURCE));
+        if (structured)
         {
             bd.MiscFlags |= D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
             bd.StructureByteStride = params.stride;
@@ -1135,7 +1154,7 @@ namespace pen
             CHECK_CALL(s_device->CreateBuffer(&bd, nullptr, &_res_pool[resource_index].generic_buffer.buf));
         }
 
-        if (bd.BindFlags & PEN_BIND_SHADER_WRITE)
+        if (params.bind_flags & PEN_BIND_SHADER_WRITE)
         {
             // uav if we need it
             D3D11_UNORDERED_ACCESS_VIEW_DESC uav_desc = {};
@@ -1146,7 +1165,10 @@ namespace pen
 
             CHECK_CALL(s_device->CreateUnorderedAccessView(_res_pool[resource_index].generic_buffer.buf, &uav_desc,
                                                            &_res_pool[resource_index].generic_buffer.uav));
+        }
 
+        if (structured)
+        {
             // srv if we need it
             D3D11_SHADER_RESOURCE_VIEW_DESC srv_desc = {};
             srv_desc.ViewDimension = D3D11_SRV_DIMENSION_BUFFEREX;
@@ -1819,6 +1841,64 @@ namespace pen
         }
     }
 
+    void direct::renderer_set_constant_buffer_range(u32 buffer_index, u32 unit, u32 flags, u32 offset, u32 size)
+    {
+        if (!s_immediate_context_1)
+        {
+            // constant buffer offsets require d3d11.1, copy the range from the cpu shadow into a scratch buffer
+            const ua_buffer& gb = _res_pool[buffer_index].generic_buffer;
+            if (!gb.shadow || unit >= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT)
+            {
+                PEN_LOG("[error] constant buffer range bound without d3d11.1 or a cpu shadow, buffer %u", buffer_index);
+                PEN_ASSERT(0);
+                return;
+            }
+
+            ID3D11Buffer*& scratch = s_cbuffer_range_scratch[unit];
+            if (!scratch)
+            {
+                D3D11_BUFFER_DESC bd;
+                ZeroMemory(&bd, sizeof(bd));
+                bd.Usage = D3D11_USAGE_DYNAMIC;
+                bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+                bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+                bd.ByteWidth = D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT * 16;
+
+                CHECK_CALL(s_device->CreateBuffer(&bd, nullptr, &scratch));
+            }
+
+            D3D11_MAPPED_SUBRESOURCE mapped_res = {0};
+            s_immediate_context->Map(scratch, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_res);
+            memcpy(mapped_res.pData, gb.shadow + offset, min<u32>(size, D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT * 16));
+            s_immediate_context->Unmap(scratch, 0);
+
+            if (flags & pen::CBUFFER_BIND_PS)
+                s_immediate_context->PSSetConstantBuffers(unit, 1, &scratch);
+
+            if (flags & pen::CBUFFER_BIND_VS)
+                s_immediate_context->VSSetConstantBuffers(unit, 1, &scratch);
+
+            if (flags & pen::CBUFFER_BIND_CS)
+                s_immediate_context->CSSetConstantBuffers(unit, 1, &scratch);
+
+            return;
+        }
+
+        // offsets and sizes are in 16 byte constants
+        ID3D11Buffer** buf = &_res_pool[buffer_index].generic_buffer.buf;
+        UINT           first_constant = offset / 16;
+        UINT           num_constants = size / 16;
+
+        if (flags & pen::CBUFFER_BIND_PS)
+            s_immediate_context_1->PSSetConstantBuffers1(unit, 1, buf, &first_constant, &num_constants);
+
+        if (flags & pen::CBUFFER_BIND_VS)
+            s_immediate_context_1->VSSetConstantBuffers1(unit, 1, buf, &first_constant, &num_constants);
+
+        if (flags & pen::CBUFFER_BIND_CS)
+            s_immediate_context_1->CSSetConstantBuffers1(unit, 1, buf, &first_constant, &num_constants);
+    }
+
     void direct::renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
     {
         static ID3D11Buffer*              null_buffer = nullptr;
@@ -1865,7 +1945,20 @@ namespace pen
     {
         D3D11_MAPPED_SUBRESOURCE mapped_res = {0};
 
-        s_immediate_context->Map(_res_pool[buffer_index].generic_buffer.buf, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_res);
+        ua_buffer& gb = _res_pool[buffer_index].generic_buffer;
+        if (gb.shadow)
+        {
+            // only ever bound by range through the shadow copy
+            memcpy(gb.shadow + offset, data, data_size);
+            return;
+        }
+
+        // buffers created with no overwrite keep the contents around an offset write (transient cbuffer ring)
+        D3D11_MAP map_type = D3D11_MAP_WRITE_DISCARD;
+        if (offset > 0 && (gb.cpu_access_flags & PEN_CPU_ACCESS_NO_OVERWRITE))
+            map_type = D3D11_MAP_WRITE_NO_OVERWRITE;
+
+        s_immediate_context->Map(_res_pool[buffer_index].generic_buffer.buf, 0, map_type, 0, &mapped_res);
 
         void* p_data = (void*)((size_t)mapped_res.pData + offset);
         memcpy(p_data, data, data_size);
@@ -1973,6 +2066,12 @@ namespace pen
     void direct::renderer_release_buffer(u32 buffer_index)
     {
         _res_pool[buffer_index].generic_buffer.buf->Release();
+
+        if (_res_pool[buffer_index].generic_buffer.shadow)
+        {
+            memory_free(_res_pool[buffer_index].generic_buffer.shadow);
+            _res_pool[buffer_index].generic_buffer.shadow = nullptr;
+        }
     }
 
     void direct::renderer_release_texture(u32 texture_index)
@@ -2459,6 +2558,10 @@ namespace pen
         if (s_swap_chain_1)
             s_swap_chain_1->Release();
 
+        for (u32 i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; ++i)
+            if (s_cbuffer_range_scratch[i])
+                s_cbuffer_range_scratch[i]->Release();
+
         if (s_immediate_context)
             s_immediate_context->Release();
         if (s_immediate_context_1)
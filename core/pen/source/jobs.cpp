@@ -7,6 +7,10 @@
 #include "renderer.h"
 #include "threads.h"
 
+#if !PEN_SINGLE_THREADED
+#include <thread>
+#endif
+
 #define MAX_THREADS 32 // lazy fixed sized array to avoid any thread saftey issues
 
 using namespace pen;
@@ -18,6 +22,441 @@ namespace
     single_thread_update_func* s_single_thread_funcs = nullptr;
 } // namespace
 
+// tasks
+namespace
+{
+    constexpr u32 k_max_tasks = 4096; // must be po2, handle = generation << k_task_index_bits | index
+    constexpr u32 k_task_index_bits = 12;
+    constexpr u32 k_task_index_mask = k_max_tasks - 1;
+    constexpr u32 k_max_continuations = 8;
+    constexpr u32 k_max_parallel_for_chunks = 256;
+    constexpr u32 k_task_claim_warn_rounds = 64; // passes over every slot before a full task pool is reported
+
+    struct task
+    {
+        task_func   func;
+        void*       user_data;
+        task_handle parent;
+        task_handle continuations[k_max_continuations];
+        u32         num_continuations;
+        a_u32       handle;
+        a_s32       unfinished;   // self + children
+        a_s32       dependencies; // unresolved dependencies + 1 released by jobs_run_task
+        a_bool      complete;
+        a_bool      lock;
+        a_bool      in_use; // claimed by jobs_create_task until the task finishes
+    };
+
+    struct parallel_for_chunk
+    {
+        parallel_for_func func;
+        void*             user_data;
+        u32               start;
+        u32               end;
+    };
+
+    task  s_tasks[k_max_tasks];
+    a_u32 s_next_task = {0};
+
+    void task_lock(task& t)
+    {
+#if !PEN_SINGLE_THREADED
+        bool expected = false;
+        while (!t.lock.compare_exchange_weak(expected, true, std::memory_order_acquire))
+            expected = false;
+#endif
+    }
+
+    void task_unlock(task& t)
+    {
+#if !PEN_SINGLE_THREADED
+        t.lock.store(false, std::memory_order_release);
+#endif
+    }
+
+    bool task_claim(task& t)
+    {
+#if PEN_SINGLE_THREADED
+        if (t.in_use)
+            return false;
+
+        t.in_use = true;
+        return true;
+#else
+        bool expected = false;
+        return t.in_use.compare_exchange_strong(expected, true);
+#endif
+    }
+
+    task& task_get(task_handle h)
+    {
+        return s_tasks[h & k_task_index_mask];
+    }
+
+    void task_execute(task_handle h);
+
+#if PEN_SINGLE_THREADED
+    task_stats s_stats = {0, 0};
+
+    void task_init()
+    {
+    }
+
+    void task_enqueue(task_handle h)
+    {
+        // no workers, so execute immediately once dependencies are met
+        task_execute(h);
+    }
+
+    void task_count_executed()
+    {
+        s_stats.executed++;
+    }
+
+    void task_help()
+    {
+    }
+#else
+    constexpr u32 k_max_workers = MAX_THREADS;
+    constexpr u32 k_max_external_threads = 8;
+    constexpr u32 k_max_queues = k_max_workers + k_max_external_threads;
+    constexpr u32 k_queue_capacity = k_max_tasks;
+    constexpr u32 k_queue_mask = k_queue_capacity - 1;
+    constexpr u32 k_idle_spins = 64;
+
+    // Chase-Lev work stealing deque, the owning thread pushes and pops from the bottom, other threads steal from the top
+    struct task_deque
+    {
+        std::atomic<s64> top;
+        u8               pad0[64 - sizeof(std::atomic<s64>)];
+        std::atomic<s64> bottom;
+        u8               pad1[64 - sizeof(std::atomic<s64>)];
+        std::atomic<u64> executed;
+        std::atomic<u64> stolen;
+        std::atomic<u32> tasks[k_queue_capacity];
+
+        void push(task_handle h)
+        {
+            s64 b = bottom.load(std::memory_order_relaxed);
+            s64 t = top.load(std::memory_order_acquire);
+            PEN_ASSERT(b - t < (s64)k_queue_capacity);
+
+            tasks[b & k_queue_mask].store(h, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        task_handle pop()
+        {
+            s64 b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 t = top.load(std::memory_order_relaxed);
+
+            if (t > b)
+            {
+                // empty
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return PEN_INVALID_HANDLE;
+            }
+
+            task_handle h = tasks[b & k_queue_mask].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // last item, race against stealers
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    h = PEN_INVALID_HANDLE;
+
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+
+            return h;
+        }
+
+        task_handle steal()
+        {
+            s64 t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            s64 b = bottom.load(std::memory_order_acquire);
+
+            if (t >= b)
+                return PEN_INVALID_HANDLE;
+
+            task_handle h = tasks[t & k_queue_mask].load(std::memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return PEN_INVALID_HANDLE;
+
+            return h;
+        }
+
+        bool empty()
+        {
+            return bottom.load(std::memory_order_acquire) <= top.load(std::memory_order_acquire);
+        }
+    };
+
+    enum task_init_state
+    {
+        e_uninitialised,
+        e_initialising,
+        e_initialised
+    };
+
+    struct task_queue_owner
+    {
+        s32 index = -1;
+        ~task_queue_owner();
+    };
+
+    task_deque                    s_queues[k_max_queues];
+    a_bool                        s_queue_used[k_max_queues];
+    a_u32                         s_init_state = {e_uninitialised};
+    u32                           s_num_workers = 0;
+    a_u32                         s_num_active_workers = {0};
+    a_u32                         s_num_queues = {0};
+    a_s32                         s_num_sleepers = {0};
+    a_bool                        s_workers_exit = {false};
+    a_u64                         s_inline_executed = {0};
+    semaphore*                    s_wake = nullptr;
+    thread_local task_queue_owner s_queue;
+    thread_local u32              s_rand = 0;
+
+    task_queue_owner::~task_queue_owner()
+    {
+        // external threads return their queue on exit, tasks left in it can still be stolen
+        if (index >= (s32)s_num_workers)
+            s_queue_used[index] = false;
+    }
+
+    void* task_worker_thread(void* params);
+
+    void task_init()
+    {
+        if (s_init_state.load() == e_initialised)
+            return;
+
+        u32 expected = e_uninitialised;
+        if (!s_init_state.compare_exchange_strong(expected, e_initialising))
+        {
+            // another thread is creating the workers
+            while (s_init_state.load() != e_initialised)
+                std::this_thread::yield();
+
+            return;
+        }
+
+        // one worker per core, minus one for the thread which issues and waits on the work
+        u32 cores = std::thread::hardware_concurrency();
+        s_num_workers = cores > 1 ? cores - 1 : 1;
+        s_num_workers = s_num_workers > k_max_workers ? k_max_workers : s_num_workers;
+
+        s_num_active_workers = s_num_workers;
+        s_num_queues = s_num_workers;
+        for (u32 i = 0; i < s_num_workers; ++i)
+            s_queue_used[i] = true;
+        s_wake = semaphore_create(0, s_num_workers);
+
+        for (u32 i = 0; i < s_num_workers; ++i)
+            thread_create(task_worker_thread, 0, (void*)(size_t)i, e_thread_start_flags::detached);
+
+        s_init_state = e_initialised;
+    }
+
+    // returns nullptr when every queue is owned by another thread, the caller runs its tasks inline instead
+    task_deque* task_get_queue()
+    {
+        if (s_queue.index != -1)
+            return &s_queues[s_queue.index];
+
+        // external thread, take a free queue and widen the range stealers scan to include it
+        for (u32 i = s_num_workers; i < k_max_queues; ++i)
+        {
+            bool expected = false;
+            if (!s_queue_used[i].compare_exchange_strong(expected, true))
+                continue;
+
+            u32 num_queues = s_num_queues.load();
+            while (num_queues < i + 1 && !s_num_queues.compare_exchange_weak(num_queues, i + 1))
+                ;
+
+            s_queue.index = (s32)i;
+            return &s_queues[i];
+        }
+
+        return nullptr;
+    }
+
+    u32 task_rand()
+    {
+        // xorshift
+        if (s_rand == 0)
+            s_rand = (u32)(s_queue.index + 2) * 2654435761u;
+
+        s_rand ^= s_rand << 13;
+        s_rand ^= s_rand >> 17;
+        s_rand ^= s_rand << 5;
+        return s_rand;
+    }
+
+    task_handle task_find(task_deque* q)
+    {
+        task_handle h = q ? q->pop() : PEN_INVALID_HANDLE;
+        if (h != PEN_INVALID_HANDLE)
+            return h;
+
+        // steal from a random victim, then walk the rest
+        u32 num_queues = s_num_queues;
+        u32 start = task_rand() % num_queues;
+        for (u32 i = 0; i < num_queues; ++i)
+        {
+            task_deque& victim = s_queues[(start + i) % num_queues];
+            if (&victim == q)
+                continue;
+
+            h = victim.steal();
+            if (h != PEN_INVALID_HANDLE)
+            {
+                if (q)
+                    q->stolen.fetch_add(1, std::memory_order_relaxed);
+                return h;
+            }
+        }
+
+        return PEN_INVALID_HANDLE;
+    }
+
+    bool task_work_available()
+    {
+        u32 num_queues = s_num_queues;
+        for (u32 i = 0; i < num_queues; ++i)
+            if (!s_queues[i].empty())
+                return true;
+
+        return false;
+    }
+
+    void task_enqueue(task_handle h)
+    {
+        task_deque* q = task_get_queue();
+        if (!q)
+        {
+            task_execute(h);
+            return;
+        }
+
+        q->push(h);
+
+        if (s_num_sleepers.load() > 0)
+            semaphore_post(s_wake, 1);
+    }
+
+    void task_count_executed()
+    {
+        task_deque* q = task_get_queue();
+        if (q)
+            q->executed.fetch_add(1, std::memory_order_relaxed);
+        else
+            s_inline_executed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void task_help()
+    {
+        task_handle h = task_find(task_get_queue());
+        if (h != PEN_INVALID_HANDLE)
+            task_execute(h);
+        else
+            std::this_thread::yield();
+    }
+
+    void* task_worker_thread(void* params)
+    {
+        s_queue.index = (s32)(size_t)params;
+        task_deque* q = &s_queues[s_queue.index];
+
+        u32 spins = 0;
+        while (!s_workers_exit)
+        {
+            // workers above the active count are parked, used to measure scaling
+            if ((u32)s_queue.index >= s_num_active_workers)
+            {
+                thread_sleep_ms(1);
+                continue;
+            }
+
+            task_handle h = task_find(q);
+            if (h != PEN_INVALID_HANDLE)
+            {
+                task_execute(h);
+                spins = 0;
+                continue;
+            }
+
+            if (++spins < k_idle_spins)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // register as a sleeper before re-checking, so a push either sees us or we see the push
+            s_num_sleepers++;
+            if (!task_work_available() && !s_workers_exit)
+                semaphore_wait(s_wake);
+            s_num_sleepers--;
+            spins = 0;
+        }
+
+        return PEN_THREAD_OK;
+    }
+#endif
+
+    void task_release(task_handle h)
+    {
+        task& t = task_get(h);
+        if (--t.dependencies == 0)
+            task_enqueue(h);
+    }
+
+    void task_finish(task_handle h)
+    {
+        task& t = task_get(h);
+        if (--t.unfinished > 0)
+            return;
+
+        // copy out before marking complete, after which the slot may be reused
+        task_handle parent = t.parent;
+        task_handle continuations[k_max_continuations];
+
+        task_lock(t);
+        u32 num_continuations = t.num_continuations;
+        for (u32 i = 0; i < num_continuations; ++i)
+            continuations[i] = t.continuations[i];
+        t.complete = true;
+        task_unlock(t);
+        t.in_use = false;
+
+        for (u32 i = 0; i < num_continuations; ++i)
+            task_release(continuations[i]);
+
+        if (parent != PEN_INVALID_HANDLE)
+            task_finish(parent);
+    }
+
+    void task_execute(task_handle h)
+    {
+        task& t = task_get(h);
+        if (t.func)
+            t.func(t.user_data);
+
+        task_count_executed();
+        task_finish(h);
+    }
+
+    void parallel_for_task(void* user_data)
+    {
+        parallel_for_chunk* chunk = (parallel_for_chunk*)user_data;
+        chunk->func(chunk->start, chunk->end, chunk->user_data);
+    }
+} // namespace
+
 namespace pen
 {
     pen::job* jobs_create_job(dispatch_thread thread_func, u32 stack_size, void* user_data, thread_start_flags flags,
@@ -63,6 +502,16 @@ namespace pen
             }
         }
 
+#if !PEN_SINGLE_THREADED
+        // all jobs have exited, so nothing can issue more tasks, wake the workers so they can exit
+        if (s_init_state == e_initialised)
+        {
+            s_workers_exit = true;
+            for (u32 i = 0; i < s_num_workers; ++i)
+                semaphore_post(s_wake, 1);
+        }
+#endif
+
         return true;
     }
 
@@ -79,4 +528,196 @@ namespace pen
             ((single_thread_update_func)s_single_thread_funcs[i])();
         }
     }
+
+    u32 jobs_get_num_workers()
+    {
+#if PEN_SINGLE_THREADED
+        return 0;
+#else
+        task_init();
+        return s_num_workers;
+#endif
+    }
+
+    void jobs_set_num_active_workers(u32 num_workers)
+    {
+#if !PEN_SINGLE_THREADED
+        task_init();
+        s_num_active_workers = num_workers > s_num_workers ? s_num_workers : num_workers;
+#endif
+    }
+
+    task_handle jobs_create_task(task_func func, void* user_data, task_handle parent)
+    {
+        task_init();
+
+        // slots are recycled in order skipping any still in flight, when all are in flight help until one finishes
+        u32 index = 0;
+        for (u32 tries = 1;; ++tries)
+        {
+            index = s_next_task++ & k_task_index_mask;
+
+            if (task_claim(s_tasks[index]))
+                break;
+
+            if (tries % k_max_tasks != 0)
+                continue;
+
+#if PEN_SINGLE_THREADED
+            // tasks run inline when released, so every slot is waiting on jobs_run_task or a dependency and nothing
+            // can finish while the caller is here
+            PEN_LOG("[jobs] all %u tasks are created and not yet run, run or wait on tasks before creating more",
+                    k_max_tasks);
+            PEN_ERROR;
+            return PEN_INVALID_HANDLE;
+#else
+            if (tries == k_max_tasks * k_task_claim_warn_rounds)
+                PEN_LOG("[jobs] all %u tasks are in flight, waiting for one to finish", k_max_tasks);
+
+            task_help();
+#endif
+        }
+
+        task& t = s_tasks[index];
+
+        u32         generation = (t.handle >> k_task_index_bits) + 1;
+        task_handle h = (generation << k_task_index_bits) | index;
+
+        // publish the new handle first so waiters on the previous generation see it as complete
+        t.handle = h;
+        t.func = func;
+        t.user_data = user_data;
+        t.parent = parent;
+        t.num_continuations = 0;
+        t.unfinished = 1;
+        t.dependencies = 1;
+        t.complete = false;
+        t.lock = false;
+
+        if (parent != PEN_INVALID_HANDLE)
+            task_get(parent).unfinished++;
+
+        return h;
+    }
+
+    void jobs_add_dependency(task_handle task_h, task_handle depends_on)
+    {
+        if (task_h == PEN_INVALID_HANDLE || depends_on == PEN_INVALID_HANDLE)
+            return;
+
+        task& t = task_get(task_h);
+        task& dep = task_get(depends_on);
+
+        t.dependencies++;
+
+        task_lock(dep);
+        if (dep.handle == depends_on && !dep.complete)
+        {
+            PEN_ASSERT(dep.num_continuations < k_max_continuations);
+            dep.continuations[dep.num_continuations++] = task_h;
+            task_unlock(dep);
+            return;
+        }
+        task_unlock(dep);
+
+        // already finished
+        t.dependencies--;
+    }
+
+    void jobs_run_task(task_handle h)
+    {
+        if (h != PEN_INVALID_HANDLE)
+            task_release(h);
+    }
+
+    bool jobs_task_complete(task_handle h)
+    {
+        if (h == PEN_INVALID_HANDLE)
+            return true;
+
+        task& t = task_get(h);
+        return t.handle != h || t.complete;
+    }
+
+    void jobs_wait_task(task_handle h)
+    {
+        while (!jobs_task_complete(h))
+            task_help();
+    }
+
+    void jobs_get_task_stats(task_stats& stats)
+    {
+#if PEN_SINGLE_THREADED
+        stats = s_stats;
+#else
+        stats.executed = s_inline_executed.load(std::memory_order_relaxed);
+        stats.stolen = 0;
+
+        u32 num_queues = s_num_queues;
+        for (u32 i = 0; i < num_queues; ++i)
+        {
+            stats.executed += s_queues[i].executed.load(std::memory_order_relaxed);
+            stats.stolen += s_queues[i].stolen.load(std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    void jobs_reset_task_stats()
+    {
+#if PEN_SINGLE_THREADED
+        s_stats.executed = 0;
+        s_stats.stolen = 0;
+#else
+        s_inline_executed = 0;
+        for (u32 i = 0; i < k_max_queues; ++i)
+        {
+            s_queues[i].executed = 0;
+            s_queues[i].stolen = 0;
+        }
+#endif
+    }
+
+    void parallel_for(u32 start, u32 end, u32 grain_size, parallel_for_func func, void* user_data)
+    {
+        if (end <= start)
+            return;
+
+        u32 count = end - start;
+        u32 grain = grain_size > 0 ? grain_size : 1;
+        u32 num_chunks = (count + grain - 1) / grain;
+
+        if (num_chunks <= 1 || jobs_get_num_workers() == 0)
+        {
+            func(start, end, user_data);
+            return;
+        }
+
+        if (num_chunks > k_max_parallel_for_chunks)
+        {
+            grain = (count + k_max_parallel_for_chunks - 1) / k_max_parallel_for_chunks;
+            num_chunks = (count + grain - 1) / grain;
+        }
+
+        // chunks live on the stack, we do not return until they have all completed
+        parallel_for_chunk chunks[k_max_parallel_for_chunks];
+        task_handle        root = jobs_create_task(nullptr, nullptr);
+
+        for (u32 i = 0; i < num_chunks; ++i)
+        {
+            chunks[i].func = func;
+            chunks[i].user_data = user_data;
+            chunks[i].start = start + i * grain;
+            chunks[i].end = chunks[i].start + grain < end ? chunks[i].start + grain : end;
+        }
+
+        for (u32 i = 1; i < num_chunks; ++i)
+            jobs_run_task(jobs_create_task(parallel_for_task, &chunks[i], root));
+
+        jobs_run_task(root);
+
+        // the calling thread takes the first chunk
+        parallel_for_task(&chunks[0]);
+
+        jobs_wait_task(root);
+    }
 } // namespace pen
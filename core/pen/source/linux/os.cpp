@@ -1,7 +1,9 @@
 // os.cpp
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
+#ifndef PEN_RENDERER_NULL
 #include "GL/glew.h"
+#endif
 
 #include "console.h"
 #include "hash.h"
@@ -21,9 +23,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifndef PEN_RENDERER_NULL
 #include <GL/glx.h>
 #include <GL/glxext.h>
 #include <X11/Xlib.h>
+#endif
 
 using namespace pen;
 
@@ -31,6 +35,7 @@ using namespace pen;
 window_creation_params pen_window;
 pen::user_info         pen_user_info;
 
+#ifndef PEN_RENDERER_NULL
 // glx / gl stuff
 #define GLX_CONTEXT_MAJOR_VERSION_ARB 0x2091
 #define GLX_CONTEXT_MINOR_VERSION_ARB 0x2092
@@ -61,12 +66,15 @@ void pen_gl_swap_buffers()
 {
     glXSwapBuffers(_display, _window);
 }
+#endif
 
 namespace
 {
-    XIM          _xim;
-    XIC          _xic;
-    bool         _ctx_error_occured = false;
+#ifndef PEN_RENDERER_NULL
+    XIM  _xim;
+    XIC  _xic;
+    bool _ctx_error_occured = false;
+#endif
     window_frame _window_frame;
     bool         _invalidate_window_frame = false;
 
@@ -82,6 +90,7 @@ namespace
         pen_user_info.user_name = &homedir[6];
     }
 
+#ifndef PEN_RENDERER_NULL
     int ctx_error_handler(Display* dpy, XErrorEvent* ev)
     {
         PEN_LOG("CONTEXT ERROR %i", ev->error_code);
@@ -231,6 +240,19 @@ namespace
         return s_error_code;
     }
 
+#else
+    int pen_run_windowed()
+    {
+        // the null renderer has no window or device, the render thread runs headless
+        renderer_init(nullptr, true, s_creation_params.max_renderer_commands);
+
+        // exit, kill other threads and wait
+        pen::jobs_terminate_all();
+
+        return s_error_code;
+    }
+#endif
+
     int pen_run_console_app()
     {
         for (;;)
@@ -245,6 +267,7 @@ namespace
         return s_error_code;
     }
 
+#ifndef PEN_RENDERER_NULL
     s32 translate_mouse_button(s32 b)
     {
         static f32 mw = 0.0f;
@@ -501,6 +524,11 @@ namespace
 
         pen::input_gamepad_update();
     }
+#else
+    void update_window()
+    {
+    }
+#endif
 } // namespace
 
 int main(int argc, char* argv[])
@@ -517,6 +545,24 @@ int main(int argc, char* argv[])
     pen_window.sample_count = pc.window_sample_count;
     s_creation_params = pc;
 
+    // args
+    for (s32 i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-test") == 0)
+        {
+            pen::renderer_test_enable();
+        }
+        else if (strcmp(argv[i], "-capture") == 0 && i + 2 < argc)
+        {
+            pen::renderer_capture_enable(argv[i + 1], atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+        {
+            pen::renderer_replay_enable(argv[++i]);
+        }
+    }
+
     if (pc.flags & e_pen_create_flags::renderer)
     {
         pen_run_windowed();
@@ -571,7 +617,11 @@ namespace pen
 
     void* window_get_primary_display_handle()
     {
+#ifndef PEN_RENDERER_NULL
         return (void*)(intptr_t)_window;
+#else
+        return nullptr;
+#endif
     }
 
     void window_get_size(s32& width, s32& height)
@@ -4,6 +4,120 @@
 
 #include "memory.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif !__EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    size_t page_size()
+    {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#elif !__EMSCRIPTEN__
+        return (size_t)sysconf(_SC_PAGESIZE);
+#else
+        return 4096;
+#endif
+    }
+} // namespace
+
+namespace pen
+{
+    void* memory_reserve(size_t size_bytes)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(nullptr, size_bytes, MEM_RESERVE, PAGE_NOACCESS);
+#elif !__EMSCRIPTEN__
+        void* mem = mmap(nullptr, size_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return mem == MAP_FAILED ? nullptr : mem;
+#else
+        // wasm memory can only grow as a whole
+        return nullptr;
+#endif
+    }
+
+    bool memory_commit(void* mem, size_t size_bytes)
+    {
+        if (size_bytes == 0)
+            return true;
+
+        static const size_t page = page_size();
+        size_t              start = (size_t)mem & ~(page - 1);
+        size_t              end = ((size_t)mem + size_bytes + page - 1) & ~(page - 1);
+
+#ifdef _WIN32
+        return VirtualAlloc((void*)start, end - start, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#elif !__EMSCRIPTEN__
+        return mprotect((void*)start, end - start, PROT_READ | PROT_WRITE) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void memory_release(void* mem, size_t size_bytes)
+    {
+        if (!mem)
+            return;
+
+#ifdef _WIN32
+        VirtualFree(mem, 0, MEM_RELEASE);
+#elif !__EMSCRIPTEN__
+        munmap(mem, size_bytes);
+#endif
+    }
+
+    bool memory_map_file(void* mem, size_t size_bytes, const c8* filename, size_t offset)
+    {
+#if !defined(_WIN32) && !__EMSCRIPTEN__
+        static const size_t page = page_size();
+        if (size_bytes == 0 || (((size_t)mem | offset) & (page - 1)))
+            return false;
+
+        s32 fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        // pages past the end of the file fault on access
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < offset + size_bytes)
+        {
+            close(fd);
+            return false;
+        }
+
+        void* mapped = mmap(mem, size_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+        close(fd);
+
+        if (mapped == MAP_FAILED)
+        {
+            // a failed fixed mapping may have removed the pages, put zeroed memory back
+            mmap(mem, size_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            return false;
+        }
+
+        // the last page holds whatever follows in the file
+        size_t tail = size_bytes & (page - 1);
+        if (tail)
+            memset((u8*)mem + size_bytes, 0x0, page - tail);
+
+        return true;
+#else
+        // windows can only place file views in reserved memory through placeholders, wasm has no mapping
+        return false;
+#endif
+    }
+} // namespace pen
+
 // C++ standard says these must be in cpp file and not inline in header ;_;
 
 using namespace pen;
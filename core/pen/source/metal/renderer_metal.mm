@@ -165,11 +165,13 @@ namespace // internal structs and static vars
         u32                                   _buffer_size;
         u32                                   _options;
         u32                                   _static;
+        u32                                   _no_overwrite; // offset writes append in place (transient cbuffers)
         u32                                   frame;
 
         id<MTLBuffer> read(size_t& offset);
         id<MTLBuffer> read();
-        void          init(id<MTLBuffer>* bufs, u32 num_buffers, u32 buffer_size, u32 options, u32 bind_flags);
+        void          init(id<MTLBuffer>* bufs, u32 num_buffers, u32 buffer_size, u32 options, u32 bind_flags,
+                           u32 cpu_access_flags);
         void          release();
         void          update(const void* data, u32 data_size, u32 offset);
     };
@@ -232,11 +234,13 @@ namespace // internal structs and static vars
         return dynamic_buffers.backbuffer();
     }
 
-    void dynamic_buffer::init(id<MTLBuffer>* bufs, u32 num_buffers, u32 buffer_size, u32 options, u32 bind_flags)
+    void dynamic_buffer::init(id<MTLBuffer>* bufs, u32 num_buffers, u32 buffer_size, u32 options, u32 bind_flags,
+                              u32 cpu_access_flags)
     {
         _buffer_size = buffer_size;
         _options = options;
         _static = 0;
+        _no_overwrite = cpu_access_flags & PEN_CPU_ACCESS_NO_OVERWRITE;
         _frame_writes = 0;
 
         stretchy_buffer = _renderer_get_stretchy_dynamic_buffer(bind_flags);
@@ -277,6 +281,21 @@ namespace // internal structs and static vars
             _frame_writes = 0;
         }
 
+        if (offset > 0 && _no_overwrite)
+        {
+            // appending to a ring (transient cbuffers), earlier writes this frame stay valid so write in place
+            auto& db = dynamic_buffers;
+            if (cur_frame != db._frame)
+            {
+                db._frame = cur_frame;
+                db.swap_buffers();
+            }
+
+            u8* pdata = (u8*)[db.backbuffer() contents];
+            memcpy(pdata + offset, data, data_size);
+            return;
+        }
+
         if (_frame_writes > 0)
         {
             // multiple updates per frame
@@ -1484,7 +1503,7 @@ namespace pen
             _res_pool.insert(resource(), resource_slot);
 
             dynamic_buffer& db = _res_pool.get(resource_slot).buffer;
-            db.init(&buf[0], num_bufs, params.buffer_size, options, params.bind_flags);
+            db.init(&buf[0], num_bufs, params.buffer_size, options, params.bind_flags, params.cpu_access_flags);
 
             _res_pool[resource_slot].type = RESOURCE_BUFFER;
         }
@@ -1533,13 +1552,14 @@ namespace pen
             ib.size_bytes = index_size_bytes(format);
         }
 
-        inline void _set_buffer(u32 buffer_index, u32 resource_slot, u32 flags)
+        inline void _set_buffer(u32 buffer_index, u32 resource_slot, u32 flags, size_t range_offset = 0)
         {
             if (buffer_index == 0)
                 return;
 
             size_t        bind_offset = 0;
             id<MTLBuffer> buf = _res_pool.get(buffer_index).buffer.read(bind_offset);
+            bind_offset += range_offset;
 
             if (flags & pen::CBUFFER_BIND_VS)
             {
@@ -1566,6 +1586,11 @@ namespace pen
             _set_buffer(buffer_index, unit, flags);
         }
 
+        void renderer_set_constant_buffer_range(u32 buffer_index, u32 unit, u32 flags, u32 offset, u32 size)
+        {
+            _set_buffer(buffer_index, unit, flags, offset);
+        }
+
         void renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
         {
             _set_buffer(buffer_index, unit, flags);
@@ -0,0 +1,594 @@
+// renderer_null.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Headless renderer backend, allocates resource slots and validates handles and state without a gpu.
+// Counts draws, binds and uploaded bytes so the cpu side of a frame can be profiled on machines with no device.
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "pen.h"
+#include "renderer.h"
+#include "renderer_shared.h"
+#include "str/Str.h"
+#include "threads.h"
+
+#include <string.h>
+
+using namespace pen;
+
+namespace
+{
+    namespace e_null_resource
+    {
+        enum null_resource_t
+        {
+            none,
+            clear_state,
+            shader,
+            program,
+            input_layout,
+            buffer,
+            texture,
+            sampler,
+            raster_state,
+            blend_state,
+            depth_stencil_state,
+            render_target
+        };
+    }
+
+    const c8* k_resource_names[] = {"none",         "clear_state", "shader",  "program",
+                                    "input_layout", "buffer",      "texture", "sampler",
+                                    "raster_state", "blend_state", "depth_stencil_state", "render_target"};
+
+    struct resource_allocation
+    {
+        u32 type;
+        u32 shader_type;
+        u32 size; // buffer size in bytes, texture data size
+    };
+
+    struct current_state
+    {
+        u32 vertex_shader;
+        u32 pixel_shader;
+        u32 compute_shader;
+        u32 num_vertex_buffers;
+        u32 index_buffer;
+    };
+
+    resource_allocation*          s_resources = nullptr; // stretchy buffer indexed by resource slot
+    current_state                 s_state;
+    null_renderer_stats           s_frame_stats;
+    null_renderer_stats           s_stats;
+    mutex*                        s_stats_mutex = nullptr;
+    renderer_info                 s_renderer_info;
+
+    const u32 k_max_logged_errors = 32;
+
+    void validation_error(const c8* msg, u32 slot)
+    {
+        if (s_frame_stats.validation_errors++ < k_max_logged_errors)
+            PEN_LOG("[null renderer] %s (slot %i)", msg, slot);
+    }
+
+    // new slots are zero, which is e_null_resource::none
+    void grow_resources(u32 slot)
+    {
+        u32 count = (u32)sb_count(s_resources);
+        if (slot >= count)
+            sb_add(s_resources, (s32)(slot + 1 - count));
+    }
+
+    bool is_null_handle(u32 slot)
+    {
+        return slot == 0 || slot == PEN_INVALID_HANDLE;
+    }
+
+    void allocate(u32 slot, u32 type, u32 size = 0)
+    {
+        grow_resources(slot);
+        resource_allocation& res = s_resources[slot];
+
+        if (res.type != e_null_resource::none)
+            validation_error("resource created over a live slot", slot);
+
+        res.type = type;
+        res.shader_type = 0;
+        res.size = size;
+    }
+
+    bool validate(u32 slot, u32 type)
+    {
+        u32 count = (u32)sb_count(s_resources);
+        if (slot >= count || s_resources[slot].type != type)
+        {
+            u32 actual = slot < count ? s_resources[slot].type : (u32)e_null_resource::none;
+
+            Str msg;
+            msg.appendf("expected %s but slot is %s", k_resource_names[type], k_resource_names[actual]);
+            validation_error(msg.c_str(), slot);
+            return false;
+        }
+
+        return true;
+    }
+
+    void release(u32 slot, u32 type)
+    {
+        if (validate(slot, type))
+            s_resources[slot].type = e_null_resource::none;
+    }
+
+    bool validate_texture(u32 slot)
+    {
+        // render targets can be bound as textures
+        if (slot < (u32)sb_count(s_resources) && s_resources[slot].type == e_null_resource::render_target)
+            return true;
+
+        return validate(slot, e_null_resource::texture);
+    }
+
+    void validate_draw()
+    {
+        s_frame_stats.draws++;
+
+        if (is_null_handle(s_state.vertex_shader))
+            validation_error("draw with no vertex shader bound", s_state.vertex_shader);
+    }
+} // namespace
+
+namespace pen
+{
+    // there is no gpu time to report
+    a_u64 g_gpu_total;
+
+    u32 direct::renderer_initialise(void*, u32 bb_res, u32 bb_depth_res)
+    {
+        // slot 0 is reserved as null
+        grow_resources(2047);
+
+        allocate(bb_res, e_null_resource::render_target);
+        allocate(bb_depth_res, e_null_resource::render_target);
+
+        s_stats_mutex = mutex_create();
+
+        s_renderer_info.shader_version = "none";
+        s_renderer_info.api_version = "null";
+        s_renderer_info.renderer = "null";
+        s_renderer_info.vendor = "pmtech";
+        s_renderer_info.renderer_cmd = "-renderer null";
+        s_renderer_info.caps = PEN_CAPS_TEX_FORMAT_BC1 | PEN_CAPS_TEX_FORMAT_BC2 | PEN_CAPS_TEX_FORMAT_BC3 |
+                               PEN_CAPS_DEPTH_CLAMP | PEN_CAPS_TEXTURE_CUBE_ARRAY | PEN_CAPS_COMPUTE | PEN_CAPS_VUP;
+
+        return PEN_ERR_OK;
+    }
+
+    void direct::renderer_shutdown()
+    {
+        mutex_destroy(s_stats_mutex);
+        s_stats_mutex = nullptr;
+
+        sb_free(s_resources);
+        s_resources = nullptr;
+    }
+
+    const renderer_info& renderer_get_info()
+    {
+        return s_renderer_info;
+    }
+
+    const c8* renderer_get_shader_platform()
+    {
+        // reuse the glsl shader data so pmfx can load and reflect techniques
+        return "glsl";
+    }
+
+    bool renderer_viewport_vup()
+    {
+        return true;
+    }
+
+    bool renderer_depth_0_to_1()
+    {
+        return false;
+    }
+
+    void renderer_get_null_stats(null_renderer_stats& stats)
+    {
+        if (!s_stats_mutex)
+        {
+            stats = null_renderer_stats();
+            return;
+        }
+
+        mutex_lock(s_stats_mutex);
+        stats = s_stats;
+        mutex_unlock(s_stats_mutex);
+    }
+
+    void direct::renderer_sync()
+    {
+    }
+
+    void direct::renderer_retain()
+    {
+    }
+
+    void direct::renderer_new_frame()
+    {
+        _renderer_new_frame();
+    }
+
+    void direct::renderer_end_frame()
+    {
+    }
+
+    void direct::renderer_present()
+    {
+        _renderer_end_frame();
+
+        mutex_lock(s_stats_mutex);
+        s_stats = s_frame_stats;
+        mutex_unlock(s_stats_mutex);
+
+        s_frame_stats = null_renderer_stats();
+        s_state = current_state();
+    }
+
+    void direct::renderer_create_clear_state(const clear_state&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::clear_state);
+    }
+
+    void direct::renderer_clear(u32 clear_state_index, u32, u32)
+    {
+        validate(clear_state_index, e_null_resource::clear_state);
+    }
+
+    void direct::renderer_clear_texture(u32 clear_state_index, u32 texture)
+    {
+        validate(clear_state_index, e_null_resource::clear_state);
+        validate_texture(texture);
+    }
+
+    void direct::renderer_load_shader(const shader_load_params& params, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::shader, params.byte_code_size);
+        s_resources[resource_slot].shader_type = params.type;
+        s_frame_stats.bytes_uploaded += params.byte_code_size;
+    }
+
+    void direct::renderer_set_shader(u32 shader_index, u32 shader_type)
+    {
+        s_frame_stats.shader_binds++;
+
+        if (!is_null_handle(shader_index))
+        {
+            if (validate(shader_index, e_null_resource::shader))
+                if (s_resources[shader_index].shader_type != shader_type)
+                    validation_error("shader bound to the wrong stage", shader_index);
+        }
+
+        if (shader_type == PEN_SHADER_TYPE_VS || shader_type == PEN_SHADER_TYPE_SO)
+            s_state.vertex_shader = shader_index;
+        else if (shader_type == PEN_SHADER_TYPE_PS)
+            s_state.pixel_shader = shader_index;
+        else if (shader_type == PEN_SHADER_TYPE_CS)
+            s_state.compute_shader = shader_index;
+    }
+
+    void direct::renderer_create_input_layout(const input_layout_creation_params&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::input_layout);
+    }
+
+    void direct::renderer_set_input_layout(u32 layout_index)
+    {
+        s_frame_stats.state_binds++;
+        validate(layout_index, e_null_resource::input_layout);
+    }
+
+    void direct::renderer_link_shader_program(const shader_link_params& params, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::program);
+
+        if (!is_null_handle(params.compute_shader))
+        {
+            validate(params.compute_shader, e_null_resource::shader);
+            return;
+        }
+
+        validate(params.vertex_shader, e_null_resource::shader);
+        if (!is_null_handle(params.pixel_shader))
+            validate(params.pixel_shader, e_null_resource::shader);
+    }
+
+    void direct::renderer_create_buffer(const buffer_creation_params& params, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::buffer, params.buffer_size);
+
+        if (params.data)
+            s_frame_stats.bytes_uploaded += params.buffer_size;
+    }
+
+    void direct::renderer_set_vertex_buffers(u32* buffer_indices, u32 num_buffers, u32 start_slot, const u32*, const u32*)
+    {
+        s_frame_stats.buffer_binds++;
+
+        for (u32 i = 0; i < num_buffers; ++i)
+            if (!is_null_handle(buffer_indices[i]))
+                validate(buffer_indices[i], e_null_resource::buffer);
+
+        s_state.num_vertex_buffers = start_slot + num_buffers;
+    }
+
+    void direct::renderer_set_index_buffer(u32 buffer_index, u32, u32)
+    {
+        s_frame_stats.buffer_binds++;
+        validate(buffer_index, e_null_resource::buffer);
+        s_state.index_buffer = buffer_index;
+    }
+
+    void direct::renderer_set_constant_buffer(u32 buffer_index, u32, u32)
+    {
+        s_frame_stats.buffer_binds++;
+        if (!is_null_handle(buffer_index))
+            validate(buffer_index, e_null_resource::buffer);
+    }
+
+    void direct::renderer_set_constant_buffer_range(u32 buffer_index, u32, u32, u32 offset, u32 size)
+    {
+        s_frame_stats.buffer_binds++;
+        if (!validate(buffer_index, e_null_resource::buffer))
+            return;
+
+        if (offset + size > s_resources[buffer_index].size)
+            validation_error("constant buffer range out of bounds", buffer_index);
+    }
+
+    void direct::renderer_set_structured_buffer(u32 buffer_index, u32, u32)
+    {
+        s_frame_stats.buffer_binds++;
+        if (!is_null_handle(buffer_index))
+            validate(buffer_index, e_null_resource::buffer);
+    }
+
+    void direct::renderer_update_buffer(u32 buffer_index, const void*, u32 data_size, u32 offset)
+    {
+        s_frame_stats.bytes_uploaded += data_size;
+
+        if (!validate(buffer_index, e_null_resource::buffer))
+            return;
+
+        if (offset + data_size > s_resources[buffer_index].size)
+            validation_error("buffer update out of bounds", buffer_index);
+    }
+
+    void direct::renderer_create_texture(const texture_creation_params& tcp, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::texture, tcp.data_size);
+
+        if (tcp.data)
+            s_frame_stats.bytes_uploaded += tcp.data_size;
+    }
+
+    void direct::renderer_create_sampler(const sampler_creation_params&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::sampler);
+    }
+
+    void direct::renderer_set_texture(u32 texture_index, u32 sampler_index, u32, u32)
+    {
+        s_frame_stats.texture_binds++;
+
+        if (!is_null_handle(texture_index))
+            validate_texture(texture_index);
+
+        if (!is_null_handle(sampler_index))
+            validate(sampler_index, e_null_resource::sampler);
+    }
+
+    void direct::renderer_create_raster_state(const raster_state_creation_params&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::raster_state);
+    }
+
+    void direct::renderer_set_raster_state(u32 raster_state_index)
+    {
+        s_frame_stats.state_binds++;
+        validate(raster_state_index, e_null_resource::raster_state);
+    }
+
+    void direct::renderer_set_viewport(const viewport&)
+    {
+        s_frame_stats.state_binds++;
+    }
+
+    void direct::renderer_set_scissor_rect(const rect&)
+    {
+        s_frame_stats.state_binds++;
+    }
+
+    void direct::renderer_create_blend_state(const blend_creation_params&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::blend_state);
+    }
+
+    void direct::renderer_set_blend_state(u32 blend_state_index)
+    {
+        s_frame_stats.state_binds++;
+        validate(blend_state_index, e_null_resource::blend_state);
+    }
+
+    void direct::renderer_create_depth_stencil_state(const depth_stencil_creation_params&, u32 resource_slot)
+    {
+        allocate(resource_slot, e_null_resource::depth_stencil_state);
+    }
+
+    void direct::renderer_set_depth_stencil_state(u32 depth_stencil_state)
+    {
+        s_frame_stats.state_binds++;
+        validate(depth_stencil_state, e_null_resource::depth_stencil_state);
+    }
+
+    void direct::renderer_set_stencil_ref(u8)
+    {
+        s_frame_stats.state_binds++;
+    }
+
+    void direct::renderer_draw(u32 vertex_count, u32, u32)
+    {
+        validate_draw();
+        s_frame_stats.vertices += vertex_count;
+    }
+
+    void direct::renderer_draw_indexed(u32 index_count, u32, u32, u32)
+    {
+        validate_draw();
+        s_frame_stats.vertices += index_count;
+
+        if (is_null_handle(s_state.index_buffer))
+            validation_error("indexed draw with no index buffer bound", s_state.index_buffer);
+    }
+
+    void direct::renderer_draw_indexed_instanced(u32 instance_count, u32, u32 index_count, u32, u32, u32)
+    {
+        validate_draw();
+        s_frame_stats.vertices += index_count * instance_count;
+
+        if (is_null_handle(s_state.index_buffer))
+            validation_error("indexed draw with no index buffer bound", s_state.index_buffer);
+    }
+
+    void direct::renderer_draw_auto()
+    {
+        validate_draw();
+    }
+
+    void direct::renderer_dispatch_compute(uint3, uint3)
+    {
+        s_frame_stats.dispatches++;
+
+        if (is_null_handle(s_state.compute_shader))
+            validation_error("dispatch with no compute shader bound", s_state.compute_shader);
+    }
+
+    void direct::renderer_create_render_target(const texture_creation_params& tcp, u32 resource_slot, bool track)
+    {
+        PEN_ASSERT(tcp.width != 0 && tcp.height != 0);
+
+        // resizing re-creates managed targets in the same slot
+        grow_resources(resource_slot);
+        s_resources[resource_slot].type = e_null_resource::none;
+        allocate(resource_slot, e_null_resource::render_target);
+
+        if (track)
+            _renderer_track_managed_render_target(tcp, resource_slot);
+    }
+
+    void direct::renderer_set_targets(const u32* const colour_targets, u32 num_colour_targets, u32 depth_target,
+                                      u32, u32)
+    {
+        s_frame_stats.target_binds++;
+
+        for (u32 i = 0; i < num_colour_targets; ++i)
+            validate(colour_targets[i], e_null_resource::render_target);
+
+        if (!is_null_handle(depth_target))
+            validate(depth_target, e_null_resource::render_target);
+    }
+
+    void direct::renderer_set_resolve_targets(u32, u32)
+    {
+    }
+
+    void direct::renderer_set_stream_out_target(u32 buffer_index)
+    {
+        if (!is_null_handle(buffer_index))
+            validate(buffer_index, e_null_resource::buffer);
+    }
+
+    void direct::renderer_resolve_target(u32 target, e_msaa_resolve_type, resolve_resources)
+    {
+        validate(target, e_null_resource::render_target);
+    }
+
+    void direct::renderer_read_back_resource(const resource_read_back_params& rrbp)
+    {
+        validate_texture(rrbp.resource_index);
+
+        // there is no gpu data, callers still expect a buffer of the requested size
+        void* data = memory_alloc(rrbp.data_size);
+        memset(data, 0x00, rrbp.data_size);
+        rrbp.call_back_function(data, rrbp.row_pitch, rrbp.depth_pitch, rrbp.block_size);
+        memory_free(data);
+    }
+
+    void direct::renderer_push_perf_marker(const c8*)
+    {
+    }
+
+    void direct::renderer_pop_perf_marker()
+    {
+    }
+
+    void direct::renderer_replace_resource(u32 dest, u32 src, e_renderer_resource)
+    {
+        s_resources[dest] = s_resources[src];
+        s_resources[src].type = e_null_resource::none;
+    }
+
+    void direct::renderer_release_shader(u32 shader_index, u32)
+    {
+        release(shader_index, e_null_resource::shader);
+    }
+
+    void direct::renderer_release_clear_state(u32 clear_state)
+    {
+        release(clear_state, e_null_resource::clear_state);
+    }
+
+    void direct::renderer_release_buffer(u32 buffer_index)
+    {
+        release(buffer_index, e_null_resource::buffer);
+    }
+
+    void direct::renderer_release_texture(u32 texture_index)
+    {
+        release(texture_index, e_null_resource::texture);
+    }
+
+    void direct::renderer_release_sampler(u32 sampler)
+    {
+        release(sampler, e_null_resource::sampler);
+    }
+
+    void direct::renderer_release_raster_state(u32 raster_state_index)
+    {
+        release(raster_state_index, e_null_resource::raster_state);
+    }
+
+    void direct::renderer_release_blend_state(u32 blend_state)
+    {
+        release(blend_state, e_null_resource::blend_state);
+    }
+
+    void direct::renderer_release_render_target(u32 render_target)
+    {
+        _renderer_untrack_managed_render_target(render_target);
+        release(render_target, e_null_resource::render_target);
+    }
+
+    void direct::renderer_release_input_layout(u32 input_layout)
+    {
+        release(input_layout, e_null_resource::input_layout);
+    }
+
+    void direct::renderer_release_depth_stencil_state(u32 depth_stencil_state)
+    {
+        release(depth_stencil_state, e_null_resource::depth_stencil_state);
+    }
+} // namespace pen
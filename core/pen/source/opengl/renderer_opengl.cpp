@@ -2470,6 +2470,12 @@ namespace pen
         CHECK_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, unit, res.handle));
     }
 
+    void direct::renderer_set_constant_buffer_range(u32 buffer_index, u32 unit, u32 flags, u32 offset, u32 size)
+    {
+        resource_allocation& res = _res_pool[buffer_index];
+        CHECK_CALL(glBindBufferRange(GL_UNIFORM_BUFFER, unit, res.handle, offset, size));
+    }
+
     void direct::renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
     {
         PEN_ASSERT(0); // stubbed.. use metal on mac or d3d / vulkan on windows
@@ -2,6 +2,7 @@
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <algorithm>
 #include <fstream>
 
 #include "console.h"
@@ -26,12 +27,6 @@ pen::resolve_resources             g_resolve_resources;
 
 using namespace pen;
 
-#if PEN_SINGLE_THREADED
-#define add_cmd(cmd) exec_cmd(cmd)
-#else
-#define add_cmd(cmd) _ctx->cmd_buffer.put(cmd)
-#endif
-
 namespace
 {
     enum commands : u32
@@ -92,22 +87,87 @@ namespace
         CMD_PUSH_PERF_MARKER,
         CMD_POP_PERF_MARKER,
         CMD_DISPATCH_COMPUTE,
-        CMD_SET_STENCIL_REF
+        CMD_SET_STENCIL_REF,
+        CMD_SET_CONSTANT_BUFFER_RANGE
     };
 
+    static const c8* k_cmd_names[] = {"none",
+                                      "new_frame",
+                                      "clear",
+                                      "clear_texture",
+                                      "present",
+                                      "load_shader",
+                                      "set_shader",
+                                      "link_shader",
+                                      "create_input_layout",
+                                      "set_input_layout",
+                                      "create_buffer",
+                                      "set_vertex_buffer",
+                                      "set_index_buffer",
+                                      "draw",
+                                      "draw_indexed",
+                                      "draw_indexed_instanced",
+                                      "create_texture",
+                                      "release_shader",
+                                      "release_buffer",
+                                      "release_texture_2d",
+                                      "create_sampler",
+                                      "set_texture",
+                                      "create_raster_state",
+                                      "set_raster_state",
+                                      "set_viewport",
+                                      "set_scissor_rect",
+                                      "set_viewport_ratio",
+                                      "set_scissor_rect_ratio",
+                                      "release_raster_state",
+                                      "create_blend_state",
+                                      "set_blend_state",
+                                      "set_constant_buffer",
+                                      "set_structured_buffer",
+                                      "update_buffer",
+                                      "create_depth_stencil_state",
+                                      "set_depth_stencil_state",
+                                      "update_queries",
+                                      "create_render_target",
+                                      "set_targets",
+                                      "release_blend_state",
+                                      "release_render_target",
+                                      "release_input_layout",
+                                      "release_sampler",
+                                      "release_program",
+                                      "release_clear_state",
+                                      "release_depth_stencil_state",
+                                      "create_so_shader",
+                                      "set_so_target",
+                                      "resolve_target",
+                                      "draw_auto",
+                                      "map_resource",
+                                      "replace_resource",
+                                      "create_clear_state",
+                                      "push_perf_marker",
+                                      "pop_perf_marker",
+                                      "dispatch_compute",
+                                      "set_stencil_ref",
+                                      "set_constant_buffer_range"};
+
+    constexpr u32 k_num_cmds = PEN_ARRAY_SIZE(k_cmd_names);
+    static_assert(k_num_cmds == CMD_SET_CONSTANT_BUFFER_RANGE + 1, "k_cmd_names must match the commands enum");
+    static_assert(k_num_cmds <= k_max_renderer_cmd_types, "renderer_frame_stats::cmd_count is too small");
+
     struct set_shader_cmd
     {
         u32 shader_index;
         u32 shader_type;
     };
 
+    // variable length, only num_colour entries of colour are stored in the cmd stream
     static const u32 k_max_colour_targets = 8;
     struct set_target_cmd
     {
         u32 num_colour;
-        u32 colour[k_max_colour_targets];
         u32 depth;
         u32 array_index;
+        u32 colour[k_max_colour_targets];
     };
 
     struct clear_cmd
@@ -117,14 +177,13 @@ namespace
         u32 texture_index;
     };
 
+    // variable length, buffer indices, strides and offsets are packed back to back num_buffers apart
+    static const u32 k_max_vertex_buffers = 8;
     struct set_vertex_buffer_cmd
     {
-        u32  buffer_index;
-        u32  start_slot;
-        u32* buffer_indices;
-        u32  num_buffers;
-        u32* strides;
-        u32* offsets;
+        u32 start_slot;
+        u32 num_buffers;
+        u32 data[k_max_vertex_buffers * 3];
     };
 
     struct set_index_buffer_cmd
@@ -174,6 +233,15 @@ namespace
         u32 flags;
     };
 
+    struct set_buffer_range_cmd
+    {
+        u32 buffer_index;
+        u32 unit;
+        u32 flags;
+        u32 offset;
+        u32 size;
+    };
+
     struct update_buffer_cmd
     {
         u32   buffer_index;
@@ -201,62 +269,320 @@ namespace
         uint3 num_threads;
     };
 
+    // commands are packed into the cmd stream using only the bytes of the header and the active union member,
+    // large creation params are stored out of line in the payload arena so hot commands stay within 16-32 bytes.
     struct renderer_cmd
     {
-        u32 command_index;
+        u16 command_index;
+        u16 size; // size in the cmd stream, including this header, set by add_cmd
         u32 resource_slot;
-        u64 frame_index;
 
         union {
-            u32                              command_data_index;
-            shader_load_params               shader_load;
-            set_shader_cmd                   set_shader;
-            input_layout_creation_params     create_input_layout;
-            buffer_creation_params           create_buffer;
-            set_vertex_buffer_cmd            set_vertex_buffer;
-            set_index_buffer_cmd             set_index_buffer;
-            draw_cmd                         draw;
-            draw_indexed_cmd                 draw_indexed;
-            draw_indexed_instanced_cmd       draw_indexed_instanced;
-            texture_creation_params          create_texture;
-            sampler_creation_params          create_sampler;
-            set_texture_cmd                  set_texture;
-            raster_state_creation_params create_raster_state;
-            viewport                         set_viewport;
-            rect                             set_rect;
-            blend_creation_params            create_blend_state;
-            set_buffer_cmd                   set_buffer;
-            update_buffer_cmd                update_buffer;
-            depth_stencil_creation_params*   p_create_depth_stencil_state;
-            texture_creation_params          create_render_target;
-            set_target_cmd                   set_targets;
-            clear_cmd                        clear;
-            shader_link_params               link_params;
-            resource_read_back_params        rrb_params;
-            msaa_resolve_params              resolve_params;
-            replace_resource                 replace_resource_params;
-            clear_state                      clear_state_params;
-            c8*                              name;
-            compute_dispatch_params          cs_dispatch;
-            u8                               stencil_ref;
+            u32                            command_data_index;
+            shader_load_params*            p_shader_load;
+            set_shader_cmd                 set_shader;
+            input_layout_creation_params*  p_create_input_layout;
+            buffer_creation_params*        p_create_buffer;
+            set_vertex_buffer_cmd          set_vertex_buffer;
+            set_index_buffer_cmd           set_index_buffer;
+            draw_cmd                       draw;
+            draw_indexed_cmd               draw_indexed;
+            draw_indexed_instanced_cmd     draw_indexed_instanced;
+            texture_creation_params*       p_create_texture;
+            sampler_creation_params*       p_create_sampler;
+            set_texture_cmd                set_texture;
+            raster_state_creation_params*  p_create_raster_state;
+            viewport                       set_viewport;
+            rect                           set_rect;
+            blend_creation_params*         p_create_blend_state;
+            set_buffer_cmd                 set_buffer;
+            set_buffer_range_cmd           set_buffer_range;
+            update_buffer_cmd              update_buffer;
+            depth_stencil_creation_params* p_create_depth_stencil_state;
+            texture_creation_params*       p_create_render_target;
+            set_target_cmd                 set_targets;
+            clear_cmd                      clear;
+            shader_link_params*            p_link_params;
+            resource_read_back_params*     p_rrb_params;
+            msaa_resolve_params            resolve_params;
+            replace_resource               replace_resource_params;
+            clear_state*                   p_clear_state;
+            c8*                            name;
+            compute_dispatch_params        cs_dispatch;
+            u8                             stencil_ref;
+            f64                            frame_begin_ns;
         };
 
         renderer_cmd(){};
     };
 
+    // releases are deferred until the gpu is no longer using the resource
+    struct release_cmd
+    {
+        renderer_cmd cmd;
+        u64          frame_index;
+    };
+
+    // shadow of the bindings issued through the front end, binds matching what is already bound on a slot are dropped.
+    // it is invalidated whenever the backend may have lost or re-interpreted its bindings (shader, targets, pass changes)
+    constexpr u32 k_max_shadow_slots = 32;
+
+    struct shadow_state
+    {
+        set_texture_cmd textures[k_max_shadow_slots];
+        set_buffer_cmd  cbuffers[k_max_shadow_slots];
+        set_buffer_cmd  sbuffers[k_max_shadow_slots];
+    };
+
+    u32 cmd_size(const renderer_cmd& cmd)
+    {
+        u32 payload_size = 0;
+        switch (cmd.command_index)
+        {
+            case CMD_SET_VERTEX_BUFFER:
+                payload_size = sizeof(u32) * (2 + cmd.set_vertex_buffer.num_buffers * 3);
+                break;
+            case CMD_SET_TARGETS:
+                payload_size = sizeof(u32) * (3 + cmd.set_targets.num_colour);
+                break;
+            case CMD_SET_SHADER:
+            case CMD_RELEASE_SHADER:
+                payload_size = sizeof(set_shader_cmd);
+                break;
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+                payload_size = sizeof(clear_cmd);
+                break;
+            case CMD_SET_INDEX_BUFFER:
+                payload_size = sizeof(set_index_buffer_cmd);
+                break;
+            case CMD_DRAW:
+                payload_size = sizeof(draw_cmd);
+                break;
+            case CMD_DRAW_INDEXED:
+                payload_size = sizeof(draw_indexed_cmd);
+                break;
+            case CMD_DRAW_INDEXED_INSTANCED:
+                payload_size = sizeof(draw_indexed_instanced_cmd);
+                break;
+            case CMD_SET_TEXTURE:
+                payload_size = sizeof(set_texture_cmd);
+                break;
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_VIEWPORT_RATIO:
+                payload_size = sizeof(viewport);
+                break;
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+                payload_size = sizeof(rect);
+                break;
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+                payload_size = sizeof(set_buffer_cmd);
+                break;
+            case CMD_SET_CONSTANT_BUFFER_RANGE:
+                payload_size = sizeof(set_buffer_range_cmd);
+                break;
+            case CMD_UPDATE_BUFFER:
+                payload_size = sizeof(update_buffer_cmd);
+                break;
+            case CMD_RESOLVE_TARGET:
+                payload_size = sizeof(msaa_resolve_params);
+                break;
+            case CMD_REPLACE_RESOURCE:
+                payload_size = sizeof(replace_resource);
+                break;
+            case CMD_DISPATCH_COMPUTE:
+                payload_size = sizeof(compute_dispatch_params);
+                break;
+            case CMD_SET_STENCIL_REF:
+                payload_size = sizeof(u8);
+                break;
+            case CMD_PRESENT:
+                payload_size = sizeof(f64);
+                break;
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_MAP_RESOURCE:
+            case CMD_CREATE_CLEAR_STATE:
+            case CMD_PUSH_PERF_MARKER:
+                payload_size = sizeof(void*);
+                break;
+            default:
+                // command_data_index or no payload
+                payload_size = sizeof(u32);
+                break;
+        }
+
+        return (u32)PEN_ALIGN(offsetof(renderer_cmd, command_data_index) + payload_size, alignof(renderer_cmd));
+    }
+
+    // lockless single producer single consumer stream of variable sized commands. positions increase monotonically and
+    // are wrapped on access, a command never straddles the end of the buffer, a CMD_NONE header pads to the end instead.
+    struct cmd_stream
+    {
+        u8*                 data = nullptr;
+        size_t              capacity = 0;
+        std::atomic<size_t> put_pos;
+        std::atomic<size_t> get_pos;
+
+        void create(size_t size)
+        {
+            capacity = PEN_ALIGN(size, alignof(renderer_cmd));
+            data = (u8*)memory_alloc(capacity);
+            put_pos = 0;
+            get_pos = 0;
+        }
+
+        void put(const renderer_cmd& cmd, u32 size)
+        {
+            size_t pos = put_pos.load(std::memory_order_relaxed);
+            size_t offset = pos % capacity;
+            size_t pad = offset + size > capacity ? capacity - offset : 0;
+
+            // wait for the render thread to free up space
+            while (capacity - (pos - get_pos.load(std::memory_order_acquire)) < pad + size)
+                pen::thread_sleep_us(100);
+
+            if (pad)
+            {
+                ((renderer_cmd*)(data + offset))->command_index = CMD_NONE;
+                pos += pad;
+                offset = 0;
+            }
+
+            memcpy(data + offset, &cmd, size);
+            ((renderer_cmd*)(data + offset))->size = (u16)size;
+
+            put_pos.store(pos + size, std::memory_order_release);
+        }
+
+        // returns the next command without consuming it, call pop once it has been executed
+        const renderer_cmd* check()
+        {
+            size_t pos = get_pos.load(std::memory_order_relaxed);
+            if (pos == put_pos.load(std::memory_order_acquire))
+                return nullptr;
+
+            size_t        offset = pos % capacity;
+            renderer_cmd* cmd = (renderer_cmd*)(data + offset);
+            if (cmd->command_index == CMD_NONE)
+            {
+                // padding, skip to the start of the buffer
+                get_pos.store(pos + capacity - offset, std::memory_order_release);
+                cmd = (renderer_cmd*)data;
+            }
+
+            return cmd;
+        }
+
+        void pop(const renderer_cmd* cmd)
+        {
+            get_pos.store(get_pos.load(std::memory_order_relaxed) + cmd->size, std::memory_order_release);
+        }
+
+        size_t occupancy()
+        {
+            return put_pos.load(std::memory_order_relaxed) - get_pos.load(std::memory_order_acquire);
+        }
+    };
+
+    // linear allocator for command payloads, one block per frame in flight plus the one being built. blocks are reset
+    // once the render thread has consumed the frame, allocations which do not fit fall back to the heap and the block
+    // grows on reuse.
+    constexpr u32    k_payload_arena_frames = k_max_renderer_frames_in_flight + 1;
+    constexpr size_t k_payload_arena_initial_size = 1024 * 1024;
+    constexpr size_t k_payload_arena_max_size = 16 * 1024 * 1024; // load time spikes beyond this stay on the heap
+    constexpr size_t k_payload_arena_alignment = 16;
+
+    struct payload_arena
+    {
+        u8*    block[k_payload_arena_frames] = {nullptr};
+        size_t block_size[k_payload_arena_frames] = {0};
+        void** overflow[k_payload_arena_frames] = {nullptr}; // heap fallbacks, freed when the frame is retired
+        u32    frame = 0;
+        size_t pos = 0;
+        size_t overflow_bytes = 0;
+    };
+
+    // per slot info for resources whose creation params are gone by the time they are used or released
+    struct slot_info
+    {
+        u64  texture_bytes = 0;
+        bool cbuffer = false;
+    };
+
+    // per draw constants are written to the cpu side of the ring and uploaded in batches when bound. the gpu buffer
+    // is split into a region per frame in flight so a frame never writes over constants the gpu may still be reading.
+    // a frame which overflows its region chains overflow pages for the rest of the frame and grows the ring for the
+    // following frames.
+    constexpr u32 k_transient_cbuffer_frames = k_max_renderer_frames_in_flight + 2;
+    constexpr u32 k_transient_cbuffer_frame_size = 4 * 1024 * 1024;
+
+    // offsets in a page follow the ring, base is the offset of the page from the end of the ring
+    struct transient_cbuffer_page
+    {
+        u32 buffer;
+        u8* cpu_data;
+        u32 base;
+        u32 size;
+        u32 pos;
+        u32 flushed;
+    };
+
+    struct transient_cbuffer_ring
+    {
+        u32                     buffer = 0;
+        u8*                     cpu_data = nullptr; // current frame region
+        u32                     frame = 0;
+        u32                     pos = 0;     // write position within the frame region
+        u32                     flushed = 0; // bytes of the frame region uploaded to the gpu
+        u32                     frame_size = k_transient_cbuffer_frame_size;
+        u32                     requested = 0;       // bytes requested this frame including writes to overflow pages
+        transient_cbuffer_page* overflow = nullptr; // stretchy buffer of this frame's pages, released with the frame
+    };
+
+    // max_renderer_commands is specified in commands, the stream is sized assuming mostly hot commands
+    constexpr u32 k_cmd_stream_bytes_per_command = 32;
+
     // front end render_ctx
     struct fe_render_ctx
     {
         pen::timer*               present_timer = nullptr;
         f64                       present_time = 0.0f;
         pen::resolve_resources    resolve_resources;
-        pen::semaphore*           consume_semaphore = nullptr;
         pen::semaphore*           continue_semaphore = nullptr;
+        pen::semaphore*           frame_semaphore = nullptr;
         pen::slot_resources       renderer_slot_resources;
-        ring_buffer<renderer_cmd> cmd_buffer;
-        ring_buffer<renderer_cmd> release_cmd_buffer;
+        cmd_stream                cmd_buffer;
+        ring_buffer<release_cmd>  release_cmd_buffer;
         u32*                      free_slots = nullptr;
-        a_s32                     wait;
+        u32                       frames_in_flight = 1;
+        a_u64                     frames_submitted; // presents added by the game thread
+        a_u64                     frames_completed; // presents executed by the render thread
+        a_u32                     frame_waiting;    // game thread is blocked on frame_semaphore
+        f64                       frame_begin_ns = 0.0; // game thread, sent to the render thread with the present
+        a_u64                     frame_latency_ns;
+        payload_arena             payload;
+        shadow_state              shadow;
+        u32                       frame_elided_count = 0;
+        u32                       frame_cmd_count = 0;
+        size_t                    frame_cmd_bytes = 0;
+        cmd_buffer_stats          stats = {};
+        renderer_frame_stats      frame_stats;
+        slot_info*                slots = nullptr;
+        transient_cbuffer_ring    transient_cbuffer;
+
+        renderer_frame_stats      published_frame_stats;
+        a_u32                     published_frame_stats_seq; // odd while published_frame_stats is being written
     };
     static fe_render_ctx* _ctx;
     static render_ctx     _main_ctx;
@@ -265,9 +591,71 @@ namespace
 
 namespace pen
 {
-    void end_frame_internal();
+    void end_frame_internal(f64 frame_begin_ns);
     void new_frame_internal();
 
+    void* payload_alloc(size_t size)
+    {
+        payload_arena& a = _ctx->payload;
+
+        size_t aligned_size = PEN_ALIGN(size, k_payload_arena_alignment);
+        if (a.pos + aligned_size <= a.block_size[a.frame])
+        {
+            void* p = a.block[a.frame] + a.pos;
+            a.pos += aligned_size;
+            return p;
+        }
+
+        void* p = memory_alloc(size);
+        sb_push(a.overflow[a.frame], p);
+        a.overflow_bytes += aligned_size;
+        return p;
+    }
+
+    template <typename T>
+    T* payload_copy(const T& src)
+    {
+        T* dst = (T*)payload_alloc(sizeof(T));
+        memcpy(dst, &src, sizeof(T));
+        return dst;
+    }
+
+    void payload_next_frame()
+    {
+        // called once the render thread has consumed every frame but the ones still in flight
+        payload_arena&    a = _ctx->payload;
+        cmd_buffer_stats& stats = _ctx->stats;
+
+        size_t frame_bytes = a.pos + a.overflow_bytes;
+        stats.payload_bytes = frame_bytes;
+        stats.payload_overflow_bytes = a.overflow_bytes;
+        stats.payload_peak_bytes = max<size_t>(stats.payload_peak_bytes, frame_bytes);
+
+        a.frame = (a.frame + 1) % k_payload_arena_frames;
+        a.pos = 0;
+        a.overflow_bytes = 0;
+
+        u32 num_overflow = sb_count(a.overflow[a.frame]);
+        for (u32 i = 0; i < num_overflow; ++i)
+            memory_free(a.overflow[a.frame][i]);
+        sb_clear(a.overflow[a.frame]);
+
+        // grow to fit the largest frame seen so far
+        size_t required = max<size_t>(stats.payload_peak_bytes, k_payload_arena_initial_size);
+        required = min<size_t>(required, k_payload_arena_max_size);
+        if (a.block_size[a.frame] < required)
+        {
+            a.block_size[a.frame] = PEN_ALIGN(required, k_payload_arena_initial_size);
+            memory_free(a.block[a.frame]);
+            a.block[a.frame] = (u8*)memory_alloc(a.block_size[a.frame]);
+        }
+    }
+
+    void renderer_get_cmd_buffer_stats(cmd_buffer_stats& stats)
+    {
+        stats = _ctx->stats;
+    }
+
     void renderer_get_present_time(f32& cpu_ms, f32& gpu_ms)
     {
         extern a_u64 g_gpu_total;
@@ -276,10 +664,199 @@ namespace pen
         gpu_ms = (f64)g_gpu_total / 1000.0 / 1000.0;
     }
 
+    //
+    // cmd stream capture
+    //
+
+    // a capture is a header followed by every executed command in order, each command is written with the bytes it
+    // occupies in the cmd stream followed by the out of line payloads it references as size prefixed blobs.
+    constexpr u32 k_capture_magic = 0x444d4350; // PCMD
+    constexpr u32 k_capture_version = 1;
+    constexpr u32 k_capture_null_blob = 0xffffffff;
+    constexpr u32 k_capture_cmd_header_size = offsetof(renderer_cmd, resource_slot);
+
+    struct capture_header
+    {
+        u32 magic;
+        u32 version;
+        u32 num_frames;
+        u32 num_cmds;
+    };
+
+    struct capture_state
+    {
+        Str            filename;
+        std::ofstream  ofs;
+        capture_header header;
+        u32            frames_remaining = 0;
+    };
+    static capture_state s_capture;
+
+    void capture_write(const void* data, size_t size)
+    {
+        s_capture.ofs.write((const c8*)data, size);
+    }
+
+    void capture_write_blob(const void* data, u32 size)
+    {
+        if (!data)
+        {
+            capture_write(&k_capture_null_blob, sizeof(u32));
+            return;
+        }
+
+        capture_write(&size, sizeof(u32));
+        capture_write(data, size);
+    }
+
+    void capture_write_string(const c8* str)
+    {
+        capture_write_blob(str, str ? string_length(str) + 1 : 0);
+    }
+
+    void capture_end()
+    {
+        // patch the header now the counts are known
+        s_capture.ofs.seekp(0);
+        capture_write(&s_capture.header, sizeof(capture_header));
+        s_capture.ofs.close();
+        s_capture.frames_remaining = 0;
+
+        PEN_LOG("captured %u frames (%u commands) to %s", s_capture.header.num_frames, s_capture.header.num_cmds,
+                s_capture.filename.c_str());
+    }
+
+    void capture_cmd(const renderer_cmd& cmd)
+    {
+        // deferred releases do not pass through the stream so the size is taken from the command itself
+        u16 header[2] = {cmd.command_index, (u16)cmd_size(cmd)};
+        capture_write(header, sizeof(header));
+        capture_write((const u8*)&cmd + k_capture_cmd_header_size, header[1] - k_capture_cmd_header_size);
+
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                const shader_load_params* p = cmd.p_shader_load;
+                capture_write(p, sizeof(shader_load_params));
+                capture_write_blob(p->byte_code, p->byte_code_size);
+                capture_write_blob(p->so_decl_entries, sizeof(stream_out_decl_entry) * p->so_num_entries);
+                for (u32 i = 0; p->so_decl_entries && i < p->so_num_entries; ++i)
+                    capture_write_string(p->so_decl_entries[i].semantic_name);
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                const shader_link_params* p = cmd.p_link_params;
+                capture_write(p, sizeof(shader_link_params));
+                capture_write_blob(p->constants, sizeof(constant_layout_desc) * p->num_constants);
+                for (u32 i = 0; p->constants && i < p->num_constants; ++i)
+                    capture_write_string(p->constants[i].name);
+
+                capture_write_blob(p->stream_out_names, sizeof(c8*) * p->num_stream_out_names);
+                for (u32 i = 0; p->stream_out_names && i < p->num_stream_out_names; ++i)
+                    capture_write_string(p->stream_out_names[i]);
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                const input_layout_creation_params* p = cmd.p_create_input_layout;
+                capture_write(p, sizeof(input_layout_creation_params));
+                capture_write_blob(p->vs_byte_code, p->vs_byte_code_size);
+                capture_write_blob(p->input_layout, sizeof(input_layout_desc) * p->num_elements);
+                for (u32 i = 0; p->input_layout && i < p->num_elements; ++i)
+                    capture_write_string(p->input_layout[i].semantic_name);
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                capture_write(cmd.p_create_buffer, sizeof(buffer_creation_params));
+                capture_write_blob(cmd.p_create_buffer->data, cmd.p_create_buffer->buffer_size);
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                capture_write(cmd.p_create_texture, sizeof(texture_creation_params));
+                capture_write_blob(cmd.p_create_texture->data, cmd.p_create_texture->data_size);
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                capture_write(cmd.p_create_blend_state, sizeof(blend_creation_params));
+                capture_write_blob(cmd.p_create_blend_state->render_targets,
+                                   sizeof(render_target_blend) * cmd.p_create_blend_state->num_render_targets);
+                break;
+
+            case CMD_UPDATE_BUFFER:
+                capture_write_blob(cmd.update_buffer.data, cmd.update_buffer.data_size);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                capture_write_string(cmd.name);
+                break;
+
+            case CMD_CREATE_SAMPLER:
+                capture_write(cmd.p_create_sampler, sizeof(sampler_creation_params));
+                break;
+
+            case CMD_CREATE_RASTER_STATE:
+                capture_write(cmd.p_create_raster_state, sizeof(raster_state_creation_params));
+                break;
+
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                capture_write(cmd.p_create_depth_stencil_state, sizeof(depth_stencil_creation_params));
+                break;
+
+            case CMD_CREATE_RENDER_TARGET:
+                capture_write(cmd.p_create_render_target, sizeof(texture_creation_params));
+                break;
+
+            case CMD_CREATE_CLEAR_STATE:
+                capture_write(cmd.p_clear_state, sizeof(clear_state));
+                break;
+
+            case CMD_MAP_RESOURCE:
+                capture_write(cmd.p_rrb_params, sizeof(resource_read_back_params));
+                break;
+        }
+
+        s_capture.header.num_cmds++;
+
+        if (cmd.command_index == CMD_PRESENT)
+        {
+            s_capture.header.num_frames++;
+            if (--s_capture.frames_remaining == 0)
+                capture_end();
+        }
+    }
+
+    void renderer_capture_enable(const c8* filename, u32 num_frames)
+    {
+        if (num_frames == 0)
+            return;
+
+        s_capture.ofs.open(filename, std::ofstream::binary);
+        if (!s_capture.ofs.is_open())
+        {
+            PEN_LOG("failed to open capture file %s", filename);
+            return;
+        }
+
+        PEN_LOG("renderer capture enabled, %u frames to %s.", num_frames, filename);
+
+        s_capture.filename = filename;
+        s_capture.header = {k_capture_magic, k_capture_version, 0, 0};
+        capture_write(&s_capture.header, sizeof(capture_header));
+        s_capture.frames_remaining = num_frames;
+    }
+
     void exec_cmd(const renderer_cmd& cmd)
     {
         //PEN_LOG("CMD %i", cmd.command_index);
 
+        if (s_capture.frames_remaining)
+            capture_cmd(cmd);
+
         switch (cmd.command_index)
         {
             case CMD_NEW_FRAME:
@@ -293,15 +870,13 @@ namespace pen
                 break;
             case CMD_PRESENT:
                 direct::renderer_present();
-                end_frame_internal();
+                end_frame_internal(cmd.frame_begin_ns);
                 _ctx->present_time = timer_elapsed_ms(_ctx->present_timer);
                 timer_start(_ctx->present_timer);
                 break;
 
             case CMD_LOAD_SHADER:
-                direct::renderer_load_shader(cmd.shader_load, cmd.resource_slot);
-                memory_free(cmd.shader_load.byte_code);
-                memory_free(cmd.shader_load.so_decl_entries);
+                direct::renderer_load_shader(*cmd.p_shader_load, cmd.resource_slot);
                 break;
 
             case CMD_SET_SHADER:
@@ -309,20 +884,13 @@ namespace pen
                 break;
 
             case CMD_LINK_SHADER:
-                direct::renderer_link_shader_program(cmd.link_params, cmd.resource_slot);
-                for (u32 i = 0; i < cmd.link_params.num_constants; ++i)
-                    memory_free(cmd.link_params.constants[i].name);
-                memory_free(cmd.link_params.constants);
-                if (cmd.link_params.stream_out_names)
-                    for (u32 i = 0; i < cmd.link_params.num_stream_out_names; ++i)
-                        memory_free(cmd.link_params.stream_out_names[i]);
-                memory_free(cmd.link_params.stream_out_names);
+                direct::renderer_link_shader_program(*cmd.p_link_params, cmd.resource_slot);
                 break;
 
             case CMD_CREATE_INPUT_LAYOUT:
-                direct::renderer_create_input_layout(cmd.create_input_layout, cmd.resource_slot);
-                memory_free(cmd.create_input_layout.vs_byte_code);
-                memory_free(cmd.create_input_layout.input_layout);
+                direct::renderer_create_input_layout(*cmd.p_create_input_layout, cmd.resource_slot);
+                memory_free(cmd.p_create_input_layout->vs_byte_code);
+                memory_free(cmd.p_create_input_layout->input_layout);
                 break;
 
             case CMD_SET_INPUT_LAYOUT:
@@ -330,18 +898,18 @@ namespace pen
                 break;
 
             case CMD_CREATE_BUFFER:
-                direct::renderer_create_buffer(cmd.create_buffer, cmd.resource_slot);
-                memory_free(cmd.create_buffer.data);
+                direct::renderer_create_buffer(*cmd.p_create_buffer, cmd.resource_slot);
+                memory_free(cmd.p_create_buffer->data);
                 break;
 
             case CMD_SET_VERTEX_BUFFER:
-                direct::renderer_set_vertex_buffers(cmd.set_vertex_buffer.buffer_indices, cmd.set_vertex_buffer.num_buffers,
-                                                    cmd.set_vertex_buffer.start_slot, cmd.set_vertex_buffer.strides,
-                                                    cmd.set_vertex_buffer.offsets);
-                memory_free(cmd.set_vertex_buffer.buffer_indices);
-                memory_free(cmd.set_vertex_buffer.strides);
-                memory_free(cmd.set_vertex_buffer.offsets);
-                break;
+            {
+                u32  num_buffers = cmd.set_vertex_buffer.num_buffers;
+                u32* data = (u32*)&cmd.set_vertex_buffer.data[0];
+                direct::renderer_set_vertex_buffers(&data[0], num_buffers, cmd.set_vertex_buffer.start_slot,
+                                                    &data[num_buffers], &data[num_buffers * 2]);
+            }
+            break;
 
             case CMD_SET_INDEX_BUFFER:
                 direct::renderer_set_index_buffer(cmd.set_index_buffer.buffer_index, cmd.set_index_buffer.format,
@@ -365,12 +933,12 @@ namespace pen
                 break;
 
             case CMD_CREATE_TEXTURE:
-                direct::renderer_create_texture(cmd.create_texture, cmd.resource_slot);
-                memory_free(cmd.create_texture.data);
+                direct::renderer_create_texture(*cmd.p_create_texture, cmd.resource_slot);
+                memory_free(cmd.p_create_texture->data);
                 break;
 
             case CMD_CREATE_SAMPLER:
-                direct::renderer_create_sampler(cmd.create_sampler, cmd.resource_slot);
+                direct::renderer_create_sampler(*cmd.p_create_sampler, cmd.resource_slot);
                 break;
 
             case CMD_SET_TEXTURE:
@@ -379,7 +947,7 @@ namespace pen
                 break;
 
             case CMD_CREATE_RASTER_STATE:
-                direct::renderer_create_raster_state(cmd.create_raster_state, cmd.resource_slot);
+                direct::renderer_create_raster_state(*cmd.p_create_raster_state, cmd.resource_slot);
                 break;
 
             case CMD_SET_RASTER_STATE:
@@ -419,8 +987,8 @@ namespace pen
                 break;
 
             case CMD_CREATE_BLEND_STATE:
-                direct::renderer_create_blend_state(cmd.create_blend_state, cmd.resource_slot);
-                memory_free(cmd.create_blend_state.render_targets);
+                direct::renderer_create_blend_state(*cmd.p_create_blend_state, cmd.resource_slot);
+                memory_free(cmd.p_create_blend_state->render_targets);
                 break;
 
             case CMD_SET_BLEND_STATE:
@@ -437,290 +1005,1252 @@ namespace pen
                                                        cmd.set_buffer.flags);
                 break;
 
+            case CMD_SET_CONSTANT_BUFFER_RANGE:
+                direct::renderer_set_constant_buffer_range(cmd.set_buffer_range.buffer_index, cmd.set_buffer_range.unit,
+                                                           cmd.set_buffer_range.flags, cmd.set_buffer_range.offset,
+                                                           cmd.set_buffer_range.size);
+                break;
+
             case CMD_UPDATE_BUFFER:
                 direct::renderer_update_buffer(cmd.update_buffer.buffer_index, cmd.update_buffer.data,
                                                cmd.update_buffer.data_size, cmd.update_buffer.offset);
-                memory_free(cmd.update_buffer.data);
                 break;
 
             case CMD_CREATE_DEPTH_STENCIL_STATE:
                 direct::renderer_create_depth_stencil_state(*cmd.p_create_depth_stencil_state, cmd.resource_slot);
-                memory_free(cmd.p_create_depth_stencil_state);
                 break;
 
-            case CMD_SET_DEPTH_STENCIL_STATE:
-                direct::renderer_set_depth_stencil_state(cmd.command_data_index);
+            case CMD_SET_DEPTH_STENCIL_STATE:
+                direct::renderer_set_depth_stencil_state(cmd.command_data_index);
+                break;
+
+            case CMD_UPDATE_QUERIES:
+                renderer_update_queries();
+                break;
+
+            case CMD_CREATE_RENDER_TARGET:
+                direct::renderer_create_render_target(*cmd.p_create_render_target, cmd.resource_slot);
+                break;
+
+            case CMD_SET_TARGETS:
+                direct::renderer_set_targets((u32*)cmd.set_targets.colour, cmd.set_targets.num_colour, cmd.set_targets.depth,
+                                             cmd.set_targets.array_index, cmd.set_targets.array_index);
+                break;
+
+            case CMD_RELEASE_BLEND_STATE:
+                direct::renderer_release_blend_state(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_CLEAR_STATE:
+                direct::renderer_release_clear_state(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_RENDER_TARGET:
+                direct::renderer_release_render_target(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_INPUT_LAYOUT:
+                direct::renderer_release_input_layout(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_SAMPLER:
+                direct::renderer_release_sampler(cmd.command_data_index);
+                break;
+
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                direct::renderer_release_depth_stencil_state(cmd.command_data_index);
+                break;
+
+            case CMD_SET_SO_TARGET:
+                direct::renderer_set_stream_out_target(cmd.command_data_index);
+                break;
+
+            case CMD_RESOLVE_TARGET:
+                direct::renderer_resolve_target(cmd.resolve_params.render_target, cmd.resolve_params.resolve_type,
+                                                _ctx->resolve_resources);
+                break;
+
+            case CMD_DRAW_AUTO:
+                direct::renderer_draw_auto();
+                break;
+
+            case CMD_MAP_RESOURCE:
+                direct::renderer_read_back_resource(*cmd.p_rrb_params);
+                break;
+
+            case CMD_REPLACE_RESOURCE:
+                direct::renderer_replace_resource(cmd.replace_resource_params.dest_handle,
+                                                  cmd.replace_resource_params.src_handle, cmd.replace_resource_params.type);
+                break;
+
+            case CMD_CREATE_CLEAR_STATE:
+                direct::renderer_create_clear_state(*cmd.p_clear_state, cmd.resource_slot);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                direct::renderer_push_perf_marker(cmd.name);
+                break;
+
+            case CMD_POP_PERF_MARKER:
+                direct::renderer_pop_perf_marker();
+                break;
+
+            case CMD_DISPATCH_COMPUTE:
+                direct::renderer_dispatch_compute(cmd.cs_dispatch.grid, cmd.cs_dispatch.num_threads);
+                break;
+
+            case CMD_SET_STENCIL_REF:
+                direct::renderer_set_stencil_ref(cmd.stencil_ref);
+                break;
+        }
+    }
+
+    //
+    // frame stats
+    //
+
+    u64 primitive_count(u32 count, u32 topology)
+    {
+        switch (topology)
+        {
+            case PEN_PT_POINTLIST:
+                return count;
+            case PEN_PT_LINELIST:
+                return count / 2;
+            case PEN_PT_LINESTRIP:
+                return count > 1 ? count - 1 : 0;
+            case PEN_PT_TRIANGLESTRIP:
+                return count > 2 ? count - 2 : 0;
+            default:
+                return count / 3;
+        }
+    }
+
+    u64 texture_bytes(const texture_creation_params& tcp)
+    {
+        if (tcp.data)
+            return tcp.data_size;
+
+        texture_creation_params t = _renderer_tcp_resolve_ratio(tcp);
+
+        u32 ppb = max<u32>(t.pixels_per_block, 1);
+        u32 w = max<u32>(t.width / ppb, 1);
+        u32 h = max<u32>(t.height / ppb, 1);
+        u32 num_mips = max<s32>(t.num_mips, 1);
+
+        u64 bytes = 0;
+        for (u32 i = 0; i < num_mips; ++i)
+        {
+            bytes += (u64)w * h * t.block_size;
+            w = max<u32>(w / 2, 1);
+            h = max<u32>(h / 2, 1);
+        }
+
+        return bytes * max<u32>(t.num_arrays, 1) * max<u32>(t.sample_count, 1);
+    }
+
+    slot_info& frame_stats_slot(u32 slot)
+    {
+        while ((u32)sb_count(_ctx->slots) <= slot)
+            sb_push(_ctx->slots, slot_info());
+
+        return _ctx->slots[slot];
+    }
+
+    void frame_stats_texture_created(u32 slot, const texture_creation_params& tcp)
+    {
+        u64 bytes = texture_bytes(tcp);
+        frame_stats_slot(slot).texture_bytes = bytes;
+        _ctx->frame_stats.texture_bytes_created += bytes;
+    }
+
+    void frame_stats_texture_released(u32 slot)
+    {
+        slot_info& si = frame_stats_slot(slot);
+        _ctx->frame_stats.texture_bytes_released += si.texture_bytes;
+        si.texture_bytes = 0;
+    }
+
+    void frame_stats_add_cmd(const renderer_cmd& cmd)
+    {
+        renderer_frame_stats& fs = _ctx->frame_stats;
+        fs.cmd_count[cmd.command_index]++;
+
+        switch (cmd.command_index)
+        {
+            case CMD_DRAW:
+                fs.draw_calls++;
+                fs.instances++;
+                fs.primitives += primitive_count(cmd.draw.vertex_count, cmd.draw.primitive_topology);
+                break;
+            case CMD_DRAW_INDEXED:
+                fs.draw_calls++;
+                fs.instances++;
+                fs.primitives += primitive_count(cmd.draw_indexed.index_count, cmd.draw_indexed.primitive_topology);
+                break;
+            case CMD_DRAW_INDEXED_INSTANCED:
+                fs.draw_calls++;
+                fs.instances += cmd.draw_indexed_instanced.instance_count;
+                fs.primitives +=
+                    primitive_count(cmd.draw_indexed_instanced.index_count, cmd.draw_indexed_instanced.primitive_topology) *
+                    cmd.draw_indexed_instanced.instance_count;
+                break;
+            case CMD_DRAW_AUTO:
+                fs.draw_calls++;
+                fs.instances++;
+                break;
+            case CMD_SET_SHADER:
+            case CMD_SET_INPUT_LAYOUT:
+            case CMD_SET_VERTEX_BUFFER:
+            case CMD_SET_INDEX_BUFFER:
+            case CMD_SET_TEXTURE:
+            case CMD_SET_RASTER_STATE:
+            case CMD_SET_VIEWPORT:
+            case CMD_SET_SCISSOR_RECT:
+            case CMD_SET_VIEWPORT_RATIO:
+            case CMD_SET_SCISSOR_RECT_RATIO:
+            case CMD_SET_BLEND_STATE:
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_CONSTANT_BUFFER_RANGE:
+            case CMD_SET_STRUCTURED_BUFFER:
+            case CMD_SET_DEPTH_STENCIL_STATE:
+            case CMD_SET_TARGETS:
+            case CMD_SET_SO_TARGET:
+            case CMD_SET_STENCIL_REF:
+                fs.state_changes++;
+                break;
+            case CMD_UPDATE_BUFFER:
+                if (frame_stats_slot(cmd.update_buffer.buffer_index).cbuffer)
+                    fs.cbuffer_bytes += cmd.update_buffer.data_size;
+                break;
+        }
+    }
+
+    void frame_stats_publish()
+    {
+        renderer_frame_stats& fs = _ctx->frame_stats;
+        fs.cmd_buffer_capacity = _ctx->cmd_buffer.capacity;
+        fs.release_buffer_capacity = (u32)_ctx->release_cmd_buffer._capacity;
+        fs.frames_in_flight = _ctx->frames_in_flight;
+        fs.frame_latency_ms = (f32)((f64)_ctx->frame_latency_ns / 1000.0 / 1000.0);
+
+        // seqlock, readers retry if the sequence was odd or changed while they copied
+        _ctx->published_frame_stats_seq++;
+#if !PEN_SINGLE_THREADED
+        std::atomic_thread_fence(std::memory_order_release);
+#endif
+        _ctx->published_frame_stats = fs;
+        _ctx->published_frame_stats_seq++;
+
+        u64 frame_index = fs.frame_index;
+        memset(&fs, 0x0, sizeof(renderer_frame_stats));
+        fs.frame_index = frame_index + 1;
+    }
+
+    renderer_frame_stats renderer_get_frame_stats()
+    {
+        renderer_frame_stats stats;
+        for (;;)
+        {
+            u32 seq = _ctx->published_frame_stats_seq;
+            if (seq & 1)
+                continue;
+
+#if !PEN_SINGLE_THREADED
+            std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+            stats = _ctx->published_frame_stats;
+#if !PEN_SINGLE_THREADED
+            std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+            if (_ctx->published_frame_stats_seq == seq)
+                return stats;
+        }
+    }
+
+    const c8* renderer_get_cmd_name(u32 cmd_index)
+    {
+        if (cmd_index >= k_num_cmds)
+            return nullptr;
+
+        return k_cmd_names[cmd_index];
+    }
+
+    //
+    //
+    //
+
+    void add_cmd(renderer_cmd& cmd)
+    {
+        u32 size = cmd_size(cmd);
+        _ctx->frame_cmd_count++;
+        _ctx->frame_cmd_bytes += size;
+        _ctx->frame_stats.cmd_bytes += size;
+        _ctx->frame_stats.cmd_fixed_bytes += sizeof(renderer_cmd);
+        frame_stats_add_cmd(cmd);
+
+#if PEN_SINGLE_THREADED
+        exec_cmd(cmd);
+#else
+        _ctx->cmd_buffer.put(cmd, size);
+
+        renderer_frame_stats& fs = _ctx->frame_stats;
+        fs.cmd_buffer_peak_bytes = max<size_t>(fs.cmd_buffer_peak_bytes, _ctx->cmd_buffer.occupancy());
+#endif
+    }
+
+    void add_release_cmd(const renderer_cmd& cmd)
+    {
+        release_cmd rc;
+        rc.cmd = cmd;
+        rc.frame_index = pen::_renderer_frame_index();
+        _ctx->release_cmd_buffer.put(rc);
+        frame_stats_add_cmd(cmd);
+
+        ring_buffer<release_cmd>& rb = _ctx->release_cmd_buffer;
+        u32                       capacity = (u32)rb._capacity;
+        u32                       pending = (rb.put_pos + capacity - rb.get_pos) % capacity;
+
+        renderer_frame_stats& fs = _ctx->frame_stats;
+        fs.release_buffer_peak = max<u32>(fs.release_buffer_peak, pending);
+    }
+
+    void shadow_state_invalidate()
+    {
+        memset(&_ctx->shadow, 0xff, sizeof(shadow_state));
+    }
+
+    void shadow_state_invalidate_buffer(u32 buffer_index)
+    {
+        // dynamic buffers may be rebound at a new offset after an update
+        shadow_state& ss = _ctx->shadow;
+        for (u32 i = 0; i < k_max_shadow_slots; ++i)
+        {
+            if (ss.cbuffers[i].buffer_index == buffer_index)
+                memset(&ss.cbuffers[i], 0xff, sizeof(set_buffer_cmd));
+
+            if (ss.sbuffers[i].buffer_index == buffer_index)
+                memset(&ss.sbuffers[i], 0xff, sizeof(set_buffer_cmd));
+        }
+    }
+
+    bool shadow_state_bound(set_buffer_cmd* slots, const set_buffer_cmd& sb)
+    {
+        if (sb.unit >= k_max_shadow_slots)
+            return false;
+
+        set_buffer_cmd& cur = slots[sb.unit];
+        if (cur.buffer_index == sb.buffer_index && cur.flags == sb.flags)
+        {
+            _ctx->frame_elided_count++;
+            return true;
+        }
+
+        cur = sb;
+        return false;
+    }
+
+    bool shadow_state_bound(const set_texture_cmd& st)
+    {
+        if (st.unit >= k_max_shadow_slots)
+            return false;
+
+        set_texture_cmd& cur = _ctx->shadow.textures[st.unit];
+        if (cur.texture_index == st.texture_index && cur.sampler_index == st.sampler_index &&
+            cur.bind_flags == st.bind_flags)
+        {
+            _ctx->frame_elided_count++;
+            return true;
+        }
+
+        cur = st;
+        return false;
+    }
+
+    void renderer_wait_init()
+    {
+        semaphore_wait(_ctx->continue_semaphore);
+    }
+
+    //
+    // transient cbuffers
+    //
+
+    void transient_cbuffer_next_frame()
+    {
+        transient_cbuffer_ring& r = _ctx->transient_cbuffer;
+
+        u32 num_pages = sb_count(r.overflow);
+        if (num_pages)
+        {
+            // releases are deferred until the gpu is done with the buffers, the ring is recreated on the next write
+            for (u32 i = 0; i < num_pages; ++i)
+            {
+                renderer_release_buffer(r.overflow[i].buffer);
+                memory_free(r.overflow[i].cpu_data);
+            }
+            sb_clear(r.overflow);
+
+            r.frame_size = PEN_ALIGN(max<u32>(r.requested, r.frame_size * 2), k_transient_cbuffer_frame_size);
+            renderer_release_buffer(r.buffer);
+            memory_free(r.cpu_data);
+            r.buffer = 0;
+            r.cpu_data = nullptr;
+        }
+
+        r.frame = (r.frame + 1) % k_transient_cbuffer_frames;
+        r.pos = 0;
+        r.flushed = 0;
+        r.requested = 0;
+    }
+
+    u32 transient_cbuffer_create(u32 size)
+    {
+        buffer_creation_params bcp;
+        bcp.usage_flags = PEN_USAGE_DYNAMIC;
+        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE | PEN_CPU_ACCESS_NO_OVERWRITE;
+        bcp.buffer_size = size;
+        bcp.data = nullptr;
+
+        return renderer_create_buffer(bcp);
+    }
+
+    // the page a write of size bytes fits in, a new page is chained when the last one is full
+    transient_cbuffer_page& transient_cbuffer_overflow_page(transient_cbuffer_ring& r, u32 size)
+    {
+        u32 num_pages = sb_count(r.overflow);
+        if (num_pages)
+        {
+            transient_cbuffer_page& last = r.overflow[num_pages - 1];
+            if (last.pos + size <= last.size)
+                return last;
+        }
+        else
+        {
+            PEN_LOG("transient cbuffer ring is full, %u bytes written this frame, chaining pages and growing", r.pos);
+        }
+
+        transient_cbuffer_page page;
+        page.base = num_pages ? r.overflow[num_pages - 1].base + r.overflow[num_pages - 1].size : 0;
+        page.size = max<u32>(r.frame_size, size);
+        page.pos = 0;
+        page.flushed = 0;
+        page.buffer = transient_cbuffer_create(page.size);
+        page.cpu_data = (u8*)memory_alloc(page.size);
+
+        sb_push(r.overflow, page);
+        return r.overflow[num_pages];
+    }
+
+    u32 renderer_write_transient_cbuffer(const void* data, u32 size)
+    {
+        transient_cbuffer_ring& r = _ctx->transient_cbuffer;
+        if (!r.buffer)
+        {
+            r.buffer = transient_cbuffer_create(r.frame_size * k_transient_cbuffer_frames);
+            r.cpu_data = (u8*)memory_alloc(r.frame_size);
+        }
+
+        u32 aligned_size = PEN_ALIGN(size, k_transient_cbuffer_alignment);
+        r.requested += aligned_size;
+
+        if (r.pos + aligned_size > r.frame_size)
+        {
+            transient_cbuffer_page& page = transient_cbuffer_overflow_page(r, aligned_size);
+
+            u32 offset = page.pos;
+            memcpy(page.cpu_data + offset, data, size);
+            page.pos += aligned_size;
+
+            return r.frame_size * k_transient_cbuffer_frames + page.base + offset;
+        }
+
+        u32 offset = r.pos;
+        memcpy(r.cpu_data + offset, data, size);
+        r.pos += aligned_size;
+
+        return r.frame * r.frame_size + offset;
+    }
+
+    bool renderer_set_transient_cbuffer(u32 offset, u32 size, u32 unit, u32 flags)
+    {
+        transient_cbuffer_ring& r = _ctx->transient_cbuffer;
+        if (offset == PEN_INVALID_HANDLE || !r.buffer)
+            return false;
+
+        // upload everything written since the last bind with a single update
+        if (r.pos > r.flushed)
+        {
+            u32 base = r.frame * r.frame_size;
+            renderer_update_buffer(r.buffer, r.cpu_data + r.flushed, r.pos - r.flushed, base + r.flushed);
+            r.flushed = r.pos;
+        }
+
+        u32 buffer = r.buffer;
+        u32 ring_size = r.frame_size * k_transient_cbuffer_frames;
+        if (offset >= ring_size)
+        {
+            transient_cbuffer_page* page = nullptr;
+            u32                     num_pages = sb_count(r.overflow);
+            for (u32 i = 0; i < num_pages && !page; ++i)
+                if (offset - ring_size < r.overflow[i].base + r.overflow[i].size)
+                    page = &r.overflow[i];
+
+            if (!page)
+                return false;
+
+            if (page->pos > page->flushed)
+            {
+                renderer_update_buffer(page->buffer, page->cpu_data + page->flushed, page->pos - page->flushed,
+                                       page->flushed);
+                page->flushed = page->pos;
+            }
+
+            buffer = page->buffer;
+            offset -= ring_size + page->base;
+        }
+
+        // the unit no longer has a whole buffer bound, a following renderer_set_constant_buffer must not be dropped
+        if (unit < k_max_shadow_slots)
+            memset(&_ctx->shadow.cbuffers[unit], 0xff, sizeof(set_buffer_cmd));
+
+        renderer_cmd cmd;
+        cmd.command_index = CMD_SET_CONSTANT_BUFFER_RANGE;
+        cmd.set_buffer_range.buffer_index = buffer;
+        cmd.set_buffer_range.unit = unit;
+        cmd.set_buffer_range.flags = flags;
+        cmd.set_buffer_range.offset = offset;
+        cmd.set_buffer_range.size = PEN_ALIGN(size, k_transient_cbuffer_alignment);
+
+        add_cmd(cmd);
+        return true;
+    }
+
+    //
+    // frames in flight
+    //
+
+    void frame_fence_signal()
+    {
+        // render thread, after each present
+        _ctx->frames_completed++;
+
+#if !PEN_SINGLE_THREADED
+        if (_ctx->frame_waiting.exchange(0))
+            semaphore_post(_ctx->frame_semaphore, 1);
+#endif
+    }
+
+    void frame_fence_wait(u64 num_frames)
+    {
+        // game thread, blocks until the render thread has presented num_frames
+#if !PEN_SINGLE_THREADED
+        while (_ctx->frames_completed.load() < num_frames)
+        {
+            _ctx->frame_waiting = 1;
+
+            // the render thread may have presented before it could see the flag
+            if (_ctx->frames_completed.load() >= num_frames)
+            {
+                // if it did see it there is a post to consume
+                if (!_ctx->frame_waiting.exchange(0))
+                    semaphore_wait(_ctx->frame_semaphore);
+
+                break;
+            }
+
+            semaphore_wait(_ctx->frame_semaphore);
+        }
+#endif
+    }
+
+    void renderer_set_frames_in_flight(u32 num_frames)
+    {
+        _ctx->frames_in_flight = max<u32>(min<u32>(num_frames, k_max_renderer_frames_in_flight), 1);
+    }
+
+    u32 renderer_get_frames_in_flight()
+    {
+        return _ctx->frames_in_flight;
+    }
+
+    void renderer_consume_cmd_buffer()
+    {
+#if !PEN_SINGLE_THREADED
+        // wait until no more than frames_in_flight presented frames are still to be executed
+        f64 wait_start = get_time_ns();
+        u64 submitted = _ctx->frames_submitted;
+        if (submitted > _ctx->frames_in_flight)
+            frame_fence_wait(submitted - _ctx->frames_in_flight);
+
+        _ctx->frame_stats.frame_wait_ms = (f32)((get_time_ns() - wait_start) / 1000.0 / 1000.0);
+
+        // sync on window surface
+        direct::renderer_sync();
+#endif
+        _ctx->stats.cmd_count = _ctx->frame_cmd_count;
+        _ctx->stats.cmd_bytes = _ctx->frame_cmd_bytes;
+        _ctx->stats.elided_cmd_count = _ctx->frame_elided_count;
+        _ctx->frame_elided_count = 0;
+        _ctx->frame_cmd_count = 0;
+        _ctx->frame_cmd_bytes = 0;
+
+        frame_stats_publish();
+        payload_next_frame();
+        transient_cbuffer_next_frame();
+
+        // the next frame starts now
+        _ctx->frame_begin_ns = get_time_ns();
+    }
+
+    void new_frame_internal()
+    {
+        // free slots we have now deleted the resources for
+        u32 ns = sb_count(_ctx->free_slots);
+        for (u32 i = 0; i < ns; ++i)
+        {
+            slot_resources_free(&_ctx->renderer_slot_resources, _ctx->free_slots[i]);
+        }
+        sb_free(_ctx->free_slots);
+        _ctx->free_slots = nullptr;
+
+        // some api's need to set the current context on the caller thread.
+        direct::renderer_new_frame();
+    }
+
+    void end_frame_internal(f64 frame_begin_ns)
+    {
+        // check the release cmd_buffer.. we need to wait a few frames before releasing resources
+        // so they arent in flight on the gpu
+        static const u32 k_waitFrames = k_max_renderer_frames_in_flight + 5;
+        for (;;)
+        {
+            release_cmd* rc = _ctx->release_cmd_buffer.check();
+            u64          cf = pen::_renderer_frame_index();
+            if (!rc || cf - rc->frame_index < k_waitFrames)
+                break;
+
+            rc = _ctx->release_cmd_buffer.get();
+            if (rc->cmd.resource_slot)
+            {
+                exec_cmd(rc->cmd);
+                sb_push(_ctx->free_slots, rc->cmd.resource_slot);
+            }
+        }
+
+        direct::renderer_end_frame();
+
+        _ctx->frame_latency_ns = (u64)(get_time_ns() - frame_begin_ns);
+
+        frame_fence_signal();
+    }
+
+    void renderer_wait_for_jobs()
+    {
+        // this is a dedicated thread which stays for the duration of the program
+        semaphore_post(_ctx->continue_semaphore, 1);
+
+        for (;;)
+        {
+            const renderer_cmd* cmd = _ctx->cmd_buffer.check();
+
+            while (cmd)
+            {
+                // the command is released to the producer on pop
+                u16 command_index = cmd->command_index;
+                exec_cmd(*cmd);
+                _ctx->cmd_buffer.pop(cmd);
+
+                // break at present to re-call os update
+                if (command_index == CMD_PRESENT)
+                    break;
+
+                cmd = _ctx->cmd_buffer.check();
+            }
+
+            if (!pen::os_update())
+                break;
+        }
+    }
+
+    bool renderer_dispatch()
+    {
+        // this function is invoked from mtk draw in view
+        //if we start renderin  we need to wait for present to prevent command buffer being released before ending encoding
+
+        const renderer_cmd* cmd = _ctx->cmd_buffer.check();
+        bool                started = cmd;
+        while (cmd)
+        {
+            // the command is released to the producer on pop
+            u16 command_index = cmd->command_index;
+            exec_cmd(*cmd);
+            _ctx->cmd_buffer.pop(cmd);
+
+            // break at present to re-call os update
+            if (command_index == CMD_PRESENT)
+                break;
+
+            cmd = _ctx->cmd_buffer.check();
+        }
+
+        direct::renderer_retain();
+        return started;
+    }
+
+    void init_resolve_resources(fe_render_ctx* ctx)
+    {
+        struct textured_vertex
+        {
+            float x, y, z, w;
+            float u, v;
+        };
+
+        textured_vertex quad_vertices[] = {
+            -1.0f, -1.0f, 0.5f, 1.0f, // p1
+            0.0f,  1.0f,              // uv1
+
+            -1.0f, 1.0f,  0.5f, 1.0f, // p2
+            0.0f,  0.0f,              // uv2
+
+            1.0f,  1.0f,  0.5f, 1.0f, // p3
+            1.0f,  0.0f,              // uv3
+
+            1.0f,  -1.0f, 0.5f, 1.0f, // p4
+            1.0f,  1.0f,              // uv4
+        };
+
+        if (renderer_viewport_vup())
+        {
+            // flip gl in the y.
+            std::swap<f32>(quad_vertices[0].v, quad_vertices[1].v);
+            std::swap<f32>(quad_vertices[2].v, quad_vertices[3].v);
+        }
+
+        buffer_creation_params bcp;
+        bcp.usage_flags = PEN_USAGE_DEFAULT;
+        bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+        bcp.cpu_access_flags = 0;
+
+        bcp.buffer_size = sizeof(textured_vertex) * 4;
+        bcp.data = (void*)&quad_vertices[0];
+
+        ctx->resolve_resources.vertex_buffer = renderer_create_buffer(bcp);
+
+        // create index buffer
+        u16 indices[] = {0, 1, 2, 2, 3, 0};
+
+        bcp.usage_flags = PEN_USAGE_IMMUTABLE;
+        bcp.bind_flags = PEN_BIND_INDEX_BUFFER;
+        bcp.cpu_access_flags = 0;
+        bcp.buffer_size = sizeof(u16) * 6;
+        bcp.data = (void*)&indices[0];
+
+        ctx->resolve_resources.index_buffer = renderer_create_buffer(bcp);
+
+        // create cbuffer
+        bcp.usage_flags = PEN_USAGE_DYNAMIC;
+        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+        bcp.buffer_size = sizeof(resolve_cbuffer);
+        bcp.data = nullptr;
+
+        ctx->resolve_resources.constant_buffer = renderer_create_buffer(bcp);
+        g_resolve_resources = ctx->resolve_resources;
+    }
+
+    //
+    // cmd stream replay
+    //
+
+    // histogram buckets are powers of 2 in nanoseconds
+    constexpr u32 k_replay_histogram_buckets = 32;
+    constexpr u32 k_replay_histogram_width = 40;
+
+    struct replay_timing
+    {
+        u64 count;
+        u64 total_ns;
+        u64 min_ns;
+        u64 max_ns;
+        u64 histogram[k_replay_histogram_buckets];
+    };
+
+    struct replay_reader
+    {
+        const u8* data;
+        size_t    size;
+        size_t    pos;
+        void**    allocs; // payloads exec_cmd does not free itself, released after the command executes
+    };
+
+    static Str s_replay_filename;
+
+    void renderer_replay_enable(const c8* filename)
+    {
+        PEN_LOG("renderer replay enabled, %s.", filename);
+        s_replay_filename = filename;
+    }
+
+    const void* replay_read(replay_reader& r, size_t size)
+    {
+        PEN_ASSERT(r.pos + size <= r.size);
+        const void* p = r.data + r.pos;
+        r.pos += size;
+        return p;
+    }
+
+    void* replay_read_blob(replay_reader& r, bool freed_by_exec = false)
+    {
+        u32 size;
+        memcpy(&size, replay_read(r, sizeof(u32)), sizeof(u32));
+        if (size == k_capture_null_blob)
+            return nullptr;
+
+        void* p = memory_alloc(size);
+        memcpy(p, replay_read(r, size), size);
+
+        if (!freed_by_exec)
+            sb_push(r.allocs, p);
+
+        return p;
+    }
+
+    template <typename T>
+    T* replay_read_struct(replay_reader& r)
+    {
+        T* p = (T*)memory_alloc(sizeof(T));
+        memcpy(p, replay_read(r, sizeof(T)), sizeof(T));
+        sb_push(r.allocs, (void*)p);
+        return p;
+    }
+
+    void replay_read_payload(replay_reader& r, renderer_cmd& cmd)
+    {
+        // mirrors capture_cmd, pointers are rebuilt to point at heap copies
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            {
+                shader_load_params* p = replay_read_struct<shader_load_params>(r);
+                p->byte_code = replay_read_blob(r);
+                p->so_decl_entries = (stream_out_decl_entry*)replay_read_blob(r);
+                for (u32 i = 0; p->so_decl_entries && i < p->so_num_entries; ++i)
+                    p->so_decl_entries[i].semantic_name = (const c8*)replay_read_blob(r);
+                cmd.p_shader_load = p;
+            }
+            break;
+
+            case CMD_LINK_SHADER:
+            {
+                shader_link_params* p = replay_read_struct<shader_link_params>(r);
+                p->constants = (constant_layout_desc*)replay_read_blob(r);
+                for (u32 i = 0; p->constants && i < p->num_constants; ++i)
+                    p->constants[i].name = (c8*)replay_read_blob(r);
+
+                p->stream_out_names = (c8**)replay_read_blob(r);
+                for (u32 i = 0; p->stream_out_names && i < p->num_stream_out_names; ++i)
+                    p->stream_out_names[i] = (c8*)replay_read_blob(r);
+                cmd.p_link_params = p;
+            }
+            break;
+
+            case CMD_CREATE_INPUT_LAYOUT:
+            {
+                input_layout_creation_params* p = replay_read_struct<input_layout_creation_params>(r);
+                p->vs_byte_code = replay_read_blob(r, true);
+                p->input_layout = (input_layout_desc*)replay_read_blob(r, true);
+                for (u32 i = 0; p->input_layout && i < p->num_elements; ++i)
+                    p->input_layout[i].semantic_name = (const c8*)replay_read_blob(r);
+                cmd.p_create_input_layout = p;
+            }
+            break;
+
+            case CMD_CREATE_BUFFER:
+                cmd.p_create_buffer = replay_read_struct<buffer_creation_params>(r);
+                cmd.p_create_buffer->data = replay_read_blob(r, true);
+                break;
+
+            case CMD_CREATE_TEXTURE:
+                cmd.p_create_texture = replay_read_struct<texture_creation_params>(r);
+                cmd.p_create_texture->data = replay_read_blob(r, true);
+                break;
+
+            case CMD_CREATE_BLEND_STATE:
+                cmd.p_create_blend_state = replay_read_struct<blend_creation_params>(r);
+                cmd.p_create_blend_state->render_targets = (render_target_blend*)replay_read_blob(r, true);
+                break;
+
+            case CMD_UPDATE_BUFFER:
+                cmd.update_buffer.data = replay_read_blob(r);
+                break;
+
+            case CMD_PUSH_PERF_MARKER:
+                cmd.name = (c8*)replay_read_blob(r);
+                break;
+
+            case CMD_CREATE_SAMPLER:
+                cmd.p_create_sampler = replay_read_struct<sampler_creation_params>(r);
+                break;
+
+            case CMD_CREATE_RASTER_STATE:
+                cmd.p_create_raster_state = replay_read_struct<raster_state_creation_params>(r);
                 break;
 
-            case CMD_UPDATE_QUERIES:
-                renderer_update_queries();
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+                cmd.p_create_depth_stencil_state = replay_read_struct<depth_stencil_creation_params>(r);
                 break;
 
             case CMD_CREATE_RENDER_TARGET:
-                direct::renderer_create_render_target(cmd.create_render_target, cmd.resource_slot);
+                cmd.p_create_render_target = replay_read_struct<texture_creation_params>(r);
                 break;
 
-            case CMD_SET_TARGETS:
-                direct::renderer_set_targets(cmd.set_targets.colour, cmd.set_targets.num_colour, cmd.set_targets.depth,
-                                             cmd.set_targets.array_index, cmd.set_targets.array_index);
+            case CMD_CREATE_CLEAR_STATE:
+                cmd.p_clear_state = replay_read_struct<clear_state>(r);
                 break;
 
-            case CMD_RELEASE_BLEND_STATE:
-                direct::renderer_release_blend_state(cmd.command_data_index);
+            case CMD_MAP_RESOURCE:
+                cmd.p_rrb_params = replay_read_struct<resource_read_back_params>(r);
                 break;
+        }
+    }
 
-            case CMD_RELEASE_CLEAR_STATE:
-                direct::renderer_release_clear_state(cmd.command_data_index);
+    // slots handed out in the replay process can differ from the capture (freed slots are not recycled and the
+    // renderer's own resources are created first) so created handles are remapped, unmapped handles pass through.
+    void replay_map(u32* remap, u32& handle)
+    {
+        if (handle < (u32)sb_count(remap) && remap[handle])
+            handle = remap[handle];
+    }
+
+    void replay_remap_cmd(renderer_cmd& cmd, u32*& remap)
+    {
+        switch (cmd.command_index)
+        {
+            case CMD_CLEAR:
+            case CMD_CLEAR_TEXTURE:
+                replay_map(remap, cmd.clear.clear_state);
+                replay_map(remap, cmd.clear.texture_index);
                 break;
 
-            case CMD_RELEASE_RENDER_TARGET:
-                direct::renderer_release_render_target(cmd.command_data_index);
+            case CMD_SET_SHADER:
+            case CMD_RELEASE_SHADER:
+                replay_map(remap, cmd.set_shader.shader_index);
                 break;
 
-            case CMD_RELEASE_INPUT_LAYOUT:
-                direct::renderer_release_input_layout(cmd.command_data_index);
+            case CMD_LINK_SHADER:
+                replay_map(remap, cmd.p_link_params->vertex_shader);
+                replay_map(remap, cmd.p_link_params->pixel_shader);
+                replay_map(remap, cmd.p_link_params->compute_shader);
+                replay_map(remap, cmd.p_link_params->stream_out_shader);
+                replay_map(remap, cmd.p_link_params->input_layout);
                 break;
 
-            case CMD_RELEASE_SAMPLER:
-                direct::renderer_release_sampler(cmd.command_data_index);
+            case CMD_SET_VERTEX_BUFFER:
+                for (u32 i = 0; i < cmd.set_vertex_buffer.num_buffers; ++i)
+                    replay_map(remap, cmd.set_vertex_buffer.data[i]);
                 break;
 
-            case CMD_RELEASE_DEPTH_STENCIL_STATE:
-                direct::renderer_release_depth_stencil_state(cmd.command_data_index);
+            case CMD_SET_INDEX_BUFFER:
+                replay_map(remap, cmd.set_index_buffer.buffer_index);
                 break;
 
-            case CMD_SET_SO_TARGET:
-                direct::renderer_set_stream_out_target(cmd.command_data_index);
+            case CMD_SET_TEXTURE:
+                replay_map(remap, cmd.set_texture.texture_index);
+                replay_map(remap, cmd.set_texture.sampler_index);
                 break;
 
-            case CMD_RESOLVE_TARGET:
-                direct::renderer_resolve_target(cmd.resolve_params.render_target, cmd.resolve_params.resolve_type,
-                                                _ctx->resolve_resources);
+            case CMD_SET_CONSTANT_BUFFER:
+            case CMD_SET_STRUCTURED_BUFFER:
+                replay_map(remap, cmd.set_buffer.buffer_index);
                 break;
 
-            case CMD_DRAW_AUTO:
-                direct::renderer_draw_auto();
+            case CMD_SET_CONSTANT_BUFFER_RANGE:
+                replay_map(remap, cmd.set_buffer_range.buffer_index);
                 break;
 
-            case CMD_MAP_RESOURCE:
-                direct::renderer_read_back_resource(cmd.rrb_params);
+            case CMD_UPDATE_BUFFER:
+                replay_map(remap, cmd.update_buffer.buffer_index);
                 break;
 
-            case CMD_REPLACE_RESOURCE:
-                direct::renderer_replace_resource(cmd.replace_resource_params.dest_handle,
-                                                  cmd.replace_resource_params.src_handle, cmd.replace_resource_params.type);
+            case CMD_SET_TARGETS:
+                for (u32 i = 0; i < cmd.set_targets.num_colour; ++i)
+                    replay_map(remap, cmd.set_targets.colour[i]);
+                replay_map(remap, cmd.set_targets.depth);
                 break;
 
-            case CMD_CREATE_CLEAR_STATE:
-                direct::renderer_create_clear_state(cmd.clear_state_params, cmd.resource_slot);
+            case CMD_RESOLVE_TARGET:
+                replay_map(remap, cmd.resolve_params.render_target);
                 break;
 
-            case CMD_PUSH_PERF_MARKER:
-                direct::renderer_push_perf_marker(cmd.name);
+            case CMD_MAP_RESOURCE:
+                replay_map(remap, cmd.p_rrb_params->resource_index);
                 break;
 
-            case CMD_POP_PERF_MARKER:
-                direct::renderer_pop_perf_marker();
+            case CMD_REPLACE_RESOURCE:
+                replay_map(remap, cmd.replace_resource_params.dest_handle);
+                replay_map(remap, cmd.replace_resource_params.src_handle);
                 break;
 
-            case CMD_DISPATCH_COMPUTE:
-                direct::renderer_dispatch_compute(cmd.cs_dispatch.grid, cmd.cs_dispatch.num_threads);
+            case CMD_SET_INPUT_LAYOUT:
+            case CMD_SET_RASTER_STATE:
+            case CMD_SET_BLEND_STATE:
+            case CMD_SET_DEPTH_STENCIL_STATE:
+            case CMD_SET_SO_TARGET:
+            case CMD_RELEASE_BUFFER:
+            case CMD_RELEASE_TEXTURE_2D:
+            case CMD_RELEASE_RASTER_STATE:
+            case CMD_RELEASE_BLEND_STATE:
+            case CMD_RELEASE_RENDER_TARGET:
+            case CMD_RELEASE_INPUT_LAYOUT:
+            case CMD_RELEASE_SAMPLER:
+            case CMD_RELEASE_PROGRAM:
+            case CMD_RELEASE_CLEAR_STATE:
+            case CMD_RELEASE_DEPTH_STENCIL_STATE:
+                replay_map(remap, cmd.command_data_index);
                 break;
 
-            case CMD_SET_STENCIL_REF:
-                direct::renderer_set_stencil_ref(cmd.stencil_ref);
+            case CMD_LOAD_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
                 break;
         }
-    }
 
-    //
-    //
-    //
+        // creation commands
+        switch (cmd.command_index)
+        {
+            case CMD_LOAD_SHADER:
+            case CMD_LINK_SHADER:
+            case CMD_CREATE_INPUT_LAYOUT:
+            case CMD_CREATE_BUFFER:
+            case CMD_CREATE_TEXTURE:
+            case CMD_CREATE_SAMPLER:
+            case CMD_CREATE_RASTER_STATE:
+            case CMD_CREATE_BLEND_STATE:
+            case CMD_CREATE_DEPTH_STENCIL_STATE:
+            case CMD_CREATE_RENDER_TARGET:
+            case CMD_CREATE_CLEAR_STATE:
+            {
+                u32 captured = cmd.resource_slot;
+                cmd.resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
 
-    void renderer_wait_init()
-    {
-        semaphore_wait(_ctx->continue_semaphore);
+                while ((u32)sb_count(remap) <= captured)
+                    sb_push(remap, 0);
+                remap[captured] = cmd.resource_slot;
+            }
+            break;
+        }
     }
 
-    void renderer_consume_cmd_buffer()
+    void replay_read_back_complete(void*, u32, u32, u32)
     {
-#if !PEN_SINGLE_THREADED
-        while (_ctx->wait > 0)
-            pen::thread_sleep_ms(1);
+    }
 
-        if (_ctx->consume_semaphore)
+    void replay_exec_cmd(const renderer_cmd& cmd)
+    {
+        // frame boundaries go straight to the backend, the front end frame sync is not running during replay
+        switch (cmd.command_index)
         {
-            semaphore_post(_ctx->consume_semaphore, 1);
-            semaphore_wait(_ctx->continue_semaphore);
+            case CMD_NEW_FRAME:
+                direct::renderer_new_frame();
+                break;
+            case CMD_PRESENT:
+                direct::renderer_present();
+                direct::renderer_end_frame();
+                break;
+            case CMD_UPDATE_QUERIES:
+                // queries are issued by the front end and have no captured state
+                break;
+            case CMD_MAP_RESOURCE:
+                cmd.p_rrb_params->call_back_function = &replay_read_back_complete;
+                exec_cmd(cmd);
+                break;
+            default:
+                exec_cmd(cmd);
+                break;
         }
-
-        // sync on window surface
-        direct::renderer_sync();
-        _ctx->wait++;
-#endif
     }
 
-    void new_frame_internal()
+    u32 replay_histogram_bucket(u64 ns)
     {
-        // free slots we have now deleted the resources for
-        u32 ns = sb_count(_ctx->free_slots);
-        for (u32 i = 0; i < ns; ++i)
+        u32 b = 0;
+        while (ns > 1 && b < k_replay_histogram_buckets - 1)
         {
-            slot_resources_free(&_ctx->renderer_slot_resources, _ctx->free_slots[i]);
+            ns >>= 1;
+            ++b;
         }
-        sb_free(_ctx->free_slots);
-        _ctx->free_slots = nullptr;
-
-        // some api's need to set the current context on the caller thread.
-        direct::renderer_new_frame();
+        return b;
     }
 
-    void end_frame_internal()
+    u64 replay_percentile_ns(const replay_timing& t, f64 percentile)
     {
-        // check the release cmd_buffer.. we need to wait a few frames before releasing resources
-        // so they arent in flight on the gpu
-        static const u32 k_waitFrames = 6;
-        for (;;)
+        // upper bound of the bucket containing the percentile
+        u64 target = (u64)(t.count * percentile);
+        u64 sum = 0;
+        for (u32 b = 0; b < k_replay_histogram_buckets; ++b)
         {
-            renderer_cmd* cmd = _ctx->release_cmd_buffer.check();
-            u64           cf = pen::_renderer_frame_index();
-            if (!cmd || cf - cmd->frame_index < k_waitFrames)
-                break;
-
-            cmd = _ctx->release_cmd_buffer.get();
-            if (cmd->resource_slot)
-            {
-                if (cmd)
-                    exec_cmd(*cmd);
-
-                sb_push(_ctx->free_slots, cmd->resource_slot);
-            }
+            sum += t.histogram[b];
+            if (sum > target)
+                return min<u64>(2ull << b, t.max_ns);
         }
-
-        direct::renderer_end_frame();
-        semaphore_post(_ctx->continue_semaphore, 1);
-        _ctx->wait--;
+        return t.max_ns;
     }
 
-    void renderer_wait_for_jobs()
+    void replay_report(const replay_timing* timings, const replay_timing& frame)
     {
-        // this is a dedicated thread which stays for the duration of the program
-        semaphore_post(_ctx->continue_semaphore, 1);
+        u32 order[k_num_cmds];
+        for (u32 i = 0; i < k_num_cmds; ++i)
+            order[i] = i;
 
-        for (;;)
+        std::sort(order, order + k_num_cmds,
+                  [timings](u32 a, u32 b) { return timings[a].total_ns > timings[b].total_ns; });
+
+        PEN_LOG("frames: %llu, mean %.3f(ms), min %.3f(ms), max %.3f(ms)", frame.count,
+                frame.count ? (f64)frame.total_ns / frame.count / 1e6 : 0.0, frame.min_ns / 1e6, frame.max_ns / 1e6);
+
+        PEN_LOG("%-28s %10s %10s %10s %10s %10s %10s", "command", "count", "total(ms)", "mean(ns)", "p50(ns)",
+                "p99(ns)", "max(ns)");
+
+        for (u32 i = 0; i < k_num_cmds; ++i)
         {
-            renderer_cmd* cmd = _ctx->cmd_buffer.get();
+            const replay_timing& t = timings[order[i]];
+            if (t.count == 0)
+                continue;
 
-            while (cmd)
-            {
-                exec_cmd(*cmd);
+            PEN_LOG("%-28s %10llu %10.3f %10llu %10llu %10llu %10llu", k_cmd_names[order[i]], t.count,
+                    t.total_ns / 1e6, t.total_ns / t.count, replay_percentile_ns(t, 0.5), replay_percentile_ns(t, 0.99),
+                    t.max_ns);
 
-                // break at present to re-call os update
-                if (cmd->command_index == CMD_PRESENT)
-                    break;
+            u64 peak = 0;
+            for (u32 b = 0; b < k_replay_histogram_buckets; ++b)
+                peak = max<u64>(peak, t.histogram[b]);
 
-                cmd = _ctx->cmd_buffer.get();
-            }
+            for (u32 b = replay_histogram_bucket(t.min_ns); b <= replay_histogram_bucket(t.max_ns); ++b)
+            {
+                c8  bar[k_replay_histogram_width + 1];
+                u32 len = (u32)((t.histogram[b] * k_replay_histogram_width + peak - 1) / peak);
+                memset(bar, '#', len);
+                bar[len] = '\0';
 
-            if (!pen::os_update())
-                break;
+                PEN_LOG("    < %10llu(ns) %-40s %llu", 2ull << b, bar, t.histogram[b]);
+            }
         }
     }
 
-    bool renderer_dispatch()
+    void replay_record(replay_timing& t, u64 ns)
     {
-        // this function is invoked from mtk draw in view
-        //if we start renderin  we need to wait for present to prevent command buffer being released before ending encoding
-
-        renderer_cmd* cmd = _ctx->cmd_buffer.get();
-        bool          started = cmd;
-        while (cmd)
-        {
-            exec_cmd(*cmd);
-
-            // break at present to re-call os update
-            if (cmd->command_index == CMD_PRESENT)
-                break;
+        if (t.count == 0 || ns < t.min_ns)
+            t.min_ns = ns;
 
-            cmd = _ctx->cmd_buffer.get();
-        }
-
-        direct::renderer_retain();
-        return started;
+        t.max_ns = max<u64>(t.max_ns, ns);
+        t.total_ns += ns;
+        t.count++;
+        t.histogram[replay_histogram_bucket(ns)]++;
     }
 
-    void init_resolve_resources(fe_render_ctx* ctx)
+    void renderer_replay()
     {
-        struct textured_vertex
+        // execute the renderer's own initialisation commands first
+        while (const renderer_cmd* init_cmd = _ctx->cmd_buffer.check())
         {
-            float x, y, z, w;
-            float u, v;
-        };
+            exec_cmd(*init_cmd);
+            _ctx->cmd_buffer.pop(init_cmd);
+        }
 
-        textured_vertex quad_vertices[] = {
-            -1.0f, -1.0f, 0.5f, 1.0f, // p1
-            0.0f,  1.0f,              // uv1
+        void* file_data = nullptr;
+        u32   file_size = 0;
+        if (filesystem_read_file_to_buffer(s_replay_filename.c_str(), &file_data, file_size) != PEN_ERR_OK)
+        {
+            PEN_LOG("failed to read capture %s", s_replay_filename.c_str());
+            return;
+        }
 
-            -1.0f, 1.0f,  0.5f, 1.0f, // p2
-            0.0f,  0.0f,              // uv2
+        capture_header header = {};
+        if (file_size >= sizeof(capture_header))
+            memcpy(&header, file_data, sizeof(capture_header));
 
-            1.0f,  1.0f,  0.5f, 1.0f, // p3
-            1.0f,  0.0f,              // uv3
+        if (header.magic != k_capture_magic || header.version != k_capture_version)
+        {
+            PEN_LOG("%s is not a version %u renderer capture", s_replay_filename.c_str(), k_capture_version);
+            memory_free(file_data);
+            return;
+        }
 
-            1.0f,  -1.0f, 0.5f, 1.0f, // p4
-            1.0f,  1.0f,              // uv4
-        };
+        PEN_LOG("replaying %s: %u frames, %u commands", s_replay_filename.c_str(), header.num_frames,
+                header.num_cmds);
 
-        if (renderer_viewport_vup())
+        replay_reader r = {(const u8*)file_data, file_size, sizeof(capture_header), nullptr};
+        u32*          remap = nullptr;
+        replay_timing timings[k_num_cmds] = {};
+        replay_timing frame = {};
+        f64           frame_start = get_time_ns();
+
+        for (u32 i = 0; i < header.num_cmds; ++i)
         {
-            // flip gl in the y.
-            std::swap<f32>(quad_vertices[0].v, quad_vertices[1].v);
-            std::swap<f32>(quad_vertices[2].v, quad_vertices[3].v);
-        }
+            renderer_cmd cmd;
+            u16          cmd_header[2];
+            memcpy(cmd_header, replay_read(r, sizeof(cmd_header)), sizeof(cmd_header));
+            cmd.command_index = cmd_header[0];
+            cmd.size = cmd_header[1];
 
-        buffer_creation_params bcp;
-        bcp.usage_flags = PEN_USAGE_DEFAULT;
-        bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
-        bcp.cpu_access_flags = 0;
+            PEN_ASSERT(cmd.command_index < k_num_cmds);
+            memcpy((u8*)&cmd + k_capture_cmd_header_size, replay_read(r, cmd.size - k_capture_cmd_header_size),
+                   cmd.size - k_capture_cmd_header_size);
 
-        bcp.buffer_size = sizeof(textured_vertex) * 4;
-        bcp.data = (void*)&quad_vertices[0];
+            replay_read_payload(r, cmd);
+            replay_remap_cmd(cmd, remap);
 
-        ctx->resolve_resources.vertex_buffer = renderer_create_buffer(bcp);
+            f64 start = get_time_ns();
+            replay_exec_cmd(cmd);
+            f64 end = get_time_ns();
 
-        // create index buffer
-        u16 indices[] = {0, 1, 2, 2, 3, 0};
+            replay_record(timings[cmd.command_index], (u64)(end - start));
 
-        bcp.usage_flags = PEN_USAGE_IMMUTABLE;
-        bcp.bind_flags = PEN_BIND_INDEX_BUFFER;
-        bcp.cpu_access_flags = 0;
-        bcp.buffer_size = sizeof(u16) * 6;
-        bcp.data = (void*)&indices[0];
+            if (cmd.command_index == CMD_PRESENT)
+            {
+                replay_record(frame, (u64)(end - frame_start));
+                frame_start = end;
+            }
 
-        ctx->resolve_resources.index_buffer = renderer_create_buffer(bcp);
+            u32 num_allocs = sb_count(r.allocs);
+            for (u32 a = 0; a < num_allocs; ++a)
+                memory_free(r.allocs[a]);
+            sb_clear(r.allocs);
+        }
 
-        // create cbuffer
-        bcp.usage_flags = PEN_USAGE_DYNAMIC;
-        bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-        bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-        bcp.buffer_size = sizeof(resolve_cbuffer);
-        bcp.data = nullptr;
+        replay_report(timings, frame);
 
-        ctx->resolve_resources.constant_buffer = renderer_create_buffer(bcp);
-        g_resolve_resources = ctx->resolve_resources;
+        sb_free(remap);
+        memory_free(file_data);
     }
 
     render_ctx renderer_create_context(u32 max_commands)
     {
         fe_render_ctx* new_ctx = new fe_render_ctx();
-        new_ctx->cmd_buffer.create(max_commands);
+        new_ctx->cmd_buffer.create(max_commands * k_cmd_stream_bytes_per_command);
         new_ctx->release_cmd_buffer.create(1024);
         new_ctx->present_timer = timer_create();
         timer_start(new_ctx->present_timer);
         new_ctx->present_time = 0.0f;
-        new_ctx->consume_semaphore = semaphore_create(0, 1);
         new_ctx->continue_semaphore = semaphore_create(0, 1);
+        new_ctx->frame_semaphore = semaphore_create(0, 1);
+        new_ctx->frames_submitted = 0;
+        new_ctx->frames_completed = 0;
+        new_ctx->frame_waiting = 0;
+        new_ctx->frame_latency_ns = 0;
         slot_resources_init(&new_ctx->renderer_slot_resources, 2048);
+        memset(&new_ctx->shadow, 0xff, sizeof(shadow_state));
+        memset(&new_ctx->frame_stats, 0x0, sizeof(renderer_frame_stats));
+        memset(&new_ctx->published_frame_stats, 0x0, sizeof(renderer_frame_stats));
+        new_ctx->published_frame_stats_seq = 0;
 
         return (render_ctx*)new_ctx;
     }
@@ -743,6 +2273,13 @@ namespace pen
 
         init_resolve_resources(_ctx);
 
+        // replay runs in place of the user thread, the caller terminates when it returns
+        if (!s_replay_filename.empty())
+        {
+            renderer_replay();
+            return;
+        }
+
         if (wait_for_jobs)
             renderer_wait_for_jobs();
     }
@@ -900,8 +2437,13 @@ namespace pen
 
     void renderer_new_frame()
     {
+        // later frames begin when the previous one is consumed
+        if (_ctx->frame_begin_ns == 0.0)
+            _ctx->frame_begin_ns = get_time_ns();
+
         renderer_cmd cmd;
         cmd.command_index = CMD_NEW_FRAME;
+        shadow_state_invalidate();
         add_cmd(cmd);
     }
 
@@ -916,6 +2458,7 @@ namespace pen
     {
         renderer_cmd cmd;
         cmd.command_index = CMD_CLEAR;
+        shadow_state_invalidate();
         cmd.clear.clear_state = clear_state_index;
         cmd.clear.array_index = array_index;
         add_cmd(cmd);
@@ -925,6 +2468,7 @@ namespace pen
     {
         renderer_cmd cmd;
         cmd.command_index = CMD_CLEAR_TEXTURE;
+        shadow_state_invalidate();
         cmd.clear.clear_state = clear_state_index;
         cmd.clear.texture_index = texture;
         add_cmd(cmd);
@@ -936,7 +2480,11 @@ namespace pen
 
         renderer_cmd cmd;
         cmd.command_index = CMD_PRESENT;
+        cmd.frame_begin_ns = _ctx->frame_begin_ns;
+        shadow_state_invalidate();
         add_cmd(cmd);
+
+        _ctx->frames_submitted++;
     }
 
     u32 renderer_load_shader(const shader_load_params& params)
@@ -945,24 +2493,22 @@ namespace pen
 
         cmd.command_index = CMD_LOAD_SHADER;
 
-        cmd.shader_load.byte_code_size = params.byte_code_size;
-        cmd.shader_load.type = params.type;
+        cmd.p_shader_load = payload_copy(params);
+        cmd.p_shader_load->byte_code = nullptr;
 
         if (params.byte_code)
         {
-            cmd.shader_load.byte_code = memory_alloc(params.byte_code_size);
-            memcpy(cmd.shader_load.byte_code, params.byte_code, params.byte_code_size);
+            cmd.p_shader_load->byte_code = payload_alloc(params.byte_code_size);
+            memcpy(cmd.p_shader_load->byte_code, params.byte_code, params.byte_code_size);
         }
 
-        cmd.shader_load.so_decl_entries = nullptr;
+        cmd.p_shader_load->so_decl_entries = nullptr;
         if (params.so_decl_entries)
         {
-            cmd.shader_load.so_num_entries = params.so_num_entries;
-
             u32 entries_size = sizeof(stream_out_decl_entry) * params.so_num_entries;
-            cmd.shader_load.so_decl_entries = (stream_out_decl_entry*)memory_alloc(entries_size);
+            cmd.p_shader_load->so_decl_entries = (stream_out_decl_entry*)payload_alloc(entries_size);
 
-            memcpy(cmd.shader_load.so_decl_entries, params.so_decl_entries, entries_size);
+            memcpy(cmd.p_shader_load->so_decl_entries, params.so_decl_entries, entries_size);
         }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
@@ -979,36 +2525,36 @@ namespace pen
 
         cmd.command_index = CMD_LINK_SHADER;
 
-        cmd.link_params = params;
+        cmd.p_link_params = payload_copy(params);
 
         u32 num = params.num_constants;
         u32 layout_size = sizeof(constant_layout_desc) * num;
-        cmd.link_params.constants = (constant_layout_desc*)memory_alloc(layout_size);
+        cmd.p_link_params->constants = (constant_layout_desc*)payload_alloc(layout_size);
 
-        constant_layout_desc* c = cmd.link_params.constants;
+        constant_layout_desc* c = cmd.p_link_params->constants;
         for (u32 i = 0; i < num; ++i)
         {
             c[i].location = params.constants[i].location;
             c[i].type = params.constants[i].type;
 
             u32 len = string_length(params.constants[i].name);
-            c[i].name = (c8*)memory_alloc(len + 1);
+            c[i].name = (c8*)payload_alloc(len + 1);
 
             memcpy(c[i].name, params.constants[i].name, len);
             c[i].name[len] = '\0';
         }
 
-        cmd.link_params.stream_out_names = nullptr;
+        cmd.p_link_params->stream_out_names = nullptr;
         if (params.stream_out_shader != 0)
         {
             u32 num_so = params.num_stream_out_names;
-            cmd.link_params.stream_out_names = (c8**)memory_alloc(sizeof(c8*) * num_so);
+            cmd.p_link_params->stream_out_names = (c8**)payload_alloc(sizeof(c8*) * num_so);
 
-            c8** so = cmd.link_params.stream_out_names;
+            c8** so = cmd.p_link_params->stream_out_names;
             for (u32 i = 0; i < num_so; ++i)
             {
                 u32 len = string_length(params.stream_out_names[i]);
-                so[i] = (c8*)memory_alloc(len + 1);
+                so[i] = (c8*)payload_alloc(len + 1);
 
                 memcpy(so[i], params.stream_out_names[i], len);
                 so[i][len] = '\0';
@@ -1028,6 +2574,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_SHADER;
+        shadow_state_invalidate();
 
         cmd.set_shader.shader_index = shader_index;
         cmd.set_shader.shader_type = shader_type;
@@ -1042,18 +2589,17 @@ namespace pen
         cmd.command_index = CMD_CREATE_INPUT_LAYOUT;
 
         // simple data
-        cmd.create_input_layout.num_elements = params.num_elements;
-        cmd.create_input_layout.vs_byte_code_size = params.vs_byte_code_size;
+        cmd.p_create_input_layout = payload_copy(params);
 
         // copy buffer
-        cmd.create_input_layout.vs_byte_code = memory_alloc(params.vs_byte_code_size);
-        memcpy(cmd.create_input_layout.vs_byte_code, params.vs_byte_code, params.vs_byte_code_size);
+        cmd.p_create_input_layout->vs_byte_code = memory_alloc(params.vs_byte_code_size);
+        memcpy(cmd.p_create_input_layout->vs_byte_code, params.vs_byte_code, params.vs_byte_code_size);
 
         // copy array
         u32 input_layouts_size = sizeof(input_layout_desc) * params.num_elements;
-        cmd.create_input_layout.input_layout = (input_layout_desc*)memory_alloc(input_layouts_size);
+        cmd.p_create_input_layout->input_layout = (input_layout_desc*)memory_alloc(input_layouts_size);
 
-        memcpy(cmd.create_input_layout.input_layout, params.input_layout, input_layouts_size);
+        memcpy(cmd.p_create_input_layout->input_layout, params.input_layout, input_layouts_size);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
@@ -1078,18 +2624,19 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_BUFFER;
 
-        memcpy(&cmd.create_buffer, (void*)&params, sizeof(buffer_creation_params));
+        cmd.p_create_buffer = payload_copy(params);
 
         if (params.data)
         {
             // make a copy of the buffers data
-            cmd.create_buffer.data = memory_alloc(params.buffer_size);
-            memcpy(cmd.create_buffer.data, params.data, params.buffer_size);
+            cmd.p_create_buffer->data = memory_alloc(params.buffer_size);
+            memcpy(cmd.p_create_buffer->data, params.data, params.buffer_size);
         }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
+        frame_stats_slot(resource_slot).cbuffer = params.bind_flags & PEN_BIND_CONSTANT_BUFFER;
         add_cmd(cmd);
 
         return resource_slot;
@@ -1107,18 +2654,17 @@ namespace pen
 
         cmd.command_index = CMD_SET_VERTEX_BUFFER;
 
+        PEN_ASSERT(num_buffers <= k_max_vertex_buffers);
+
         cmd.set_vertex_buffer.start_slot = start_slot;
         cmd.set_vertex_buffer.num_buffers = num_buffers;
 
-        cmd.set_vertex_buffer.buffer_indices = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.strides = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-        cmd.set_vertex_buffer.offsets = (u32*)memory_alloc(sizeof(u32) * num_buffers);
-
+        u32* data = &cmd.set_vertex_buffer.data[0];
         for (u32 i = 0; i < num_buffers; ++i)
         {
-            cmd.set_vertex_buffer.buffer_indices[i] = buffer_indices[i];
-            cmd.set_vertex_buffer.strides[i] = strides[i];
-            cmd.set_vertex_buffer.offsets[i] = offsets[i];
+            data[i] = buffer_indices[i];
+            data[num_buffers + i] = strides[i];
+            data[num_buffers * 2 + i] = offsets[i];
         }
 
         add_cmd(cmd);
@@ -1189,11 +2735,12 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_RENDER_TARGET;
 
-        memcpy(&cmd.create_render_target, (void*)&tcp, sizeof(texture_creation_params));
+        cmd.p_create_render_target = payload_copy(tcp);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
+        frame_stats_texture_created(resource_slot, tcp);
         add_cmd(cmd);
 
         return resource_slot;
@@ -1217,22 +2764,22 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_TEXTURE;
 
-        memcpy(&cmd.create_texture, (void*)&tcp, sizeof(texture_creation_params));
-
-        cmd.create_texture.data = memory_alloc(tcp.data_size);
+        cmd.p_create_texture = payload_copy(tcp);
 
         if (tcp.data)
         {
-            memcpy(cmd.create_texture.data, tcp.data, tcp.data_size);
+            cmd.p_create_texture->data = memory_alloc(tcp.data_size);
+            memcpy(cmd.p_create_texture->data, tcp.data, tcp.data_size);
         }
         else
         {
-            cmd.create_texture.data = nullptr;
+            cmd.p_create_texture->data = nullptr;
         }
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
 
+        frame_stats_texture_created(resource_slot, tcp);
         add_cmd(cmd);
 
         return resource_slot;
@@ -1244,7 +2791,7 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_SAMPLER;
 
-        memcpy(&cmd.create_sampler, (void*)&scp, sizeof(sampler_creation_params));
+        cmd.p_create_sampler = payload_copy(scp);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
@@ -1265,6 +2812,9 @@ namespace pen
         cmd.set_texture.unit = unit;
         cmd.set_texture.bind_flags = bind_flags;
 
+        if (shadow_state_bound(cmd.set_texture))
+            return;
+
         add_cmd(cmd);
     }
 
@@ -1274,7 +2824,7 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_RASTER_STATE;
 
-        memcpy(&cmd.create_raster_state, (void*)&rscp, sizeof(raster_state_creation_params));
+        cmd.p_create_raster_state = payload_copy(rscp);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
@@ -1333,14 +2883,14 @@ namespace pen
 
         cmd.command_index = CMD_CREATE_BLEND_STATE;
 
-        memcpy(&cmd.create_blend_state, (void*)&bcp, sizeof(blend_creation_params));
+        cmd.p_create_blend_state = payload_copy(bcp);
 
         // alloc and copy the render targets blend modes. to save space in the cmd buffer
         u32   render_target_modes_size = sizeof(render_target_blend) * bcp.num_render_targets;
         void* mem = memory_alloc(render_target_modes_size);
-        cmd.create_blend_state.render_targets = (render_target_blend*)mem;
+        cmd.p_create_blend_state->render_targets = (render_target_blend*)mem;
 
-        memcpy(cmd.create_blend_state.render_targets, (void*)bcp.render_targets, render_target_modes_size);
+        memcpy(cmd.p_create_blend_state->render_targets, (void*)bcp.render_targets, render_target_modes_size);
 
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
         cmd.resource_slot = resource_slot;
@@ -1371,6 +2921,9 @@ namespace pen
         cmd.set_buffer.unit = unit;
         cmd.set_buffer.flags = flags;
 
+        if (shadow_state_bound(_ctx->shadow.cbuffers, cmd.set_buffer))
+            return;
+
         add_cmd(cmd);
     }
 
@@ -1384,6 +2937,9 @@ namespace pen
         cmd.set_buffer.unit = unit;
         cmd.set_buffer.flags = flags;
 
+        if (shadow_state_bound(_ctx->shadow.sbuffers, cmd.set_buffer))
+            return;
+
         add_cmd(cmd);
     }
 
@@ -1395,11 +2951,12 @@ namespace pen
             return;
 
         cmd.command_index = CMD_UPDATE_BUFFER;
+        shadow_state_invalidate_buffer(buffer_index);
 
         cmd.update_buffer.buffer_index = buffer_index;
         cmd.update_buffer.data_size = data_size;
         cmd.update_buffer.offset = offset;
-        cmd.update_buffer.data = memory_alloc(data_size);
+        cmd.update_buffer.data = payload_alloc(data_size);
         memcpy(cmd.update_buffer.data, data, data_size);
 
         add_cmd(cmd);
@@ -1412,7 +2969,7 @@ namespace pen
         cmd.command_index = CMD_CREATE_DEPTH_STENCIL_STATE;
 
         cmd.p_create_depth_stencil_state =
-            (depth_stencil_creation_params*)memory_alloc(sizeof(depth_stencil_creation_params));
+            (depth_stencil_creation_params*)payload_alloc(sizeof(depth_stencil_creation_params));
 
         memcpy(cmd.p_create_depth_stencil_state, &dscp, sizeof(depth_stencil_creation_params));
 
@@ -1439,7 +2996,10 @@ namespace pen
     {
         renderer_cmd cmd;
 
+        PEN_ASSERT(num_colour_targets <= k_max_colour_targets);
+
         cmd.command_index = CMD_SET_TARGETS;
+        shadow_state_invalidate();
         cmd.set_targets.num_colour = num_colour_targets;
         memcpy(&cmd.set_targets.colour, colour_targets, num_colour_targets * sizeof(u32));
         cmd.set_targets.depth = depth_target;
@@ -1453,6 +3013,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_TARGETS;
+        shadow_state_invalidate();
         cmd.set_targets.num_colour = is_valid(colour_target) ? 1 : 0;
         cmd.set_targets.colour[0] = colour_target;
         cmd.set_targets.depth = depth_target;
@@ -1466,12 +3027,11 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SHADER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = shader_index;
         cmd.set_shader.shader_index = shader_index;
         cmd.set_shader.shader_type = shader_type;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_buffer(u32 buffer_index)
@@ -1479,11 +3039,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BUFFER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = buffer_index;
         cmd.command_data_index = buffer_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_texture(u32 texture_index)
@@ -1493,9 +3052,9 @@ namespace pen
         cmd.command_index = CMD_RELEASE_TEXTURE_2D;
         cmd.resource_slot = texture_index;
         cmd.command_data_index = texture_index;
-        cmd.frame_index = pen::_renderer_frame_index();
 
-        _ctx->release_cmd_buffer.put(cmd);
+        frame_stats_texture_released(texture_index);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_blend_state(u32 blend_state)
@@ -1503,11 +3062,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_BLEND_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = blend_state;
         cmd.command_data_index = blend_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_render_target(u32 render_target)
@@ -1515,11 +3073,11 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_RENDER_TARGET;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = render_target;
         cmd.command_data_index = render_target;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        frame_stats_texture_released(render_target);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_clear_state(u32 clear_state)
@@ -1527,11 +3085,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_CLEAR_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = clear_state;
         cmd.command_data_index = clear_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_input_layout(u32 input_layout)
@@ -1539,11 +3096,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_INPUT_LAYOUT;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = input_layout;
         cmd.command_data_index = input_layout;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_sampler(u32 sampler)
@@ -1551,11 +3107,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_SAMPLER;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = sampler;
         cmd.command_data_index = sampler;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_depth_stencil_state(u32 depth_stencil_state)
@@ -1563,11 +3118,10 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RELEASE_DEPTH_STENCIL_STATE;
-        cmd.frame_index = pen::_renderer_frame_index();
         cmd.resource_slot = depth_stencil_state;
         cmd.command_data_index = depth_stencil_state;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_release_raster_state(u32 raster_state_index)
@@ -1578,7 +3132,7 @@ namespace pen
         cmd.resource_slot = raster_state_index;
         cmd.command_data_index = raster_state_index;
 
-        _ctx->release_cmd_buffer.put(cmd);
+        add_release_cmd(cmd);
     }
 
     void renderer_set_stream_out_target(u32 buffer_index)
@@ -1586,6 +3140,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_SET_SO_TARGET;
+        shadow_state_invalidate();
         cmd.command_data_index = buffer_index;
 
         add_cmd(cmd);
@@ -1596,6 +3151,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_RESOLVE_TARGET;
+        shadow_state_invalidate();
 
         cmd.resolve_params.render_target = target;
         cmd.resolve_params.resolve_type = type;
@@ -1617,6 +3173,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_DISPATCH_COMPUTE;
+        shadow_state_invalidate();
         cmd.cs_dispatch.grid = grid;
         cmd.cs_dispatch.num_threads = num_threads;
 
@@ -1628,8 +3185,9 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_MAP_RESOURCE;
+        shadow_state_invalidate();
 
-        cmd.rrb_params = rrbp;
+        cmd.p_rrb_params = payload_copy(rrbp);
 
         add_cmd(cmd);
     }
@@ -1639,6 +3197,7 @@ namespace pen
         renderer_cmd cmd;
 
         cmd.command_index = CMD_REPLACE_RESOURCE;
+        shadow_state_invalidate();
 
         cmd.replace_resource_params = {dest, src, type};
 
@@ -1652,7 +3211,7 @@ namespace pen
         u32 resource_slot = slot_resources_get_next(&_ctx->renderer_slot_resources);
 
         cmd.command_index = CMD_CREATE_CLEAR_STATE;
-        cmd.clear_state_params = cs;
+        cmd.p_clear_state = payload_copy(cs);
         cmd.resource_slot = resource_slot;
 
         add_cmd(cmd);
@@ -1678,7 +3237,7 @@ namespace pen
 
         // make copy of string to be able to use temporaries
         u32 len = string_length(name);
-        cmd.name = (c8*)memory_alloc(len);
+        cmd.name = (c8*)payload_alloc(len + 1);
         memcpy(cmd.name, name, len);
         cmd.name[len] = '\0';
 
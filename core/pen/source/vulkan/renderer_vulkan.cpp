@@ -436,6 +436,10 @@ namespace
                 u32 bind_flags;
             };
         };
+
+        // uniform buffer sub range, buffer_range 0 binds the whole buffer
+        u32 buffer_offset = 0;
+        u32 buffer_range = 0;
     };
 
     struct vk_pass_cache
@@ -1801,8 +1805,8 @@ namespace
                     vulkan_buffer& vb = _res_pool.get(pb.index).buffer;
 
                     buf_info.buffer = vb.get_buffer();
-                    buf_info.offset = 0;
-                    buf_info.range = vb.size;
+                    buf_info.offset = pb.buffer_offset;
+                    buf_info.range = pb.buffer_range ? pb.buffer_range : vb.size;
 
                     descriptor_write.pBufferInfo = &buf_info;
                 }
@@ -2167,6 +2171,23 @@ namespace pen
             _set_binding(b);
         }
 
+        void renderer_set_constant_buffer_range(u32 buffer_index, u32 unit, u32 flags, u32 offset, u32 size)
+        {
+            if (buffer_index == 0)
+                return;
+
+            pen_binding b;
+            b.descriptor_type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            b.stage = to_vk_stage(flags);
+            b.index = buffer_index;
+            b.slot = unit;
+            b.bind_flags = flags;
+            b.buffer_offset = offset;
+            b.buffer_range = size;
+
+            _set_binding(b);
+        }
+
         void renderer_set_structured_buffer(u32 buffer_index, u32 unit, u32 flags)
         {
         }
@@ -2179,7 +2200,7 @@ namespace pen
             VkDeviceMemory mem = _res_pool.get(buffer_index).buffer.get_mem();
 
             void* map_data;
-            vkMapMemory(_ctx.device, mem, 0, data_size, 0, &map_data);
+            vkMapMemory(_ctx.device, mem, offset, data_size, 0, &map_data);
             memcpy(map_data, data, (size_t)data_size);
             vkUnmapMemory(_ctx.device, mem);
         }
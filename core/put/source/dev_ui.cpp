@@ -61,6 +61,48 @@ namespace
     const u32      s_program_prefs_save_timeout = 60; //frames
     bool           s_enable_rendering = true;
     bool           s_initialised = false;
+    bool           s_renderer_stats_open = false;
+
+    // rolling history of pen::renderer_frame_stats for the renderer stats plots
+    const u32 k_renderer_stats_history = 256;
+
+    namespace e_renderer_stat
+    {
+        enum renderer_stat_t
+        {
+            commands,
+            draw_calls,
+            primitives,
+            state_changes,
+            cbuffer_kb,
+            cmd_buffer_kb,
+            pending_releases,
+            frame_latency_us,
+            frame_wait_us,
+            COUNT
+        };
+    }
+
+    const c8* k_renderer_stat_names[] = {"Commands",
+                                         "Draw Calls",
+                                         "Primitives",
+                                         "State Changes",
+                                         "CBuffer Upload (kb)",
+                                         "Cmd Buffer Peak (kb)",
+                                         "Pending Releases",
+                                         "Frame Latency (us)",
+                                         "Frame Wait (us)"};
+    static_assert(PEN_ARRAY_SIZE(k_renderer_stat_names) == e_renderer_stat::COUNT, "missing renderer stat name");
+
+    struct renderer_stats_history
+    {
+        f32 values[e_renderer_stat::COUNT][k_renderer_stats_history] = {};
+        u32 pos = 0;
+        u64 frame_index = -1;
+        u64 texture_bytes_created = 0;
+        u64 texture_bytes_released = 0;
+    };
+    renderer_stats_history s_renderer_stats;
 
     void create_texture_atlas()
     {
@@ -1395,6 +1437,93 @@ namespace put
             return s_console_open;
         }
 
+        void show_renderer_stats(bool val)
+        {
+            s_renderer_stats_open = val;
+        }
+
+        bool is_renderer_stats_open()
+        {
+            return s_renderer_stats_open;
+        }
+
+        void renderer_stats()
+        {
+            renderer_stats_history&   h = s_renderer_stats;
+            pen::renderer_frame_stats fs = pen::renderer_get_frame_stats();
+
+            // sample every frame so the history is populated when the window is opened
+            if (fs.frame_index != h.frame_index)
+            {
+                u32 num_cmds = 0;
+                for (u32 i = 0; i < pen::k_max_renderer_cmd_types; ++i)
+                    num_cmds += fs.cmd_count[i];
+
+                f32 sample[e_renderer_stat::COUNT];
+                sample[e_renderer_stat::commands] = (f32)num_cmds;
+                sample[e_renderer_stat::draw_calls] = (f32)fs.draw_calls;
+                sample[e_renderer_stat::primitives] = (f32)fs.primitives;
+                sample[e_renderer_stat::state_changes] = (f32)fs.state_changes;
+                sample[e_renderer_stat::cbuffer_kb] = (f32)fs.cbuffer_bytes / 1024.0f;
+                sample[e_renderer_stat::cmd_buffer_kb] = (f32)fs.cmd_buffer_peak_bytes / 1024.0f;
+                sample[e_renderer_stat::pending_releases] = (f32)fs.release_buffer_peak;
+                sample[e_renderer_stat::frame_latency_us] = fs.frame_latency_ms * 1000.0f;
+                sample[e_renderer_stat::frame_wait_us] = fs.frame_wait_ms * 1000.0f;
+
+                for (u32 i = 0; i < e_renderer_stat::COUNT; ++i)
+                    h.values[i][h.pos] = sample[i];
+
+                h.pos = (h.pos + 1) % k_renderer_stats_history;
+                h.frame_index = fs.frame_index;
+                h.texture_bytes_created += fs.texture_bytes_created;
+                h.texture_bytes_released += fs.texture_bytes_released;
+            }
+
+            if (!s_renderer_stats_open)
+                return;
+
+            ImGui::Begin("Renderer Stats", &s_renderer_stats_open, ImGuiWindowFlags_AlwaysAutoResize);
+
+            u32 last = (h.pos + k_renderer_stats_history - 1) % k_renderer_stats_history;
+            for (u32 i = 0; i < e_renderer_stat::COUNT; ++i)
+            {
+                f32 peak = 0.0f;
+                for (u32 j = 0; j < k_renderer_stats_history; ++j)
+                    peak = std::max<f32>(peak, h.values[i][j]);
+
+                Str overlay;
+                overlay.appendf("%s: %.0f (peak %.0f)", k_renderer_stat_names[i], h.values[i][last], peak);
+
+                ImGui::PushID(i);
+                ImGui::PlotLines("", &h.values[i][0], k_renderer_stats_history, h.pos, overlay.c_str(), 0.0f,
+                                 peak * 1.1f + 1.0f, ImVec2(512, 48));
+                ImGui::PopID();
+            }
+
+            s32 frames_in_flight = (s32)pen::renderer_get_frames_in_flight();
+            if (ImGui::SliderInt("Frames In Flight", &frames_in_flight, 1, pen::k_max_renderer_frames_in_flight))
+                pen::renderer_set_frames_in_flight((u32)frames_in_flight);
+
+            ImGui::Text("Instances: %u", fs.instances);
+            ImGui::Text("Cmd Buffer: %.1f / %.1f(kb)", (f32)fs.cmd_buffer_peak_bytes / 1024.0f,
+                        (f32)fs.cmd_buffer_capacity / 1024.0f);
+            ImGui::Text("Release Buffer: %u / %u", fs.release_buffer_peak, fs.release_buffer_capacity);
+            ImGui::Text("Texture Memory: %.2f(mb) created, %.2f(mb) released",
+                        (f64)h.texture_bytes_created / 1024.0 / 1024.0, (f64)h.texture_bytes_released / 1024.0 / 1024.0);
+
+            if (ImGui::CollapsingHeader("Commands"))
+            {
+                for (u32 i = 0; i < pen::k_max_renderer_cmd_types; ++i)
+                {
+                    const c8* name = pen::renderer_get_cmd_name(i);
+                    if (name && fs.cmd_count[i])
+                        ImGui::Text("%-28s %u", name, fs.cmd_count[i]);
+                }
+            }
+
+            ImGui::End();
+        }
+
         void log(const c8* fmt, ...)
         {
             va_list args;
@@ -1470,6 +1599,7 @@ namespace put
 
             // update console
             console();
+            renderer_stats();
 
             // perform program prefs save
             perform_save_program_prefs();
@@ -82,6 +82,11 @@ namespace put
         void log_level(u32 level, const c8* fmt, ...);
         void console();
 
+        // renderer stats, plots pen::renderer_get_frame_stats over time
+        bool is_renderer_stats_open();
+        void show_renderer_stats(bool val);
+        void renderer_stats();
+
         // imgui extensions
         bool      state_button(const c8* text, bool state_active);
         void      set_tooltip(const c8* fmt, ...);
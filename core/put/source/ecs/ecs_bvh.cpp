@@ -0,0 +1,584 @@
+// ecs_bvh.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_bvh.h"
+#include "ecs/ecs_cull.h"
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <float.h>
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            const u32 k_bins = 16;
+            const u32 k_median_depth = 96; // past this depth splits are at the median so the depth stays bounded
+            const u32 k_stack_size = 160;  // k_median_depth + log2 of the maximum entity count + 1
+
+            namespace e_overlap
+            {
+                enum overlap_t
+                {
+                    outside,
+                    intersect,
+                    inside
+                };
+            }
+
+            struct build_ref
+            {
+                vec3f min;
+                vec3f max;
+                vec3f centroid;
+                u32   entity;
+            };
+
+            struct traverse_entry
+            {
+                u32 node;
+                u32 contained; // the node is inside the query volume, the subtree is output without further tests
+            };
+
+            inline f32 axis_value(const vec3f& v, u32 axis)
+            {
+                return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+            }
+
+            inline f32 surface_area(const vec3f& min, const vec3f& max)
+            {
+                vec3f d = max - min;
+                return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+            }
+
+            inline bool same_bounds(const bvh_node& node, const vec3f& min, const vec3f& max)
+            {
+                return node.min.x == min.x && node.min.y == min.y && node.min.z == min.z && node.max.x == max.x &&
+                       node.max.y == max.y && node.max.z == max.z;
+            }
+
+            inline bool is_leaf(const bvh_node& node)
+            {
+                return node.right == PEN_INVALID_HANDLE;
+            }
+
+            u32 bin_index(const vec3f& centroid, u32 axis, f32 cmin, f32 inv_extent)
+            {
+                // clamped before the cast, which is undefined for nan and values outside the range of u32
+                f32 b = (axis_value(centroid, axis) - cmin) * inv_extent * (f32)k_bins;
+                if (!(b > 0.0f))
+                    return 0;
+
+                return b < (f32)(k_bins - 1) ? (u32)b : k_bins - 1;
+            }
+
+            // binned sah split along the longest centroid axis, falls back to the median if sah can not separate
+            u32 split_refs(build_ref* refs, u32 begin, u32 end, const vec3f& cmin, const vec3f& cmax, u32 depth)
+            {
+                vec3f ce = cmax - cmin;
+                u32   axis = ce.x > ce.y ? (ce.x > ce.z ? 0 : 2) : (ce.y > ce.z ? 1 : 2);
+                f32   extent = axis_value(ce, axis);
+                u32   mid = begin + (end - begin) / 2;
+
+                // every centroid is the same
+                if (extent <= 0.0f)
+                    return mid;
+
+                if (depth < k_median_depth)
+                {
+                    f32 amin = axis_value(cmin, axis);
+                    f32 inv_extent = 1.0f / extent;
+
+                    u32   bin_count[k_bins] = {0};
+                    vec3f bin_min[k_bins];
+                    vec3f bin_max[k_bins];
+                    for (u32 b = 0; b < k_bins; ++b)
+                    {
+                        bin_min[b] = vec3f::flt_max();
+                        bin_max[b] = -vec3f::flt_max();
+                    }
+
+                    for (u32 i = begin; i < end; ++i)
+                    {
+                        u32 b = bin_index(refs[i].centroid, axis, amin, inv_extent);
+                        bin_count[b]++;
+                        bin_min[b] = min_union(bin_min[b], refs[i].min);
+                        bin_max[b] = max_union(bin_max[b], refs[i].max);
+                    }
+
+                    // sweep from the right to get the cost of the right side of each split
+                    f32   right_cost[k_bins];
+                    u32   count = 0;
+                    vec3f rmin = vec3f::flt_max();
+                    vec3f rmax = -vec3f::flt_max();
+                    for (u32 b = k_bins - 1; b > 0; --b)
+                    {
+                        count += bin_count[b];
+                        rmin = min_union(rmin, bin_min[b]);
+                        rmax = max_union(rmax, bin_max[b]);
+                        right_cost[b] = count ? surface_area(rmin, rmax) * count : 0.0f;
+                    }
+
+                    f32   best_cost = FLT_MAX;
+                    u32   best_split = 0;
+                    u32   left_count = 0;
+                    vec3f lmin = vec3f::flt_max();
+                    vec3f lmax = -vec3f::flt_max();
+                    for (u32 b = 0; b < k_bins - 1; ++b)
+                    {
+                        left_count += bin_count[b];
+                        lmin = min_union(lmin, bin_min[b]);
+                        lmax = max_union(lmax, bin_max[b]);
+
+                        u32 right_count = (end - begin) - left_count;
+                        if (left_count == 0 || right_count == 0)
+                            continue;
+
+                        f32 cost = surface_area(lmin, lmax) * left_count + right_cost[b + 1];
+                        if (cost < best_cost)
+                        {
+                            best_cost = cost;
+                            best_split = b;
+                        }
+                    }
+
+                    if (best_cost < FLT_MAX)
+                    {
+                        build_ref* split = std::partition(refs + begin, refs + end, [&](const build_ref& r) {
+                            return bin_index(r.centroid, axis, amin, inv_extent) <= best_split;
+                        });
+
+                        u32 sah_mid = (u32)(split - refs);
+                        if (sah_mid > begin && sah_mid < end)
+                            return sah_mid;
+                    }
+                }
+
+                std::nth_element(refs + begin, refs + mid, refs + end, [axis](const build_ref& a, const build_ref& b) {
+                    return axis_value(a.centroid, axis) < axis_value(b.centroid, axis);
+                });
+
+                return mid;
+            }
+
+            u32 build_node(ecs_bvh* bvh, build_ref* refs, u32 begin, u32 end, u32 parent, u32 depth)
+            {
+                u32       ni = bvh->num_nodes++;
+                bvh_node& node = bvh->nodes[ni];
+
+                vec3f bmin = vec3f::flt_max();
+                vec3f bmax = -vec3f::flt_max();
+                vec3f cmin = vec3f::flt_max();
+                vec3f cmax = -vec3f::flt_max();
+                for (u32 i = begin; i < end; ++i)
+                {
+                    bmin = min_union(bmin, refs[i].min);
+                    bmax = max_union(bmax, refs[i].max);
+                    cmin = min_union(cmin, refs[i].centroid);
+                    cmax = max_union(cmax, refs[i].centroid);
+                }
+
+                node.min = bmin;
+                node.max = bmax;
+                node.parent = parent;
+
+                if (end - begin == 1)
+                {
+                    node.left = refs[begin].entity;
+                    node.right = PEN_INVALID_HANDLE;
+                    bvh->leaf_nodes[refs[begin].entity] = ni;
+                    return ni;
+                }
+
+                bvh->internal_area += surface_area(bmin, bmax);
+
+                u32 mid = split_refs(refs, begin, end, cmin, cmax, depth);
+
+                // nodes are allocated up front so the reference stays valid
+                node.left = build_node(bvh, refs, begin, mid, ni, depth + 1);
+                node.right = build_node(bvh, refs, mid, end, ni, depth + 1);
+
+                return ni;
+            }
+
+            template <typename T>
+            void query(const ecs_bvh* bvh, const T& overlap, u32** entities_out)
+            {
+                u32 num_unbounded = sb_count(bvh->unbounded);
+                for (u32 i = 0; i < num_unbounded; ++i)
+                    sb_push(*entities_out, bvh->unbounded[i]);
+
+                if (!is_valid(bvh->root))
+                    return;
+
+                traverse_entry stack[k_stack_size];
+                u32            sp = 0;
+                stack[sp++] = {bvh->root, 0};
+
+                while (sp)
+                {
+                    traverse_entry  entry = stack[--sp];
+                    const bvh_node& node = bvh->nodes[entry.node];
+
+                    u32 contained = entry.contained;
+                    if (!contained)
+                    {
+                        u32 o = overlap(node.min, node.max);
+                        if (o == e_overlap::outside)
+                            continue;
+
+                        contained = o == e_overlap::inside;
+                    }
+
+                    if (is_leaf(node))
+                    {
+                        sb_push(*entities_out, node.left);
+                        continue;
+                    }
+
+                    PEN_ASSERT(sp + 2 <= k_stack_size);
+                    stack[sp++] = {node.right, contained};
+                    stack[sp++] = {node.left, contained};
+                }
+            }
+
+            struct frustum_plane
+            {
+                vec3f n;
+                vec3f sign_flip;
+                f32   pd_neg;
+            };
+
+            void get_frustum_planes(const frustum& frust, frustum_plane* planes)
+            {
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    planes[p].n = frust.n[p];
+                    planes[p].sign_flip = sgn(frust.n[p]) * -1.0f;
+                    planes[p].pd_neg = -maths::plane_distance(frust.p[p], frust.n[p]);
+                }
+            }
+
+            // same test as frustum_cull_aabb_scalar, with the far corner as well to find boxes fully inside
+            u32 overlap_frustum(const vec3f& min, const vec3f& max, const frustum_plane* planes)
+            {
+                vec3f pos = min + (max - min) * 0.5f;
+                vec3f extent = max - pos;
+
+                u32 result = e_overlap::inside;
+                for (s32 p = 0; p < 6; ++p)
+                {
+                    vec3f ext = extent * planes[p].sign_flip;
+
+                    if (dot(pos + ext, planes[p].n) > planes[p].pd_neg)
+                        return e_overlap::outside;
+
+                    if (dot(pos - ext, planes[p].n) > planes[p].pd_neg)
+                        result = e_overlap::intersect;
+                }
+
+                return result;
+            }
+        } // namespace
+
+        bool bvh_bounded(const extents& bounds)
+        {
+            // comparisons with nan are false, so non finite extents are unbounded as well
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                f32 min = axis_value(bounds.min, axis);
+                f32 max = axis_value(bounds.max, axis);
+                if (!(min >= -k_bvh_max_extent && max <= k_bvh_max_extent && min <= max))
+                    return false;
+            }
+
+            return true;
+        }
+
+        void bvh_build(ecs_bvh* bvh, const extents* bounds, const u32* entities, u32 count)
+        {
+            bvh->num_builds++;
+            bvh->num_nodes = 0;
+            bvh->root = PEN_INVALID_HANDLE;
+            bvh->internal_area = 0.0f;
+            bvh->build_cost = 0.0f;
+            sb_clear(bvh->unbounded);
+
+            u32 max_entity = 0;
+            for (u32 i = 0; i < count; ++i)
+                max_entity = std::max<u32>(max_entity, entities[i] + 1);
+
+            if (max_entity > bvh->leaf_nodes_capacity)
+            {
+                bvh->leaf_nodes_capacity = max_entity;
+                bvh->leaf_nodes = (u32*)pen::memory_realloc(bvh->leaf_nodes, sizeof(u32) * max_entity);
+            }
+
+            if (bvh->leaf_nodes)
+                memset(bvh->leaf_nodes, 0xff, sizeof(u32) * bvh->leaf_nodes_capacity);
+
+            if (count == 0)
+                return;
+
+            // unbounded entities would make the centroids and surface areas inf or nan
+            build_ref* refs = (build_ref*)pen::memory_alloc(sizeof(build_ref) * count);
+            u32        num_refs = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                const extents& e = bounds[entities[i]];
+                if (!bvh_bounded(e))
+                {
+                    sb_push(bvh->unbounded, entities[i]);
+                    continue;
+                }
+
+                build_ref& r = refs[num_refs++];
+                r.min = e.min;
+                r.max = e.max;
+                r.centroid = (e.min + e.max) * 0.5f;
+                r.entity = entities[i];
+            }
+
+            if (num_refs == 0)
+            {
+                pen::memory_free(refs);
+                return;
+            }
+
+            u32 num_nodes = num_refs * 2 - 1;
+            if (num_nodes > bvh->nodes_capacity)
+            {
+                bvh->nodes_capacity = num_nodes;
+                bvh->nodes = (bvh_node*)pen::memory_realloc(bvh->nodes, sizeof(bvh_node) * num_nodes);
+            }
+
+            bvh->root = build_node(bvh, refs, 0, num_refs, PEN_INVALID_HANDLE, 0);
+            bvh->build_cost = bvh_cost(bvh);
+
+            pen::memory_free(refs);
+        }
+
+        bool bvh_refit(ecs_bvh* bvh, const extents* bounds, const u32* entities, u32 count)
+        {
+            bvh->num_refits++;
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32  e = entities[i];
+                bool in_tree = e < bvh->leaf_nodes_capacity && is_valid(bvh->leaf_nodes[e]);
+                bool bounded = bvh_bounded(bounds[e]);
+
+                // entities that stay unbounded remain in the unbounded list, a change either way needs a rebuild
+                if (!in_tree && !bounded)
+                    continue;
+
+                if (!in_tree || !bounded)
+                    return false;
+
+                bvh_node& leaf = bvh->nodes[bvh->leaf_nodes[e]];
+                leaf.min = bounds[e].min;
+                leaf.max = bounds[e].max;
+
+                // ancestors above an unchanged node are already correct
+                u32 p = leaf.parent;
+                while (is_valid(p))
+                {
+                    bvh_node& node = bvh->nodes[p];
+
+                    vec3f nmin = min_union(bvh->nodes[node.left].min, bvh->nodes[node.right].min);
+                    vec3f nmax = max_union(bvh->nodes[node.left].max, bvh->nodes[node.right].max);
+                    if (same_bounds(node, nmin, nmax))
+                        break;
+
+                    bvh->internal_area += surface_area(nmin, nmax) - surface_area(node.min, node.max);
+                    node.min = nmin;
+                    node.max = nmax;
+
+                    p = node.parent;
+                }
+            }
+
+            return true;
+        }
+
+        f32 bvh_cost(const ecs_bvh* bvh)
+        {
+            if (!is_valid(bvh->root))
+                return 0.0f;
+
+            const bvh_node& root = bvh->nodes[bvh->root];
+            f32             root_area = surface_area(root.min, root.max);
+            if (root_area <= 0.0f)
+                return 0.0f;
+
+            return bvh->internal_area / root_area;
+        }
+
+        bool bvh_needs_rebuild(const ecs_bvh* bvh)
+        {
+            return bvh_cost(bvh) > bvh->build_cost * k_bvh_rebuild_ratio;
+        }
+
+        void bvh_destroy(ecs_bvh* bvh)
+        {
+            pen::memory_free(bvh->nodes);
+            pen::memory_free(bvh->leaf_nodes);
+            sb_free(bvh->unbounded);
+            *bvh = ecs_bvh();
+        }
+
+        void bvh_query_frustum(const ecs_bvh* bvh, const frustum& frust, u32** entities_out)
+        {
+            frustum_plane planes[6];
+            get_frustum_planes(frust, planes);
+
+            query(bvh, [&planes](const vec3f& min, const vec3f& max) { return overlap_frustum(min, max, planes); },
+                  entities_out);
+        }
+
+        void bvh_query_aabb(const ecs_bvh* bvh, const vec3f& min, const vec3f& max, u32** entities_out)
+        {
+            query(bvh,
+                  [&min, &max](const vec3f& nmin, const vec3f& nmax) -> u32 {
+                      if (nmin.x > max.x || nmin.y > max.y || nmin.z > max.z)
+                          return e_overlap::outside;
+
+                      if (nmax.x < min.x || nmax.y < min.y || nmax.z < min.z)
+                          return e_overlap::outside;
+
+                      if (nmin.x >= min.x && nmin.y >= min.y && nmin.z >= min.z && nmax.x <= max.x && nmax.y <= max.y &&
+                          nmax.z <= max.z)
+                          return e_overlap::inside;
+
+                      return e_overlap::intersect;
+                  },
+                  entities_out);
+        }
+
+        void bvh_query_sphere(const ecs_bvh* bvh, const vec3f& pos, f32 radius, u32** entities_out)
+        {
+            f32 r2 = radius * radius;
+
+            query(bvh,
+                  [&pos, r2](const vec3f& nmin, const vec3f& nmax) -> u32 {
+                      // closest point in the box to the sphere centre
+                      vec3f cp = max_union(nmin, min_union(pos, nmax));
+                      if (mag2(cp - pos) > r2)
+                          return e_overlap::outside;
+
+                      // furthest corner from the sphere centre
+                      vec3f d = max_union(pos - nmin, nmax - pos);
+                      if (mag2(d) <= r2)
+                          return e_overlap::inside;
+
+                      return e_overlap::intersect;
+                  },
+                  entities_out);
+        }
+
+        void bvh_query_ray(const ecs_bvh* bvh, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out)
+        {
+            vec3f inv_dir = vec3f(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+
+            query(bvh,
+                  [&origin, &inv_dir, max_t](const vec3f& nmin, const vec3f& nmax) -> u32 {
+                      // slab test
+                      vec3f t0 = (nmin - origin) * inv_dir;
+                      vec3f t1 = (nmax - origin) * inv_dir;
+
+                      vec3f tmin = min_union(t0, t1);
+                      vec3f tmax = max_union(t0, t1);
+
+                      f32 enter = std::max<f32>(std::max<f32>(tmin.x, tmin.y), std::max<f32>(tmin.z, 0.0f));
+                      f32 exit = std::min<f32>(std::min<f32>(tmax.x, tmax.y), std::min<f32>(tmax.z, max_t));
+
+                      return enter <= exit ? e_overlap::intersect : e_overlap::outside;
+                  },
+                  entities_out);
+        }
+
+        void bvh_query_frustums(const ecs_bvh* bvh, const frustum* frustums, u32 num_frustums, u32** entities_out,
+                                u64** masks_out)
+        {
+            PEN_ASSERT(num_frustums <= k_max_cull_frustums);
+
+            if (num_frustums == 0)
+                return;
+
+            u64 all = num_frustums == 64 ? ~0ull : (1ull << num_frustums) - 1;
+
+            u32 num_unbounded = sb_count(bvh->unbounded);
+            for (u32 i = 0; i < num_unbounded; ++i)
+            {
+                sb_push(*entities_out, bvh->unbounded[i]);
+                sb_push(*masks_out, all);
+            }
+
+            if (!is_valid(bvh->root))
+                return;
+
+            frustum_plane planes[k_max_cull_frustums][6];
+            for (u32 f = 0; f < num_frustums; ++f)
+                get_frustum_planes(frustums[f], planes[f]);
+
+            struct frustums_entry
+            {
+                u32 node;
+                u64 partial; // frustums the node intersects, children are tested against these
+                u64 inside;  // frustums the node is fully inside
+            };
+
+            frustums_entry stack[k_stack_size];
+            u32            sp = 0;
+
+            stack[sp++] = {bvh->root, all, 0};
+
+            while (sp)
+            {
+                frustums_entry  entry = stack[--sp];
+                const bvh_node& node = bvh->nodes[entry.node];
+                bool            leaf = is_leaf(node);
+
+                u64 partial = entry.partial;
+                u64 inside = entry.inside;
+                for (u32 f = 0; f < num_frustums; ++f)
+                {
+                    u64 bit = 1ull << f;
+                    if (!(partial & bit))
+                        continue;
+
+                    u32 o = overlap_frustum(node.min, node.max, planes[f]);
+                    if (o == e_overlap::outside)
+                    {
+                        partial &= ~bit;
+                    }
+                    else if (o == e_overlap::inside || leaf)
+                    {
+                        partial &= ~bit;
+                        inside |= bit;
+                    }
+                }
+
+                if (!(partial | inside))
+                    continue;
+
+                if (leaf)
+                {
+                    sb_push(*entities_out, node.left);
+                    sb_push(*masks_out, inside);
+                    continue;
+                }
+
+                PEN_ASSERT(sp + 2 <= k_stack_size);
+                stack[sp++] = {node.right, partial, inside};
+                stack[sp++] = {node.left, partial, inside};
+            }
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,61 @@
+// ecs_bvh.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Dynamic bounding volume hierarchy over entity world space extents, built with binned sah and refit in place.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct bvh_node
+        {
+            vec3f min;
+            vec3f max;
+            u32   parent;
+            u32   left;  // entity index for leaves
+            u32   right; // PEN_INVALID_HANDLE for leaves
+        };
+
+        struct ecs_bvh
+        {
+            bvh_node* nodes = nullptr;
+            u32       num_nodes = 0;
+            u32       nodes_capacity = 0;
+            u32       root = PEN_INVALID_HANDLE;
+            u32*      leaf_nodes = nullptr; // leaf of each entity index, PEN_INVALID_HANDLE if the entity is not in the tree
+            u32       leaf_nodes_capacity = 0;
+            u32*      unbounded = nullptr; // entities with infinite or non finite extents, output by every query
+            f32       internal_area = 0.0f; // sum of internal node surface areas, kept current by refits
+            f32       build_cost = 0.0f;    // internal_area / root area after the last build
+            u32       num_builds = 0;
+            u32       num_refits = 0;
+        };
+
+        static const f32 k_bvh_rebuild_ratio = 1.5f; // rebuild once the sah cost has grown this much since the build
+        static const f32 k_bvh_max_extent = 1e15f;   // extents past this are unbounded, surface areas stay finite
+
+        void bvh_build(ecs_bvh* bvh, const extents* bounds, const u32* entities, u32 count);
+        bool bvh_refit(ecs_bvh* bvh, const extents* bounds, const u32* entities, u32 count); // false if not in the tree
+        bool bvh_bounded(const extents& bounds);
+        bool bvh_needs_rebuild(const ecs_bvh* bvh);
+        f32  bvh_cost(const ecs_bvh* bvh);
+        void bvh_destroy(ecs_bvh* bvh);
+
+        // queries push every unbounded entity and the entities of every leaf that overlaps the volume
+        void bvh_query_frustum(const ecs_bvh* bvh, const frustum& frust, u32** entities_out);
+        void bvh_query_aabb(const ecs_bvh* bvh, const vec3f& min, const vec3f& max, u32** entities_out);
+        void bvh_query_sphere(const ecs_bvh* bvh, const vec3f& pos, f32 radius, u32** entities_out);
+        void bvh_query_ray(const ecs_bvh* bvh, const vec3f& origin, const vec3f& dir, f32 max_t, u32** entities_out);
+
+        // tests all frustums in one traversal, subtrees fully inside or outside a frustum are not tested against it again.
+        // bit f of masks_out[i] is set if entities_out[i] is inside frustums[f], only entities inside one or more are output
+        // and unbounded entities have every bit set
+        void bvh_query_frustums(const ecs_bvh* bvh, const frustum* frustums, u32 num_frustums, u32** entities_out,
+                                u64** masks_out);
+    } // namespace ecs
+} // namespace put
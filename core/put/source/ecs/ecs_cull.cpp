@@ -1,13 +1,22 @@
 #include "ecs_cull.h"
 
+#include "ecs_query.h"
 #include "ecs_scene.h"
+#include "ecs_transform.h"
+#include "console.h"
 #include "timer.h"
 
+#include <algorithm>
+
 #if __SSE2__ || __AVX2__ || __AVX__
 #include <immintrin.h>
 #include <xmmintrin.h>
 #endif
 
+#if _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace ::pen;
 
 namespace put
@@ -81,24 +90,28 @@ namespace put
             }
         }
 
-        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        bool filter_entity_scalar(const ecs_scene* scene, u32 e)
         {
             u32 accept_entities = e_cmp::geometry | e_cmp::material;
             u32 reject_entities = e_cmp::sub_instance;
 
-            for (u32 i = 0; i < scene->num_entities; ++i)
-            {
-                // entity flags accept
-                if ((scene->entities[i] & accept_entities) != accept_entities)
-                    continue;
+            // entity flags accept
+            if ((scene->entities[e] & accept_entities) != accept_entities)
+                return false;
 
-                // entity flags reject
-                if (reject_entities)
-                    if (scene->entities[i] & reject_entities)
-                        continue;
+            // entity flags reject
+            if (reject_entities)
+                if (scene->entities[e] & reject_entities)
+                    return false;
 
-                sb_push(*entities_out, i);
-            }
+            return true;
+        }
+
+        void filter_entities_scalar(const ecs_scene* scene, u32** entities_out)
+        {
+            for (u32 i = 0; i < scene->num_entities; ++i)
+                if (filter_entity_scalar(scene, i))
+                    sb_push(*entities_out, i);
         }
 
         //
@@ -109,11 +122,10 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            // the last group repeats its final entity in unused lanes, only valid lanes are output
+            u32 n = sb_count(entities_in);
+            if (n == 0)
+                return;
 
             // sphere radius and position
             __m128 posx;
@@ -137,7 +149,6 @@ namespace put
             __m128 sfy[6];
             __m128 sfz[6];
 
-            f32 result[4];
             u32 e[4];
 
             // load camera planes
@@ -155,12 +166,11 @@ namespace put
                 sfz[p] = _mm_set1_ps(sgn(frust.n[p].z) * -1.0f);
             }
 
-            u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 4)
             {
                 // unpack entities
                 for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[std::min<u32>(i + j, n - 1)];
 
                 auto& p0 = scene->pos_extent[e[0]].pos;
                 auto& p1 = scene->pos_extent[e[1]].pos;
@@ -179,7 +189,7 @@ namespace put
                 exty = _mm_set_ps(e0.y, e1.y, e2.y, e3.y);
                 extz = _mm_set_ps(e0.z, e1.z, e2.z, e3.z);
 
-                __m128 inside = _mm_set1_ps(0.0f);
+                __m128 outside = _mm_setzero_ps();
 
                 for (s32 p = 0; p < 6; ++p)
                 {
@@ -200,14 +210,16 @@ namespace put
                     r = _mm_fmadd_ps(dpz, pnz[p], r);
 
                     // if(r > -pd) inside = false
-                    __m128 ge = _mm_cmpge_ps(r, pd_neg[p]);
-                    inside = _mm_add_ps(ge, inside);
+                    __m128 gt = _mm_cmpgt_ps(r, pd_neg[p]);
+                    outside = _mm_or_ps(gt, outside);
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                // lanes are set in reverse, e[j] is in lane 3 - j
+                u32 mask = (u32)_mm_movemask_ps(outside);
+                u32 lanes = std::min<u32>(n - i, 4);
+                for (u32 j = 0; j < lanes; ++j)
+                    if (!(mask & (1 << (3 - j))))
+                        sb_push(*entities_out, e[j]);
             }
         }
 
@@ -215,11 +227,10 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 4
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 4);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            // the last group repeats its final entity in unused lanes, only valid lanes are output
+            u32 n = sb_count(entities_in);
+            if (n == 0)
+                return;
 
             // sphere radius and position
             __m128 radius;
@@ -235,7 +246,6 @@ namespace put
             // plane distance
             __m128 pd[6];
 
-            f32 result[4];
             u32 e[4];
 
             // load camera planes
@@ -248,12 +258,11 @@ namespace put
                 pd[p] = _mm_set1_ps(ppd);
             }
 
-            u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 4)
             {
                 // unpack entities
                 for (u32 j = 0; j < 4; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[std::min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -271,7 +280,7 @@ namespace put
                 posy = _mm_set_ps(p0.y, p1.y, p2.y, p3.y);
                 posz = _mm_set_ps(p0.z, p1.z, p2.z, p3.z);
 
-                __m128 inside = _mm_set1_ps(0.0f);
+                __m128 outside = _mm_setzero_ps();
 
                 for (s32 p = 0; p < 6; ++p)
                 {
@@ -282,14 +291,16 @@ namespace put
                     dd = _mm_fmadd_ps(posz, pnz[p], dd);
 
                     // compare if dd is greater than radius, if so we are outside
-                    __m128 ge = _mm_cmpge_ps(dd, radius);
-                    inside = _mm_add_ps(ge, inside);
+                    __m128 gt = _mm_cmpgt_ps(dd, radius);
+                    outside = _mm_or_ps(gt, outside);
                 }
 
-                _mm_store_ps(result, inside);
-                for (u32 j = 0; j < 4; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[3 - j]);
+                // lanes are set in reverse, e[j] is in lane 3 - j
+                u32 mask = (u32)_mm_movemask_ps(outside);
+                u32 lanes = std::min<u32>(n - i, 4);
+                for (u32 j = 0; j < lanes; ++j)
+                    if (!(mask & (1 << (3 - j))))
+                        sb_push(*entities_out, e[j]);
             }
         }
 #endif
@@ -302,11 +313,10 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            // the last group repeats its final entity in unused lanes, only valid lanes are output
+            u32 n = sb_count(entities_in);
+            if (n == 0)
+                return;
 
             // splat constants
             __m256 zero = _mm256_set1_ps(0.0f);
@@ -325,7 +335,6 @@ namespace put
             // plane distance
             __m256 pd[6];
 
-            f32 result[8];
             u32 e[8];
 
             // load camera planes
@@ -338,12 +347,11 @@ namespace put
                 pd[p] = _mm256_set1_ps(ppd);
             }
 
-            u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 8)
             {
                 // unpack entities
                 for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[std::min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -384,10 +392,12 @@ namespace put
                     inside = _mm256_add_ps(diff, inside);
                 }
 
-                _mm256_store_ps(result, inside);
-                for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                // lanes are set in reverse, e[j] is in lane 7 - j
+                u32 mask = (u32)_mm256_movemask_ps(_mm256_cmp_ps(inside, zero, _CMP_GT_OQ));
+                u32 lanes = std::min<u32>(n - i, 8);
+                for (u32 j = 0; j < lanes; ++j)
+                    if (!(mask & (1 << (7 - j))))
+                        sb_push(*entities_out, e[j]);
             }
         }
 
@@ -395,11 +405,10 @@ namespace put
         {
             const frustum& frust = cam->camera_frustum;
 
-            // pad to 8
-            u32 xn = sb_count(entities_in);
-            u32 yn = PEN_ALIGN(xn, 8);
-            for (u32 i = 0; i < yn - xn; ++i)
-                sb_push(entities_in, entities_in[0]);
+            // the last group repeats its final entity in unused lanes, only valid lanes are output
+            u32 n = sb_count(entities_in);
+            if (n == 0)
+                return;
 
             // splat constants
             __m256 zero = _mm256_set1_ps(0.0f);
@@ -426,7 +435,6 @@ namespace put
             __m256 pd[6];
             __m256 pd_neg[6];
 
-            f32 result[8];
             u32 e[8];
 
             // load camera planes
@@ -444,13 +452,11 @@ namespace put
                 sfz[p] = _mm256_set1_ps(sgn(frust.n[p].z) * -1.0f);
             }
 
-            // n is number of entities + padding for alignment
-            u32 n = sb_count(entities_in);
             for (u32 i = 0; i < n; i += 8)
             {
                 // unpack entities
                 for (u32 j = 0; j < 8; ++j)
-                    e[j] = entities_in[i + j];
+                    e[j] = entities_in[std::min<u32>(i + j, n - 1)];
 
                 // load entities values
                 auto& p0 = scene->pos_extent[e[0]].pos;
@@ -503,13 +509,218 @@ namespace put
                     inside = _mm256_add_ps(diff, inside);
                 }
 
-                _mm256_store_ps(result, inside);
+                // lanes are set in reverse, e[j] is in lane 7 - j
+                u32 mask = (u32)_mm256_movemask_ps(_mm256_cmp_ps(inside, zero, _CMP_GT_OQ));
+                u32 lanes = std::min<u32>(n - i, 8);
+                for (u32 j = 0; j < lanes; ++j)
+                    if (!(mask & (1 << (7 - j))))
+                        sb_push(*entities_out, e[j]);
+            }
+        }
+#endif
+        //
+        // all views in one pass, each frustum sets one bit of the entity visibility mask
+        //
+
+        namespace
+        {
+            struct cull_plane
+            {
+                vec3f n;
+                vec3f sign_flip;
+                f32   pd_neg;
+            };
+
+            void get_cull_planes(const frustum* frustums, u32 num_frustums, cull_plane (*planes)[6])
+            {
+                for (u32 f = 0; f < num_frustums; ++f)
+                {
+                    for (s32 p = 0; p < 6; ++p)
+                    {
+                        const frustum& frust = frustums[f];
+                        planes[f][p].n = frust.n[p];
+                        planes[f][p].sign_flip = sgn(frust.n[p]) * -1.0f;
+                        planes[f][p].pd_neg = -maths::plane_distance(frust.p[p], frust.n[p]);
+                    }
+                }
+            }
+        } // namespace
+
+        void frustum_cull_views_aabb_scalar(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                            const u32* entities, u32 count, u64* masks_out)
+        {
+            PEN_ASSERT(num_frustums <= k_max_cull_frustums);
+
+            cull_plane planes[k_max_cull_frustums][6];
+            get_cull_planes(frustums, num_frustums, planes);
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 e = entities[i];
+
+                vec3f pos = scene->pos_extent[e].pos.xyz;
+                vec3f extent = scene->pos_extent[e].extent.xyz;
+
+                u64 mask = 0;
+                for (u32 f = 0; f < num_frustums; ++f)
+                {
+                    bool inside = true;
+                    for (s32 p = 0; p < 6; ++p)
+                    {
+                        f32 d2 = dot(pos + extent * planes[f][p].sign_flip, planes[f][p].n);
+                        if (d2 > planes[f][p].pd_neg)
+                        {
+                            inside = false;
+                            break;
+                        }
+                    }
+
+                    if (inside)
+                        mask |= 1ull << f;
+                }
+
+                masks_out[i] = mask;
+            }
+        }
+
+#if __SSE4_1__ || __AVX__
+        void frustum_cull_views_aabb_simd128(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                             const u32* entities, u32 count, u64* masks_out)
+        {
+            PEN_ASSERT(num_frustums <= k_max_cull_frustums);
+
+            cull_plane planes[k_max_cull_frustums][6];
+            get_cull_planes(frustums, num_frustums, planes);
+
+            alignas(16) f32 soa[6][4];
+
+            for (u32 i = 0; i < count; i += 4)
+            {
+                // the last group repeats its final entity in unused lanes
+                for (u32 j = 0; j < 4; ++j)
+                {
+                    const cmp_pos_extent& pe = scene->pos_extent[entities[std::min<u32>(i + j, count - 1)]];
+                    soa[0][j] = pe.pos.x;
+                    soa[1][j] = pe.pos.y;
+                    soa[2][j] = pe.pos.z;
+                    soa[3][j] = pe.extent.x;
+                    soa[4][j] = pe.extent.y;
+                    soa[5][j] = pe.extent.z;
+                }
+
+                __m128 posx = _mm_load_ps(soa[0]);
+                __m128 posy = _mm_load_ps(soa[1]);
+                __m128 posz = _mm_load_ps(soa[2]);
+                __m128 extx = _mm_load_ps(soa[3]);
+                __m128 exty = _mm_load_ps(soa[4]);
+                __m128 extz = _mm_load_ps(soa[5]);
+
+                u64 lane_masks[4] = {0};
+
+                for (u32 f = 0; f < num_frustums; ++f)
+                {
+                    __m128 outside = _mm_setzero_ps();
+
+                    for (s32 p = 0; p < 6; ++p)
+                    {
+                        const cull_plane& cp = planes[f][p];
+
+                        // pos + extent * sign_flip
+                        __m128 dpx = _mm_add_ps(_mm_mul_ps(extx, _mm_set1_ps(cp.sign_flip.x)), posx);
+                        __m128 dpy = _mm_add_ps(_mm_mul_ps(exty, _mm_set1_ps(cp.sign_flip.y)), posy);
+                        __m128 dpz = _mm_add_ps(_mm_mul_ps(extz, _mm_set1_ps(cp.sign_flip.z)), posz);
+
+                        // dot(pos + extent * sign_flip, frust.n[p]);
+                        __m128 r = _mm_mul_ps(dpx, _mm_set1_ps(cp.n.x));
+                        r = _mm_add_ps(_mm_mul_ps(dpy, _mm_set1_ps(cp.n.y)), r);
+                        r = _mm_add_ps(_mm_mul_ps(dpz, _mm_set1_ps(cp.n.z)), r);
+
+                        // if(r > -pd) inside = false
+                        outside = _mm_or_ps(_mm_cmpgt_ps(r, _mm_set1_ps(cp.pd_neg)), outside);
+                    }
+
+                    u32 inside = ~(u32)_mm_movemask_ps(outside) & 0xf;
+                    for (u32 j = 0; j < 4; ++j)
+                        if (inside & (1 << j))
+                            lane_masks[j] |= 1ull << f;
+                }
+
+                u32 lanes = std::min<u32>(count - i, 4);
+                for (u32 j = 0; j < lanes; ++j)
+                    masks_out[i + j] = lane_masks[j];
+            }
+        }
+#endif
+
+#if __AVX2__
+        void frustum_cull_views_aabb_simd256(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                             const u32* entities, u32 count, u64* masks_out)
+        {
+            PEN_ASSERT(num_frustums <= k_max_cull_frustums);
+
+            cull_plane planes[k_max_cull_frustums][6];
+            get_cull_planes(frustums, num_frustums, planes);
+
+            alignas(32) f32 soa[6][8];
+
+            for (u32 i = 0; i < count; i += 8)
+            {
+                // the last group repeats its final entity in unused lanes
                 for (u32 j = 0; j < 8; ++j)
-                    if (!result[j])
-                        sb_push(*entities_out, e[7 - j]);
+                {
+                    const cmp_pos_extent& pe = scene->pos_extent[entities[std::min<u32>(i + j, count - 1)]];
+                    soa[0][j] = pe.pos.x;
+                    soa[1][j] = pe.pos.y;
+                    soa[2][j] = pe.pos.z;
+                    soa[3][j] = pe.extent.x;
+                    soa[4][j] = pe.extent.y;
+                    soa[5][j] = pe.extent.z;
+                }
+
+                __m256 posx = _mm256_load_ps(soa[0]);
+                __m256 posy = _mm256_load_ps(soa[1]);
+                __m256 posz = _mm256_load_ps(soa[2]);
+                __m256 extx = _mm256_load_ps(soa[3]);
+                __m256 exty = _mm256_load_ps(soa[4]);
+                __m256 extz = _mm256_load_ps(soa[5]);
+
+                u64 lane_masks[8] = {0};
+
+                for (u32 f = 0; f < num_frustums; ++f)
+                {
+                    __m256 outside = _mm256_setzero_ps();
+
+                    for (s32 p = 0; p < 6; ++p)
+                    {
+                        const cull_plane& cp = planes[f][p];
+
+                        // pos + extent * sign_flip
+                        __m256 dpx = _mm256_fmadd_ps(extx, _mm256_set1_ps(cp.sign_flip.x), posx);
+                        __m256 dpy = _mm256_fmadd_ps(exty, _mm256_set1_ps(cp.sign_flip.y), posy);
+                        __m256 dpz = _mm256_fmadd_ps(extz, _mm256_set1_ps(cp.sign_flip.z), posz);
+
+                        // dot(pos + extent * sign_flip, frust.n[p]);
+                        __m256 r = _mm256_mul_ps(dpx, _mm256_set1_ps(cp.n.x));
+                        r = _mm256_fmadd_ps(dpy, _mm256_set1_ps(cp.n.y), r);
+                        r = _mm256_fmadd_ps(dpz, _mm256_set1_ps(cp.n.z), r);
+
+                        // if(r > -pd) inside = false
+                        outside = _mm256_or_ps(_mm256_cmp_ps(r, _mm256_set1_ps(cp.pd_neg), _CMP_GT_OQ), outside);
+                    }
+
+                    u32 inside = ~(u32)_mm256_movemask_ps(outside) & 0xff;
+                    for (u32 j = 0; j < 8; ++j)
+                        if (inside & (1 << j))
+                            lane_masks[j] |= 1ull << f;
+                }
+
+                u32 lanes = std::min<u32>(count - i, 8);
+                for (u32 j = 0; j < lanes; ++j)
+                    masks_out[i + j] = lane_masks[j];
             }
         }
 #endif
+
         //
         // Arm neon simd 128 implementation
         //
@@ -523,20 +734,114 @@ namespace put
         {
         }
 #endif
-        void frustum_cull_simd_init()
+        typedef void (*frustum_cull_func)(const ecs_scene*, const camera*, u32*, u32**);
+        typedef void (*frustum_cull_views_func)(const ecs_scene*, const frustum*, u32, const u32*, u32, u64*);
+
+        static frustum_cull_func       s_frustum_cull_aabb = frustum_cull_aabb_scalar;
+        static frustum_cull_func       s_frustum_cull_sphere = frustum_cull_sphere_scalar;
+        static frustum_cull_views_func s_frustum_cull_views_aabb = frustum_cull_views_aabb_scalar;
+
+        void frustum_cull_simd_init(simd_t simd_level)
+        {
+            s_frustum_cull_aabb = frustum_cull_aabb_scalar;
+            s_frustum_cull_sphere = frustum_cull_sphere_scalar;
+            s_frustum_cull_views_aabb = frustum_cull_views_aabb_scalar;
+
+#if __SSE4_1__ || __AVX__
+            if (simd_level >= e_simd::sse4)
+                s_frustum_cull_views_aabb = frustum_cull_views_aabb_simd128;
+#endif
+#if __AVX2__
+            // the single view 128 bit versions use fma so avx2 level is required for simd single view culling
+            if (simd_level >= e_simd::avx2)
+            {
+                s_frustum_cull_aabb = frustum_cull_aabb_simd256;
+                s_frustum_cull_sphere = frustum_cull_sphere_simd256;
+                s_frustum_cull_views_aabb = frustum_cull_views_aabb_simd256;
+            }
+#endif
+        }
+
+        //
+        // cpu detection
+        //
+
+        namespace
+        {
+            simd_t s_simd_level = e_simd::none;
+
+            simd_t detect_simd_level()
+            {
+#if _MSC_VER && (_M_X64 || _M_IX86)
+                int info[4];
+                __cpuid(info, 0);
+                int max_leaf = info[0];
+
+                __cpuid(info, 1);
+                bool sse41 = (info[2] & (1 << 19)) != 0;
+                bool fma = (info[2] & (1 << 12)) != 0;
+                bool osxsave = (info[2] & (1 << 27)) != 0;
+                bool avx = (info[2] & (1 << 28)) != 0;
+
+                bool avx2 = false;
+                if (max_leaf >= 7)
+                {
+                    __cpuidex(info, 7, 0);
+                    avx2 = (info[1] & (1 << 5)) != 0;
+                }
+
+                // os must save the ymm registers on context switch
+                bool ymm = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+
+                if (avx2 && fma && ymm)
+                    return e_simd::avx2;
+
+                if (sse41)
+                    return e_simd::sse4;
+#elif (__GNUC__ || __clang__) && (__x86_64__ || __i386__)
+                __builtin_cpu_init();
+
+                if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                    return e_simd::avx2;
+
+                if (__builtin_cpu_supports("sse4.1"))
+                    return e_simd::sse4;
+#endif
+                return e_simd::none;
+            }
+        } // namespace
+
+        void simd_init()
         {
+            static const c8* k_simd_names[] = {"none", "sse4", "avx2"};
+
+            s_simd_level = detect_simd_level();
+            PEN_LOG("[ecs] simd: %s", k_simd_names[s_simd_level]);
+
+            frustum_cull_simd_init(s_simd_level);
+            transform_simd_init(s_simd_level);
+            query_simd_init(s_simd_level);
+        }
+
+        simd_t simd_get_level()
+        {
+            return s_simd_level;
         }
 
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_aabb_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_aabb_simd256(scene, cam, entities_in, entities_out);
+            s_frustum_cull_aabb(scene, cam, entities_in, entities_out);
         }
 
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out)
         {
-            frustum_cull_sphere_scalar(scene, cam, entities_in, entities_out);
-            //frustum_cull_sphere_simd256(scene, cam, entities_in, entities_out);
+            s_frustum_cull_sphere(scene, cam, entities_in, entities_out);
+        }
+
+        void frustum_cull_views_aabb(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                     const u32* entities, u32 count, u64* masks_out)
+        {
+            s_frustum_cull_views_aabb(scene, frustums, num_frustums, entities, count, masks_out);
         }
 
         void debug_culling()
@@ -1,7 +1,10 @@
+#pragma once
+
 #include "camera.h"
 #include "types.h"
 
 using put::camera;
+using put::frustum;
 
 namespace put
 {
@@ -9,16 +12,37 @@ namespace put
     {
         struct ecs_scene;
 
+        static const u32 k_max_cull_frustums = 64; // one bit per frustum in the u64 visibility mask
+
+        namespace e_simd
+        {
+            enum simd_t
+            {
+                none,
+                sse4,
+                avx2
+            };
+        }
+        typedef e_simd::simd_t simd_t;
+
         // run time detect of simd extensions and setup function pointers to the fastest implementation
-        void simd_init();
+        void   simd_init();
+        simd_t simd_get_level();
 
         // frustum_cull_xxx_scalar versions scalar float cross platform implementations,
+        bool filter_entity_scalar(const ecs_scene* scene, u32 entity);
         void filter_entities_scalar(const ecs_scene* scene, u32** filtered_entities_out);
         void frustum_cull_aabb_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere_scalar(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
 
+        // tests each entity against every frustum at once, bit f of masks_out[i] is set if entities[i] is inside frustums[f]
+        void frustum_cull_views_aabb_scalar(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                            const u32* entities, u32 count, u64* masks_out);
+
         // frustum_cull_xxx functions are replaced by simd where available and fall back to scalar if no simd is available
         void frustum_cull_aabb(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
         void frustum_cull_sphere(const ecs_scene* scene, const camera* cam, u32* entities_in, u32** entities_out);
+        void frustum_cull_views_aabb(const ecs_scene* scene, const frustum* frustums, u32 num_frustums,
+                                     const u32* entities, u32 count, u64* masks_out);
     } // namespace ecs
 } // namespace put
@@ -3,6 +3,7 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include "ecs/ecs_editor.h"
+#include "ecs/ecs_query.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_utilities.h"
 
@@ -222,6 +223,7 @@ namespace put
             scene->transforms[light].scale = vec3f::one();
             scene->entities[light] |= e_cmp::light;
             scene->entities[light] |= e_cmp::transform;
+            invalidate_queries(scene);
             instantiate_model_cbuffer(scene, light);
 
             sb_clear(scene->selection_list);
@@ -308,6 +310,7 @@ namespace put
                 return;
 
             scene->entities[master] |= e_cmp::master_instance;
+            invalidate_queries(scene);
 
             scene->master_instances[master].num_instances = selection_size;
             scene->master_instances[master].instance_stride = sizeof(cmp_draw_call);
@@ -389,6 +392,7 @@ namespace put
 
             sb_clear(scene->selection_list);
             scene->flags |= e_scene_flags::invalidate_scene_tree;
+            invalidate_queries(scene);
         }
 
         void add_selection(ecs_scene* scene, u32 index, u32 select_mode)
@@ -438,6 +442,8 @@ namespace put
                 scene->state_flags[index] &= ~e_state::selected;
             else
                 scene->state_flags[index] |= e_state::selected;
+
+            invalidate_queries(scene);
         }
 
         void delete_selection(ecs_scene* scene)
@@ -703,6 +709,8 @@ namespace put
                 if (scene->state_flags[p] & e_state::selected || scene->state_flags[p] & e_state::child_selected)
                     scene->state_flags[n] |= e_state::child_selected;
             }
+
+            invalidate_queries(scene);
         }
 
         // undoable / redoable actions
@@ -737,7 +745,7 @@ namespace put
                 for (u32 i = 0; i < num; ++i)
                 {
                     generic_cmp_array& cmp = scene->get_component_array(i);
-                    diff += memcmp(cmp[node_index], us.components[i], cmp.size);
+                    diff += memcmp(cmp.get(node_index), us.components[i], cmp.size);
                 }
 
                 // no change bail out
@@ -751,7 +759,7 @@ namespace put
                     for (u32 i = 0; i < num; ++i)
                     {
                         generic_cmp_array& cmp = scene->get_component_array(i);
-                        edit_diff += memcmp(cmp[node_index], ns.components[i], cmp.size);
+                        edit_diff += memcmp(cmp.get(node_index), ns.components[i], cmp.size);
                     }
 
                     // no change since last frame
@@ -775,7 +783,8 @@ namespace put
                 if (!ns.components[i])
                     ns.components[i] = pen::memory_alloc(cmp.size);
 
-                void* data = cmp[node_index];
+                // entities without a sparse component store zero
+                const void* data = cmp.get(node_index);
 
                 memcpy(ns.components[i], data, cmp.size);
             }
@@ -790,7 +799,7 @@ namespace put
 
                 // specialisations
                 // remove physics
-                if (cmp[node_index] == &scene->physics_handles[node_index])
+                if (cmp.get(node_index) == &scene->physics_handles[node_index])
                 {
                     u32 h_cur = scene->physics_handles[node_index];
                     u32 h_prev = *(u32*)ns.components[i];
@@ -802,7 +811,7 @@ namespace put
                     }
                 }
 
-                if (cmp[node_index] == &scene->physics_handles[node_index])
+                if (cmp.get(node_index) == &scene->physics_handles[node_index])
                 {
                     u32 h_cur = scene->physics_handles[node_index];
                     u32 h_prev = *(u32*)ns.components[i];
@@ -814,9 +823,12 @@ namespace put
                     }
                 }
 
-                memcpy(cmp[node_index], ns.components[i], cmp.size);
+                set_component(cmp, node_index, ns.components[i]);
             }
 
+            // restored matrices, bounds and parents bypass the dirty flags
+            scene->flags |= e_scene_flags::invalidate_transforms | e_scene_flags::invalidate_visibility;
+
             node_state& us = s_editor_nodes[node_index].action_state[e_editor_actions::undo];
             node_state& rs = s_editor_nodes[node_index].action_state[e_editor_actions::redo];
 
@@ -861,6 +873,13 @@ namespace put
             restore_from_stack(scene, s_redo_stack, s_undo_stack, e_editor_actions::redo);
         }
 
+        void remap_undo_stack(ecs_scene* scene, action_stack& stack)
+        {
+            for (s32 i = 0; i < stack.pos; ++i)
+                if (stack.data[i].node_index >= 0)
+                    stack.data[i].node_index = remap_entity(scene, stack.data[i].node_index);
+        }
+
         void update_undo_stack(ecs_scene* scene, f32 dt)
         {
             // resize buffers
@@ -871,6 +890,27 @@ namespace put
                 stb__sbn(s_editor_nodes) = scene->soa_size;
             }
 
+            // entities were moved by reorder_entities, pending and stacked actions follow them
+            static ecs_scene* remap_scene = nullptr;
+            static u32        remap_generation = 0;
+            if (scene == remap_scene && scene->entity_remap_generation != remap_generation)
+            {
+                u32            num = std::min<u32>((u32)scene->num_entities, sb_count(s_editor_nodes));
+                editor_action* moved = (editor_action*)pen::memory_alloc(sizeof(editor_action) * num);
+                memcpy(moved, s_editor_nodes, sizeof(editor_action) * num);
+
+                for (u32 n = 0; n < num; ++n)
+                    s_editor_nodes[remap_entity(scene, n)] = moved[n];
+
+                pen::memory_free(moved);
+
+                remap_undo_stack(scene, s_undo_stack);
+                remap_undo_stack(scene, s_redo_stack);
+            }
+
+            remap_scene = scene;
+            remap_generation = scene->entity_remap_generation;
+
             static editor_action macro_begin;
             static editor_action macro_end;
 
@@ -1029,6 +1069,7 @@ namespace put
                     {
                         scene->state_flags[i] |= e_state::hidden;
                     }
+                    invalidate_queries(scene);
                 }
 
                 if (ImGui::MenuItem("Unhide All"))
@@ -1037,6 +1078,7 @@ namespace put
                     {
                         scene->state_flags[i] &= ~e_state::hidden;
                     }
+                    invalidate_queries(scene);
                 }
 
                 if (sb_count(scene->selection_list) > 0)
@@ -1048,6 +1090,7 @@ namespace put
                             if (scene->state_flags[i] & e_state::selected)
                                 scene->state_flags[i] |= e_state::hidden;
                         }
+                        invalidate_queries(scene);
                     }
 
                     if (ImGui::MenuItem("Hide Un-Selected"))
@@ -1057,6 +1100,7 @@ namespace put
                             if (!(scene->state_flags[i] & e_state::selected))
                                 scene->state_flags[i] |= e_state::hidden;
                         }
+                        invalidate_queries(scene);
                     }
                 }
 
@@ -1136,6 +1180,10 @@ namespace put
                 ImGui::MenuItem("Console", nullptr, &co);
                 dev_ui::show_console(co);
 
+                bool rs = dev_ui::is_renderer_stats_open();
+                ImGui::MenuItem("Renderer Stats", nullptr, &rs);
+                dev_ui::show_renderer_stats(rs);
+
                 ImGui::MenuItem("Settings", nullptr, &settings_open);
                 ImGui::MenuItem("Dev", nullptr, &dev_open);
 
@@ -1551,7 +1599,7 @@ namespace put
                         if (scene->entities[i] & e_cmp::constraint)
                             continue;
 
-                        scene->physics_data[i].constraint = preview_constraint;
+                        scene->physics_data.get_or_add(i).constraint = preview_constraint;
 
                         instantiate_constraint(scene, i);
                     }
@@ -1559,7 +1607,7 @@ namespace put
             }
 
             if (sb_count(scene->selection_list) == 1)
-                scene->physics_data[scene->selection_list[0]].constraint = preview_constraint;
+                scene->physics_data.get_or_add(scene->selection_list[0]).constraint = preview_constraint;
         }
 
         void scene_rigid_body_ui(ecs_scene* scene)
@@ -1612,7 +1660,7 @@ namespace put
                 for (u32 s = 0; s < sel_num; ++s)
                 {
                     u32 i = scene->selection_list[s];
-                    scene->physics_data[i].rigid_body = s_physics_preview.params.rigid_body;
+                    scene->physics_data.get_or_add(i).rigid_body = s_physics_preview.params.rigid_body;
                     scene->physics_offset[i].translation = s_physics_preview.offset.translation;
 
                     if (!(scene->entities[i] & e_cmp::physics))
@@ -1635,7 +1683,7 @@ namespace put
 
             if (num_selected == 1)
             {
-                s_physics_preview.params = scene->physics_data[scene->selection_list[0]];
+                s_physics_preview.params = scene->physics_data.get(scene->selection_list[0]);
                 physics_type = s_physics_preview.params.type;
             }
 
@@ -1691,7 +1739,7 @@ namespace put
             }
 
             if (sb_count(scene->selection_list) == 1)
-                scene->physics_data[scene->selection_list[0]] = s_physics_preview.params;
+                scene->physics_data.get_or_add(scene->selection_list[0]) = s_physics_preview.params;
         }
 
         bool scene_geometry_ui(ecs_scene* scene)
@@ -1779,6 +1827,8 @@ namespace put
                         scene->state_flags[s] &= ~e_state::hidden;
                     }
                 }
+
+                invalidate_queries(scene);
             }
         }
 
@@ -1903,8 +1953,11 @@ namespace put
 
             if (ImGui::CollapsingHeader("Bounds"))
             {
-                ImGui::InputFloat3("Min", &scene->bounding_volumes[si].min_extents[0]);
-                ImGui::InputFloat3("Max", &scene->bounding_volumes[si].max_extents[0]);
+                bool changed = ImGui::InputFloat3("Min", &scene->bounding_volumes[si].min_extents[0]);
+                changed |= ImGui::InputFloat3("Max", &scene->bounding_volumes[si].max_extents[0]);
+                if (changed)
+                    scene->state_flags[si] |= e_state::transform_dirty;
+
                 ImGui::InputFloat3("Transformed Min", &scene->bounding_volumes[si].transformed_min_extents[0]);
                 ImGui::InputFloat3("Transformed Min", &scene->bounding_volumes[si].transformed_max_extents[0]);
                 ImGui::InputFloat("Radius", &scene->bounding_volumes[si].radius);
@@ -2051,6 +2104,14 @@ namespace put
 
                             f32* f3 = &scene->material_data[si].data[cb_offset];
                             memcpy(f3, f1, tc_size);
+                            scene->state_flags[si] |= e_state::draw_dirty;
+
+                            // edited entities stop sharing the material cbuffer of their batch
+                            if (scene->state_flags[si] & e_state::shared_material)
+                            {
+                                scene->materials[si].material_cbuffer = PEN_INVALID_HANDLE;
+                                instantiate_material_cbuffer(scene, si, scene->materials[si].material_cbuffer_size);
+                            }
                         }
                     }
 
@@ -2232,7 +2293,7 @@ namespace put
                                 instantiate_area_light_ex(scene, selected_index, alr);
                             }
 
-                            area_light_resource& alr = scene->area_light_resources[selected_index];
+                            area_light_resource& alr = scene->area_light_resources.get_or_add(selected_index);
 
                             u32 shader = 0;
                             u32 technique_list_index = 0;
@@ -2337,6 +2398,8 @@ namespace put
 
                     if (caster_type == 2)
                         scene->entities[si] |= e_cmp::sdf_shadow;
+
+                    invalidate_queries(scene);
                 }
 
                 if (caster_type == CAST_SDF)
@@ -2381,6 +2444,7 @@ namespace put
                     scene->transforms[nn].scale = vec3f::one();
 
                     scene->entities[nn] |= e_cmp::transform;
+                    invalidate_queries(scene);
 
                     add_selection(scene, nn);
 
@@ -2453,6 +2517,27 @@ namespace put
                         ImGui::Text("%s: %i", dumps[i].display_name, dumps[i].count);
                 }
 
+                if (ImGui::CollapsingHeader("Component Memory"))
+                {
+                    static std::vector<component_memory> report;
+                    get_component_memory(scene, report);
+
+                    size_t total = 0;
+                    size_t total_dense = 0;
+                    for (auto& cm : report)
+                    {
+                        const c8* storage = cm.flags & e_cmp_array_flags::sparse ? "sparse" : "dense";
+                        ImGui::Text("%s (%s): %u elements, %.1fkb of %.1fkb", cm.name, storage, cm.elements,
+                                    cm.used_bytes / 1024.0f, cm.allocated_bytes / 1024.0f);
+
+                        total += cm.allocated_bytes;
+                        total_dense += cm.dense_bytes;
+                    }
+
+                    ImGui::Separator();
+                    ImGui::Text("Total: %.1fkb (%.1fkb dense)", total / 1024.0f, total_dense / 1024.0f);
+                }
+
                 if (ImGui::CollapsingHeader("Entities"))
                 {
                     ImGui::BeginChild("Entities", ImVec2(0, 300), true);
@@ -3108,8 +3193,9 @@ namespace put
                         dc.world_matrix_inv_transpose = mat4::create_identity();
                         dc.v2 = vec4f(scene->lights[n].colour, 1.0f);
 
-                        pen::renderer_update_buffer(scene->cbuffer[n], &dc, sizeof(cmp_draw_call));
-                        pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                        u32 dc_offset = pen::renderer_write_transient_cbuffer(&dc, sizeof(cmp_draw_call));
+                        pen::renderer_set_transient_cbuffer(dc_offset, sizeof(cmp_draw_call), 1,
+                                                            pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
                         pen::renderer_set_vertex_buffer(r.vertex_buffer, 0, r.vertex_size, 0);
                         pen::renderer_set_index_buffer(r.index_buffer, r.index_type, 0);
                         pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
@@ -3134,7 +3220,7 @@ namespace put
 
                 if ((scene->entities[n] & e_cmp::physics) || preview_rb)
                 {
-                    u32 prim = scene->physics_data[n].rigid_body.shape;
+                    u32 prim = scene->physics_data.get(n).rigid_body.shape;
 
                     if (prim == 0)
                         continue;
@@ -3174,7 +3260,7 @@ namespace put
                     else
                     {
                         // from physics instance
-                        mat4 scale = mat::create_scale(scene->physics_data[n].rigid_body.dimensions);
+                        mat4 scale = mat::create_scale(scene->physics_data.get(n).rigid_body.dimensions);
                         mat4 rbmat = physics::get_rb_matrix(scene->physics_handles[n]);
                         dc.world_matrix = rbmat * scale;
                     }
@@ -3364,6 +3450,8 @@ namespace put
                         dbg::add_aabb(scene->bounding_volumes[n].transformed_min_extents,
                                       scene->bounding_volumes[n].transformed_max_extents, col);
                 }
+
+                invalidate_queries(scene);
             }
 
             if (scene->view_flags & e_scene_view_flags::bones)
@@ -0,0 +1,448 @@
+// ecs_light_cluster.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_light_cluster.h"
+
+#include "data_struct.h"
+#include "memory.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if __SSE2__ || __AVX__ || __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            const f32 k_point_influence = 2.2360680f; // sqrt(5), see point_light_attenuation_cutoff
+
+            // soa arrays in light_cluster_grid::bounds, padded so 4 wide loads at the end of a row stay in bounds
+            enum cluster_bound
+            {
+                min_x,
+                min_y,
+                min_z,
+                max_x,
+                max_y,
+                max_z,
+                centre_x,
+                centre_y,
+                centre_z,
+                radius,
+                num_cluster_bounds
+            };
+            const u32 k_bounds_stride = k_light_clusters + 4;
+
+            struct light_volume
+            {
+                vec3f pos; // view space
+                f32   radius;
+                vec3f dir; // view space spot direction
+                f32   cos_angle;
+                f32   sin_angle;
+                bool  cone;
+            };
+
+            inline vec3f transform_point(const mat4& m, const vec3f& p)
+            {
+                return vec3f(m.m[0] * p.x + m.m[1] * p.y + m.m[2] * p.z + m.m[3],
+                             m.m[4] * p.x + m.m[5] * p.y + m.m[6] * p.z + m.m[7],
+                             m.m[8] * p.x + m.m[9] * p.y + m.m[10] * p.z + m.m[11]);
+            }
+
+            inline vec3f rotate_vector(const mat4& m, const vec3f& v)
+            {
+                return vec3f(m.m[0] * v.x + m.m[1] * v.y + m.m[2] * v.z, m.m[4] * v.x + m.m[5] * v.y + m.m[6] * v.z,
+                             m.m[8] * v.x + m.m[9] * v.y + m.m[10] * v.z);
+            }
+
+            // view space point on the ray through the eye and an ndc position
+            inline vec3f unproject_ray(const mat4& inv_proj, f32 x, f32 y)
+            {
+                const f32* m = inv_proj.m;
+                f32        w = m[12] * x + m[13] * y + m[15];
+                return vec3f(m[0] * x + m[1] * y + m[3], m[4] * x + m[5] * y + m[7], m[8] * x + m[9] * y + m[11]) / w;
+            }
+
+            // point along a ray through the eye where clip w equals depth
+            inline vec3f ray_at_depth(const mat4& proj, const vec3f& ray, f32 depth)
+            {
+                f32 w = proj.m[12] * ray.x + proj.m[13] * ray.y + proj.m[14] * ray.z;
+                return ray * ((depth - proj.m[15]) / w);
+            }
+
+            inline f32 clip_w(const mat4& m, const vec3f& p)
+            {
+                return m.m[12] * p.x + m.m[13] * p.y + m.m[14] * p.z + m.m[15];
+            }
+
+            inline u32 depth_slice(const light_cluster_grid* grid, f32 w)
+            {
+                if (w <= grid->near_plane)
+                    return 0;
+
+                return std::min((u32)(logf(w / grid->near_plane) * grid->slice_scale), k_light_cluster_z - 1);
+            }
+
+            inline f32 slice_depth(const light_cluster_grid* grid, u32 z)
+            {
+                return grid->near_plane * powf(grid->far_plane / grid->near_plane, (f32)z / (f32)k_light_cluster_z);
+            }
+
+            // plane through the eye containing 2 rays, facing toward the third
+            vec3f eye_plane(const vec3f& a, const vec3f& b, const vec3f& towards)
+            {
+                vec3f n = normalized(cross(a, b));
+                return dot(n, towards) < 0.0f ? n * -1.0f : n;
+            }
+
+            void update_bounds(light_cluster_grid* grid, const mat4& proj, f32 near_plane, f32 far_plane)
+            {
+                if (grid->near_plane == near_plane && grid->far_plane == far_plane &&
+                    memcmp(&grid->proj, &proj, sizeof(mat4)) == 0)
+                    return;
+
+                grid->proj = proj;
+                grid->near_plane = near_plane;
+                grid->far_plane = far_plane;
+                grid->slice_scale = (f32)k_light_cluster_z / logf(far_plane / near_plane);
+
+                if (!grid->bounds)
+                {
+                    u32 size = sizeof(f32) * k_bounds_stride * num_cluster_bounds;
+                    grid->bounds = (f32*)pen::memory_alloc(size);
+                    pen::memory_zero(grid->bounds, size);
+                }
+
+                mat4 inv_proj = mat::inverse4x4(proj);
+
+                // tile boundaries, ndc y is up so row 0 is the bottom of the screen
+                for (u32 x = 0; x <= k_light_cluster_x; ++x)
+                {
+                    f32 nx = -1.0f + 2.0f * (f32)x / (f32)k_light_cluster_x;
+                    grid->tile_x[x] = eye_plane(unproject_ray(inv_proj, nx, -1.0f), unproject_ray(inv_proj, nx, 1.0f),
+                                                unproject_ray(inv_proj, nx + 1.0f, 0.0f));
+                }
+
+                for (u32 y = 0; y <= k_light_cluster_y; ++y)
+                {
+                    f32 ny = -1.0f + 2.0f * (f32)y / (f32)k_light_cluster_y;
+                    grid->tile_y[y] = eye_plane(unproject_ray(inv_proj, -1.0f, ny), unproject_ray(inv_proj, 1.0f, ny),
+                                                unproject_ray(inv_proj, 0.0f, ny + 1.0f));
+                }
+
+                f32* b = grid->bounds;
+                for (u32 z = 0; z < k_light_cluster_z; ++z)
+                {
+                    f32 d0 = slice_depth(grid, z);
+                    f32 d1 = slice_depth(grid, z + 1);
+
+                    for (u32 y = 0; y < k_light_cluster_y; ++y)
+                    {
+                        for (u32 x = 0; x < k_light_cluster_x; ++x)
+                        {
+                            vec3f mn = vec3f(FLT_MAX);
+                            vec3f mx = vec3f(-FLT_MAX);
+                            for (u32 c = 0; c < 4; ++c)
+                            {
+                                f32   nx = -1.0f + 2.0f * (f32)(x + (c & 1)) / (f32)k_light_cluster_x;
+                                f32   ny = -1.0f + 2.0f * (f32)(y + (c >> 1)) / (f32)k_light_cluster_y;
+                                vec3f ray = unproject_ray(inv_proj, nx, ny);
+
+                                vec3f p0 = ray_at_depth(proj, ray, d0);
+                                vec3f p1 = ray_at_depth(proj, ray, d1);
+                                mn = min_union(mn, min_union(p0, p1));
+                                mx = max_union(mx, max_union(p0, p1));
+                            }
+
+                            u32   i = (z * k_light_cluster_y + y) * k_light_cluster_x + x;
+                            vec3f centre = (mn + mx) * 0.5f;
+
+                            b[min_x * k_bounds_stride + i] = mn.x;
+                            b[min_y * k_bounds_stride + i] = mn.y;
+                            b[min_z * k_bounds_stride + i] = mn.z;
+                            b[max_x * k_bounds_stride + i] = mx.x;
+                            b[max_y * k_bounds_stride + i] = mx.y;
+                            b[max_z * k_bounds_stride + i] = mx.z;
+                            b[centre_x * k_bounds_stride + i] = centre.x;
+                            b[centre_y * k_bounds_stride + i] = centre.y;
+                            b[centre_z * k_bounds_stride + i] = centre.z;
+                            b[radius * k_bounds_stride + i] = mag(mx - centre);
+                        }
+                    }
+                }
+            }
+
+            inline f32 bound(const f32* b, cluster_bound cb, u32 i)
+            {
+                return b[cb * k_bounds_stride + i];
+            }
+
+            inline void push_pair(light_cluster_grid* grid, u32 cluster, u32 light)
+            {
+                u64 pair = ((u64)cluster << 32) | light;
+                sb_push(grid->pairs, pair);
+                grid->ranges[cluster].count++;
+            }
+
+            // sphere against the cluster aabb, spots are also tested as a cone against the cluster bounding sphere
+            bool overlaps_scalar(const f32* b, u32 i, const light_volume& lv)
+            {
+                f32 dx = std::max(std::max(bound(b, min_x, i) - lv.pos.x, lv.pos.x - bound(b, max_x, i)), 0.0f);
+                f32 dy = std::max(std::max(bound(b, min_y, i) - lv.pos.y, lv.pos.y - bound(b, max_y, i)), 0.0f);
+                f32 dz = std::max(std::max(bound(b, min_z, i) - lv.pos.z, lv.pos.z - bound(b, max_z, i)), 0.0f);
+
+                if (dx * dx + dy * dy + dz * dz > lv.radius * lv.radius)
+                    return false;
+
+                if (!lv.cone)
+                    return true;
+
+                f32 vx = bound(b, centre_x, i) - lv.pos.x;
+                f32 vy = bound(b, centre_y, i) - lv.pos.y;
+                f32 vz = bound(b, centre_z, i) - lv.pos.z;
+                f32 r = bound(b, radius, i);
+
+                f32 len2 = vx * vx + vy * vy + vz * vz;
+                f32 along = vx * lv.dir.x + vy * lv.dir.y + vz * lv.dir.z;
+                f32 closest = lv.cos_angle * sqrtf(std::max(len2 - along * along, 0.0f)) - along * lv.sin_angle;
+
+                return !(closest > r || along > r + lv.radius || along < -r);
+            }
+
+            void assign_row_scalar(light_cluster_grid* grid, u32 row, u32 x0, u32 x1, const light_volume& lv, u32 light)
+            {
+                for (u32 x = x0; x <= x1; ++x)
+                    if (overlaps_scalar(grid->bounds, row + x, lv))
+                        push_pair(grid, row + x, light);
+            }
+
+#if __SSE2__ || __AVX__ || __AVX2__
+            // 4 clusters along a row at a time, the same tests as overlaps_scalar
+            void assign_row_simd128(light_cluster_grid* grid, u32 row, u32 x0, u32 x1, const light_volume& lv, u32 light)
+            {
+                const f32* b = grid->bounds;
+
+                __m128 zero = _mm_setzero_ps();
+                __m128 px = _mm_set1_ps(lv.pos.x);
+                __m128 py = _mm_set1_ps(lv.pos.y);
+                __m128 pz = _mm_set1_ps(lv.pos.z);
+                __m128 r2 = _mm_set1_ps(lv.radius * lv.radius);
+
+                __m128 range = _mm_set1_ps(lv.radius);
+                __m128 dirx = _mm_set1_ps(lv.dir.x);
+                __m128 diry = _mm_set1_ps(lv.dir.y);
+                __m128 dirz = _mm_set1_ps(lv.dir.z);
+                __m128 cos_angle = _mm_set1_ps(lv.cos_angle);
+                __m128 sin_angle = _mm_set1_ps(lv.sin_angle);
+
+                for (u32 x = x0; x <= x1; x += 4)
+                {
+                    u32 i = row + x;
+
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b + min_x * k_bounds_stride + i), px),
+                                                      _mm_sub_ps(px, _mm_loadu_ps(b + max_x * k_bounds_stride + i))),
+                                           zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b + min_y * k_bounds_stride + i), py),
+                                                      _mm_sub_ps(py, _mm_loadu_ps(b + max_y * k_bounds_stride + i))),
+                                           zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(b + min_z * k_bounds_stride + i), pz),
+                                                      _mm_sub_ps(pz, _mm_loadu_ps(b + max_z * k_bounds_stride + i))),
+                                           zero);
+
+                    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    __m128 hit = _mm_cmple_ps(d2, r2);
+
+                    if (lv.cone && _mm_movemask_ps(hit))
+                    {
+                        __m128 vx = _mm_sub_ps(_mm_loadu_ps(b + centre_x * k_bounds_stride + i), px);
+                        __m128 vy = _mm_sub_ps(_mm_loadu_ps(b + centre_y * k_bounds_stride + i), py);
+                        __m128 vz = _mm_sub_ps(_mm_loadu_ps(b + centre_z * k_bounds_stride + i), pz);
+                        __m128 r = _mm_loadu_ps(b + radius * k_bounds_stride + i);
+
+                        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+                        __m128 along =
+                            _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dirx), _mm_mul_ps(vy, diry)), _mm_mul_ps(vz, dirz));
+                        __m128 perp = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(len2, _mm_mul_ps(along, along)), zero));
+                        __m128 closest = _mm_sub_ps(_mm_mul_ps(cos_angle, perp), _mm_mul_ps(along, sin_angle));
+
+                        __m128 culled = _mm_cmpgt_ps(closest, r);
+                        culled = _mm_or_ps(culled, _mm_cmpgt_ps(along, _mm_add_ps(r, range)));
+                        culled = _mm_or_ps(culled, _mm_cmplt_ps(along, _mm_sub_ps(zero, r)));
+                        hit = _mm_andnot_ps(culled, hit);
+                    }
+
+                    // mask lanes past the end of the range
+                    u32 mask = (u32)_mm_movemask_ps(hit);
+                    u32 lanes = std::min<u32>(x1 - x + 1, 4);
+                    mask &= (1u << lanes) - 1;
+
+                    for (u32 l = 0; l < lanes; ++l)
+                        if (mask & (1u << l))
+                            push_pair(grid, i + l, light);
+                }
+            }
+#endif
+
+            inline void assign_row(light_cluster_grid* grid, u32 row, u32 x0, u32 x1, const light_volume& lv, u32 light)
+            {
+#if __SSE2__ || __AVX__ || __AVX2__
+                assign_row_simd128(grid, row, x0, x1, lv, light);
+#else
+                assign_row_scalar(grid, row, x0, x1, lv, light);
+#endif
+            }
+
+            void assign_light(light_cluster_grid* grid, const mat4& view, const light_data& light, u32 index)
+            {
+                light_volume lv;
+                lv.pos = transform_point(view, light.pos_radius.xyz);
+                lv.radius = light_cluster_influence_radius(light);
+                lv.dir = vec3f::zero();
+                lv.cos_angle = 1.0f;
+                lv.sin_angle = 0.0f;
+                lv.cone = false;
+
+                if (lv.radius <= 0.0f)
+                    return;
+
+                // spot lights are lit where 1 - dot(l, dir) < cutoff, the cone test needs an angle under 90 degrees
+                if ((u32)light.data.z == e_cluster_light::spot)
+                {
+                    lv.dir = normalized(rotate_vector(view, light.dir_cutoff.xyz));
+                    lv.cos_angle = 1.0f - light.dir_cutoff.w;
+                    lv.sin_angle = sqrtf(std::max(1.0f - lv.cos_angle * lv.cos_angle, 0.0f));
+                    lv.cone = lv.cos_angle > 0.0f && lv.cos_angle < 1.0f;
+                }
+
+                // range of slices from clip w, which is linear in view space
+                const f32* pm = grid->proj.m;
+                f32        w = clip_w(grid->proj, lv.pos);
+                f32        wr = lv.radius * sqrtf(pm[12] * pm[12] + pm[13] * pm[13] + pm[14] * pm[14]);
+                f32        w0 = w - wr;
+                f32        w1 = w + wr;
+
+                if (w1 < grid->near_plane || w0 > grid->far_plane)
+                    return;
+
+                u32 z0 = depth_slice(grid, w0);
+                u32 z1 = depth_slice(grid, std::min(w1, grid->far_plane));
+
+                // range of tiles, the tile planes pass through the eye so they only bound spheres in front of it
+                u32 x0 = 0;
+                u32 x1 = k_light_cluster_x - 1;
+                u32 y0 = 0;
+                u32 y1 = k_light_cluster_y - 1;
+
+                if (w0 > 0.0f)
+                {
+                    while (x0 <= x1 && dot(grid->tile_x[x0 + 1], lv.pos) > lv.radius)
+                        ++x0;
+
+                    while (x1 > x0 && dot(grid->tile_x[x1], lv.pos) < -lv.radius)
+                        --x1;
+
+                    while (y0 <= y1 && dot(grid->tile_y[y0 + 1], lv.pos) > lv.radius)
+                        ++y0;
+
+                    while (y1 > y0 && dot(grid->tile_y[y1], lv.pos) < -lv.radius)
+                        --y1;
+
+                    if (x0 > x1 || y0 > y1)
+                        return;
+                }
+
+                for (u32 z = z0; z <= z1; ++z)
+                    for (u32 y = y0; y <= y1; ++y)
+                        assign_row(grid, (z * k_light_cluster_y + y) * k_light_cluster_x, x0, x1, lv, index);
+            }
+        } // namespace
+
+        f32 light_cluster_influence_radius(const light_data& light)
+        {
+            if ((u32)light.data.z == e_cluster_light::spot)
+                return light.pos_radius.w;
+
+            return light.pos_radius.w * k_point_influence;
+        }
+
+        void light_cluster_build(light_cluster_grid* grid, const mat4& view, const mat4& proj, f32 near_plane,
+                                 f32 far_plane, const light_data* lights, u32 num_lights)
+        {
+            f64 start = pen::get_time_us();
+
+            update_bounds(grid, proj, near_plane, far_plane);
+            grid->view_proj = proj * view;
+
+            if (!grid->ranges)
+                grid->ranges = (light_cluster_range*)pen::memory_alloc(sizeof(light_cluster_range) * k_light_clusters);
+
+            pen::memory_zero(grid->ranges, sizeof(light_cluster_range) * k_light_clusters);
+
+            // pairs are generated light by light so each cluster lists its lights in ascending order
+            sb_clear(grid->pairs);
+            for (u32 i = 0; i < num_lights; ++i)
+                assign_light(grid, view, lights[i], i);
+
+            u32 offset = 0;
+            for (u32 c = 0; c < k_light_clusters; ++c)
+            {
+                grid->ranges[c].offset = offset;
+                offset += grid->ranges[c].count;
+                grid->ranges[c].count = 0;
+            }
+
+            if (offset > grid->index_capacity)
+            {
+                grid->index_capacity = offset + offset / 2;
+                grid->indices = (u32*)pen::memory_realloc(grid->indices, sizeof(u32) * grid->index_capacity);
+            }
+
+            u32 num_pairs = sb_count(grid->pairs);
+            for (u32 i = 0; i < num_pairs; ++i)
+            {
+                light_cluster_range& r = grid->ranges[grid->pairs[i] >> 32];
+                grid->indices[r.offset + r.count++] = (u32)grid->pairs[i];
+            }
+
+            grid->num_indices = offset;
+            grid->build_ms = (pen::get_time_us() - start) / 1000.0;
+        }
+
+        u32 light_cluster_find(const light_cluster_grid* grid, const vec3f& pos)
+        {
+            const f32* m = grid->view_proj.m;
+            f32        cx = m[0] * pos.x + m[1] * pos.y + m[2] * pos.z + m[3];
+            f32        cy = m[4] * pos.x + m[5] * pos.y + m[6] * pos.z + m[7];
+            f32        w = clip_w(grid->view_proj, pos);
+
+            f32 tx = (cx / w * 0.5f + 0.5f) * (f32)k_light_cluster_x;
+            f32 ty = (cy / w * 0.5f + 0.5f) * (f32)k_light_cluster_y;
+
+            u32 x = (u32)std::min(std::max(tx, 0.0f), (f32)(k_light_cluster_x - 1));
+            u32 y = (u32)std::min(std::max(ty, 0.0f), (f32)(k_light_cluster_y - 1));
+            u32 z = depth_slice(grid, w);
+
+            return (z * k_light_cluster_y + y) * k_light_cluster_x + x;
+        }
+
+        void light_cluster_destroy(light_cluster_grid* grid)
+        {
+            pen::memory_free(grid->bounds);
+            pen::memory_free(grid->ranges);
+            pen::memory_free(grid->indices);
+            sb_free(grid->pairs);
+
+            *grid = light_cluster_grid();
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,67 @@
+// ecs_light_cluster.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Clustered light assignment for forward shading, point and spot lights are binned into screen tiles and depth slices.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        static const u32 k_light_cluster_x = 16;
+        static const u32 k_light_cluster_y = 8;
+        static const u32 k_light_cluster_z = 24;
+        static const u32 k_light_clusters = k_light_cluster_x * k_light_cluster_y * k_light_cluster_z;
+
+        // clustered lights are packed in light_data with the type in data.z
+        namespace e_cluster_light
+        {
+            enum cluster_light_t
+            {
+                point = 0,
+                spot = 1
+            };
+        }
+
+        struct light_cluster_range
+        {
+            u32 offset; // into light_cluster_grid::indices
+            u32 count;
+        };
+
+        struct light_cluster_grid
+        {
+            f32                  near_plane = 0.0f;
+            f32                  far_plane = 0.0f;
+            f32                  slice_scale = 0.0f; // k_light_cluster_z / log(far / near)
+            mat4                 proj;
+            mat4                 view_proj;
+            vec3f                tile_x[k_light_cluster_x + 1]; // planes through the eye between columns of tiles
+            vec3f                tile_y[k_light_cluster_y + 1]; // planes through the eye between rows of tiles
+            f32*                 bounds = nullptr; // soa view space aabb and bounding sphere of each cluster
+            light_cluster_range* ranges = nullptr; // k_light_clusters ranges
+            u32*                 indices = nullptr;
+            u32                  num_indices = 0;
+            u32                  index_capacity = 0;
+            u64*                 pairs = nullptr; // cluster << 32 | light, scratch for building ranges
+            f64                  build_ms = 0.0;
+        };
+
+        // assigns point and spot lights to the clusters of a perspective view, cluster bounds are only recomputed
+        // when the projection changes. near and far are the range sliced in z, lights outside of it are skipped.
+        void light_cluster_build(light_cluster_grid* grid, const mat4& view, const mat4& proj, f32 near_plane,
+                                 f32 far_plane, const light_data* lights, u32 num_lights);
+
+        // index of the cluster containing a world space position, the same lookup forward_lit_clustered performs
+        u32 light_cluster_find(const light_cluster_grid* grid, const vec3f& pos);
+
+        // distance from a light at which it stops contributing, point attenuation reaches 0 at sqrt(5) * radius
+        f32 light_cluster_influence_radius(const light_data& light);
+
+        void light_cluster_destroy(light_cluster_grid* grid);
+    } // namespace ecs
+} // namespace put
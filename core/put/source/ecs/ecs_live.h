@@ -42,7 +42,7 @@ typedef void (*proc_load_scene)(const c8*, ecs_scene*, bool);
 typedef s32 (*proc_load_pmm)(const c8*, ecs_scene*, u32);
 typedef s32 (*proc_load_pma)(const c8*);
 typedef s32 (*proc_load_pmv)(const c8*, ecs_scene*);
-typedef void (*proc_optimise_pmm)(const c8*, const c8*);
+typedef void (*proc_optimise_pmm)(const c8*, const c8*, u32);
 typedef void (*proc_optimise_pma)(const c8*, const c8*);
 typedef void (*proc_instantiate_rigid_body)(ecs_scene*, u32);
 typedef void (*proc_instantiate_compound_rigid_body)(ecs_scene*, u32, u32*, u32);
@@ -0,0 +1,371 @@
+// ecs_occlusion.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_occlusion.h"
+
+#include "data_struct.h"
+#include "memory.h"
+#include "threads.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#if __SSE2__ || __AVX__ || __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        namespace
+        {
+            const f32 k_near_w = 0.001f;     // clip w below this is treated as crossing the near plane
+            const f32 k_depth_bias = 0.001f; // occluders must be nearer than a box by this fraction to hide it
+            const u32 k_cull_grain = 256;
+
+            struct clip_pos
+            {
+                f32 x, y, w;
+            };
+
+            inline clip_pos transform_clip(const mat4& m, f32 x, f32 y, f32 z)
+            {
+                clip_pos c;
+                c.x = m.m[0] * x + m.m[1] * y + m.m[2] * z + m.m[3];
+                c.y = m.m[4] * x + m.m[5] * y + m.m[6] * z + m.m[7];
+                c.w = m.m[12] * x + m.m[13] * y + m.m[14] * z + m.m[15];
+                return c;
+            }
+
+            // ndc to pixels with y down, pixel centres are at + 0.5
+            inline vec3f to_screen(const occlusion_buffer* ob, const clip_pos& c)
+            {
+                f32 rw = 1.0f / c.w;
+                return vec3f((c.x * rw * 0.5f + 0.5f) * (f32)ob->width, (0.5f - c.y * rw * 0.5f) * (f32)ob->height, rw);
+            }
+
+            bool setup_triangle(const occlusion_buffer* ob, vec3f v0, vec3f v1, vec3f v2, occluder_triangle& t)
+            {
+                // pixel bounds, clipped to the buffer
+                f32 minx = std::max(std::min(std::min(v0.x, v1.x), v2.x), 0.0f);
+                f32 miny = std::max(std::min(std::min(v0.y, v1.y), v2.y), 0.0f);
+                f32 maxx = std::min(std::max(std::max(v0.x, v1.x), v2.x), (f32)(ob->width - 1));
+                f32 maxy = std::min(std::max(std::max(v0.y, v1.y), v2.y), (f32)(ob->height - 1));
+
+                if (minx > maxx || miny > maxy)
+                    return false;
+
+                // both windings are rasterized, keeping the nearest depth makes back faces harmless
+                f32 area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+                if (area == 0.0f)
+                    return false;
+
+                if (area < 0.0f)
+                {
+                    std::swap(v1, v2);
+                    area = -area;
+                }
+
+                // edge i is opposite vertex i and evaluates to area at it
+                const vec3f* v[3] = {&v0, &v1, &v2};
+                f32          rcp_area = 1.0f / area;
+
+                t.za = 0.0f;
+                t.zb = 0.0f;
+                t.zc = 0.0f;
+
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    const vec3f& p = *v[(i + 1) % 3];
+                    const vec3f& q = *v[(i + 2) % 3];
+
+                    t.a[i] = p.y - q.y;
+                    t.b[i] = q.x - p.x;
+                    t.c[i] = p.x * q.y - q.x * p.y;
+
+                    // depth is the barycentric weighted sum of the vertex depths
+                    f32 zi = v[i]->z * rcp_area;
+                    t.za += t.a[i] * zi;
+                    t.zb += t.b[i] * zi;
+                    t.zc += t.c[i] * zi;
+                }
+
+                t.x0 = (s32)minx;
+                t.x1 = (s32)maxx;
+                t.y0 = (s32)miny;
+                t.y1 = (s32)maxy;
+
+                return true;
+            }
+
+            void rasterize_row_scalar(f32* row, const occluder_triangle& t, f32 py)
+            {
+                f32 e0 = t.b[0] * py + t.c[0];
+                f32 e1 = t.b[1] * py + t.c[1];
+                f32 e2 = t.b[2] * py + t.c[2];
+                f32 z = t.zb * py + t.zc;
+
+                for (s32 x = t.x0; x <= t.x1; ++x)
+                {
+                    f32 px = (f32)x + 0.5f;
+                    if (t.a[0] * px + e0 < 0.0f || t.a[1] * px + e1 < 0.0f || t.a[2] * px + e2 < 0.0f)
+                        continue;
+
+                    row[x] = std::max(row[x], t.za * px + z);
+                }
+            }
+
+#if __SSE2__ || __AVX__ || __AVX2__
+            // 4 pixels at a time, buffer widths are a multiple of the tile size so groups never cross the row end
+            void rasterize_row_simd128(f32* row, const occluder_triangle& t, f32 py)
+            {
+                __m128 zero = _mm_setzero_ps();
+                __m128 offset = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+
+                __m128 a0 = _mm_set1_ps(t.a[0]);
+                __m128 a1 = _mm_set1_ps(t.a[1]);
+                __m128 a2 = _mm_set1_ps(t.a[2]);
+                __m128 za = _mm_set1_ps(t.za);
+
+                __m128 e0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+                __m128 e1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+                __m128 e2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+                __m128 z = _mm_set1_ps(t.zb * py + t.zc);
+
+                for (s32 x = t.x0 & ~3; x <= t.x1; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), offset);
+
+                    __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), e0), zero);
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), e1), zero));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), e2), zero));
+
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+
+                    __m128 d = _mm_loadu_ps(row + x);
+                    __m128 nd = _mm_max_ps(d, _mm_add_ps(_mm_mul_ps(za, px), z));
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nd), _mm_andnot_ps(inside, d)));
+                }
+            }
+#endif
+
+            inline void rasterize_row(f32* row, const occluder_triangle& t, f32 py)
+            {
+#if __SSE2__ || __AVX__ || __AVX2__
+                rasterize_row_simd128(row, t, py);
+#else
+                rasterize_row_scalar(row, t, py);
+#endif
+            }
+
+            void rasterize_tile_row(occlusion_buffer* ob, u32 ty)
+            {
+                s32 r0 = ty * k_occlusion_tile_size;
+                s32 r1 = r0 + k_occlusion_tile_size - 1;
+
+                u32 num_triangles = sb_count(ob->triangles);
+                for (u32 i = 0; i < num_triangles; ++i)
+                {
+                    const occluder_triangle& t = ob->triangles[i];
+
+                    s32 y0 = std::max(t.y0, r0);
+                    s32 y1 = std::min(t.y1, r1);
+
+                    for (s32 y = y0; y <= y1; ++y)
+                        rasterize_row(ob->depth + y * ob->width, t, (f32)y + 0.5f);
+                }
+
+                // farthest depth of each tile
+                for (u32 tx = 0; tx < ob->tiles_x; ++tx)
+                {
+                    f32 farthest = FLT_MAX;
+                    for (s32 y = r0; y <= r1; ++y)
+                    {
+                        const f32* row = ob->depth + y * ob->width + tx * k_occlusion_tile_size;
+                        for (u32 x = 0; x < k_occlusion_tile_size; ++x)
+                            farthest = std::min(farthest, row[x]);
+                    }
+
+                    ob->tile_depth[ty * ob->tiles_x + tx] = farthest;
+                }
+            }
+        } // namespace
+
+        void occlusion_begin(occlusion_buffer* ob, const mat4& view_proj, u32 width, u32 height)
+        {
+            ob->tiles_x = (width + k_occlusion_tile_size - 1) / k_occlusion_tile_size;
+            ob->tiles_y = (height + k_occlusion_tile_size - 1) / k_occlusion_tile_size;
+            ob->width = ob->tiles_x * k_occlusion_tile_size;
+            ob->height = ob->tiles_y * k_occlusion_tile_size;
+            ob->view_proj = view_proj;
+
+            u32 num_pixels = ob->width * ob->height;
+            if (num_pixels > ob->capacity)
+            {
+                u32 num_tiles = ob->tiles_x * ob->tiles_y;
+                ob->capacity = num_pixels;
+                ob->depth = (f32*)pen::memory_realloc(ob->depth, sizeof(f32) * num_pixels);
+                ob->tile_depth = (f32*)pen::memory_realloc(ob->tile_depth, sizeof(f32) * num_tiles);
+            }
+
+            pen::memory_zero(ob->depth, sizeof(f32) * num_pixels);
+            pen::memory_zero(ob->tile_depth, sizeof(f32) * ob->tiles_x * ob->tiles_y);
+
+            sb_clear(ob->triangles);
+        }
+
+        void occlusion_add_occluder(occlusion_buffer* ob, const mat4& world, const vec4f* positions, const void* indices,
+                                    u32 num_indices, u32 index_size)
+        {
+            mat4 wvp = ob->view_proj * world;
+
+            for (u32 i = 0; i + 2 < num_indices; i += 3)
+            {
+                vec3f sv[3];
+                bool  clipped = false;
+
+                for (u32 j = 0; j < 3; ++j)
+                {
+                    u32 index = index_size == 2 ? ((const u16*)indices)[i + j] : ((const u32*)indices)[i + j];
+
+                    const vec4f& p = positions[index];
+                    clip_pos     c = transform_clip(wvp, p.x, p.y, p.z);
+
+                    if (c.w < k_near_w)
+                    {
+                        clipped = true;
+                        break;
+                    }
+
+                    sv[j] = to_screen(ob, c);
+                }
+
+                // dropping triangles that cross the near plane only loses occlusion
+                if (clipped)
+                    continue;
+
+                occluder_triangle t;
+                if (setup_triangle(ob, sv[0], sv[1], sv[2], t))
+                    sb_push(ob->triangles, t);
+            }
+        }
+
+        void occlusion_rasterize(occlusion_buffer* ob)
+        {
+            // each row of tiles is written by one job, triangles are tested against every row they overlap
+            pen::parallel_for(0, ob->tiles_y, 1, [ob](u32 start, u32 end) {
+                for (u32 ty = start; ty < end; ++ty)
+                    rasterize_tile_row(ob, ty);
+            });
+        }
+
+        bool occlusion_test_aabb(const occlusion_buffer* ob, const vec3f& min, const vec3f& max)
+        {
+            f32 sx0 = FLT_MAX;
+            f32 sy0 = FLT_MAX;
+            f32 sx1 = -FLT_MAX;
+            f32 sy1 = -FLT_MAX;
+            f32 nearest = 0.0f;
+
+            // 1/w is largest at one of the corners, the rect of the corners bounds the projected box
+            for (u32 i = 0; i < 8; ++i)
+            {
+                f32 x = i & 1 ? max.x : min.x;
+                f32 y = i & 2 ? max.y : min.y;
+                f32 z = i & 4 ? max.z : min.z;
+
+                clip_pos c = transform_clip(ob->view_proj, x, y, z);
+                if (c.w < k_near_w)
+                    return true;
+
+                vec3f s = to_screen(ob, c);
+                sx0 = std::min(sx0, s.x);
+                sy0 = std::min(sy0, s.y);
+                sx1 = std::max(sx1, s.x);
+                sy1 = std::max(sy1, s.y);
+                nearest = std::max(nearest, s.z);
+            }
+
+            // keeps occluders from hiding themselves where their surface lies on their bounds
+            nearest *= 1.0f + k_depth_bias;
+
+            if (sx1 < 0.0f || sy1 < 0.0f || sx0 >= (f32)ob->width || sy0 >= (f32)ob->height)
+                return true;
+
+            s32 px0 = (s32)std::max(sx0, 0.0f);
+            s32 py0 = (s32)std::max(sy0, 0.0f);
+            s32 px1 = (s32)std::min(sx1, (f32)(ob->width - 1));
+            s32 py1 = (s32)std::min(sy1, (f32)(ob->height - 1));
+
+            s32 tx0 = px0 / k_occlusion_tile_size;
+            s32 ty0 = py0 / k_occlusion_tile_size;
+            s32 tx1 = px1 / k_occlusion_tile_size;
+            s32 ty1 = py1 / k_occlusion_tile_size;
+
+            for (s32 ty = ty0; ty <= ty1; ++ty)
+            {
+                for (s32 tx = tx0; tx <= tx1; ++tx)
+                {
+                    // every pixel in the tile is nearer than the box
+                    if (ob->tile_depth[ty * ob->tiles_x + tx] > nearest)
+                        continue;
+
+                    // refine with the pixels of the tile the box covers
+                    s32 x0 = std::max<s32>(px0, tx * k_occlusion_tile_size);
+                    s32 y0 = std::max<s32>(py0, ty * k_occlusion_tile_size);
+                    s32 x1 = std::min<s32>(px1, (tx + 1) * k_occlusion_tile_size - 1);
+                    s32 y1 = std::min<s32>(py1, (ty + 1) * k_occlusion_tile_size - 1);
+
+                    for (s32 y = y0; y <= y1; ++y)
+                    {
+                        const f32* row = ob->depth + y * ob->width;
+                        for (s32 x = x0; x <= x1; ++x)
+                            if (row[x] <= nearest)
+                                return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        void occlusion_cull_aabb(const occlusion_buffer* ob, const extents* bounds, const u32* entities, u32 count,
+                                 u32** entities_out)
+        {
+            if (count == 0)
+                return;
+
+            u8* visible = (u8*)pen::memory_alloc(count);
+
+            pen::parallel_for(0, count, k_cull_grain, [ob, bounds, entities, visible](u32 start, u32 end) {
+                for (u32 i = start; i < end; ++i)
+                {
+                    const extents& e = bounds[entities[i]];
+                    visible[i] = occlusion_test_aabb(ob, e.min, e.max) ? 1 : 0;
+                }
+            });
+
+            for (u32 i = 0; i < count; ++i)
+                if (visible[i])
+                    sb_push(*entities_out, entities[i]);
+
+            pen::memory_free(visible);
+        }
+
+        void occlusion_destroy(occlusion_buffer* ob)
+        {
+            pen::memory_free(ob->depth);
+            pen::memory_free(ob->tile_depth);
+            sb_free(ob->triangles);
+
+            ob->depth = nullptr;
+            ob->tile_depth = nullptr;
+            ob->triangles = nullptr;
+            ob->capacity = 0;
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,56 @@
+// ecs_occlusion.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Cpu occlusion culling against a low resolution 1/w depth buffer with a farthest depth per 8x8 tile.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        static const u32 k_occlusion_tile_size = 8;
+
+        struct occluder_triangle
+        {
+            f32 a[3], b[3], c[3]; // edge functions a * x + b * y + c in pixels, inside where all 3 are >= 0
+            f32 za, zb, zc;       // 1/w plane
+            s32 x0, x1, y0, y1;   // pixel bounds, inclusive
+        };
+
+        struct occlusion_buffer
+        {
+            u32                width = 0;
+            u32                height = 0;
+            u32                tiles_x = 0;
+            u32                tiles_y = 0;
+            f32*               depth = nullptr;
+            f32*               tile_depth = nullptr; // farthest depth of each tile
+            u32                capacity = 0;
+            mat4               view_proj;
+            occluder_triangle* triangles = nullptr;
+        };
+
+        // clear and set the view, width and height are rounded up to whole tiles
+        void occlusion_begin(occlusion_buffer* ob, const mat4& view_proj, u32 width, u32 height);
+
+        // transform an indexed triangle list by world and queue it for rasterization, index_size is 2 or 4 bytes
+        void occlusion_add_occluder(occlusion_buffer* ob, const mat4& world, const vec4f* positions, const void* indices,
+                                    u32 num_indices, u32 index_size);
+
+        // rasterize queued triangles and build the tile depths, rows of tiles are split over the job workers
+        void occlusion_rasterize(occlusion_buffer* ob);
+
+        // false if the box is hidden behind rasterized occluders
+        bool occlusion_test_aabb(const occlusion_buffer* ob, const vec3f& min, const vec3f& max);
+
+        // pushes the entities whose bounds pass occlusion_test_aabb, in input order
+        void occlusion_cull_aabb(const occlusion_buffer* ob, const extents* bounds, const u32* entities, u32 count,
+                                 u32** entities_out);
+
+        void occlusion_destroy(occlusion_buffer* ob);
+    } // namespace ecs
+} // namespace put
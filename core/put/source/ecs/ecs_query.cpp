@@ -0,0 +1,268 @@
+// ecs_query.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_query.h"
+#include "ecs/ecs_cull.h"
+
+#include "data_struct.h"
+#include "memory.h"
+
+#include <string.h>
+
+#if __SSE4_1__ || __AVX__ || __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        struct cached_query
+        {
+            entity_query q;
+            u32*         entities; // stretchy buffer
+            u32          version;
+        };
+
+        struct ecs_query_cache
+        {
+            cached_query* queries = nullptr;
+            u32           version = 1;
+        };
+
+        //
+        // scalar implementation
+        //
+
+        namespace
+        {
+            u32 query_range_scalar(const u64* entities, const u64* state_flags, u32 start, u32 end, const entity_query& q,
+                                   u32* entities_out)
+            {
+                u64 cmp_mask = q.require | q.exclude;
+                u64 state_mask = q.require_state | q.exclude_state;
+
+                u32 num = 0;
+                for (u32 n = start; n < end; ++n)
+                {
+                    if ((entities[n] & cmp_mask) != q.require)
+                        continue;
+
+                    if ((state_flags[n] & state_mask) != q.require_state)
+                        continue;
+
+                    entities_out[num++] = n;
+                }
+
+                return num;
+            }
+        } // namespace
+
+        u32 query_entities_scalar(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                  u32* entities_out)
+        {
+            return query_range_scalar(entities, state_flags, 0, count, q, entities_out);
+        }
+
+        //
+        // sse4.1 128 implementation
+        //
+
+#if __SSE4_1__ || __AVX__
+        // every lane writes its index and the count only advances for matches, so there are no branches on the flags.
+        // state flags are only loaded when the query tests them.
+        template <bool k_state>
+        u32 query_entities_simd128_t(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                     u32* entities_out)
+        {
+            __m128i cmp_mask = _mm_set1_epi64x((long long)(q.require | q.exclude));
+            __m128i cmp_require = _mm_set1_epi64x((long long)q.require);
+            __m128i state_mask = _mm_set1_epi64x((long long)(q.require_state | q.exclude_state));
+            __m128i state_require = _mm_set1_epi64x((long long)q.require_state);
+
+            u32 num = 0;
+            u32 n = 0;
+            for (; n + 2 <= count; n += 2)
+            {
+                __m128i e = _mm_loadu_si128((const __m128i*)(entities + n));
+                __m128i match = _mm_cmpeq_epi64(_mm_and_si128(e, cmp_mask), cmp_require);
+
+                if (k_state)
+                {
+                    __m128i s = _mm_loadu_si128((const __m128i*)(state_flags + n));
+                    match = _mm_and_si128(match, _mm_cmpeq_epi64(_mm_and_si128(s, state_mask), state_require));
+                }
+
+                u32 bits = (u32)_mm_movemask_pd(_mm_castsi128_pd(match));
+
+                entities_out[num] = n;
+                num += bits & 1;
+                entities_out[num] = n + 1;
+                num += (bits >> 1) & 1;
+            }
+
+            return num + query_range_scalar(entities, state_flags, n, count, q, entities_out + num);
+        }
+
+        u32 query_entities_simd128(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                   u32* entities_out)
+        {
+            if (q.require_state | q.exclude_state)
+                return query_entities_simd128_t<true>(entities, state_flags, count, q, entities_out);
+
+            return query_entities_simd128_t<false>(entities, state_flags, count, q, entities_out);
+        }
+#endif
+
+        //
+        // avx2 256 implementation
+        //
+
+#if __AVX2__
+        template <bool k_state>
+        u32 query_entities_simd256_t(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                     u32* entities_out)
+        {
+            __m256i cmp_mask = _mm256_set1_epi64x((long long)(q.require | q.exclude));
+            __m256i cmp_require = _mm256_set1_epi64x((long long)q.require);
+            __m256i state_mask = _mm256_set1_epi64x((long long)(q.require_state | q.exclude_state));
+            __m256i state_require = _mm256_set1_epi64x((long long)q.require_state);
+
+            u32 num = 0;
+            u32 n = 0;
+            for (; n + 8 <= count; n += 8)
+            {
+                // two vectors of 4 entities give an 8 bit match mask
+                __m256i e0 = _mm256_loadu_si256((const __m256i*)(entities + n));
+                __m256i e1 = _mm256_loadu_si256((const __m256i*)(entities + n + 4));
+                __m256i m0 = _mm256_cmpeq_epi64(_mm256_and_si256(e0, cmp_mask), cmp_require);
+                __m256i m1 = _mm256_cmpeq_epi64(_mm256_and_si256(e1, cmp_mask), cmp_require);
+
+                if (k_state)
+                {
+                    __m256i s0 = _mm256_loadu_si256((const __m256i*)(state_flags + n));
+                    __m256i s1 = _mm256_loadu_si256((const __m256i*)(state_flags + n + 4));
+                    m0 = _mm256_and_si256(m0, _mm256_cmpeq_epi64(_mm256_and_si256(s0, state_mask), state_require));
+                    m1 = _mm256_and_si256(m1, _mm256_cmpeq_epi64(_mm256_and_si256(s1, state_mask), state_require));
+                }
+
+                u32 bits = (u32)_mm256_movemask_pd(_mm256_castsi256_pd(m0));
+                bits |= (u32)_mm256_movemask_pd(_mm256_castsi256_pd(m1)) << 4;
+
+                // skip runs of entities which do not match, common for rare components
+                if (bits == 0)
+                    continue;
+
+                for (u32 j = 0; j < 8; ++j)
+                {
+                    entities_out[num] = n + j;
+                    num += (bits >> j) & 1;
+                }
+            }
+
+            return num + query_range_scalar(entities, state_flags, n, count, q, entities_out + num);
+        }
+
+        u32 query_entities_simd256(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                   u32* entities_out)
+        {
+            if (q.require_state | q.exclude_state)
+                return query_entities_simd256_t<true>(entities, state_flags, count, q, entities_out);
+
+            return query_entities_simd256_t<false>(entities, state_flags, count, q, entities_out);
+        }
+#endif
+
+        typedef u32 (*query_entities_func)(const u64*, const u64*, u32, const entity_query&, u32*);
+        static query_entities_func s_query_entities = query_entities_scalar;
+
+        void query_simd_init(u32 simd_level)
+        {
+            s_query_entities = query_entities_scalar;
+
+#if __SSE4_1__ || __AVX__
+            if (simd_level >= e_simd::sse4)
+                s_query_entities = query_entities_simd128;
+#endif
+#if __AVX2__
+            if (simd_level >= e_simd::avx2)
+                s_query_entities = query_entities_simd256;
+#endif
+        }
+
+        u32 query_entities(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                           u32* entities_out)
+        {
+            return s_query_entities(entities, state_flags, count, q, entities_out);
+        }
+
+        //
+        // per scene cache
+        //
+
+        u32* query(ecs_scene* scene, const entity_query& q)
+        {
+            if (!scene->query_cache)
+                scene->query_cache = new ecs_query_cache();
+
+            ecs_query_cache* cache = scene->query_cache;
+
+            cached_query* cq = nullptr;
+            u32           num_queries = sb_count(cache->queries);
+            for (u32 i = 0; i < num_queries; ++i)
+            {
+                if (memcmp(&cache->queries[i].q, &q, sizeof(entity_query)) == 0)
+                {
+                    cq = &cache->queries[i];
+                    break;
+                }
+            }
+
+            if (!cq)
+            {
+                cached_query nq = {q, nullptr, 0};
+                sb_push(cache->queries, nq);
+                cq = &sb_last(cache->queries);
+            }
+
+            if (cq->version == cache->version)
+                return cq->entities;
+
+            // room for every entity to match
+            u32 num_entities = (u32)scene->num_entities;
+            u32 size = sb_count(cq->entities);
+            if (size < num_entities)
+                sb_add(cq->entities, num_entities - size);
+
+            if (cq->entities)
+                stb__sbn(cq->entities) =
+                    query_entities(scene->entities.data, scene->state_flags.data, num_entities, q, cq->entities);
+
+            cq->version = cache->version;
+            return cq->entities;
+        }
+
+        void invalidate_queries(ecs_scene* scene)
+        {
+            if (scene->query_cache)
+                scene->query_cache->version++;
+        }
+
+        void destroy_queries(ecs_scene* scene)
+        {
+            ecs_query_cache* cache = scene->query_cache;
+            if (!cache)
+                return;
+
+            u32 num_queries = sb_count(cache->queries);
+            for (u32 i = 0; i < num_queries; ++i)
+                sb_free(cache->queries[i].entities);
+
+            sb_free(cache->queries);
+            delete cache;
+
+            scene->query_cache = nullptr;
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,41 @@
+// ecs_query.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Cached entity queries over the component and state flags of a scene.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        struct entity_query
+        {
+            u64 require;       // e_cmp flags an entity must have all of
+            u64 exclude;       // e_cmp flags an entity must have none of
+            u64 require_state; // e_state flags an entity must have all of
+            u64 exclude_state; // e_state flags an entity must have none of
+        };
+
+        // called from simd_init with the highest extension supported by the cpu
+        void query_simd_init(u32 simd_level);
+
+        // cached stretchy buffer of entities matching q owned by the scene, do not push to or free it. the list stays
+        // valid until the same query is made after the queries of the scene have been invalidated.
+        u32* query(ecs_scene* scene, const entity_query& q);
+
+        // update_scene invalidates after the controllers and again at the end, flags set before it or by controllers are
+        // seen. code writing e_cmp or e_state flags at any other time must call this, the ecs helpers already do.
+        void invalidate_queries(ecs_scene* scene);
+        void destroy_queries(ecs_scene* scene);
+
+        // uncached scans, entities_out must have room for count entities, returns the number of matching entities
+        u32 query_entities_scalar(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                                  u32* entities_out);
+        u32 query_entities(const u64* entities, const u64* state_flags, u32 count, const entity_query& q,
+                           u32* entities_out);
+    } // namespace ecs
+} // namespace put
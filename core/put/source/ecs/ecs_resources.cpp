@@ -3,6 +3,7 @@
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
 #include "ecs/ecs_resources.h"
+#include "ecs/ecs_query.h"
 #include "ecs/ecs_utilities.h"
 
 #include "debug_render.h"
@@ -32,6 +33,9 @@ namespace
     // constants
     static const u32 k_matrix_floats = 16;
     static const u32 k_extent_floats = 3;
+    static const u32 k_pmm_lod_version = 2; // geometry with a lod chain after each submesh
+    static const u32 k_max_lods = 8;
+    static const f32 k_lod_error = 0.01f; // simplification error of the first lod, doubling with each level
 
     namespace e_pmm_transform
     {
@@ -69,6 +73,17 @@ namespace
         std::vector<Str> geometry_names;
     };
 
+    struct pmm_lod
+    {
+        f32    error;
+        u32    num_indices;
+        u32    num_pos_indices;
+        void*  index_data;
+        size_t index_data_size;
+        void*  pos_index_data;
+        size_t pos_index_data_size;
+    };
+
     struct pmm_submesh
     {
         // pmm submesh header
@@ -85,17 +100,19 @@ namespace
         u32   num_joint_floats;
         mat4  bind_shape_matrix;
         // end of header
-        u32    vertex_size;
-        void*  joint_data;
-        size_t joint_data_size;
-        void*  pos_data;
-        size_t pos_data_size;
-        void*  pos_index_data;
-        size_t pos_index_data_size;
-        void*  vertex_data;
-        size_t vertex_data_size;
-        void*  index_data;
-        size_t index_data_size;
+        u32     vertex_size;
+        void*   joint_data;
+        size_t  joint_data_size;
+        void*   pos_data;
+        size_t  pos_data_size;
+        void*   pos_index_data;
+        size_t  pos_index_data_size;
+        void*   vertex_data;
+        size_t  vertex_data_size;
+        void*   index_data;
+        size_t  index_data_size;
+        u32     num_lods;
+        pmm_lod lods[k_max_lods];
     };
 
     struct pmm_geometry
@@ -239,6 +256,40 @@ namespace
                 memcpy(sm.index_data, p_reader, sm.index_data_size);
                 p_reader = (u32*)((c8*)p_reader + sm.index_data_size);
 
+                // lod chain, index data into the vertex and position buffers above
+                if (og.version >= k_pmm_lod_version)
+                {
+                    u32 num_lods = *p_reader++;
+                    for (u32 l = 0; l < num_lods; ++l)
+                    {
+                        pmm_lod lod;
+                        memcpy(&lod.error, p_reader, sizeof(f32));
+                        p_reader++;
+
+                        lod.num_indices = *p_reader++;
+                        lod.num_pos_indices = *p_reader++;
+
+                        lod.index_data_size = lod.num_indices * sm.index_size;
+                        lod.index_data = pen::memory_alloc(lod.index_data_size);
+                        memcpy(lod.index_data, p_reader, lod.index_data_size);
+                        p_reader = (u32*)((c8*)p_reader + lod.index_data_size);
+
+                        lod.pos_index_data_size = lod.num_pos_indices * sm.pos_index_size;
+                        lod.pos_index_data = pen::memory_alloc(lod.pos_index_data_size);
+                        memcpy(lod.pos_index_data, p_reader, lod.pos_index_data_size);
+                        p_reader = (u32*)((c8*)p_reader + lod.pos_index_data_size);
+
+                        if (sm.num_lods < k_max_lods)
+                        {
+                            sm.lods[sm.num_lods++] = lod;
+                            continue;
+                        }
+
+                        pen::memory_free(lod.index_data);
+                        pen::memory_free(lod.pos_index_data);
+                    }
+                }
+
                 og.submeshes.push_back(sm);
             }
 
@@ -345,6 +396,37 @@ namespace
                     r.index_buffer = pen::renderer_create_buffer(bcp);
                 }
 
+                // lods only need index buffers, the cpu copies are not kept
+                if (sm.num_lods > 0)
+                {
+                    p_geometry->num_lods = sm.num_lods;
+                    p_geometry->lods = (geometry_lod*)pen::memory_alloc(sizeof(geometry_lod) * sm.num_lods);
+
+                    for (u32 l = 0; l < sm.num_lods; ++l)
+                    {
+                        pmm_lod&      pl = sm.lods[l];
+                        geometry_lod& lod = p_geometry->lods[l];
+
+                        lod.error = pl.error;
+                        lod.num_indices = pl.num_indices;
+                        lod.num_position_indices = pl.num_pos_indices;
+
+                        bcp.usage_flags = PEN_USAGE_DEFAULT;
+                        bcp.bind_flags = PEN_BIND_INDEX_BUFFER;
+                        bcp.cpu_access_flags = 0;
+                        bcp.buffer_size = pl.index_data_size;
+                        bcp.data = pl.index_data;
+                        lod.index_buffer = pen::renderer_create_buffer(bcp);
+
+                        bcp.buffer_size = pl.pos_index_data_size;
+                        bcp.data = pl.pos_index_data;
+                        lod.position_index_buffer = pen::renderer_create_buffer(bcp);
+
+                        pen::memory_free(pl.index_data);
+                        pen::memory_free(pl.pos_index_data);
+                    }
+                }
+
                 s_geometry_resources.push_back(p_geometry);
             }
         }
@@ -628,10 +710,6 @@ namespace
 
             scene->local_matrices[current_node] = (matrix);
 
-            // store intial position for physics to hook into later
-            scene->physics_data[current_node].rigid_body.position = translation;
-            scene->physics_data[current_node].rigid_body.rotation = final_rotation;
-
             // assign geometry, materials and physics
             u32 dest = current_node;
             if (num_meshes > 0)
@@ -743,6 +821,8 @@ namespace
             scene->entities[old_root] &= ~e_cmp::allocated;
         }
 
+        invalidate_queries(scene);
+
         // now we have loaded the whole scene fix up any anim controllers
         for (s32 i = root; i < root + total_nodes; ++i)
         {
@@ -818,23 +898,24 @@ namespace put
 
         void instantiate_constraint(ecs_scene* scene, u32 node_index)
         {
-            physics::constraint_params& cp = scene->physics_data[node_index].constraint;
+            physics::constraint_params& cp = scene->physics_data.get_or_add(node_index).constraint;
 
             // hinge
             s32 rb = cp.rb_indices[0];
             cp.pivot = scene->transforms[node_index].translation - scene->physics_data[rb].rigid_body.position;
 
             scene->physics_handles[node_index] = physics::add_constraint(cp);
-            scene->physics_data[node_index].type = e_physics_type::constraint;
+            scene->physics_data.get_or_add(node_index).type = e_physics_type::constraint;
 
             scene->entities[node_index] |= e_cmp::constraint;
+            invalidate_queries(scene);
         }
 
         void bake_rigid_body_params(ecs_scene* scene, u32 node_index)
         {
             u32 s = node_index;
 
-            physics::rigid_body_params& rb = scene->physics_data[s].rigid_body;
+            physics::rigid_body_params& rb = scene->physics_data.get_or_add(s).rigid_body;
             cmp_transform&              pt = scene->physics_offset[s];
 
             vec3f min = scene->bounding_volumes[s].min_extents;
@@ -879,7 +960,7 @@ namespace put
 
             bake_rigid_body_params(scene, node_index);
 
-            physics::rigid_body_params& rb = scene->physics_data[s].rigid_body;
+            physics::rigid_body_params& rb = scene->physics_data.get_or_add(s).rigid_body;
 
             if (rb.shape == physics::e_shape::compound)
             {
@@ -896,8 +977,9 @@ namespace put
                 scene->physics_handles[s] = physics::add_rb(rb);
             }
 
-            scene->physics_data[node_index].type = e_physics_type::rigid_body;
+            scene->physics_data.get_or_add(node_index).type = e_physics_type::rigid_body;
             scene->entities[s] |= e_cmp::physics;
+            invalidate_queries(scene);
         }
 
         using physics::rigid_body_params;
@@ -914,7 +996,7 @@ namespace put
                 rbchild[i] = scene->physics_data[ci].rigid_body;
             }
 
-            physics::rigid_body_params& rb = scene->physics_data[parent].rigid_body;
+            physics::rigid_body_params& rb = scene->physics_data.get_or_add(parent).rigid_body;
 
             physics::compound_rb_params cbpr;
             cbpr.rb = nullptr;
@@ -924,7 +1006,7 @@ namespace put
 
             u32* child_handles = nullptr;
             scene->physics_handles[parent] = physics::add_compound_rb(cbpr, &child_handles);
-            scene->physics_data[parent].type = e_physics_type::rigid_body;
+            scene->physics_data.get_or_add(parent).type = e_physics_type::rigid_body;
             scene->entities[parent] |= e_cmp::physics;
 
             // fixup children
@@ -933,9 +1015,11 @@ namespace put
             {
                 u32 ci = children[i];
                 scene->physics_handles[ci] = child_handles[i];
-                scene->physics_data[ci].type = e_physics_type::compound_child;
+                scene->physics_data.get_or_add(ci).type = e_physics_type::compound_child;
                 scene->entities[ci] |= e_cmp::physics;
             }
+
+            invalidate_queries(scene);
         }
 
         void destroy_physics(ecs_scene* scene, s32 node_index)
@@ -944,6 +1028,7 @@ namespace put
                 return;
 
             scene->entities[node_index] &= ~e_cmp::physics;
+            invalidate_queries(scene);
 
             physics::release_entity(scene->physics_handles[node_index]);
             scene->physics_handles[node_index] = PEN_INVALID_HANDLE;
@@ -970,6 +1055,7 @@ namespace put
             bv->min_extents = gr->min_extents;
             bv->max_extents = gr->max_extents;
             bv->radius = mag(bv->max_extents - bv->min_extents) * 0.5f;
+            scene->state_flags[node_index] |= e_state::transform_dirty;
 
             scene->geometry_names[node_index] = gr->geometry_name;
             scene->id_geometry[node_index] = gr->hash;
@@ -978,6 +1064,8 @@ namespace put
             if (gr->p_skin)
                 scene->entities[node_index] |= e_cmp::skinned;
 
+            invalidate_queries(scene);
+
             instance->vertex_shader_class = ID_VERTEX_CLASS_BASIC;
             if (scene->entities[node_index] & e_cmp::skinned)
                 instance->vertex_shader_class = ID_VERTEX_CLASS_SKINNED;
@@ -1001,33 +1089,43 @@ namespace put
 
             scene->entities[node_index] &= ~e_cmp::geometry;
             scene->entities[node_index] &= ~e_cmp::material;
+            invalidate_queries(scene);
 
             // zero cmp geom
             pen::memory_zero(&scene->geometries[node_index], sizeof(cmp_geometry));
 
-            // release cbuffer
-            pen::renderer_release_buffer(scene->cbuffer[node_index]);
+            // draw constants
             scene->cbuffer[node_index] = PEN_INVALID_HANDLE;
             scene->geometry_names[node_index] = "";
 
-            // release matrial cbuffer
-            if (is_valid(scene->materials[node_index].material_cbuffer))
-                pen::renderer_release_buffer(scene->materials[node_index].material_cbuffer);
+            // release matrial cbuffer, shared cbuffers are released with the scene
+            u32 mcb = scene->materials[node_index].material_cbuffer;
+            if (is_valid(mcb) && !(scene->state_flags[node_index] & e_state::shared_material))
+                pen::renderer_release_buffer(mcb);
 
             scene->materials[node_index].material_cbuffer = PEN_INVALID_HANDLE;
+            scene->state_flags[node_index] &= ~e_state::shared_material;
         }
 
         void instantiate_material_cbuffer(ecs_scene* scene, s32 node_index, s32 size)
         {
+            // material data is uploaded by the next update
+            scene->state_flags[node_index] |= e_state::draw_dirty;
+
             if (is_valid(scene->materials[node_index].material_cbuffer))
             {
                 if (size == scene->materials[node_index].material_cbuffer_size)
                     return;
 
-                pen::renderer_release_buffer(scene->materials[node_index].material_cbuffer);
+                if (!(scene->state_flags[node_index] & e_state::shared_material))
+                    pen::renderer_release_buffer(scene->materials[node_index].material_cbuffer);
+
                 scene->materials[node_index].material_cbuffer = PEN_INVALID_HANDLE;
             }
 
+            // the entity owns any cbuffer created from here
+            scene->state_flags[node_index] &= ~e_state::shared_material;
+
             if (size == 0)
                 return;
 
@@ -1045,14 +1143,9 @@ namespace put
 
         void instantiate_model_cbuffer(ecs_scene* scene, s32 node_index)
         {
-            pen::buffer_creation_params bcp;
-            bcp.usage_flags = PEN_USAGE_DYNAMIC;
-            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
-            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
-            bcp.buffer_size = sizeof(cmp_draw_call);
-            bcp.data = nullptr;
-
-            scene->cbuffer[node_index] = pen::renderer_create_buffer(bcp);
+            // draw constants are written in update_scene
+            scene->cbuffer[node_index] = k_draw_cbuffer;
+            scene->state_flags[node_index] |= e_state::draw_dirty;
         }
 
         void instantiate_model_pre_skin(ecs_scene* scene, s32 node_index)
@@ -1089,6 +1182,7 @@ namespace put
             // set pre-skinned and unset skinned
             scene->entities[node_index] |= e_cmp::pre_skinned;
             scene->entities[node_index] &= ~e_cmp::skinned;
+            invalidate_queries(scene);
 
             geom.vertex_shader_class = ID_VERTEX_CLASS_BASIC;
         }
@@ -1099,7 +1193,7 @@ namespace put
 
             if (geom->p_skin)
             {
-                cmp_anim_controller_v2& controller = scene->anim_controller_v2[node_index];
+                cmp_anim_controller_v2& controller = scene->anim_controller_v2.get_or_add(node_index);
 
                 std::vector<s32> joint_indices;
                 build_heirarchy_node_list(scene, node_index, joint_indices);
@@ -1119,6 +1213,7 @@ namespace put
                 }
 
                 scene->entities[node_index] |= e_cmp::anim_controller;
+                invalidate_queries(scene);
             }
         }
 
@@ -1146,6 +1241,7 @@ namespace put
             scene->shadows[node_index].texture_handle = volume_texture;
             scene->shadows[node_index].sampler_state = pmfx::get_render_state(id_cl, pmfx::e_render_state::sampler);
             scene->entities[node_index] |= e_cmp::sdf_shadow;
+            invalidate_queries(scene);
         }
 
         void instantiate_light(ecs_scene* scene, u32 node_index)
@@ -1155,10 +1251,12 @@ namespace put
 
             // cbuffer for draw call, light volume for editor / deferred etc
             scene->entities[node_index] |= e_cmp::light;
+            invalidate_queries(scene);
             instantiate_model_cbuffer(scene, node_index);
 
             scene->bounding_volumes[node_index].min_extents = -vec3f::one();
             scene->bounding_volumes[node_index].max_extents = vec3f::one();
+            scene->state_flags[node_index] |= e_state::transform_dirty;
 
             scene->world_matrices[node_index] = mat4::create_identity();
             f32 rad = std::max<f32>(scene->lights[node_index].radius, 1.0f);
@@ -1172,7 +1270,7 @@ namespace put
             snl.spot_falloff = 0.001f;
             snl.cos_cutoff = 0.1f;
 
-            area_light_resource& alr = scene->area_light_resources[node_index];
+            area_light_resource& alr = scene->area_light_resources.get_or_add(node_index);
             alr.sampler_state_name = "";
             alr.texture_name = "";
             alr.shader_name = "";
@@ -1194,6 +1292,7 @@ namespace put
             instantiate_model_cbuffer(scene, node_index);
 
             scene->entities[node_index] |= e_cmp::light;
+            invalidate_queries(scene);
             scene->lights[node_index].type = e_light_type::area;
             scene->area_light[node_index].shader = PEN_INVALID_HANDLE;
         }
@@ -1213,6 +1312,7 @@ namespace put
             instantiate_model_cbuffer(scene, node_index);
 
             scene->entities[node_index] |= e_cmp::light;
+            invalidate_queries(scene);
             scene->lights[node_index].type = e_light_type::area_ex;
 
             if (!alr.texture_name.empty())
@@ -1234,7 +1334,7 @@ namespace put
             }
 
             // store for later for save load.
-            scene->area_light_resources[node_index] = alr;
+            scene->area_light_resources.get_or_add(node_index) = alr;
         }
 
         void instantiate_material(material_resource* mr, ecs_scene* scene, u32 node_index)
@@ -1243,6 +1343,7 @@ namespace put
             scene->material_names[node_index] = mr->material_name;
 
             scene->entities[node_index] |= e_cmp::material;
+            invalidate_queries(scene);
 
             // set defaults
             if (mr->id_shader == 0)
@@ -1340,6 +1441,7 @@ namespace put
 
                 scene->entities[node_index] |= e_cmp::samplers;
                 scene->state_flags[node_index] |= e_state::samplers_initialised;
+                invalidate_queries(scene);
             }
 
             // bake ss handles
@@ -1691,15 +1793,21 @@ namespace put
             void*  ib;
             void*  vb;
             u32    index_size;
+            u32    vertex_size;
             size_t vb_size;
             size_t ib_size;
             size_t vertex_count;
             size_t num_indices;
+            u32    num_lods;
+            void*  lod_ib[k_max_lods];
+            size_t lod_num_indices[k_max_lods];
         };
 
         mesh_opt optimise_vb(u32* index_data, u32 num_indices, void* vertex_data, u32 num_verts, u32 vertex_size)
         {
             mesh_opt opt;
+            opt.vertex_size = vertex_size;
+            opt.num_lods = 0;
 
             opt.ib_size = num_indices * sizeof(u32);
             opt.ib = (u32*)pen::memory_alloc(opt.ib_size);
@@ -1729,7 +1837,50 @@ namespace put
             return opt;
         }
 
-        void optimise_pmm(const c8* input_filename, const c8* output_filename)
+        f32 lod_error(u32 level)
+        {
+            return k_lod_error * (f32)(1 << level);
+        }
+
+        void generate_lods(mesh_opt& opt, u32 num_lods)
+        {
+            // each level aims for half the triangles of the previous within a growing error, positions are the first
+            // 3 floats of each vertex. the chain stops once the simplifier can not make progress.
+            size_t prev_indices = opt.num_indices;
+            for (u32 l = 0; l < num_lods && l < k_max_lods; ++l)
+            {
+                size_t target = (opt.num_indices >> (l + 1)) / 3 * 3;
+                u32*   lod = (u32*)pen::memory_alloc(opt.num_indices * sizeof(u32));
+
+                size_t count = meshopt_simplify(lod, (u32*)opt.ib, opt.num_indices, (f32*)opt.vb, opt.vertex_count,
+                                                opt.vertex_size, target, lod_error(l));
+
+                if (count == 0 || count >= prev_indices - prev_indices / 10)
+                {
+                    pen::memory_free(lod);
+                    break;
+                }
+
+                meshopt_optimizeVertexCache(lod, lod, count, opt.vertex_count);
+
+                opt.lod_ib[l] = lod;
+                opt.lod_num_indices[l] = count;
+                opt.num_lods++;
+                prev_indices = count;
+            }
+        }
+
+        size_t lod_chain_size(const pmm_submesh& sm)
+        {
+            // count, then the error, index counts and index data of each level
+            size_t size = sizeof(u32);
+            for (u32 l = 0; l < sm.num_lods; ++l)
+                size += sizeof(u32) * 3 + sm.lods[l].index_data_size + sm.lods[l].pos_index_data_size;
+
+            return size;
+        }
+
+        void optimise_pmm(const c8* input_filename, const c8* output_filename, u32 num_lods)
         {
             pmm_contents contents;
             if (!parse_pmm_contents(input_filename, contents))
@@ -1775,6 +1926,9 @@ namespace put
                                 std::swap(i32[i], i32[i + 2]);
                         }
 
+                        // lods keep the winding
+                        generate_lods(o, num_lods);
+
                         // reduce index size to u16 if possible
                         o.index_size = 4;
                         if (o.vertex_count < 65535)
@@ -1787,9 +1941,38 @@ namespace put
                             pen::memory_free(o.ib);
                             o.ib = nni;
                             o.index_size = 2;
+
+                            for (u32 l = 0; l < o.num_lods; ++l)
+                            {
+                                u32* li32 = (u32*)o.lod_ib[l];
+                                u16* li16 = (u16*)pen::memory_alloc(o.lod_num_indices[l] * sizeof(u16));
+                                for (u32 i = 0; i < o.lod_num_indices[l]; ++i)
+                                    li16[i] = li32[i];
+
+                                pen::memory_free(li32);
+                                o.lod_ib[l] = li16;
+                            }
                         }
                     }
 
+                    // the full and position only chains must have the same levels
+                    u32 lods = std::min(opt[0].num_lods, opt[1].num_lods);
+                    for (auto& o : opt)
+                    {
+                        for (u32 l = lods; l < o.num_lods; ++l)
+                            pen::memory_free(o.lod_ib[l]);
+
+                        o.num_lods = lods;
+                    }
+
+                    // lods from a previous optimisation index the old vertex buffers
+                    intptr_t prev_lod_size = g.version >= k_pmm_lod_version ? (intptr_t)lod_chain_size(sm) : 0;
+                    for (u32 l = 0; l < sm.num_lods; ++l)
+                    {
+                        pen::memory_free(sm.lods[l].index_data);
+                        pen::memory_free(sm.lods[l].pos_index_data);
+                    }
+
                     // cleanup the old / temp buffers
                     pen::memory_free(sm.vertex_data);
                     pen::memory_free(sm.index_data);
@@ -1822,9 +2005,29 @@ namespace put
                     sm.num_pos_verts = (u32)opt[1].vertex_count;
                     sm.pos_index_size = opt[1].index_size;
 
+                    sm.num_lods = lods;
+                    for (u32 l = 0; l < lods; ++l)
+                    {
+                        pmm_lod& lod = sm.lods[l];
+                        lod.error = lod_error(l);
+                        lod.num_indices = (u32)opt[0].lod_num_indices[l];
+                        lod.index_data = opt[0].lod_ib[l];
+                        lod.index_data_size = lod.num_indices * opt[0].index_size;
+                        lod.num_pos_indices = (u32)opt[1].lod_num_indices[l];
+                        lod.pos_index_data = opt[1].lod_ib[l];
+                        lod.pos_index_data_size = lod.num_pos_indices * opt[1].index_size;
+
+                        PEN_LOG("    lod %i: %i triangles, error %f", l + 1, lod.num_indices / 3, lod.error);
+                    }
+
+                    reduction += (intptr_t)lod_chain_size(sm) - prev_lod_size;
+
                     mc++;
                 }
                 reductions.push_back(reduction);
+
+                // lod chains are always written
+                g.version = std::max(g.version, k_pmm_lod_version);
             }
 
             // work out the offset adjustments, geom is at the end so we dont need to bother with the last one.
@@ -1940,6 +2143,17 @@ namespace put
                     ofs.write((const c8*)sm.vertex_data, sm.vertex_data_size);
                     ofs.write((const c8*)sm.pos_index_data, sm.pos_index_data_size);
                     ofs.write((const c8*)sm.index_data, sm.index_data_size);
+                    // lods
+                    ofs.write((const c8*)&sm.num_lods, sizeof(u32));
+                    for (u32 l = 0; l < sm.num_lods; ++l)
+                    {
+                        const pmm_lod& lod = sm.lods[l];
+                        ofs.write((const c8*)&lod.error, sizeof(f32));
+                        ofs.write((const c8*)&lod.num_indices, sizeof(u32));
+                        ofs.write((const c8*)&lod.num_pos_indices, sizeof(u32));
+                        ofs.write((const c8*)lod.index_data, lod.index_data_size);
+                        ofs.write((const c8*)lod.pos_index_data, lod.pos_index_data_size);
+                    }
                 }
             }
 
@@ -1955,6 +2169,12 @@ namespace put
                     pen::memory_free(sm.pos_index_data);
                     pen::memory_free(sm.index_data);
                     pen::memory_free(sm.joint_data);
+
+                    for (u32 l = 0; l < sm.num_lods; ++l)
+                    {
+                        pen::memory_free(sm.lods[l].index_data);
+                        pen::memory_free(sm.lods[l].pos_index_data);
+                    }
                 }
             }
             pen::memory_free(contents.file_data);
@@ -228,6 +228,8 @@ namespace put
             vec3f          max_extents;
             cmp_skin*      p_skin;
             pmm_renderable renderable[e_pmm_renderable::COUNT];
+            geometry_lod*  lods = nullptr; // simplified levels from optimise_pmm, finest first
+            u32            num_lods = 0;
         };
 
         struct vertex_2d
@@ -273,7 +275,8 @@ namespace put
         s32 load_pma(const c8* model_scene_name);
         s32 load_pmv(const c8* filename, ecs_scene* scene);
 
-        void optimise_pmm(const c8* input_filename, const c8* output_filename);
+        // optimises vertex and index buffers for the gpu caches and adds num_lods simplified levels to each submesh
+        void optimise_pmm(const c8* input_filename, const c8* output_filename, u32 num_lods = 0);
         void optimise_pma(const c8* input_filename, const c8* output_filename);
 
         void instantiate_rigid_body(ecs_scene* scene, u32 node_index);
@@ -2,6 +2,8 @@
 // Copyright 2014 - 2019 Alex Dixon.
 // License: https://github.com/polymonster/pmtech/blob/master/license.md
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
 #include <functional>
 
@@ -14,13 +16,20 @@
 #include "input.h"
 #include "os.h"
 #include "pmfx.h"
+#include "renderer_shared.h"
 #include "str/Str.h"
 #include "str_utilities.h"
+#include "threads.h"
 #include "timer.h"
 
+#include "ecs/ecs_bvh.h"
 #include "ecs/ecs_cull.h"
+#include "ecs/ecs_light_cluster.h"
+#include "ecs/ecs_occlusion.h"
+#include "ecs/ecs_query.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
+#include "ecs/ecs_transform.h"
 #include "ecs/ecs_utilities.h"
 
 using namespace put;
@@ -54,60 +63,519 @@ namespace put
             sb_push(scene->controllers, controller);
         }
 
-        void initialise_free_list(ecs_scene* scene)
+        // the unallocated entities of [start, end) become the free list in ascending order
+        static void link_free_list(ecs_scene* scene, u32 start, u32 end)
         {
             scene->free_list_head = nullptr;
 
-            for (s32 i = scene->soa_size - 1; i >= 0; --i)
+            free_node_list* tail = nullptr;
+            for (u32 i = start; i < end; ++i)
             {
-                scene->free_list[i].node = i;
+                free_node_list* l = &scene->free_list[i];
+                l->node = i;
 
-                if (!(scene->entities[i] & e_cmp::allocated))
-                {
-                    free_node_list* l = &scene->free_list[i];
-                    l->next = scene->free_list_head;
+                if (scene->entities[i] & e_cmp::allocated)
+                    continue;
 
-                    if (l->next)
-                        l->next->prev = l;
+                l->prev = tail;
+                l->next = nullptr;
 
+                if (tail)
+                    tail->next = l;
+                else
                     scene->free_list_head = l;
-                }
+
+                tail = l;
             }
 
             if (!scene->free_list_head)
                 PEN_ASSERT(0);
         }
 
-        void resize_scene_buffers(ecs_scene* scene, s32 size)
+        void initialise_free_list(ecs_scene* scene)
+        {
+            link_free_list(scene, 0, scene->soa_size);
+        }
+
+        // base components in ecs_scene declaration order
+        static const c8* k_component_names[] = {"entities", "state_flags", "id_name", "id_geometry", "id_material", "names",
+                                                "geometry_names", "material_names", "parents", "transforms", "local_matrices",
+                                                "world_matrices", "offset_matrices", "physics_matrices", "bounding_volumes",
+                                                "lights", "physics_handles", "master_instances", "geometries", "pre_skin",
+                                                "physics_data", "position_geometries", "cbuffer", "draw_call_data",
+                                                "free_list", "materials", "material_data", "material_resources", "shadows",
+                                                "samplers", "material_permutation", "initial_transform", "anim_controller_v2",
+                                                "physics_offset", "physics_debug_cbuffer", "area_light",
+                                                "area_light_resources", "render_flags", "pos_extent"};
+
+        // slots grow with the other per entity arrays, entities without the component index slot 0
+        static void sparse_pool_init(generic_cmp_array& cmp)
+        {
+            sparse_pool& pool = cmp.pool;
+            if (pool.pages)
+                return;
+
+            pool.pages = (u8**)pen::memory_alloc(sizeof(u8*));
+            pool.pages[0] = (u8*)pen::memory_alloc(cmp.size * k_sparse_page_size);
+            pen::memory_zero(pool.pages[0], cmp.size * k_sparse_page_size);
+
+            pool.entities = (u32*)pen::memory_alloc(sizeof(u32) * k_sparse_page_size);
+            pool.entities[0] = PEN_INVALID_HANDLE;
+
+            pool.capacity = k_sparse_page_size;
+            pool.num_slots = 1;
+        }
+
+        static void sparse_pool_free(generic_cmp_array& cmp)
+        {
+            sparse_pool& pool = cmp.pool;
+
+            u32 num_pages = pool.capacity >> k_sparse_page_shift;
+            for (u32 p = 0; p < num_pages; ++p)
+                pen::memory_free(pool.pages[p]);
+
+            pen::memory_free(pool.pages);
+            pen::memory_free(pool.entities);
+            sb_free(pool.free_slots);
+
+            pool = sparse_pool();
+        }
+
+        static void sparse_pool_release(generic_cmp_array& cmp, u32 index)
+        {
+            sparse_pool& pool = cmp.pool;
+
+            u32 s = pool.slots[index];
+            if (!s)
+                return;
+
+            // slots are reused in place so the other elements keep their address
+            pen::memory_zero(sparse_pool_slot(pool, cmp.size, s), cmp.size);
+            pool.entities[s] = PEN_INVALID_HANDLE;
+            pool.slots[index] = 0;
+            sb_push(pool.free_slots, s);
+        }
+
+        static bool is_zero(const void* data, u32 size)
+        {
+            const u8* d = (const u8*)data;
+            for (u32 i = 0; i < size; ++i)
+                if (d[i])
+                    return false;
+
+            return true;
+        }
+
+        void* sparse_cmp_insert(generic_cmp_array& cmp, size_t index)
+        {
+            sparse_pool& pool = cmp.pool;
+
+            u32 s = pool.slots[index];
+            if (s)
+                return sparse_pool_slot(pool, cmp.size, s);
+
+            u32 num_free = sb_count(pool.free_slots);
+            if (num_free)
+            {
+                s = pool.free_slots[num_free - 1];
+                stb__sbn(pool.free_slots)--;
+            }
+            else
+            {
+                if (pool.num_slots == pool.capacity)
+                {
+                    // add a page, existing pages never move
+                    u32 num_pages = pool.capacity >> k_sparse_page_shift;
+                    pool.pages = (u8**)pen::memory_realloc(pool.pages, sizeof(u8*) * (num_pages + 1));
+                    pool.pages[num_pages] = (u8*)pen::memory_alloc(cmp.size * k_sparse_page_size);
+                    pen::memory_zero(pool.pages[num_pages], cmp.size * k_sparse_page_size);
+
+                    pool.capacity += k_sparse_page_size;
+                    pool.entities = (u32*)pen::memory_realloc(pool.entities, sizeof(u32) * pool.capacity);
+                }
+
+                s = pool.num_slots++;
+            }
+
+            pool.slots[index] = s;
+            pool.entities[s] = (u32)index;
+
+            return sparse_pool_slot(pool, cmp.size, s);
+        }
+
+        void zero_component(generic_cmp_array& cmp, u32 index)
+        {
+            if (cmp.flags & e_cmp_array_flags::sparse)
+            {
+                sparse_pool_release(cmp, index);
+                return;
+            }
+
+            pen::memory_zero((u8*)cmp.data + index * cmp.size, cmp.size);
+        }
+
+        void set_component(generic_cmp_array& cmp, u32 index, const void* data)
+        {
+            if ((cmp.flags & e_cmp_array_flags::sparse) && is_zero(data, cmp.size))
+            {
+                sparse_pool_release(cmp, index);
+                return;
+            }
+
+            void* dst = cmp.get_or_add(index);
+            if (dst != data)
+                memcpy(dst, data, cmp.size);
+        }
+
+        void copy_component(generic_cmp_array& dst, u32 dst_index, const generic_cmp_array& src, u32 src_index)
+        {
+            if ((src.flags & e_cmp_array_flags::sparse) && !src.has(src_index))
+            {
+                zero_component(dst, dst_index);
+                return;
+            }
+
+            set_component(dst, dst_index, src.get(src_index));
+        }
+
+        template <typename T>
+        static T* sb_clone(const T* src)
+        {
+            T*  dst = nullptr;
+            u32 n = src ? sb_count(src) : 0;
+            if (n)
+                memcpy(sb_add(dst, n), src, sizeof(T) * n);
+
+            return dst;
+        }
+
+        void copy_component_buffers(ecs_scene* scene, u32 dst, u32 src)
+        {
+            if (scene->anim_controller_v2.has(src))
+            {
+                const cmp_anim_controller_v2& sc = scene->anim_controller_v2.get(src);
+                cmp_anim_controller_v2&       dc = scene->anim_controller_v2.get_or_add(dst);
+
+                dc.joint_indices = sb_clone(sc.joint_indices);
+                dc.joint_flags = sb_clone(sc.joint_flags);
+                dc.anim_instances = sb_clone(sc.anim_instances);
+
+                u32 num_anims = sb_count(dc.anim_instances);
+                for (u32 i = 0; i < num_anims; ++i)
+                {
+                    anim_instance& a = dc.anim_instances[i];
+                    a.targets = sb_clone(a.targets);
+                    a.joints = sb_clone(a.joints);
+                    a.samplers = sb_clone(a.samplers);
+                }
+            }
+
+            if (scene->entities[src] & e_cmp::pre_skinned)
+            {
+                cmp_pre_skin& pre_skin = scene->pre_skin[dst];
+                cmp_geometry& geom = scene->geometries[dst];
+
+                // skinned vertices from the geometry resource, released with the entity
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DEFAULT;
+                bcp.bind_flags = PEN_BIND_VERTEX_BUFFER;
+                bcp.cpu_access_flags = 0;
+                bcp.buffer_size = pre_skin.vertex_size * pre_skin.num_verts;
+                bcp.data = nullptr;
+
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[src]);
+                if (gr)
+                    bcp.data = gr->renderable[e_pmm_renderable::full_vertex_buffer].cpu_vertex_buffer;
+
+                pre_skin.vertex_buffer = bcp.data ? pen::renderer_create_buffer(bcp) : 0;
+                pre_skin.position_buffer = 0;
+
+                // stream out target
+                bcp.bind_flags = PEN_STREAM_OUT_VERTEX_BUFFER;
+                bcp.buffer_size = sizeof(vertex_model) * pre_skin.num_verts;
+                bcp.data = nullptr;
+
+                geom.vertex_buffer = pen::renderer_create_buffer(bcp);
+                geom.position_buffer = 0;
+            }
+        }
+
+        void get_component_memory(ecs_scene* scene, std::vector<component_memory>& report)
         {
-            u32 new_size = scene->soa_size + size;
+            PEN_ASSERT(PEN_ARRAY_SIZE(k_component_names) == scene->num_base_components);
+
+            report.clear();
+
+            u32 num_ext = sb_count(scene->extensions);
+            u32 ext = 0;
+            u32 ext_start = scene->num_base_components;
 
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                u32                alloc_size = cmp.size * new_size;
 
-                if (cmp.data)
+                component_memory cm;
+                cm.index = i;
+                cm.size = cmp.size;
+                cm.flags = cmp.flags;
+                cm.dense_bytes = (size_t)cmp.size * scene->soa_size;
+
+                if (i < scene->num_base_components)
+                {
+                    cm.name = k_component_names[i];
+                }
+                else
                 {
-                    // realloc
-                    cmp.data = pen::memory_realloc(cmp.data, alloc_size);
+                    while (ext < num_ext && i >= ext_start + scene->extensions[ext].num_components)
+                        ext_start += scene->extensions[ext++].num_components;
 
-                    // zero new mem
-                    u32 prev_size = scene->soa_size * cmp.size;
-                    u8* new_offset = (u8*)cmp.data + prev_size;
-                    u32 zero_size = alloc_size - prev_size;
-                    pen::memory_zero(new_offset, zero_size);
+                    cm.name = ext < num_ext ? scene->extensions[ext].name.c_str() : "";
+                }
 
-                    continue;
+                if (cmp.flags & e_cmp_array_flags::sparse)
+                {
+                    const sparse_pool& pool = cmp.pool;
+                    cm.elements = pool.num_slots ? pool.num_slots - 1 - sb_count(pool.free_slots) : 0;
+                    cm.used_bytes = (size_t)cm.elements * cmp.size;
+                    cm.allocated_bytes = (size_t)pool.capacity * (cmp.size + sizeof(u32));
+                    cm.allocated_bytes += (size_t)scene->soa_size * sizeof(u32);
+                    cm.allocated_bytes += (pool.capacity >> k_sparse_page_shift) * sizeof(u8*);
+                }
+                else
+                {
+                    cm.elements = (u32)scene->num_entities;
+                    cm.used_bytes = (size_t)cmp.size * scene->num_entities;
+                    cm.allocated_bytes = cm.dense_bytes;
+                }
+
+                report.push_back(cm);
+            }
+        }
+
+        // calls f(data, element_size) with every per entity array of the scene and stores the array f returns
+        template <typename F>
+        static void for_each_entity_array(ecs_scene* scene, F f)
+        {
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+
+                if (cmp.flags & e_cmp_array_flags::sparse)
+                    cmp.pool.slots = (u32*)f(cmp.pool.slots, sizeof(u32));
+                else
+                    cmp.data = f(cmp.data, cmp.size);
+            }
+
+            scene->draw_cbuffer_offsets = (u32*)f(scene->draw_cbuffer_offsets, sizeof(u32));
+            scene->draw_cbuffers = (u32*)f(scene->draw_cbuffers, sizeof(u32));
+            scene->entity_extents = (extents*)f(scene->entity_extents, sizeof(extents));
+            scene->entity_lods = (entity_lod*)f(scene->entity_lods, sizeof(entity_lod));
+        }
+
+        // doubles from the scene size up to a chunk so small scenes commit little, larger ones commit whole chunks
+        static u32 entity_commit_size(u32 prev_size, u32 count)
+        {
+            if (count >= k_entity_chunk_size)
+                return (count + k_entity_chunk_size - 1) & ~(k_entity_chunk_size - 1);
+
+            u32 size = std::max<u32>(prev_size, 1);
+            while (size < count)
+                size *= 2;
+
+            return std::min<u32>(size, k_entity_chunk_size);
+        }
+
+        static void entity_array_free(void* data, size_t element_size, u32 reserved_size)
+        {
+            if (reserved_size)
+                pen::memory_release(data, element_size * reserved_size);
+            else
+                pen::memory_free(data);
+        }
+
+        // commits the new elements of a reserved array in place, they are zero. false if the memory is not available
+        static bool entity_array_commit(void* data, size_t element_size, u32 prev_size, u32 new_size)
+        {
+            return pen::memory_commit((u8*)data + element_size * prev_size, element_size * (new_size - prev_size));
+        }
+
+        // new elements are zero
+        static void* entity_array_realloc(void* data, size_t element_size, u32 prev_size, u32 new_size)
+        {
+            size_t offset = element_size * prev_size;
+            size_t grow = element_size * (new_size - prev_size);
+
+            data = pen::memory_realloc(data, offset + grow);
+            pen::memory_zero((u8*)data + offset, grow);
+            return data;
+        }
+
+        // moves reserved arrays to plain allocations of the current size
+        static void release_scene_reservation(ecs_scene* scene)
+        {
+            u32 size = scene->soa_size;
+            u32 reserved_size = scene->reserved_size;
+
+            for_each_entity_array(scene, [=](void* data, size_t element_size) -> void* {
+                void* mem = size ? pen::memory_alloc(element_size * size) : nullptr;
+                if (mem)
+                    memcpy(mem, data, element_size * size);
+
+                entity_array_free(data, element_size, reserved_size);
+                return mem;
+            });
+
+            scene->reserved_size = 0;
+        }
+
+        // puts every per entity array in address space reserved for reserve_size entities, arrays already reserved at
+        // that size stay where they are. if any reservation fails the scene falls back to reallocating its arrays.
+        static bool reserve_scene_buffers(ecs_scene* scene, u32 reserve_size)
+        {
+            u32    size = scene->soa_size;
+            u32    prev_reserve_size = scene->reserved_size;
+            void** reserved = nullptr;
+            bool   ok = true;
+
+            for_each_entity_array(scene, [&](void* data, size_t element_size) -> void* {
+                void* mem = nullptr;
+                if (ok && (!data || reserve_size != prev_reserve_size))
+                {
+                    mem = pen::memory_reserve(element_size * reserve_size);
+                    if (mem && !pen::memory_commit(mem, element_size * size))
+                    {
+                        pen::memory_release(mem, element_size * reserve_size);
+                        mem = nullptr;
+                    }
+
+                    ok = mem != nullptr;
+                }
+
+                sb_push(reserved, mem);
+                return data;
+            });
+
+            u32 i = 0;
+            for_each_entity_array(scene, [&](void* data, size_t element_size) -> void* {
+                void* mem = reserved[i++];
+                if (!ok)
+                {
+                    pen::memory_release(mem, element_size * reserve_size);
+
+                    // previously reserved arrays move to plain allocations
+                    if (!data || !prev_reserve_size)
+                        return data;
+
+                    mem = pen::memory_alloc(element_size * size);
+                }
+                else if (!mem)
+                {
+                    return data;
+                }
+
+                if (data)
+                {
+                    memcpy(mem, data, element_size * size);
+                    entity_array_free(data, element_size, prev_reserve_size);
+                }
+
+                return mem;
+            });
+
+            sb_free(reserved);
+
+            scene->reserved_size = ok ? reserve_size : 0;
+            return ok;
+        }
+
+        void resize_scene_buffers(ecs_scene* scene, s32 size)
+        {
+            u32             prev_size = scene->soa_size;
+            u32             new_size = prev_size + size;
+            free_node_list* free_list = scene->free_list.data;
+
+            // scenes reserve address space for k_entity_reserve_default entities on first use and then commit in place,
+            // arrays only move when the reservation runs out. 32 bit address space is too small to reserve for every array.
+            if ((prev_size == 0 || scene->reserved_size) && sizeof(size_t) == 8)
+            {
+                u32 commit_size = entity_commit_size(prev_size, new_size);
+                u32 reserve_size = scene->reserved_size;
+                if (commit_size > reserve_size)
+                {
+                    reserve_size = std::max<u32>(scene->reserve_hint, k_entity_reserve_default);
+                    if (commit_size > reserve_size)
+                        reserve_size = commit_size * k_entity_reserve_scale;
+                }
+
+                if (reserve_scene_buffers(scene, reserve_size))
+                    new_size = commit_size;
+            }
+
+            bool reserved = scene->reserved_size != 0;
+            if (reserved)
+            {
+                bool committed = true;
+                for_each_entity_array(scene, [&](void* data, size_t element_size) -> void* {
+                    committed = committed && entity_array_commit(data, element_size, prev_size, new_size);
+                    return data;
+                });
+
+                // out of memory to commit, the arrays fall back to reallocating
+                if (!committed)
+                {
+                    PEN_LOG("[ecs] failed to commit %u entities, scene buffers are reallocated from now on", new_size);
+                    release_scene_reservation(scene);
+                    reserved = false;
                 }
+            }
+
+            if (!reserved)
+            {
+                for_each_entity_array(scene, [=](void* data, size_t element_size) -> void* {
+                    return entity_array_realloc(data, element_size, data ? prev_size : 0, new_size);
+                });
+            }
+
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+                if (cmp.flags & e_cmp_array_flags::sparse)
+                    sparse_pool_init(cmp);
+            }
 
-                // alloc and zero
-                cmp.data = pen::memory_alloc(alloc_size);
-                pen::memory_zero(cmp.data, alloc_size);
+            // transient cbuffer offsets are rewritten every update, new entities have none until then
+            for (u32 i = prev_size; i < new_size; ++i)
+            {
+                scene->draw_cbuffer_offsets[i] = PEN_INVALID_HANDLE;
+                scene->draw_cbuffers[i] = PEN_INVALID_HANDLE;
             }
 
             scene->soa_size = new_size;
-            initialise_free_list(scene);
+
+            // free nodes keep their addresses when the arrays stay in place, an exhausted list only needs the new entities
+            if (reserved && !scene->free_list_head && free_list == scene->free_list.data)
+                link_free_list(scene, prev_size, new_size);
+            else
+                initialise_free_list(scene);
+        }
+
+        void reserve_entities(ecs_scene* scene, u32 count)
+        {
+            scene->reserve_hint = count;
+
+            // scenes without arrays reserve on first use, arrays which are reallocated stay that way
+            if (scene->soa_size && scene->reserved_size && count > scene->reserved_size)
+                reserve_scene_buffers(scene, count);
+        }
+
+        void grow_scene_buffers(ecs_scene* scene, u32 count)
+        {
+            // reserved scenes commit only the chunks needed, reallocated arrays at least double to amortise the copy
+            u32 size = std::max<u32>(count, scene->soa_size + 1) - scene->soa_size;
+            if (!scene->reserved_size)
+                size = std::max<u32>(size, scene->soa_size);
+
+            resize_scene_buffers(scene, size);
         }
 
         void free_scene_buffers(ecs_scene* scene, bool cmp_mem_only = 0)
@@ -122,29 +590,62 @@ namespace put
                     delete_entity_second_pass(scene, i);
             }
 
+            // draw cbuffers belong to entity slots rather than entities, they are released with the arrays
+            for (u32 i = 0; i < scene->soa_size; ++i)
+                if (is_valid(scene->draw_cbuffers[i]))
+                    pen::renderer_release_buffer(scene->draw_cbuffers[i]);
+
             // Free component array memory
+            u32 reserved_size = scene->reserved_size;
+            for_each_entity_array(scene, [=](void* data, size_t element_size) -> void* {
+                entity_array_free(data, element_size, reserved_size);
+                return nullptr;
+            });
+
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                pen::memory_free(cmp.data);
-                cmp.data = nullptr;
+                if (cmp.flags & e_cmp_array_flags::sparse)
+                    sparse_pool_free(cmp);
+            }
+
+            pen::memory_free(scene->entity_remap);
+            scene->entity_remap = nullptr;
+
+            if (scene->bvh)
+            {
+                bvh_destroy(scene->bvh);
+                delete scene->bvh;
+                scene->bvh = nullptr;
             }
 
+            destroy_queries(scene);
+
+            u32 num_shared = sb_count(scene->shared_material_cbuffers);
+            for (u32 i = 0; i < num_shared; ++i)
+                pen::renderer_release_buffer(scene->shared_material_cbuffers[i]);
+
+            sb_free(scene->shared_material_cbuffers);
+            scene->shared_material_cbuffers = nullptr;
+
             scene->soa_size = 0;
+            scene->reserved_size = 0;
             scene->num_entities = 0;
         }
 
         void zero_entity_components(ecs_scene* scene, u32 node_index)
         {
             for (u32 i = 0; i < scene->num_components; ++i)
-            {
-                generic_cmp_array& cmp = scene->get_component_array(i);
-                u8*                offset = (u8*)cmp.data + node_index * cmp.size;
-                pen::memory_zero(offset, cmp.size);
-            }
+                zero_component(scene->get_component_array(i), node_index);
 
             // Annoyingly nodeindex == parent is used to determine if a node is not a child
             scene->parents[node_index] = node_index;
+
+            // the slot's draw cbuffer still holds the constants of the entity which used it last
+            scene->state_flags[node_index] |= e_state::draw_dirty;
+
+            scene->flags |= e_scene_flags::invalidate_transforms | e_scene_flags::invalidate_visibility;
+            invalidate_queries(scene);
         }
 
         void delete_entity(ecs_scene* scene, u32 node_index)
@@ -153,9 +654,6 @@ namespace put
             if (is_valid(scene->physics_handles[node_index]))
                 physics::release_entity(scene->physics_handles[node_index]);
 
-            if (is_valid(scene->cbuffer[node_index]))
-                pen::renderer_release_buffer(scene->cbuffer[node_index]);
-
             // zero
             zero_entity_components(scene, node_index);
         }
@@ -166,9 +664,6 @@ namespace put
             if (is_valid(scene->physics_handles[node_index]) && (scene->entities[node_index] & e_cmp::constraint))
                 physics::release_entity(scene->physics_handles[node_index]);
 
-            if (is_valid(scene->cbuffer[node_index]))
-                pen::renderer_release_buffer(scene->cbuffer[node_index]);
-
             if (scene->entities[node_index] & e_cmp::pre_skinned)
             {
                 if (scene->pre_skin[node_index].vertex_buffer)
@@ -195,6 +690,7 @@ namespace put
         {
             free_scene_buffers(scene);
             resize_scene_buffers(scene);
+            scene->flags |= e_scene_flags::invalidate_visibility;
         }
 
         // a component wise memcpy of all components and extension components
@@ -204,8 +700,11 @@ namespace put
             for (u32 i = 0; i < scene->num_components; ++i)
             {
                 generic_cmp_array& cmp = scene->get_component_array(i);
-                memcpy(cmp[dst], cmp[src], cmp.size);
+                copy_component(cmp, dst, cmp, src);
             }
+
+            scene->flags |= e_scene_flags::invalidate_transforms | e_scene_flags::invalidate_visibility;
+            invalidate_queries(scene);
         }
 
         void swap_entities(ecs_scene* scene, u32 a, s32 b)
@@ -227,38 +726,231 @@ namespace put
             zero_entity_components(scene, temp);
         }
 
-        u32 clone_entity(ecs_scene* scene, u32 src, s32 dst, s32 parent, clone_mode mode, vec3f offset, const c8* suffix)
+        u32 remap_entity(const ecs_scene* scene, u32 entity)
         {
-            if (dst == -1)
+            if (scene->entity_remap && entity < scene->num_entities)
+                return scene->entity_remap[entity];
+
+            return entity;
+        }
+
+        bool reorder_entities(ecs_scene* scene)
+        {
+            u32 num = (u32)scene->num_entities;
+            if (num == 0)
+                return false;
+
+            u32* order = (u32*)pen::memory_alloc(sizeof(u32) * num);   // new index to old index
+            u32* pending = (u32*)pen::memory_alloc(sizeof(u32) * num); // first child waiting on its parent
+            u32* last = (u32*)pen::memory_alloc(sizeof(u32) * num);    // last child waiting on its parent
+            u32* next = (u32*)pen::memory_alloc(sizeof(u32) * num);    // next sibling waiting on the same parent
+            u32* stack = (u32*)pen::memory_alloc(sizeof(u32) * num);
+            u8*  emitted = (u8*)pen::memory_alloc(num);
+
+            memset(pending, 0xff, sizeof(u32) * num);
+            memset(emitted, 0x0, num);
+
+            // sub instances are emitted with their master so the instance range stays contiguous
+            static const u8 k_instance_range = 2;
+            for (u32 n = 0; n < num; ++n)
             {
-                dst = get_new_entity(scene);
+                if (!(scene->entities[n] & e_cmp::master_instance))
+                    continue;
+
+                u32 end = std::min<u32>(n + 1 + scene->master_instances[n].num_instances, num);
+                for (u32 i = n + 1; i < end; ++i)
+                    if (scene->entities[i] & e_cmp::sub_instance)
+                        emitted[i] = k_instance_range;
             }
-            else
+
+            // stable topological order: entities keep their relative order, anything stored before its parent is
+            // moved to directly follow the parent along with its own children. a valid order is unchanged.
+            u32 count = 0;
+            for (u32 n = 0; n < num; ++n)
             {
-                if (dst >= scene->num_entities)
-                    scene->num_entities = dst + 1;
-            }
+                if (emitted[n] == k_instance_range)
+                    continue;
 
-            ecs_scene* p_sn = scene;
+                u32 p = scene->parents[n];
+                if (p != n && p < num && !emitted[p])
+                {
+                    // append to keep siblings in index order
+                    next[n] = PEN_INVALID_HANDLE;
+                    if (pending[p] == PEN_INVALID_HANDLE)
+                        pending[p] = n;
+                    else
+                        next[last[p]] = n;
 
-            // copy components
-            for (u32 i = 0; i < scene->num_components; ++i)
-            {
-                generic_cmp_array& cmp = p_sn->get_component_array(i);
-                memcpy(cmp[dst], cmp[src], cmp.size);
-            }
+                    last[p] = n;
+                    continue;
+                }
 
-            // assign
-            Str blank;
-            memcpy(&p_sn->names[dst], &blank, sizeof(Str));
-            memcpy(&p_sn->material_names[dst], &blank, sizeof(Str));
-            memcpy(&p_sn->material_names[dst], &blank, sizeof(Str));
+                u32 sp = 0;
+                stack[sp++] = n;
+                while (sp > 0)
+                {
+                    u32 e = stack[--sp];
+                    order[count++] = e;
+                    emitted[e] = 1;
 
-            p_sn->names[dst] = p_sn->names[src].c_str();
-            p_sn->names[dst].append(suffix);
+                    // push in reverse so the first pending child is emitted first
+                    u32 first = sp;
+                    for (u32 c = pending[e]; c != PEN_INVALID_HANDLE; c = next[c])
+                        stack[sp++] = c;
 
-            p_sn->geometry_names[dst] = p_sn->geometry_names[src].c_str();
-            p_sn->material_names[dst] = p_sn->material_names[src].c_str();
+                    for (u32 i = e + 1; i < num && emitted[i] == k_instance_range; ++i)
+                    {
+                        order[count++] = i;
+                        emitted[i] = 1;
+
+                        for (u32 c = pending[i]; c != PEN_INVALID_HANDLE; c = next[c])
+                            stack[sp++] = c;
+                    }
+
+                    std::reverse(stack + first, stack + sp);
+                }
+            }
+
+            // entities in a parent cycle can not be ordered, they keep their relative order at the end
+            for (u32 n = 0; n < num; ++n)
+                if (emitted[n] != 1)
+                    order[count++] = n;
+
+            bool changed = false;
+            for (u32 n = 0; n < num; ++n)
+            {
+                if (order[n] != n)
+                {
+                    changed = true;
+                    break;
+                }
+            }
+
+            if (changed)
+            {
+                scene->entity_remap = (u32*)pen::memory_realloc(scene->entity_remap, sizeof(u32) * num);
+                for (u32 n = 0; n < num; ++n)
+                    scene->entity_remap[order[n]] = n;
+
+                // permute components one cycle at a time through a spare entity past the end of the scene
+                if (num >= scene->soa_size)
+                    grow_scene_buffers(scene, num + 1);
+
+                u32 spare = num;
+
+                memset(emitted, 0x0, num);
+                for (u32 n = 0; n < num; ++n)
+                {
+                    if (emitted[n] || order[n] == n)
+                        continue;
+
+                    entity_cpy(scene, spare, n);
+
+                    u32 dst = n;
+                    for (;;)
+                    {
+                        emitted[dst] = 1;
+
+                        u32 src = order[dst];
+                        if (src == n)
+                        {
+                            entity_cpy(scene, dst, spare);
+                            break;
+                        }
+
+                        entity_cpy(scene, dst, src);
+                        dst = src;
+                    }
+                }
+
+                // unallocated entities have moved as well
+                zero_entity_components(scene, spare);
+                initialise_free_list(scene);
+
+                // fix up entity indices stored in components and the scene
+                for (u32 n = 0; n < num; ++n)
+                    scene->parents[n] = remap_entity(scene, scene->parents[n]);
+
+                u32* controllers = query(scene, {e_cmp::anim_controller});
+                u32  num_controllers = sb_count(controllers);
+                for (u32 i = 0; i < num_controllers; ++i)
+                {
+                    u32                     n = controllers[i];
+                    cmp_anim_controller_v2& controller = scene->anim_controller_v2.get_or_add(n);
+                    controller.joints_offset = remap_entity(scene, controller.joints_offset);
+
+                    u32 num_joints = sb_count(controller.joint_indices);
+                    for (u32 j = 0; j < num_joints; ++j)
+                        controller.joint_indices[j] = remap_entity(scene, controller.joint_indices[j]);
+                }
+
+                for_each_component(scene->physics_data, [scene](u32 n, cmp_physics& p) {
+                    if (p.type != e_physics_type::constraint)
+                        return;
+
+                    for (u32 i = 0; i < 2; ++i)
+                        if (p.constraint.rb_indices[i] >= 0)
+                            p.constraint.rb_indices[i] = remap_entity(scene, p.constraint.rb_indices[i]);
+                });
+
+                u32 sel_num = sb_count(scene->selection_list);
+                for (u32 i = 0; i < sel_num; ++i)
+                    scene->selection_list[i] = remap_entity(scene, scene->selection_list[i]);
+
+                if (scene->selected_index >= 0)
+                    scene->selected_index = remap_entity(scene, scene->selected_index);
+
+                scene->entity_remap_generation++;
+                scene->flags |= e_scene_flags::invalidate_scene_tree;
+                scene->flags |= e_scene_flags::invalidate_transforms | e_scene_flags::invalidate_visibility;
+            }
+
+            pen::memory_free(order);
+            pen::memory_free(pending);
+            pen::memory_free(last);
+            pen::memory_free(next);
+            pen::memory_free(stack);
+            pen::memory_free(emitted);
+
+            return changed;
+        }
+
+        u32 clone_entity(ecs_scene* scene, u32 src, s32 dst, s32 parent, clone_mode mode, vec3f offset, const c8* suffix)
+        {
+            if (dst == -1)
+            {
+                dst = get_new_entity(scene);
+            }
+            else
+            {
+                if (dst >= scene->num_entities)
+                    scene->num_entities = dst + 1;
+            }
+
+            ecs_scene* p_sn = scene;
+
+            // copy components
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = p_sn->get_component_array(i);
+                copy_component(cmp, dst, cmp, src);
+            }
+
+            // moved entities keep their buffers, copies get their own
+            if (mode != e_clone_mode::move)
+                copy_component_buffers(scene, dst, src);
+
+            // assign
+            Str blank;
+            memcpy(&p_sn->names[dst], &blank, sizeof(Str));
+            memcpy(&p_sn->material_names[dst], &blank, sizeof(Str));
+            memcpy(&p_sn->material_names[dst], &blank, sizeof(Str));
+
+            p_sn->names[dst] = p_sn->names[src].c_str();
+            p_sn->names[dst].append(suffix);
+
+            p_sn->geometry_names[dst] = p_sn->geometry_names[src].c_str();
+            p_sn->material_names[dst] = p_sn->material_names[src].c_str();
 
             // fixup
             u32 parent_offset = p_sn->parents[src] - src;
@@ -295,6 +987,7 @@ namespace put
                 zero_entity_components(scene, src);
             }
 
+            invalidate_queries(scene);
             return dst;
         }
 
@@ -315,6 +1008,7 @@ namespace put
             svr_shadow_maps.name = "ecs_render_shadow_maps";
             svr_shadow_maps.id_name = PEN_HASH(svr_shadow_maps.name.c_str());
             svr_shadow_maps.render_function = &ecs::render_shadow_views;
+            svr_shadow_maps.cached_function = &ecs::shadow_views_cached;
 
             put::scene_view_renderer svr_area_light_textures;
             svr_area_light_textures.name = "ecs_render_area_light_textures";
@@ -325,6 +1019,7 @@ namespace put
             svr_omni_shadow_maps.name = "ecs_render_omni_shadow_maps";
             svr_omni_shadow_maps.id_name = PEN_HASH(svr_omni_shadow_maps.name.c_str());
             svr_omni_shadow_maps.render_function = &ecs::render_omni_shadow_views;
+            svr_omni_shadow_maps.cached_function = &ecs::omni_shadow_views_cached;
 
             put::scene_view_renderer svr_volume_gi;
             svr_volume_gi.name = "ecs_compute_volume_gi";
@@ -337,6 +1032,8 @@ namespace put
             pmfx::register_scene_view_renderer(svr_omni_shadow_maps);
             pmfx::register_scene_view_renderer(svr_area_light_textures);
             pmfx::register_scene_view_renderer(svr_volume_gi);
+
+            simd_init();
         }
 
         ecs_scene* create_scene(const c8* name)
@@ -397,6 +1094,15 @@ namespace put
 
             new_instance.scene->gi_volume_buffer = pen::renderer_create_buffer(bcp);
 
+            // light clusters, the structured buffers are created when clusters are first built
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = sizeof(light_cluster_buffer);
+            bcp.data = nullptr;
+
+            new_instance.scene->cluster_info_buffer = pen::renderer_create_buffer(bcp);
+
             return new_instance.scene;
         }
 
@@ -404,6 +1110,22 @@ namespace put
         {
             free_scene_buffers(scene);
 
+            sb_free(scene->cluster_lights);
+            scene->cluster_lights = nullptr;
+
+            u32* cluster_buffers[] = {&scene->cluster_light_buffer, &scene->cluster_range_buffer,
+                                      &scene->cluster_index_buffer};
+            for (u32* buffer : cluster_buffers)
+            {
+                if (is_valid(*buffer))
+                    pen::renderer_release_buffer(*buffer);
+
+                *buffer = PEN_INVALID_HANDLE;
+            }
+
+            scene->cluster_light_capacity = 0;
+            scene->cluster_index_capacity = 0;
+
             // todo release resource refs
             // geom
             // anim
@@ -413,12 +1135,13 @@ namespace put
         {
             ecs_scene* scene = view.scene;
 
-            u32 count = 0;
-            u32 area_light = -1;
-            for (u32 i = 0; i < scene->num_entities; ++i)
+            u32  count = 0;
+            u32  area_light = -1;
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            for (u32 li = 0; li < num_lights; ++li)
             {
-                if (!(scene->entities[i] & e_cmp::light))
-                    continue;
+                u32 i = lights[li];
 
                 if (!(scene->lights[i].type == e_light_type::area_ex))
                     continue;
@@ -441,7 +1164,7 @@ namespace put
 
             cmp_area_light& al = scene->area_light[area_light];
 
-            pen::renderer_set_constant_buffer(scene->cbuffer[area_light], 1, pen::CBUFFER_BIND_PS);
+            set_draw_cbuffer(scene, area_light, pen::CBUFFER_BIND_PS);
 
             if (is_valid(al.shader))
             {
@@ -519,6 +1242,109 @@ namespace put
             }
         }
 
+        // directional shadow views skip casters whose shadow, swept along the light, can not reach a receiving view
+        struct caster_sweep
+        {
+            bool  enabled = false;
+            vec3f dir = vec3f::zero();
+            f32   length = 0.0f;
+        };
+
+        static caster_sweep s_caster_sweep;
+        static bool         s_shadow_caster_culling = true;
+        static bool         s_shadow_caching = true;
+        static shadow_stats s_shadow_stats;
+        static shadow_stats s_frame_shadow_stats;
+        static const u32    k_dynamic_caster = e_cmp::dynamic | e_cmp::physics | e_cmp::skinned;
+
+        void set_shadow_caching(bool enable)
+        {
+            s_shadow_caching = enable;
+        }
+
+        bool get_shadow_caching()
+        {
+            return s_shadow_caching;
+        }
+
+        void set_shadow_caster_culling(bool enable)
+        {
+            s_shadow_caster_culling = enable;
+        }
+
+        bool get_shadow_caster_culling()
+        {
+            return s_shadow_caster_culling;
+        }
+
+        void get_shadow_stats(shadow_stats& stats)
+        {
+            stats = s_shadow_stats;
+        }
+
+        // entity of the light rendered into a shadow map array slice, in the order update_lights indexes them
+        static u32 shadow_light_entity(ecs_scene* scene, u32 array_index)
+        {
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            u32  shadow_index = 0;
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32 n = lights[i];
+
+                if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
+                    continue;
+
+                if (shadow_index++ == array_index)
+                    return n;
+            }
+
+            return PEN_INVALID_HANDLE;
+        }
+
+        static u32 omni_shadow_light_entity(ecs_scene* scene, u32 omni_index)
+        {
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            u32  omni_light_index = 0;
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32 n = lights[i];
+
+                if (!(scene->lights[n].flags & e_light_flags::omni_shadow_map))
+                    continue;
+
+                if (omni_light_index++ == omni_index)
+                    return n;
+            }
+
+            return PEN_INVALID_HANDLE;
+        }
+
+        static void omni_shadow_camera(camera& cam, const ecs_scene* scene, u32 n, u32 face)
+        {
+            cam.pos = scene->transforms[n].translation;
+            put::camera_create_cubemap(&cam, 0.1f, scene->lights[n].radius * 2.0f);
+            put::camera_set_cubemap_face(&cam, face);
+        }
+
+        static caster_sweep shadow_caster_sweep(const ecs_scene* scene, u32 n, u32 render_flags)
+        {
+            caster_sweep sweep;
+            if (!s_shadow_caster_culling || scene->lights[n].type != e_light_type::dir)
+                return sweep;
+
+            // gi colour maps light the whole scene, only depth shadows are culled against the receivers
+            if (!(render_flags & pmfx::e_scene_render_flags::shadow_map))
+                return sweep;
+
+            // light travels away from direction, as far as the shadow frustum reaches
+            sweep.enabled = true;
+            sweep.dir = normalised(-scene->lights[n].direction);
+            sweep.length = mag(scene->renderable_extents.max - scene->renderable_extents.min);
+            return sweep;
+        }
+
         void render_shadow_views(const scene_view& view)
         {
             ecs_scene* scene = view.scene;
@@ -537,18 +1363,9 @@ namespace put
             }
 
             static mat4 shadow_matrices[e_scene_limits::max_shadow_maps];
-            u32         shadow_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32         n = shadow_light_entity(scene, view.array_index);
+            if (is_valid(n))
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                if (!(scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination)))
-                    continue;
-
-                if (shadow_index++ != view.array_index)
-                    continue;
-
                 // create a shadow camera
                 camera cam;
                 shadow_camera_from_entity(cam, scene, n);
@@ -574,7 +1391,8 @@ namespace put
                 }
 
                 pen::renderer_update_buffer(cb_view, &shadow_vp, sizeof(mat4));
-                shadow_matrices[shadow_index - 1] = shadow_vp;
+                if (view.array_index < e_scene_limits::max_shadow_maps)
+                    shadow_matrices[view.array_index] = shadow_vp;
                 vv.cb_view = cb_view;
 
                 // colour shadow maps
@@ -600,7 +1418,9 @@ namespace put
                     pen::renderer_set_constant_buffer(cb_light, 10, pen::CBUFFER_BIND_PS);
                 }
 
+                s_caster_sweep = shadow_caster_sweep(scene, n, vv.render_flags);
                 render_scene_view(vv);
+                s_caster_sweep = caster_sweep();
             }
 
             // update cbuffer
@@ -631,23 +1451,10 @@ namespace put
                 cb_light = pen::renderer_create_buffer(bcp);
             }
 
-            u32 target_omni_light_index = view.array_index / 6;
-            u32 array_face = view.array_index % 6;
-            u32 omni_light_index = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32 n = omni_shadow_light_entity(scene, view.array_index / 6);
+            if (is_valid(n))
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
-                if (!(scene->lights[n].flags & e_light_flags::omni_shadow_map))
-                    continue;
-
-                if (omni_light_index++ != target_omni_light_index)
-                    continue;
-
-                cam_omni_shadow.pos = scene->transforms[n].translation;
-                put::camera_create_cubemap(&cam_omni_shadow, 0.1f, scene->lights[n].radius * 2.0f);
-                put::camera_set_cubemap_face(&cam_omni_shadow, array_face);
+                omni_shadow_camera(cam_omni_shadow, scene, n, view.array_index % 6);
                 put::camera_update_shader_constants(&cam_omni_shadow);
 
                 light_data ld;
@@ -688,10 +1495,11 @@ namespace put
             static hash_id id_disable_depth = PEN_HASH("disabled");
             u32            depth_disabled = pmfx::get_render_state(id_disable_depth, pmfx::e_render_state::depth_stencil);
 
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            for (u32 i = 0; i < num_lights; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = lights[i];
 
                 if (!scene->cbuffer[n])
                     continue;
@@ -747,6 +1555,10 @@ namespace put
                 // pack light data into world_matrix_inv_transpose
                 memcpy(&dc.world_matrix_inv_transpose, &ld, sizeof(mat4));
 
+                u32 dc_offset = pen::renderer_write_transient_cbuffer(&dc, sizeof(cmp_draw_call));
+                pen::renderer_set_transient_cbuffer(dc_offset, sizeof(cmp_draw_call), 1,
+                                                    pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+
                 // flip cull mode if we are inside the light volume
                 if (inside_volume)
                 {
@@ -754,8 +1566,6 @@ namespace put
                     pen::renderer_set_depth_stencil_state(depth_disabled);
                 }
 
-                pen::renderer_update_buffer(scene->cbuffer[n], &dc, sizeof(cmp_draw_call));
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
                 pen::renderer_set_vertex_buffer(r.vertex_buffer, 0, r.vertex_size, 0);
                 pen::renderer_set_index_buffer(r.index_buffer, r.index_type, 0);
                 pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
@@ -810,11 +1620,12 @@ namespace put
             info.scene_size.xyz = vec3f(min(max_dim, 128.0f));
 
             // get inv shadow matrices
-            u32 i = 0;
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32  i = 0;
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            for (u32 li = 0; li < num_lights; ++li)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = lights[li];
 
                 if (!(scene->lights[n].flags & e_light_flags::global_illumination))
                     continue;
@@ -847,6 +1658,762 @@ namespace put
             pen::renderer_set_texture(0, 0, 2, pen::TEXTURE_BIND_CS);
         }
 
+        // draw sorting, each visible entity emits a packet with a 64 bit key which is radix sorted before submission
+        struct draw_packet
+        {
+            u64 key;
+            u32 entity;
+        };
+
+        namespace e_sort_key
+        {
+            // bit layout msb to lsb
+            // opaque: layer (4) | translucent (1) | technique (12) | material (12) | geometry (12) | depth (23)
+            // alpha: layer (4) | translucent (1) | depth (23) | technique (12) | material (12) | geometry (12)
+            // layer is 0 for all scene views, it is reserved so packets from multiple views can share a list
+            enum sort_key_t
+            {
+                layer_shift = 60,
+                translucent_shift = 59,
+                state_bits = 12,
+                depth_bits = 23
+            };
+        } // namespace e_sort_key
+
+        static bool         s_draw_sorting = true;
+        static draw_stats   s_draw_stats;
+        static draw_stats   s_frame_draw_stats;
+        static draw_packet* s_draw_packets = nullptr;
+        static draw_packet* s_draw_packets_temp = nullptr;
+        static u32          s_draw_packets_capacity = 0;
+
+        // entities visible from every frustum rendered this frame, built once by the first render_scene_view
+        struct view_visibility
+        {
+            const ecs_scene* scene = nullptr;
+            frustum          frustums[k_max_cull_frustums];
+            u32              num_frustums = 0;
+            u64*             masks = nullptr; // bit f set if query entity i is inside frustums[f]
+            u32              masks_capacity = 0;
+            u32*             bvh_entities = nullptr; // entities inside one or more frustums from bvh_query_frustums
+            u64*             bvh_masks = nullptr;
+            u32*             visible[k_max_cull_frustums] = {}; // packed list of visible entities per frustum
+            u32*             unoccluded[k_max_cull_frustums] = {}; // visible minus occluded entities per frustum
+            u64              occlusion_valid = 0;                  // bit f set if unoccluded[f] is current
+            frustum          receivers[k_max_cull_frustums]; // registered cameras, which can see shadows
+            u32              num_receivers = 0;
+            hash_id          receiver_hash = 0;
+        };
+        static view_visibility s_view_visibility;
+        static const u32       k_visibility_grain = 1024;
+
+        // renderable entities, matches filter_entity_scalar
+        static const entity_query k_cull_query = {e_cmp::geometry | e_cmp::material, e_cmp::sub_instance, 0, 0};
+
+        struct occluder_candidate
+        {
+            f32 size;
+            u32 entity;
+        };
+        static occlusion_buffer    s_occlusion_buffer;
+        static occluder_candidate* s_occluder_candidates = nullptr;
+        static occlusion_stats     s_occlusion_stats;
+        static occlusion_stats     s_frame_occlusion_stats;
+        static bool                s_occlusion_culling = true;
+        static const u32           k_occlusion_width = 256;
+        static const u32           k_occlusion_height = 128;
+        static const u32           k_max_occluders = 32;
+        static const f32           k_min_occluder_size = 0.1f; // bounding radius / distance to the camera
+
+        // forward_lit materials swap to forward_lit_clustered where the platform has it, cached per frame
+        struct clustered_technique
+        {
+            u32 shader;
+            u32 technique_index;
+            u32 permutation;
+            u32 clustered_index; // PEN_INVALID_HANDLE if the shader has no clustered technique
+        };
+        static light_cluster_grid   s_light_cluster;
+        static light_cluster_stats  s_light_cluster_stats;
+        static light_cluster_stats  s_frame_light_cluster_stats;
+        static bool                 s_light_clustering = true;
+        static const ecs_scene*     s_light_cluster_scene = nullptr; // scene and camera of the current cluster buffers
+        static const camera*        s_light_cluster_camera = nullptr;
+        static clustered_technique* s_clustered_techniques = nullptr;
+        static const u32            k_light_cluster_cbuffer = 12;
+        static const u32            k_light_cluster_sbuffer = 16; // lights, cluster ranges and light indices
+
+        static bool      s_mesh_lods = true;
+        static f32       s_lod_shadow_bias = 4.0f;
+        static lod_stats s_lod_stats;
+        static lod_stats s_frame_lod_stats;
+        static u32       s_lod_frame = 1;
+        static camera    s_lod_camera; // first registered camera, copied once a frame
+        static u32       s_lod_camera_frame = 0;
+        static bool      s_lod_camera_valid = false;
+        static const f32 k_lod_max_error = 1.0f;   // pixels
+        static const f32 k_lod_hysteresis = 0.25f; // fraction of the limit a coarser level must be below
+
+        static const u32 k_max_tracked_texture_units = 16;
+
+        inline u32 sort_key_combine(u32 hash, u32 v)
+        {
+            // fnv-1a step
+            return (hash ^ v) * 16777619;
+        }
+
+        inline u64 sort_key_fold(u32 v)
+        {
+            // fold down to state_bits, collisions only cost a redundant state change
+            const u32 bits = e_sort_key::state_bits;
+            return (v ^ (v >> bits) ^ (v >> (bits * 2))) & ((1 << bits) - 1);
+        }
+
+        inline u64 sort_key_depth(f32 d)
+        {
+            // positive floats order the same as their bit patterns, keep the exponent and high mantissa bits
+            union {
+                f32 f;
+                u32 u;
+            } fu;
+            fu.f = d > 0.0f ? d : 0.0f;
+            return fu.u >> (31 - e_sort_key::depth_bits);
+        }
+
+        static u64 make_sort_key(const ecs_scene* scene, const scene_view& view, u32 n)
+        {
+            const cmp_material& mat = scene->materials[n];
+            u32                 permutation = scene->material_permutation[n];
+
+            u32 technique = 2166136261;
+            if (!is_valid(view.pmfx_shader))
+            {
+                technique = sort_key_combine(technique, mat.shader);
+                technique = sort_key_combine(technique, mat.technique_index);
+            }
+            technique = sort_key_combine(technique, permutation);
+
+            u32                 material = 2166136261;
+            const cmp_samplers& samplers = scene->samplers[n];
+            for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
+            {
+                material = sort_key_combine(material, samplers.sb[s].handle);
+                material = sort_key_combine(material, samplers.sb[s].sampler_state);
+            }
+
+            const cmp_geometry* p_geom = &scene->geometries[n];
+            if (!(scene->entities[n] & e_cmp::skinned))
+                if (view.render_flags & pmfx::e_scene_render_flags::shadow_map)
+                    p_geom = &scene->position_geometries[n];
+
+            u32 geometry = sort_key_combine(2166136261, p_geom->vertex_buffer);
+            geometry = sort_key_combine(geometry, p_geom->index_buffer);
+
+            // squared distance is enough for ordering
+            vec3f to_entity = scene->pos_extent[n].pos.xyz - view.camera->pos;
+            u64   depth = sort_key_depth(dot(to_entity, to_entity));
+
+            const u64 sb = e_sort_key::state_bits;
+            const u64 db = e_sort_key::depth_bits;
+            u64       state = (sort_key_fold(technique) << (sb * 2)) | (sort_key_fold(material) << sb) | sort_key_fold(geometry);
+
+            u32 render_flags = view.render_flags | scene->render_flags[n];
+            if (render_flags & pmfx::e_scene_render_flags::alpha_blended)
+            {
+                // back to front
+                depth = ((1 << db) - 1) - depth;
+                return (1ull << e_sort_key::translucent_shift) | (depth << (sb * 3)) | state;
+            }
+
+            // front to back within each state group
+            return (state << db) | depth;
+        }
+
+        static void radix_sort_draw_packets(u32 count)
+        {
+            // lsd radix sort 8 bits per pass, passes where all keys share the same digit are skipped
+            for (u32 shift = 0; shift < 64; shift += 8)
+            {
+                u32 offsets[256] = {0};
+                for (u32 i = 0; i < count; ++i)
+                    offsets[(s_draw_packets[i].key >> shift) & 0xff]++;
+
+                if (offsets[(s_draw_packets[0].key >> shift) & 0xff] == count)
+                    continue;
+
+                u32 total = 0;
+                for (u32 d = 0; d < 256; ++d)
+                {
+                    u32 c = offsets[d];
+                    offsets[d] = total;
+                    total += c;
+                }
+
+                for (u32 i = 0; i < count; ++i)
+                    s_draw_packets_temp[offsets[(s_draw_packets[i].key >> shift) & 0xff]++] = s_draw_packets[i];
+
+                std::swap(s_draw_packets, s_draw_packets_temp);
+            }
+        }
+
+        static void build_draw_packets(const ecs_scene* scene, const scene_view& view, const u32* entities, u32 count)
+        {
+            if (count > s_draw_packets_capacity)
+            {
+                s_draw_packets_capacity = count;
+                s_draw_packets = (draw_packet*)pen::memory_realloc(s_draw_packets, sizeof(draw_packet) * count);
+                s_draw_packets_temp = (draw_packet*)pen::memory_realloc(s_draw_packets_temp, sizeof(draw_packet) * count);
+            }
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+                s_draw_packets[i].entity = n;
+                s_draw_packets[i].key = s_draw_sorting ? make_sort_key(scene, view, n) : 0;
+            }
+
+            if (s_draw_sorting && count > 1)
+                radix_sort_draw_packets(count);
+        }
+
+        void set_draw_sorting(bool enable)
+        {
+            s_draw_sorting = enable;
+        }
+
+        bool get_draw_sorting()
+        {
+            return s_draw_sorting;
+        }
+
+        void get_draw_stats(draw_stats& stats)
+        {
+            stats = s_draw_stats;
+        }
+
+        void set_mesh_lods(bool enable)
+        {
+            s_mesh_lods = enable;
+        }
+
+        bool get_mesh_lods()
+        {
+            return s_mesh_lods;
+        }
+
+        void set_lod_shadow_bias(f32 bias)
+        {
+            s_lod_shadow_bias = bias;
+        }
+
+        f32 get_lod_shadow_bias()
+        {
+            return s_lod_shadow_bias;
+        }
+
+        void get_lod_stats(lod_stats& stats)
+        {
+            stats = s_lod_stats;
+        }
+
+        u32 select_geometry_lod(const geometry_lod* lods, u32 num_lods, u32 current, f32 error_scale, f32 max_error)
+        {
+            u32 level = std::min(current, num_lods);
+
+            // finer while the current level is over the limit
+            while (level > 0 && lods[level - 1].error * error_scale > max_error)
+                --level;
+
+            // coarser only once the next level is clearly under it
+            while (level < num_lods && lods[level].error * error_scale < max_error * (1.0f - k_lod_hysteresis))
+                ++level;
+
+            return level;
+        }
+
+        // lods are selected against the first registered camera in every view, shadow views included, a light's view
+        // says little about how much of an entity is seen
+        static const camera* get_lod_camera(const scene_view& view)
+        {
+            if (s_lod_camera_frame != s_lod_frame)
+            {
+                camera** cams = pmfx::get_cameras();
+                s_lod_camera_valid = sb_count(cams) > 0;
+                if (s_lod_camera_valid)
+                    s_lod_camera = *cams[0];
+
+                sb_free(cams);
+                s_lod_camera_frame = s_lod_frame;
+            }
+
+            return s_lod_camera_valid ? &s_lod_camera : view.camera;
+        }
+
+        // level of the lod chain an entity draws in a view with the given height in pixels, 0 is the full mesh. camera
+        // and shadow views each select once per frame and the views which follow reuse it, so several cameras, cascades
+        // or cube faces do not overwrite each others hysteresis.
+        static u32 entity_lod_level(ecs_scene* scene, const scene_view& view, const camera* cam, u32 n, f32 height)
+        {
+            entity_lod& el = scene->entity_lods[n];
+            if (el.id_geometry != scene->id_geometry[n])
+            {
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+                el.id_geometry = scene->id_geometry[n];
+                el.lods = gr ? gr->lods : nullptr;
+                el.num_lods = gr ? gr->num_lods : 0;
+                el.level[0] = 0;
+                el.level[1] = 0;
+                el.frame[0] = 0;
+                el.frame[1] = 0;
+            }
+
+            if (el.num_lods == 0 || (scene->entities[n] & e_cmp::master_instance))
+                return 0;
+
+            u32 shadow = (view.render_flags & pmfx::e_scene_render_flags::shadow_map) ? 1 : 0;
+            if (el.frame[shadow] == s_lod_frame)
+                return el.level[shadow];
+
+            el.frame[shadow] = s_lod_frame;
+
+            // pixels covered by the bounding sphere, lod errors are relative to the mesh extents
+            f32 radius = scene->pos_extent[n].extent.w;
+            f32 error_scale = radius * cam->proj.m[5] * height;
+            if (!(cam->flags & e_camera_flags::orthographic))
+                error_scale /= std::max(mag(scene->pos_extent[n].pos.xyz - cam->pos), radius);
+
+            f32 max_error = shadow ? k_lod_max_error * s_lod_shadow_bias : k_lod_max_error;
+
+            u32 level = select_geometry_lod(el.lods, el.num_lods, el.level[shadow], error_scale, max_error);
+            if (level != el.level[shadow])
+            {
+                el.level[shadow] = (u8)level;
+                s_frame_lod_stats.lod_changes++;
+            }
+
+            return level;
+        }
+
+        void set_occlusion_culling(bool enable)
+        {
+            s_occlusion_culling = enable;
+        }
+
+        bool get_occlusion_culling()
+        {
+            return s_occlusion_culling;
+        }
+
+        void get_occlusion_stats(occlusion_stats& stats)
+        {
+            stats = s_occlusion_stats;
+        }
+
+        void set_light_clustering(bool enable)
+        {
+            s_light_clustering = enable;
+        }
+
+        bool get_light_clustering()
+        {
+            return s_light_clustering;
+        }
+
+        void get_light_cluster_stats(light_cluster_stats& stats)
+        {
+            stats = s_light_cluster_stats;
+        }
+
+        static u32 clustered_technique_index(u32 shader, u32 technique_index, u32 permutation)
+        {
+            static const hash_id id_forward_lit = PEN_HASH("forward_lit");
+            static const hash_id id_forward_lit_clustered = PEN_HASH("forward_lit_clustered");
+
+            u32 num = sb_count(s_clustered_techniques);
+            for (u32 i = 0; i < num; ++i)
+            {
+                const clustered_technique& ct = s_clustered_techniques[i];
+                if (ct.shader == shader && ct.technique_index == technique_index && ct.permutation == permutation)
+                    return ct.clustered_index;
+            }
+
+            clustered_technique ct = {shader, technique_index, permutation, PEN_INVALID_HANDLE};
+            if (pmfx::get_technique_id(shader, technique_index) == id_forward_lit)
+                ct.clustered_index = pmfx::get_technique_index_perm(shader, id_forward_lit_clustered, permutation);
+
+            sb_push(s_clustered_techniques, ct);
+            return ct.clustered_index;
+        }
+
+        static void reserve_structured_buffer(u32& buffer, u32& capacity, u32 count, u32 stride)
+        {
+            if (is_valid(buffer) && count <= capacity)
+                return;
+
+            if (is_valid(buffer))
+                pen::renderer_release_buffer(buffer);
+
+            capacity = std::max<u32>(count + count / 2, 64);
+
+            pen::buffer_creation_params bcp;
+            bcp.usage_flags = PEN_USAGE_DYNAMIC;
+            bcp.bind_flags = PEN_BIND_SHADER_RESOURCE;
+            bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+            bcp.buffer_size = capacity * stride;
+            bcp.stride = stride;
+            bcp.data = nullptr;
+
+            buffer = pen::renderer_create_buffer(bcp);
+        }
+
+        static void bind_light_clusters(ecs_scene* scene, const camera* cam)
+        {
+            light_cluster_grid* grid = &s_light_cluster;
+            u32                 num_lights = sb_count(scene->cluster_lights);
+
+            // views sharing a camera share the clusters until the next update or until the camera moves
+            mat4 view_proj = cam->proj * cam->view;
+            bool moved = memcmp(&view_proj, &grid->view_proj, sizeof(mat4)) != 0;
+            if (s_light_cluster_scene != scene || s_light_cluster_camera != cam || moved)
+            {
+                light_cluster_build(grid, cam->view, cam->proj, cam->near_plane, cam->far_plane, scene->cluster_lights,
+                                    num_lights);
+
+                reserve_structured_buffer(scene->cluster_light_buffer, scene->cluster_light_capacity, num_lights,
+                                          sizeof(light_data));
+                reserve_structured_buffer(scene->cluster_index_buffer, scene->cluster_index_capacity, grid->num_indices,
+                                          sizeof(u32));
+
+                if (!is_valid(scene->cluster_range_buffer))
+                {
+                    u32 range_capacity = 0;
+                    reserve_structured_buffer(scene->cluster_range_buffer, range_capacity, k_light_clusters,
+                                              sizeof(light_cluster_range));
+                }
+
+                if (num_lights)
+                    pen::renderer_update_buffer(scene->cluster_light_buffer, scene->cluster_lights,
+                                                sizeof(light_data) * num_lights);
+
+                if (grid->num_indices)
+                    pen::renderer_update_buffer(scene->cluster_index_buffer, grid->indices, sizeof(u32) * grid->num_indices);
+
+                pen::renderer_update_buffer(scene->cluster_range_buffer, grid->ranges,
+                                            sizeof(light_cluster_range) * k_light_clusters);
+
+                light_cluster_buffer lcb;
+                lcb.view_projection = grid->view_proj;
+                lcb.info = vec4f((f32)k_light_cluster_x, (f32)k_light_cluster_y, (f32)k_light_cluster_z, (f32)num_lights);
+                lcb.depth = vec4f(grid->near_plane, grid->far_plane, grid->slice_scale, 0.0f);
+                pen::renderer_update_buffer(scene->cluster_info_buffer, &lcb, sizeof(lcb));
+
+                u32 max_cluster_lights = 0;
+                for (u32 c = 0; c < k_light_clusters; ++c)
+                    max_cluster_lights = std::max(max_cluster_lights, grid->ranges[c].count);
+
+                light_cluster_stats& stats = s_frame_light_cluster_stats;
+                stats.views++;
+                stats.lights += num_lights;
+                stats.light_indices += grid->num_indices;
+                stats.max_cluster_lights = std::max(stats.max_cluster_lights, max_cluster_lights);
+                stats.build_ms += grid->build_ms;
+
+                s_light_cluster_scene = scene;
+                s_light_cluster_camera = cam;
+            }
+
+            static const u32 sb_flags = pen::SBUFFER_BIND_PS | pen::SBUFFER_BIND_READ;
+            pen::renderer_set_constant_buffer(scene->cluster_info_buffer, k_light_cluster_cbuffer, pen::CBUFFER_BIND_PS);
+            pen::renderer_set_structured_buffer(scene->cluster_light_buffer, k_light_cluster_sbuffer, sb_flags);
+            pen::renderer_set_structured_buffer(scene->cluster_range_buffer, k_light_cluster_sbuffer + 1, sb_flags);
+            pen::renderer_set_structured_buffer(scene->cluster_index_buffer, k_light_cluster_sbuffer + 2, sb_flags);
+        }
+
+        static void occlusion_cull_view(const ecs_scene* scene, const camera* cam, const u32* entities, u32 count,
+                                        u32** entities_out)
+        {
+            occlusion_stats& stats = s_frame_occlusion_stats;
+            f64              start = pen::get_time_us();
+
+            // largest on screen first, flagged occluders ahead of everything
+            sb_clear(s_occluder_candidates);
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+                if (scene->entities[n] & (e_cmp::skinned | e_cmp::master_instance))
+                    continue;
+
+                const extents& e = scene->entity_extents[n];
+
+                f32 size = FLT_MAX;
+                if (!(scene->state_flags[n] & e_state::occluder))
+                {
+                    vec3f centre = e.min + (e.max - e.min) * 0.5f;
+                    f32   dist = std::max(mag(centre - cam->pos), cam->near_plane);
+                    size = mag(e.max - e.min) * 0.5f / dist;
+
+                    if (size < k_min_occluder_size)
+                        continue;
+                }
+
+                occluder_candidate oc = {size, n};
+                sb_push(s_occluder_candidates, oc);
+            }
+
+            u32 num_candidates = sb_count(s_occluder_candidates);
+            std::sort(s_occluder_candidates, s_occluder_candidates + num_candidates,
+                      [](const occluder_candidate& a, const occluder_candidate& b) {
+                          return a.size != b.size ? a.size > b.size : a.entity < b.entity;
+                      });
+
+            occlusion_buffer* ob = &s_occlusion_buffer;
+            occlusion_begin(ob, cam->proj * cam->view, k_occlusion_width, k_occlusion_height);
+
+            u32 num_occluders = 0;
+            for (u32 i = 0; i < num_candidates && num_occluders < k_max_occluders; ++i)
+            {
+                u32                n = s_occluder_candidates[i].entity;
+                geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
+                if (!gr)
+                    continue;
+
+                pmm_renderable& r = gr->renderable[e_pmm_renderable::position_only];
+                if (!r.cpu_vertex_buffer || !r.cpu_index_buffer)
+                    continue;
+
+                u32 index_size = r.index_type == PEN_FORMAT_R16_UINT ? 2 : 4;
+                occlusion_add_occluder(ob, scene->world_matrices[n], (const vec4f*)r.cpu_vertex_buffer,
+                                       r.cpu_index_buffer, r.num_indices, index_size);
+                ++num_occluders;
+            }
+
+            u32 num_triangles = sb_count(ob->triangles);
+            if (num_triangles == 0)
+            {
+                for (u32 i = 0; i < count; ++i)
+                    sb_push(*entities_out, entities[i]);
+
+                return;
+            }
+
+            occlusion_rasterize(ob);
+            f64 rasterized = pen::get_time_us();
+
+            u32 visible = sb_count(*entities_out);
+            occlusion_cull_aabb(ob, scene->entity_extents, entities, count, entities_out);
+            visible = sb_count(*entities_out) - visible;
+
+            stats.views++;
+            stats.occluders += num_occluders;
+            stats.occluder_triangles += num_triangles;
+            stats.tested += count;
+            stats.culled += count - visible;
+            stats.rasterize_ms += (rasterized - start) / 1000.0;
+            stats.test_ms += (pen::get_time_us() - rasterized) / 1000.0;
+        }
+
+        static bool same_frustum_planes(const frustum& a, const frustum& b)
+        {
+            return memcmp(a.n, b.n, sizeof(a.n)) == 0 && memcmp(a.p, b.p, sizeof(a.p)) == 0;
+        }
+
+        static s32 find_visibility_frustum(const frustum& f)
+        {
+            view_visibility& vis = s_view_visibility;
+            for (u32 i = 0; i < vis.num_frustums; ++i)
+                if (same_frustum_planes(vis.frustums[i], f))
+                    return (s32)i;
+
+            return -1;
+        }
+
+        static void add_visibility_frustum(const frustum& f)
+        {
+            // views past the limit are culled individually in render_scene_view
+            view_visibility& vis = s_view_visibility;
+            if (vis.num_frustums >= k_max_cull_frustums || find_visibility_frustum(f) != -1)
+                return;
+
+            vis.frustums[vis.num_frustums++] = f;
+        }
+
+        static void update_view_visibility(ecs_scene* scene)
+        {
+            view_visibility& vis = s_view_visibility;
+            vis.scene = scene;
+            vis.num_frustums = 0;
+            vis.num_receivers = 0;
+
+            // registered cameras, with the frustum pmfx will compute when it updates the camera constants
+            camera** cams = pmfx::get_cameras();
+            for (u32 i = 0; i < sb_count(cams); ++i)
+            {
+                camera cam = *cams[i];
+                camera_update_frustum(&cam);
+                add_visibility_frustum(cam.camera_frustum);
+
+                if (vis.num_receivers < k_max_cull_frustums)
+                    vis.receivers[vis.num_receivers++] = cam.camera_frustum;
+            }
+            sb_free(cams);
+
+            pen::HashMurmur2A hm;
+            hm.begin();
+            for (u32 i = 0; i < vis.num_receivers; ++i)
+            {
+                hm.add(vis.receivers[i].n, sizeof(vis.receivers[i].n));
+                hm.add(vis.receivers[i].p, sizeof(vis.receivers[i].p));
+            }
+            vis.receiver_hash = hm.end();
+
+            // the same cameras render_shadow_views and render_omni_shadow_views create for each light
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_lights = sb_count(lights);
+            for (u32 i = 0; i < num_lights; ++i)
+            {
+                u32 n = lights[i];
+
+                if (scene->lights[n].flags & (e_light_flags::shadow_map | e_light_flags::global_illumination))
+                {
+                    camera cam;
+                    shadow_camera_from_entity(cam, scene, n);
+                    add_visibility_frustum(cam.camera_frustum);
+                }
+
+                if (scene->lights[n].flags & e_light_flags::omni_shadow_map)
+                {
+                    camera cam;
+                    cam.pos = scene->transforms[n].translation;
+                    put::camera_create_cubemap(&cam, 0.1f, scene->lights[n].radius * 2.0f);
+
+                    for (u32 f = 0; f < 6; ++f)
+                    {
+                        put::camera_set_cubemap_face(&cam, f);
+                        put::camera_update_frustum(&cam);
+                        add_visibility_frustum(cam.camera_frustum);
+                    }
+                }
+            }
+
+            for (u32 f = 0; f < k_max_cull_frustums; ++f)
+                sb_clear(vis.visible[f]);
+
+            vis.occlusion_valid = 0;
+
+            // traverse the bvh once for all frustums, only subtrees that intersect a frustum are visited
+            if (scene->bvh && is_valid(scene->bvh->root))
+            {
+                sb_clear(vis.bvh_entities);
+                sb_clear(vis.bvh_masks);
+                bvh_query_frustums(scene->bvh, vis.frustums, vis.num_frustums, &vis.bvh_entities, &vis.bvh_masks);
+
+                u32 count = sb_count(vis.bvh_entities);
+                for (u32 i = 0; i < count; ++i)
+                {
+                    u32 e = vis.bvh_entities[i];
+                    if (!filter_entity_scalar(scene, e))
+                        continue;
+
+                    u64 mask = vis.bvh_masks[i];
+                    for (u32 f = 0; mask; ++f, mask >>= 1)
+                        if (mask & 1)
+                            sb_push(vis.visible[f], e);
+                }
+
+                return;
+            }
+
+            // filter once and test every entity against all frustums
+            u32* entities = query(scene, k_cull_query);
+
+            u32 count = sb_count(entities);
+            if (count > vis.masks_capacity)
+            {
+                vis.masks_capacity = count;
+                vis.masks = (u64*)pen::memory_realloc(vis.masks, sizeof(u64) * count);
+            }
+
+            pen::parallel_for(0, count, k_visibility_grain, [scene, &vis, entities](u32 start, u32 end) {
+                frustum_cull_views_aabb(scene, vis.frustums, vis.num_frustums, entities + start, end - start,
+                                        vis.masks + start);
+            });
+
+            // pack the visible entities of each frustum
+            for (u32 i = 0; i < count; ++i)
+            {
+                u64 mask = vis.masks[i];
+                for (u32 f = 0; mask; ++f, mask >>= 1)
+                    if (mask & 1)
+                        sb_push(vis.visible[f], entities[i]);
+            }
+        }
+
+        static void ensure_view_visibility(ecs_scene* scene)
+        {
+            // visibility of all views is culled in one pass after each update or structural change, the flag is cleared
+            // here so the other views this frame reuse it
+            if ((scene->flags & e_scene_flags::invalidate_visibility) || s_view_visibility.scene != scene)
+            {
+                update_view_visibility(scene);
+                scene->flags &= ~e_scene_flags::invalidate_visibility;
+            }
+        }
+
+        // a box swept along a direction is outside a plane when it is outside at both ends of the sweep
+        static bool swept_aabb_outside(const frustum& f, const vec3f& pos, const vec3f& extent, const vec3f& sweep)
+        {
+            for (u32 p = 0; p < 6; ++p)
+            {
+                vec3f sign_flip = sgn(f.n[p]) * -1.0f;
+                f32   pd = maths::plane_distance(f.p[p], f.n[p]);
+                f32   d = dot(pos + extent * sign_flip, f.n[p]) + pd;
+
+                if (d > 0.0f && d + dot(sweep, f.n[p]) > 0.0f)
+                    return true;
+            }
+
+            return false;
+        }
+
+        static void cull_shadow_casters(const ecs_scene* scene, const u32* entities, u32 count, u32** casters_out)
+        {
+            const view_visibility& vis = s_view_visibility;
+            const caster_sweep&    sweep = s_caster_sweep;
+            bool                   receivers = sweep.enabled && vis.num_receivers > 0;
+            vec3f                  sv = sweep.dir * sweep.length;
+
+            u32 culled = 0;
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 n = entities[i];
+                if (scene->state_flags[n] & e_state::no_shadow)
+                {
+                    ++culled;
+                    continue;
+                }
+
+                if (receivers)
+                {
+                    vec3f pos = scene->pos_extent[n].pos.xyz;
+                    vec3f extent = scene->pos_extent[n].extent.xyz;
+
+                    bool reaches = false;
+                    for (u32 r = 0; r < vis.num_receivers && !reaches; ++r)
+                        reaches = !swept_aabb_outside(vis.receivers[r], pos, extent, sv);
+
+                    if (!reaches)
+                    {
+                        ++culled;
+                        continue;
+                    }
+                }
+
+                sb_push(*casters_out, n);
+            }
+
+            s_frame_shadow_stats.culled_casters += culled;
+        }
+
         void render_scene_view(const scene_view& view)
         {
             // PEN_PERF_SCOPE_PRINT(render_scene_view);
@@ -878,35 +2445,101 @@ namespace put
 
             // sdf shadows
             pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* shadows = query(scene, {e_cmp::sdf_shadow});
+            u32  num_shadows = sb_count(shadows);
+            for (u32 i = 0; i < num_shadows; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
-                    continue;
+                u32 n = shadows[i];
+
+                cmp_shadow& shadow = scene->shadows[n];
+
+                if (is_valid(shadow.texture_handle))
+                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
+                                              pen::TEXTURE_BIND_PS);
+
+                // info for sdf
+                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+            }
+
+            // gi volume
+            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
+
+            // blue noise
+            static hash_id id_wrap_point = PEN_HASH("wrap_point");
+            u32            wrap_point = pmfx::get_render_state(id_wrap_point, pmfx::e_render_state::sampler);
+            static u32     blue_noise = put::load_texture("data/textures/noise/blue_noise_ldr_rgba_0.dds");
+            pen::renderer_set_texture(blue_noise, wrap_point, 5, pen::TEXTURE_BIND_PS);
+
+            ensure_view_visibility(scene);
+
+            // filter and cull, only views the visibility pass did not know about
+            u32* culled_entities = nullptr;
+            u32* visible_entities = nullptr;
+
+            s32 vis_index = find_visibility_frustum(view.camera->camera_frustum);
+            if (vis_index != -1)
+            {
+                visible_entities = s_view_visibility.visible[vis_index];
+            }
+            else
+            {
+                frustum_cull_aabb(scene, view.camera, query(scene, k_cull_query), &culled_entities);
+                visible_entities = culled_entities;
+            }
+
+            // occlusion, shared by views with the same camera after each visibility pass
+            bool occlusion = s_occlusion_culling && !(view.render_flags & pmfx::e_scene_render_flags::shadow_map) &&
+                             !(view.camera->flags & e_camera_flags::orthographic);
+            if (occlusion)
+            {
+                view_visibility& vis = s_view_visibility;
+                if (vis_index != -1)
+                {
+                    u64 bit = 1ull << vis_index;
+                    if (!(vis.occlusion_valid & bit))
+                    {
+                        sb_clear(vis.unoccluded[vis_index]);
+                        occlusion_cull_view(scene, view.camera, visible_entities, sb_count(visible_entities),
+                                            &vis.unoccluded[vis_index]);
+                        vis.occlusion_valid |= bit;
+                    }
+
+                    visible_entities = vis.unoccluded[vis_index];
+                }
+                else
+                {
+                    u32* unoccluded = nullptr;
+                    occlusion_cull_view(scene, view.camera, culled_entities, sb_count(culled_entities), &unoccluded);
+                    sb_free(culled_entities);
+                    culled_entities = unoccluded;
+                    visible_entities = culled_entities;
+                }
+            }
 
-                cmp_shadow& shadow = scene->shadows[n];
+            // shadow casters
+            if (view.render_flags & pmfx::e_scene_render_flags::shadow_map)
+            {
+                u32* casters = nullptr;
+                cull_shadow_casters(scene, visible_entities, sb_count(visible_entities), &casters);
 
-                if (is_valid(shadow.texture_handle))
-                    pen::renderer_set_texture(shadow.texture_handle, shadow.sampler_state, e_global_textures::sdf_shadow,
-                                              pen::TEXTURE_BIND_PS);
+                if (culled_entities)
+                    sb_free(culled_entities);
 
-                // info for sdf
-                pen::renderer_set_constant_buffer(scene->sdf_shadow_buffer, 5, pen::CBUFFER_BIND_PS);
+                culled_entities = casters;
+                visible_entities = culled_entities;
             }
 
-            // gi volume
-            pen::renderer_set_constant_buffer(scene->gi_volume_buffer, 11, pen::CBUFFER_BIND_PS);
-
-            // blue noise
-            static hash_id id_wrap_point = PEN_HASH("wrap_point");
-            u32            wrap_point = pmfx::get_render_state(id_wrap_point, pmfx::e_render_state::sampler);
-            static u32     blue_noise = put::load_texture("data/textures/noise/blue_noise_ldr_rgba_0.dds");
-            pen::renderer_set_texture(blue_noise, wrap_point, 5, pen::TEXTURE_BIND_PS);
+            // sort
+            u32 vc = sb_count(visible_entities);
+            build_draw_packets(scene, view, visible_entities, vc);
 
-            // filter and cull
-            u32* filtered_entities = nullptr;
-            u32* culled_entities = nullptr;
-            filter_entities_scalar(scene, &filtered_entities);
-            frustum_cull_aabb_scalar(scene, view.camera, filtered_entities, &culled_entities);
+            // clustered lights are built and bound on the first draw which uses forward_lit_clustered
+            static const hash_id id_forward_lit = PEN_HASH("forward_lit");
+            static const hash_id id_forward_lit_clustered = PEN_HASH("forward_lit_clustered");
+            bool clustered = s_light_clustering && (view.render_flags & pmfx::e_scene_render_flags::forward_lit) &&
+                             !(view.camera->flags & e_camera_flags::orthographic) &&
+                             (pen::renderer_get_info().caps & PEN_CAPS_COMPUTE);
+            bool clusters_bound = false;
 
             // track to prevent redundant state changes.
             u32 cur_shader = -1;
@@ -914,12 +2547,26 @@ namespace put
             u32 cur_permutation = -1;
             u32 cur_vb = -1;
             u32 cur_ib = -1;
-            u32 vc = sb_count(culled_entities);
+            u32 cur_mcb = -1;
+            u32 cur_tex[k_max_tracked_texture_units];
+            u32 cur_sampler[k_max_tracked_texture_units];
+
+            draw_stats& stats = s_frame_draw_stats;
+            lod_stats&  lstats = s_frame_lod_stats;
+
+            // lods are selected against the size of the view in pixels
+            f32           lod_height = 0.0f;
+            const camera* lod_camera = nullptr;
+            if (s_mesh_lods && view.viewport)
+            {
+                lod_height = pen::_renderer_resolve_viewport_ratio(*view.viewport).height;
+                lod_camera = get_lod_camera(view);
+            }
 
             // render
             for (u32 i = 0; i < vc; ++i)
             {
-                u32 n = culled_entities[i];
+                u32 n = s_draw_packets[i].entity;
 
                 cmp_geometry* p_geom = &scene->geometries[n];
                 if (!(scene->entities[n] & e_cmp::skinned))
@@ -935,7 +2582,20 @@ namespace put
                     if (!is_valid(view.pmfx_shader))
                     {
                         // per entity material
-                        pmfx::set_technique(p_mat->shader, p_mat->technique_index);
+                        u32 technique_index = p_mat->technique_index;
+                        if (clustered)
+                        {
+                            u32 ci = clustered_technique_index(p_mat->shader, technique_index, permutation);
+                            if (is_valid(ci))
+                            {
+                                technique_index = ci;
+                                if (!clusters_bound)
+                                    bind_light_clusters(scene, view.camera);
+                                clusters_bound = true;
+                            }
+                        }
+
+                        pmfx::set_technique(p_mat->shader, technique_index);
                         cur_shader = p_mat->shader;
                         cur_technique = p_mat->technique_index;
                         cur_permutation = permutation;
@@ -943,15 +2603,35 @@ namespace put
                     else
                     {
                         // per pass material but with permutation specialisation (instanced, skinned etc)
-                        pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
+                        bool set = false;
+                        if (clustered && view.id_technique == id_forward_lit)
+                        {
+                            set = pmfx::set_technique_perm(view.pmfx_shader, id_forward_lit_clustered, permutation);
+                            if (set && !clusters_bound)
+                            {
+                                bind_light_clusters(scene, view.camera);
+                                clusters_bound = true;
+                            }
+                        }
+
+                        if (!set)
+                            pmfx::set_technique_perm(view.pmfx_shader, view.id_technique, permutation);
                         cur_shader = view.pmfx_shader;
                         cur_technique = view.id_technique;
                         cur_permutation = permutation;
                     }
 
-                    // if we change pipeline, we need to rebind buffers
+                    // if we change pipeline, we need to rebind buffers and textures
                     cur_vb = -1;
                     cur_ib = -1;
+                    cur_mcb = -1;
+                    for (u32 t = 0; t < k_max_tracked_texture_units; ++t)
+                    {
+                        cur_tex[t] = -1;
+                        cur_sampler[t] = -1;
+                    }
+
+                    stats.technique_changes++;
                 }
 
                 // update skin
@@ -970,7 +2650,7 @@ namespace put
                         p_geom->p_skin->bone_cbuffer = pen::renderer_create_buffer(bcp);
                     }
 
-                    s32 joints_offset = scene->anim_controller_v2[n].joints_offset;
+                    s32 joints_offset = scene->anim_controller_v2.get(n).joints_offset;
                     for (s32 i = 0; i < p_geom->p_skin->num_joints; ++i)
                         bb[i] = scene->world_matrices[joints_offset + i] * p_geom->p_skin->joint_bind_matrices[i];
 
@@ -980,13 +2660,15 @@ namespace put
 
                 // set material cbs
                 u32 mcb = scene->materials[n].material_cbuffer;
-                if (is_valid(mcb))
+                if (is_valid(mcb) && mcb != cur_mcb)
                 {
                     pen::renderer_set_constant_buffer(mcb, 7, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                    cur_mcb = mcb;
+                    stats.material_changes++;
                 }
 
                 // draw call cb
-                pen::renderer_set_constant_buffer(scene->cbuffer[n], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+                set_draw_cbuffer(scene, n, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
 
                 // set textures
                 if (p_mat)
@@ -994,11 +2676,21 @@ namespace put
                     cmp_samplers& samplers = scene->samplers[n];
                     for (u32 s = 0; s < e_pmfx_constants::max_technique_sampler_bindings; ++s)
                     {
-                        if (!samplers.sb[s].handle)
+                        const sampler_binding& sb = samplers.sb[s];
+                        if (!sb.handle)
                             continue;
 
-                        pen::renderer_set_texture(samplers.sb[s].handle, samplers.sb[s].sampler_state,
-                                                  samplers.sb[s].sampler_unit, pen::TEXTURE_BIND_PS);
+                        if (sb.sampler_unit < k_max_tracked_texture_units)
+                        {
+                            if (cur_tex[sb.sampler_unit] == sb.handle && cur_sampler[sb.sampler_unit] == sb.sampler_state)
+                                continue;
+
+                            cur_tex[sb.sampler_unit] = sb.handle;
+                            cur_sampler[sb.sampler_unit] = sb.sampler_state;
+                        }
+
+                        pen::renderer_set_texture(sb.handle, sb.sampler_state, sb.sampler_unit, pen::TEXTURE_BIND_PS);
+                        stats.texture_changes++;
                     }
                 }
 
@@ -1010,6 +2702,8 @@ namespace put
                     u32 offsets[2] = {0};
 
                     pen::renderer_set_vertex_buffers(vbs, 2, 0, strides, offsets);
+                    cur_vb = -1;
+                    stats.vertex_buffer_changes++;
                 }
                 else
                 {
@@ -1017,50 +2711,232 @@ namespace put
                     {
                         pen::renderer_set_vertex_buffer(p_geom->vertex_buffer, 0, p_geom->vertex_size, 0);
                         cur_vb = p_geom->vertex_buffer;
+                        stats.vertex_buffer_changes++;
+                    }
+                }
+
+                // lod, simplified levels share the vertex buffer and index type of the full mesh
+                u32 index_buffer = p_geom->index_buffer;
+                u32 num_indices = p_geom->num_indices;
+                u32 level = lod_height > 0.0f ? entity_lod_level(scene, view, lod_camera, n, lod_height) : 0;
+                if (level > 0)
+                {
+                    const geometry_lod& lod = scene->entity_lods[n].lods[level - 1];
+                    if (p_geom == &scene->position_geometries[n])
+                    {
+                        index_buffer = lod.position_index_buffer;
+                        num_indices = lod.num_position_indices;
+                    }
+                    else
+                    {
+                        index_buffer = lod.index_buffer;
+                        num_indices = lod.num_indices;
                     }
+
+                    lstats.lod_draws++;
                 }
 
                 // set index buffer
-                if (cur_ib != p_geom->index_buffer)
+                if (cur_ib != index_buffer)
                 {
-                    pen::renderer_set_index_buffer(p_geom->index_buffer, p_geom->index_type, 0);
-                    cur_ib = p_geom->index_buffer;
+                    pen::renderer_set_index_buffer(index_buffer, p_geom->index_type, 0);
+                    cur_ib = index_buffer;
+                    stats.index_buffer_changes++;
                 }
 
                 // draw
+                stats.draw_calls++;
+                lstats.draws++;
 
                 // instances
                 if (scene->entities[n] & e_cmp::master_instance)
                 {
                     u32 num_instances = scene->master_instances[n].num_instances;
-                    pen::renderer_draw_indexed_instanced(num_instances, 0, p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
-                    n += num_instances;
+                    lstats.full_triangles += (u64)(p_geom->num_indices / 3) * num_instances;
+                    lstats.submitted_triangles += (u64)(num_indices / 3) * num_instances;
+                    pen::renderer_draw_indexed_instanced(num_instances, 0, num_indices, 0, 0, PEN_PT_TRIANGLELIST);
                     continue;
                 }
 
                 // single
-                pen::renderer_draw_indexed(p_geom->num_indices, 0, 0, PEN_PT_TRIANGLELIST);
+                lstats.full_triangles += p_geom->num_indices / 3;
+                lstats.submitted_triangles += num_indices / 3;
+                pen::renderer_draw_indexed(num_indices, 0, 0, PEN_PT_TRIANGLELIST);
             }
 
-            if (filtered_entities)
+            if (culled_entities)
             {
-                sb_free(filtered_entities);
+                sb_free(culled_entities);
             }
+        }
 
-            if (culled_entities)
+        // the signature of each shadow view array slice when it was last rendered, per pmfx view
+        struct shadow_view_cache
+        {
+            const ecs_scene* scene = nullptr;
+            hash_id          id_view = 0;
+            u32              target_version = 0;
+            u32              num_slices = 0;
+            hash_id*         slices = nullptr; // 0 if the slice has not been rendered
+        };
+        static shadow_view_cache* s_shadow_view_caches = nullptr;
+
+        static hash_id& shadow_slice_cache(const scene_view& view)
+        {
+            shadow_view_cache* cache = nullptr;
+            u32                num_caches = sb_count(s_shadow_view_caches);
+            for (u32 i = 0; i < num_caches; ++i)
             {
-                sb_free(culled_entities);
+                shadow_view_cache& c = s_shadow_view_caches[i];
+                if (c.scene == view.scene && c.id_view == view.id_view)
+                {
+                    cache = &c;
+                    break;
+                }
+            }
+
+            if (!cache)
+            {
+                shadow_view_cache c;
+                c.scene = view.scene;
+                c.id_view = view.id_view;
+                sb_push(s_shadow_view_caches, c);
+                cache = &s_shadow_view_caches[num_caches];
             }
+
+            // targets were recreated or resized and no longer hold any slices
+            if (cache->target_version != view.target_version || cache->num_slices != view.num_arrays)
+            {
+                cache->target_version = view.target_version;
+                cache->num_slices = view.num_arrays;
+                cache->slices = (hash_id*)pen::memory_realloc(cache->slices, sizeof(hash_id) * view.num_arrays);
+                memset(cache->slices, 0x0, sizeof(hash_id) * view.num_arrays);
+            }
+
+            return cache->slices[view.array_index];
+        }
+
+        static bool shadow_slice_cached(const scene_view& view, const camera& cam, u32 light, const caster_sweep& sweep)
+        {
+            ecs_scene*    scene = view.scene;
+            shadow_stats& stats = s_frame_shadow_stats;
+            stats.slices++;
+
+            ensure_view_visibility(scene);
+            const view_visibility& vis = s_view_visibility;
+
+            // the light, its shadow camera and the receivers directional casters were culled against
+            const cmp_light&  l = scene->lights[light];
+            pen::HashMurmur2A hm;
+            hm.begin();
+            hm.add(cam.view);
+            hm.add(cam.proj);
+            hm.add(l.type);
+            hm.add(l.colour);
+            hm.add(l.radius);
+            hm.add(l.spot_falloff);
+            hm.add(l.cos_cutoff);
+            hm.add(l.direction);
+            hm.add(scene->static_caster_version);
+            if (sweep.enabled)
+                hm.add(vis.receiver_hash);
+
+            // casters inside the light frustum by entity, geometry and material, the dynamic layer also by transform
+            u32* culled = nullptr;
+            u32* casters = nullptr;
+
+            s32 vis_index = find_visibility_frustum(cam.camera_frustum);
+            if (vis_index != -1)
+            {
+                casters = vis.visible[vis_index];
+            }
+            else
+            {
+                frustum_cull_aabb(scene, &cam, query(scene, k_cull_query), &culled);
+                casters = culled;
+            }
+
+            // skinned casters change pose without moving, slices containing them are always rendered
+            bool cacheable = s_shadow_caching;
+            u32  num_casters = sb_count(casters);
+            for (u32 i = 0; i < num_casters; ++i)
+            {
+                u32 n = casters[i];
+                hm.add(n);
+                hm.add(scene->state_flags[n] & e_state::no_shadow);
+                hm.add(scene->id_geometry[n]);
+                hm.add(scene->id_material[n]);
+                hm.add(scene->materials[n].shader);
+                hm.add(scene->materials[n].technique_index);
+
+                if (scene->entities[n] & k_dynamic_caster)
+                {
+                    hm.add(scene->world_matrices[n]);
+                    cacheable &= !(scene->entities[n] & e_cmp::skinned);
+                    stats.dynamic_casters++;
+                }
+                else
+                {
+                    stats.static_casters++;
+                }
+            }
+
+            sb_free(culled);
+
+            hash_id signature = hm.end();
+            if (!cacheable)
+                signature = 0;
+
+            hash_id& cached = shadow_slice_cache(view);
+            bool     hit = signature != 0 && cached == signature;
+            cached = signature;
+
+            if (hit)
+                stats.cached_slices++;
+
+            return hit;
+        }
+
+        bool shadow_views_cached(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+            if (scene->view_flags & e_scene_view_flags::hide)
+                return false;
+
+            u32 n = shadow_light_entity(scene, view.array_index);
+            if (!is_valid(n))
+                return false;
+
+            camera cam;
+            shadow_camera_from_entity(cam, scene, n);
+            return shadow_slice_cached(view, cam, n, shadow_caster_sweep(scene, n, view.render_flags));
+        }
+
+        bool omni_shadow_views_cached(const scene_view& view)
+        {
+            ecs_scene* scene = view.scene;
+            if (scene->view_flags & e_scene_view_flags::hide)
+                return false;
+
+            u32 n = omni_shadow_light_entity(scene, view.array_index / 6);
+            if (!is_valid(n))
+                return false;
+
+            camera cam;
+            omni_shadow_camera(cam, scene, n, view.array_index % 6);
+            put::camera_update_frustum(&cam);
+            return shadow_slice_cached(view, cam, n, caster_sweep());
         }
 
         void update_animations(ecs_scene* scene, f32 dt)
         {
-            for (u32 n = 0; n < scene->num_entities; ++n)
+            u32* controllers = query(scene, {e_cmp::anim_controller});
+            u32  num_controllers = sb_count(controllers);
+            for (u32 i = 0; i < num_controllers; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::anim_controller))
-                    continue;
+                u32 n = controllers[i];
 
-                cmp_anim_controller_v2 controller = scene->anim_controller_v2[n];
+                cmp_anim_controller_v2 controller = scene->anim_controller_v2.get(n);
 
                 u32 num_anims = sb_count(controller.anim_instances);
                 for (u32 ai = 0; ai < num_anims; ++ai)
@@ -1269,202 +3145,595 @@ namespace put
                 dt = ft;
             }
 
-            for (auto& si : s_scenes)
-            {
-                update_scene(si.scene, dt);
+            for (auto& si : s_scenes)
+            {
+                update_scene(si.scene, dt);
+            }
+
+            // draw stats are reported for the previous frame
+            s_draw_stats = s_frame_draw_stats;
+            s_frame_draw_stats = draw_stats();
+            s_occlusion_stats = s_frame_occlusion_stats;
+            s_frame_occlusion_stats = occlusion_stats();
+            s_shadow_stats = s_frame_shadow_stats;
+            s_frame_shadow_stats = shadow_stats();
+            s_light_cluster_stats = s_frame_light_cluster_stats;
+            s_frame_light_cluster_stats = light_cluster_stats();
+            s_lod_stats = s_frame_lod_stats;
+            s_frame_lod_stats = lod_stats();
+            s_lod_frame++;
+
+            // lights and cameras move, clusters and techniques are found again next frame
+            s_light_cluster_scene = nullptr;
+            s_light_cluster_camera = nullptr;
+            sb_clear(s_clustered_techniques);
+        }
+
+        std::vector<ecs_scene_instance>* get_scenes()
+        {
+            return &s_scenes;
+        }
+
+        // update_scene runs as a sequence of phases, entity work inside a phase is split over the job workers with
+        // pen::parallel_for. each entity is computed by the same function in both paths so the output is bit identical
+        // to a serial update. anything which talks to physics or the renderer stays on the calling thread in entity
+        // order so the command streams are unchanged.
+        // only entities whose local matrix changed, and their children, have world matrices, bounds and draw
+        // constants recomputed.
+        static const u32 k_update_grain = 512;
+        static const u32 k_update_batch = 256; // entities gathered per call into the ecs_transform kernels
+
+        namespace e_update_flags
+        {
+            enum update_flags_t
+            {
+                world = 1 << 0,     // world matrix, bounds and draw constants are recomputed this update
+                bounds = 1 << 1,    // bounds of the entity or one of its descendants changed
+                skip_world = 1 << 2, // physics entities without a rigid body matrix keep last frames world matrix
+                compose = 1 << 3     // local matrix needs composing from the transform component
+            };
+        }
+
+        struct update_hierarchy
+        {
+            u32* level = nullptr;          // depth of each entity, roots are level 0
+            u32* level_start = nullptr;    // level_entities[level_start[l], level_start[l + 1]) are at level l
+            u32* level_entities = nullptr; // entities sorted by level
+            u32* child_start = nullptr;    // children[child_start[n], child_start[n + 1]) are the children of n
+            u32* children = nullptr;
+            u32* cursor = nullptr;
+            u8*  update_flags = nullptr; // e_update_flags per entity
+            u32  capacity = 0;
+            u32  num_levels = 0;
+            bool ordered = true; // every parent precedes its children, otherwise hierarchy phases run serially once
+            bool logged_unordered = false;
+        };
+
+        static update_hierarchy s_update_hierarchy;
+        static bool             s_update_parallel = true;
+        static f64              s_update_time_ms = 0.0;
+        static u32              s_dirty_entity_count = 0;
+
+        void set_update_parallel(bool enable)
+        {
+            s_update_parallel = enable;
+        }
+
+        bool get_update_parallel()
+        {
+            return s_update_parallel;
+        }
+
+        f64 get_update_time_ms()
+        {
+            return s_update_time_ms;
+        }
+
+        u32 get_dirty_entity_count()
+        {
+            return s_dirty_entity_count;
+        }
+
+        template <typename T>
+        static void update_range(u32 start, u32 end, const T& func)
+        {
+            if (s_update_parallel)
+                pen::parallel_for(start, end, k_update_grain, func);
+            else
+                func(start, end);
+        }
+
+        static void update_hierarchy_reserve(update_hierarchy& h, u32 num)
+        {
+            if (num <= h.capacity)
+                return;
+
+            h.capacity = num;
+
+            u32** arrays[] = {&h.level, &h.level_start, &h.level_entities, &h.child_start, &h.children, &h.cursor};
+            for (u32** a : arrays)
+                *a = (u32*)pen::memory_realloc(*a, sizeof(u32) * (num + 1));
+
+            h.update_flags = (u8*)pen::memory_realloc(h.update_flags, num);
+        }
+
+        static void build_update_hierarchy(ecs_scene* scene)
+        {
+            update_hierarchy& h = s_update_hierarchy;
+            u32               num = (u32)scene->num_entities;
+
+            update_hierarchy_reserve(h, num);
+
+            h.ordered = true;
+            h.num_levels = 0;
+
+            if (num == 0)
+                return;
+
+            for (u32 n = 0; n < num; ++n)
+            {
+                u32 p = scene->parents[n];
+                if (p > n)
+                {
+                    // parents written directly, reorder at the start of the next update. entities in a parent cycle
+                    // stay unordered after a reorder so it is only scheduled once until the hierarchy changes again
+                    if (!h.logged_unordered)
+                    {
+                        PEN_LOG("[ecs] entity %u is stored before its parent %u, reordering next update", n, p);
+
+                        scene->flags |= e_scene_flags::invalidate_order;
+                    }
+
+                    h.logged_unordered = true;
+                    h.ordered = false;
+                    return;
+                }
+
+                h.level[n] = p == n ? 0 : h.level[p] + 1;
+                h.num_levels = std::max<u32>(h.num_levels, h.level[n] + 1);
+            }
+
+            h.logged_unordered = false;
+
+            // bucket entities by level
+            memset(h.level_start, 0x0, sizeof(u32) * (h.num_levels + 1));
+            for (u32 n = 0; n < num; ++n)
+                h.level_start[h.level[n] + 1]++;
+
+            for (u32 l = 0; l < h.num_levels; ++l)
+                h.level_start[l + 1] += h.level_start[l];
+
+            memcpy(h.cursor, h.level_start, sizeof(u32) * h.num_levels);
+            for (u32 n = 0; n < num; ++n)
+                h.level_entities[h.cursor[h.level[n]]++] = n;
+
+            // children of each entity
+            memset(h.child_start, 0x0, sizeof(u32) * (num + 1));
+            for (u32 n = 0; n < num; ++n)
+                if (scene->parents[n] != n)
+                    h.child_start[scene->parents[n] + 1]++;
+
+            for (u32 n = 0; n < num; ++n)
+                h.child_start[n + 1] += h.child_start[n];
+
+            memcpy(h.cursor, h.child_start, sizeof(u32) * num);
+            for (u32 n = 0; n < num; ++n)
+                if (scene->parents[n] != n)
+                    h.children[h.cursor[scene->parents[n]]++] = n;
+        }
+
+        static u8 update_local_matrix(ecs_scene* scene, u32 n)
+        {
+            u8 flags = 0;
+
+            if (scene->state_flags[n] & e_state::transform_dirty)
+            {
+                scene->state_flags[n] &= ~e_state::transform_dirty;
+                flags |= e_update_flags::world;
+            }
+
+            // force physics entity to sync and ignore controlled transform
+            if (scene->state_flags[n] & e_state::sync_physics_transform)
+            {
+                scene->state_flags[n] &= ~e_state::sync_physics_transform;
+                scene->entities[n] &= ~e_cmp::transform;
+                flags |= e_update_flags::world;
+            }
+
+            // controlled transform, the local matrix is composed in batches by the caller
+            if (scene->entities[n] & e_cmp::transform)
+            {
+                cmp_transform& t = scene->transforms[n];
+
+                if (scene->entities[n] & e_cmp::physics)
+                {
+                    if (scene->physics_data.get(n).type == e_physics_type::rigid_body)
+                    {
+                        cmp_transform& pt = scene->physics_offset[n];
+                        physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
+                        physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
+                        physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
+                    }
+                }
+
+                // local matrix will be baked
+                scene->entities[n] &= ~e_cmp::transform;
+                flags |= e_update_flags::world | e_update_flags::compose;
+            }
+            else if (scene->entities[n] & e_cmp::physics)
+            {
+                if (!physics::has_rb_matrix(n))
+                    return flags | e_update_flags::skip_world;
+
+                cmp_transform& t = scene->transforms[n];
+                cmp_transform& pt = scene->physics_offset[n];
+
+                mat4 scale_mat = mat::create_scale(t.scale);
+
+                vec3f os = t.scale;
+                t = physics::get_rb_transform(scene->physics_handles[n]);
+                t.scale = os;
+
+                mat4 rot_mat;
+                t.rotation.get_matrix(rot_mat);
+
+                mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
+
+                // resting bodies keep the same matrix and stay clean
+                mat4 local = translation_mat * rot_mat * scale_mat;
+                if (memcmp(&local, &scene->local_matrices[n], sizeof(mat4)) != 0)
+                {
+                    scene->local_matrices[n] = local;
+                    flags |= e_update_flags::world;
+                }
+            }
+
+            return flags;
+        }
+
+        static inline void compose_local_matrices(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            compose_trs(&scene->transforms[0], &scene->local_matrices[0], entities, count);
+        }
+
+        static inline void update_world_matrices(ecs_scene* scene, const u32* entities, u32 count)
+        {
+            // heirarchical scene transform
+            multiply_parent(&scene->local_matrices[0], &scene->parents[0], &scene->world_matrices[0], entities, count);
+        }
+
+        static void update_transforms(ecs_scene* scene)
+        {
+            update_hierarchy& h = s_update_hierarchy;
+            u32               num = (u32)scene->num_entities;
+
+            // structural changes or an unordered hierarchy recompute every entity
+            u8 full = 0;
+            if (!h.ordered || (scene->flags & e_scene_flags::invalidate_transforms))
+                full = e_update_flags::world;
+
+            scene->flags &= ~e_scene_flags::invalidate_transforms;
+
+            // physics commands are not thread safe, physics entities are updated first in entity order
+            for (u32 n = 0; n < num; ++n)
+            {
+                if (!(scene->entities[n] & e_cmp::physics))
+                    continue;
+
+                h.update_flags[n] = full | update_local_matrix(scene, n);
+                if (h.update_flags[n] & e_update_flags::compose)
+                    compose_local_matrices(scene, &n, 1);
+            }
+
+            update_range(0, num, [scene, &h, full](u32 start, u32 end) {
+                u32 batch[k_update_batch];
+                u32 count = 0;
+
+                for (u32 n = start; n < end; ++n)
+                {
+                    if (scene->entities[n] & e_cmp::physics)
+                        continue;
+
+                    h.update_flags[n] = full | update_local_matrix(scene, n);
+                    if (!(h.update_flags[n] & e_update_flags::compose))
+                        continue;
+
+                    batch[count++] = n;
+                    if (count == k_update_batch)
+                    {
+                        compose_local_matrices(scene, batch, count);
+                        count = 0;
+                    }
+                }
+
+                if (count)
+                    compose_local_matrices(scene, batch, count);
+            });
+
+            if (!h.ordered)
+            {
+                // the kernel processes entities in list order, same as the serial index order loop
+                u32 batch[k_update_batch];
+                u32 count = 0;
+
+                for (u32 n = 0; n < num; ++n)
+                {
+                    if (h.update_flags[n] & e_update_flags::skip_world)
+                        continue;
+
+                    batch[count++] = n;
+                    if (count == k_update_batch)
+                    {
+                        update_world_matrices(scene, batch, count);
+                        count = 0;
+                    }
+                }
+
+                if (count)
+                    update_world_matrices(scene, batch, count);
+
+                return;
+            }
+
+            // parents are complete before the next level reads them, children of changed parents are marked
+            for (u32 l = 0; l < h.num_levels; ++l)
+            {
+                update_range(h.level_start[l], h.level_start[l + 1], [scene, &h](u32 start, u32 end) {
+                    u32 batch[k_update_batch];
+                    u32 count = 0;
+
+                    for (u32 i = start; i < end; ++i)
+                    {
+                        u32 n = h.level_entities[i];
+                        u32 p = scene->parents[n];
+
+                        u8& flags = h.update_flags[n];
+                        if (p != n && (h.update_flags[p] & e_update_flags::world))
+                            flags |= e_update_flags::world;
+
+                        if (!(flags & e_update_flags::world) || (flags & e_update_flags::skip_world))
+                            continue;
+
+                        batch[count++] = n;
+                        if (count == k_update_batch)
+                        {
+                            update_world_matrices(scene, batch, count);
+                            count = 0;
+                        }
+                    }
+
+                    if (count)
+                        update_world_matrices(scene, batch, count);
+                });
             }
         }
 
-        std::vector<ecs_scene_instance>* get_scenes()
+        static void update_bone_bounding_volume(ecs_scene* scene, u32 n)
         {
-            return &s_scenes;
+            vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+            vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+
+            tmin = tmax = scene->world_matrices[n].get_translation();
+            scene->entity_extents[n] = {tmin, tmax};
         }
 
-        void update_scene(ecs_scene* scene, f32 dt)
+        static void update_bounding_volume_batch(ecs_scene* scene, const u32* entities, u32 count)
         {
-            // static anim time to pass into draw calls etc..
-            f32 anim_time = pen::get_time_ms() / 1000.0f;
+            transform_aabb(&scene->world_matrices[0], &scene->bounding_volumes[0], entities, count);
 
-            u32 num_controllers = sb_count(scene->controllers);
-            u32 num_extensions = sb_count(scene->extensions);
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32    n = entities[i];
+                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
 
-            // pre update controllers
-            for (u32 c = 0; c < num_controllers; ++c)
-                if (scene->controllers[c].update_func)
-                    scene->controllers[c].update_func(scene->controllers[c], scene, dt);
+                f32& trad = scene->bounding_volumes[n].radius;
+                trad = mag(tmax - tmin) * 0.5f;
 
-            if (scene->flags & e_scene_flags::pause_update)
-            {
-                physics::set_paused(1);
-            }
-            else
-            {
-                physics::set_paused(0);
-                update_animations(scene, dt);
+                // pos extent for faster aabb and sphere culling
+                auto& pe = scene->pos_extent[n];
+                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
+                pe.extent.xyz = tmax - pe.pos.xyz;
+                pe.extent.w = trad;
+
+                scene->entity_extents[n] = {tmin, tmax};
             }
+        }
 
-            // extension component update
-            for (u32 e = 0; e < num_extensions; ++e)
-                if (scene->extensions[e].update_func)
-                    scene->extensions[e].update_func(scene->extensions[e], scene, dt);
+        static inline void expand_parent_bounding_volume(ecs_scene* scene, u32 p, u32 n)
+        {
+            vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
+            vec3f& parent_tmax = scene->bounding_volumes[p].transformed_max_extents;
 
-            static pen::timer* timer = pen::timer_create();
-            pen::timer_start(timer);
+            vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
+            vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
 
-            // scene node transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            if (scene->entities[p] & e_cmp::anim_controller)
             {
-                // force physics entity to sync and ignore controlled transform
-                if (scene->state_flags[n] & e_state::sync_physics_transform)
-                {
-                    scene->state_flags[n] &= ~e_state::sync_physics_transform;
-                    scene->entities[n] &= ~e_cmp::transform;
-                }
+                vec3f pad = vec3f(0.0f);
 
-                // controlled transform
-                if (scene->entities[n] & e_cmp::transform)
-                {
-                    cmp_transform& t = scene->transforms[n];
+                parent_tmin = min_union(parent_tmin, tmin - pad);
+                parent_tmax = max_union(parent_tmax, tmax + pad);
+            }
+            else
+            {
+                parent_tmin = min_union(parent_tmin, tmin);
+                parent_tmax = max_union(parent_tmax, tmax);
+            }
+        }
 
-                    // generate matrix from transform
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+        static void update_bounding_volumes(ecs_scene* scene)
+        {
+            update_hierarchy& h = s_update_hierarchy;
+            u32               num = (u32)scene->num_entities;
 
-                    mat4 translation_mat = mat::create_translation(t.translation);
+            // transform extents by transform
+            update_range(0, num, [scene, &h](u32 start, u32 end) {
+                u32 batch[k_update_batch];
+                u32 count = 0;
 
-                    mat4 scale_mat = mat::create_scale(t.scale);
+                for (u32 n = start; n < end; ++n)
+                {
+                    if (!(h.update_flags[n] & e_update_flags::world))
+                        continue;
 
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
+                    h.update_flags[n] |= e_update_flags::bounds;
 
-                    if (scene->entities[n] & e_cmp::physics)
+                    if (scene->entities[n] & e_cmp::bone)
                     {
-                        if (scene->physics_data[n].type == e_physics_type::rigid_body)
-                        {
-                            cmp_transform& pt = scene->physics_offset[n];
-                            physics::set_transform(scene->physics_handles[n], t.translation + pt.translation, t.rotation);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_angular_velocity);
-                            physics::set_v3(scene->physics_handles[n], vec3f::zero(), physics::e_cmd::set_linear_velocity);
-                        }
+                        update_bone_bounding_volume(scene, n);
+                        continue;
                     }
 
-                    // local matrix will be baked
-                    scene->entities[n] &= ~e_cmp::transform;
+                    batch[count++] = n;
+                    if (count == k_update_batch)
+                    {
+                        update_bounding_volume_batch(scene, batch, count);
+                        count = 0;
+                    }
                 }
-                else if (scene->entities[n] & e_cmp::physics)
-                {
-                    if (!physics::has_rb_matrix(n))
-                        continue;
-
-                    cmp_transform& t = scene->transforms[n];
-                    cmp_transform& pt = scene->physics_offset[n];
-
-                    mat4 scale_mat = mat::create_scale(t.scale);
-
-                    vec3f os = t.scale;
-                    t = physics::get_rb_transform(scene->physics_handles[n]);
-                    t.scale = os;
 
-                    mat4 rot_mat;
-                    t.rotation.get_matrix(rot_mat);
+                if (count)
+                    update_bounding_volume_batch(scene, batch, count);
+            });
 
-                    mat4 translation_mat = mat::create_translation(t.translation - pt.translation);
-
-                    scene->local_matrices[n] = translation_mat * rot_mat * scale_mat;
-                }
+            u32  dirty = 0;
+            bool static_caster_moved = false;
+            for (u32 n = 0; n < num; ++n)
+            {
+                if (!(h.update_flags[n] & e_update_flags::world))
+                    continue;
 
-                // heirarchical scene transform
-                u32 parent = scene->parents[n];
-                if (parent == n)
-                    scene->world_matrices[n] = scene->local_matrices[n];
-                else
-                    scene->world_matrices[n] = scene->world_matrices[parent] * scene->local_matrices[n];
+                ++dirty;
+                if ((scene->entities[n] & e_cmp::geometry) && !(scene->entities[n] & k_dynamic_caster))
+                    static_caster_moved = true;
             }
 
-            // bounding volume transform
-            static vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
+            s_dirty_entity_count = dirty;
 
-                                      vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
+            // cached shadow slices do not hash static caster transforms, any of them moving invalidates every slice
+            if (static_caster_moved)
+                scene->static_caster_version++;
 
-                                      vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
+            // also set scene extents, from the entity extents before children are merged in
+            if (dirty)
+            {
+                scene->renderable_extents.min = vec3f::flt_max();
+                scene->renderable_extents.max = -vec3f::flt_max();
 
-                                      vec3f(1.0f, 1.0f, 1.0f)};
+                for (u32 n = 0; n < num; ++n)
+                {
+                    if (scene->entities[n] & e_cmp::bone)
+                        continue;
 
-            scene->renderable_extents.min = vec3f::flt_max();
-            scene->renderable_extents.max = -vec3f::flt_max();
+                    if (!(scene->entities[n] & e_cmp::geometry))
+                        continue;
 
-            // transform extents by transform
-            for (size_t n = 0; n < scene->num_entities; ++n)
+                    const extents& e = scene->entity_extents[n];
+                    scene->renderable_extents.min = min_union(e.min, scene->renderable_extents.min);
+                    scene->renderable_extents.max = max_union(e.max, scene->renderable_extents.max);
+                }
+            }
+
+            if (!h.ordered)
             {
-                vec3f min = scene->bounding_volumes[n].min_extents;
-                vec3f max = scene->bounding_volumes[n].max_extents - min;
+                // reverse iterate over scene and expand parents extents by children
+                for (intptr_t n = scene->num_entities - 1; n > 0; --n)
+                {
+                    if (!(scene->entities[n] & e_cmp::allocated))
+                        continue;
 
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+                    u32 p = scene->parents[n];
+                    if (p == n)
+                        continue;
 
-                if (scene->entities[n] & e_cmp::bone)
-                {
-                    tmin = tmax = scene->world_matrices[n].get_translation();
-                    continue;
+                    expand_parent_bounding_volume(scene, p, (u32)n);
                 }
 
-                tmax = -vec3f::flt_max();
-                tmin = vec3f::flt_max();
-
-                for (s32 c = 0; c < 8; ++c)
-                {
-                    vec3f p = scene->world_matrices[n].transform_vector(min + max * corners[c]);
+                return;
+            }
 
-                    tmax = max_union(tmax, p);
-                    tmin = min_union(tmin, p);
-                }
+            // deepest level first so children already contain their own children, each parent gathers its children
+            // again when its own bounds or any of its childrens bounds changed
+            for (u32 l = h.num_levels; l > 1; --l)
+            {
+                update_range(h.level_start[l - 2], h.level_start[l - 1], [scene, &h](u32 start, u32 end) {
+                    for (u32 i = start; i < end; ++i)
+                    {
+                        u32 p = h.level_entities[i];
+                        u32 cs = h.child_start[p];
+                        u32 ce = h.child_start[p + 1];
 
-                f32& trad = scene->bounding_volumes[n].radius;
-                trad = mag(tmax - tmin) * 0.5f;
+                        bool gather = h.update_flags[p] & e_update_flags::bounds;
+                        for (u32 c = cs; c < ce && !gather; ++c)
+                        {
+                            u32 n = h.children[c];
+                            if (scene->entities[n] & e_cmp::allocated)
+                                gather = h.update_flags[n] & e_update_flags::bounds;
+                        }
 
-                // pos extent for faster aabb and sphere culling
-                auto& pe = scene->pos_extent[n];
-                pe.pos.xyz = tmin + (tmax - tmin) * 0.5f;
-                pe.extent.xyz = tmax - pe.pos.xyz;
-                pe.extent.w = trad;
+                        if (!gather)
+                            continue;
 
-                if (!(scene->entities[n] & e_cmp::geometry))
-                    continue;
+                        // restore the parents own extents before merging children back in
+                        if (!(h.update_flags[p] & e_update_flags::bounds))
+                        {
+                            scene->bounding_volumes[p].transformed_min_extents = scene->entity_extents[p].min;
+                            scene->bounding_volumes[p].transformed_max_extents = scene->entity_extents[p].max;
+                            h.update_flags[p] |= e_update_flags::bounds;
+                        }
 
-                // also set scene extents
-                scene->renderable_extents.min = min_union(tmin, scene->renderable_extents.min);
-                scene->renderable_extents.max = max_union(tmax, scene->renderable_extents.max);
+                        for (u32 c = cs; c < ce; ++c)
+                        {
+                            u32 n = h.children[c];
+                            if (scene->entities[n] & e_cmp::allocated)
+                                expand_parent_bounding_volume(scene, p, n);
+                        }
+                    }
+                });
             }
+        }
 
-            // reverse iterate over scene and expand parents extents by children
-            for (intptr_t n = scene->num_entities - 1; n > 0; --n)
-            {
-                if (!(scene->entities[n] & e_cmp::allocated))
-                    continue;
+        static void update_bvh(ecs_scene* scene, bool structural)
+        {
+            update_hierarchy& h = s_update_hierarchy;
+            u32               num = (u32)scene->num_entities;
 
-                u32 p = scene->parents[n];
-                if (p == n)
-                    continue;
+            if (!scene->bvh)
+                scene->bvh = new ecs_bvh();
 
-                vec3f& parent_tmin = scene->bounding_volumes[p].transformed_min_extents;
-                vec3f& parent_tmax = scene->bounding_volumes[p].transformed_max_extents;
+            ecs_bvh* bvh = scene->bvh;
 
-                vec3f& tmin = scene->bounding_volumes[n].transformed_min_extents;
-                vec3f& tmax = scene->bounding_volumes[n].transformed_max_extents;
+            // refit the leaves of moved entities, the tree is untouched when nothing moved
+            bool rebuild = structural || !is_valid(bvh->root);
+            if (!rebuild && s_dirty_entity_count)
+            {
+                static u32* moved = nullptr;
+                sb_clear(moved);
 
-                if (scene->entities[p] & e_cmp::anim_controller)
-                {
-                    vec3f pad = vec3f(0.0f);
+                for (u32 n = 0; n < num; ++n)
+                    if ((h.update_flags[n] & e_update_flags::world) && (scene->entities[n] & e_cmp::allocated))
+                        sb_push(moved, n);
 
-                    parent_tmin = min_union(parent_tmin, tmin - pad);
-                    parent_tmax = max_union(parent_tmax, tmax + pad);
-                }
-                else
-                {
-                    parent_tmin = min_union(parent_tmin, tmin);
-                    parent_tmax = max_union(parent_tmax, tmax);
-                }
+                if (!bvh_refit(bvh, scene->entity_extents, moved, sb_count(moved)))
+                    rebuild = true;
             }
 
+            if (!rebuild && !bvh_needs_rebuild(bvh))
+                return;
+
+            static u32* entities = nullptr;
+            sb_clear(entities);
+
+            for (u32 n = 0; n < num; ++n)
+                if (scene->entities[n] & e_cmp::allocated)
+                    sb_push(entities, n);
+
+            bvh_build(bvh, scene->entity_extents, entities, sb_count(entities));
+        }
+
+        static void update_lights(ecs_scene* scene, f32 anim_time)
+        {
             // Forward light buffer
             static forward_light_buffer light_buffer;
             s32                         pos = 0;
@@ -1472,23 +3741,31 @@ namespace put
 
             memset(&light_buffer, 0x0, sizeof(forward_light_buffer));
 
+            // point and spot lights for clustered shading are not capped
+            sb_clear(scene->cluster_lights);
+
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_light_entities = sb_count(lights);
+
             // directional lights
             s32 num_directions_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
+                u32        n = lights[i];
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::dir)
                     continue;
 
                 // update bv and transform
-                scene->bounding_volumes[n].min_extents = -vec3f(FLT_MAX);
-                scene->bounding_volumes[n].max_extents = vec3f(FLT_MAX);
+                vec3f max_extents = vec3f(FLT_MAX);
+                if (memcmp(&scene->bounding_volumes[n].max_extents, &max_extents, sizeof(vec3f)) != 0)
+                    scene->state_flags[n] |= e_state::transform_dirty;
+
+                scene->bounding_volumes[n].min_extents = -max_extents;
+                scene->bounding_volumes[n].max_extents = max_extents;
 
                 if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
+                    continue;
 
                 // current directional light is a point light very far away
                 // with no attenuation..
@@ -1502,14 +3779,17 @@ namespace put
                 ++pos;
             }
 
-            // point lights
+            // point lights, omni shadows are rendered for flagged lights in entity order
             s32 num_point_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            u32 omni_shadow_index = 0;
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
+                u32        n = lights[i];
                 cmp_light& l = scene->lights[n];
+                u32        omni_index = omni_shadow_index;
+                if (l.flags & e_light_flags::omni_shadow_map)
+                    ++omni_shadow_index;
+
                 if (l.type != e_light_type::point)
                     continue;
 
@@ -1521,31 +3801,36 @@ namespace put
                 scene->transforms[n].scale = vec3f(rad, rad, rad);
                 scene->entities[n] |= e_cmp::transform;
 
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
-
                 cmp_transform& t = scene->transforms[n];
 
-                bool sm = l.flags & e_light_flags::omni_shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                bool       sm = l.flags & e_light_flags::omni_shadow_map;
+                light_data ld = {};
+                ld.pos_radius = vec4f(t.translation, l.radius);
+                ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                ld.data = vec4f(0.0f, (f32)omni_index, (f32)e_cluster_light::point, 0.0f);
+                sb_push(scene->cluster_lights, ld);
+
+                if (num_lights >= e_scene_limits::max_forward_lights)
+                    continue;
+
+                light_buffer.lights[pos] = ld;
+                light_buffer.lights[pos].data = vec4f::zero();
 
                 ++num_point_lights;
                 ++num_lights;
                 ++pos;
             }
 
-            // spot lights
+            // spot lights, shadow maps are rendered for shadow and gi lights in entity order
             s32 num_spot_lights = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            u32 shadow_map_index = 0;
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (num_lights >= e_scene_limits::max_forward_lights)
-                    break;
-
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
+                u32        n = lights[i];
                 cmp_light& l = scene->lights[n];
+                u32        shadow_index = shadow_map_index;
+                if (l.flags & (e_light_flags::shadow_map | e_light_flags::global_illumination))
+                    ++shadow_map_index;
 
                 if (l.type != e_light_type::spot)
                     continue;
@@ -1565,10 +3850,20 @@ namespace put
 
                 vec3f dir = normalized(-scene->world_matrices[n].get_column(1).xyz);
 
-                bool sm = l.flags & e_light_flags::shadow_map;
-                light_buffer.lights[pos].pos_radius = vec4f(t.translation, l.radius);
-                light_buffer.lights[pos].dir_cutoff = vec4f(dir, l.cos_cutoff);
-                light_buffer.lights[pos].colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                // shadow maps past the shadow matrix buffer are not sampled
+                bool       sm = l.flags & e_light_flags::shadow_map && shadow_index < e_scene_limits::max_shadow_maps;
+                light_data ld = {};
+                ld.pos_radius = vec4f(t.translation, l.radius);
+                ld.dir_cutoff = vec4f(dir, l.cos_cutoff);
+                ld.colour = vec4f(l.colour, sm ? 1.0 : 0.0);
+                ld.data = vec4f(l.spot_falloff, (f32)shadow_index, (f32)e_cluster_light::spot, 0.0f);
+                sb_push(scene->cluster_lights, ld);
+
+                if (num_lights >= e_scene_limits::max_forward_lights)
+                    continue;
+
+                light_buffer.lights[pos] = ld;
+                light_buffer.lights[pos].colour.w = l.flags & e_light_flags::shadow_map ? 1.0f : 0.0f;
                 light_buffer.lights[pos].data = vec4f(l.spot_falloff, 0.0f, 0.0f, 0.0f);
 
                 ++num_spot_lights;
@@ -1591,14 +3886,12 @@ namespace put
             u32 num_constant_colour_area_lights = 0;
             u32 num_textured_area_lights = 0;
             // constant colour area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
+                u32        n = lights[i];
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::area)
                     continue;
@@ -1613,14 +3906,12 @@ namespace put
                 ++num_area_lights;
             }
             // textured / shader / animated area light
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
                 if (num_lights >= e_scene_limits::max_forward_lights)
                     break;
 
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
-
+                u32        n = lights[i];
                 cmp_light& l = scene->lights[n];
                 if (l.type != e_light_type::area_ex)
                     continue;
@@ -1634,6 +3925,9 @@ namespace put
                 scene->draw_call_data[n].v1.z = (f32)num_textured_area_lights;
                 ++num_textured_area_lights;
 
+                // area light shaders animate with the time in v1.y, their constants are written every update
+                scene->state_flags[n] |= e_state::draw_dirty;
+
                 ++num_area_lights;
             }
 
@@ -1657,12 +3951,15 @@ namespace put
                     pmfx::resize_render_target(PEN_HASH("area_light_textures"), rrp);
                 }
             }
+        }
 
-            // Distance field shadows
-            for (size_t n = 0; n < scene->num_entities; ++n)
+        static void update_sdf_shadows(ecs_scene* scene)
+        {
+            u32* shadows = query(scene, {e_cmp::sdf_shadow});
+            u32  num_shadows = sb_count(shadows);
+            for (u32 i = 0; i < num_shadows; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::sdf_shadow))
-                    continue;
+                u32 n = shadows[i];
 
                 static distance_field_shadow_buffer sdf_buffer;
 
@@ -1671,17 +3968,19 @@ namespace put
 
                 pen::renderer_update_buffer(scene->sdf_shadow_buffer, &sdf_buffer, sizeof(sdf_buffer));
             }
+        }
 
-            // Shadow maps
-
+        static void update_shadow_maps(ecs_scene* scene)
+        {
             // directional
             u32 num_shadow_maps = 0;
             u32 num_omni_shadow_maps = 0;
             u32 num_gi_maps = 0;
-            for (size_t n = 0; n < scene->num_entities; ++n)
+            u32* lights = query(scene, {e_cmp::light});
+            u32  num_light_entities = sb_count(lights);
+            for (u32 i = 0; i < num_light_entities; ++i)
             {
-                if (!(scene->entities[n] & e_cmp::light))
-                    continue;
+                u32 n = lights[i];
 
                 cmp_light& l = scene->lights[n];
 
@@ -1746,16 +4045,20 @@ namespace put
                     pmfx::resize_render_target(PEN_HASH("colour_shadow_map_depth"), rrp);
                 }
             }
+        }
 
+        static void update_pre_skin(ecs_scene* scene)
+        {
             // Update pre skinned vertex buffers
             static hash_id id_pre_skin_technique = PEN_HASH("pre_skin");
             static u32     shader = pmfx::load_shader("forward_render");
             if (pmfx::set_technique_perm(shader, id_pre_skin_technique))
             {
-                for (size_t n = 0; n < scene->num_entities; ++n)
+                u32* pre_skinned = query(scene, {e_cmp::pre_skinned});
+                u32  num_pre_skinned = sb_count(pre_skinned);
+                for (u32 j = 0; j < num_pre_skinned; ++j)
                 {
-                    if (!(scene->entities[n] & e_cmp::pre_skinned))
-                        continue;
+                    u32 n = pre_skinned[j];
 
                     // update bone cbuffer
                     cmp_geometry& geom = scene->geometries[n];
@@ -1772,7 +4075,7 @@ namespace put
                     }
 
                     static mat4 bb[85];
-                    s32         joints_offset = scene->anim_controller_v2[n].joints_offset;
+                    s32         joints_offset = scene->anim_controller_v2.get(n).joints_offset;
                     for (s32 i = 0; i < geom.p_skin->num_joints; ++i)
                         bb[i] = scene->world_matrices[joints_offset + i] * geom.p_skin->joint_bind_matrices[i];
 
@@ -1789,59 +4092,217 @@ namespace put
                     pen::renderer_set_stream_out_target(0);
                 }
             }
+        }
 
-            // update draw call data
-            for (size_t n = 0; n < scene->num_entities; ++n)
+        static void update_draw_call(ecs_scene* scene, u32 n, f32 time_ms)
+        {
+            bool moved = s_update_hierarchy.update_flags[n] & e_update_flags::world;
+            if (!moved && !(scene->state_flags[n] & e_state::draw_dirty))
+                return;
+
+            // store node index in v1.x, v1.y is the time the constants were last written
+            scene->draw_call_data[n].v1.x = (f32)n;
+            scene->draw_call_data[n].v1.y = time_ms;
+
+            if (!moved)
+                return;
+
+            scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+
+            if (is_invalid_or_null(scene->cbuffer[n]))
+                return;
+
+            if (scene->entities[n] & e_cmp::sub_instance)
+                return;
+
+            // skinned meshes have the world matrix baked into the bones
+            if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
+                scene->draw_call_data[n].world_matrix = mat4::create_identity();
+
+            mat4 invt = scene->world_matrices[n];
+
+            invt = invt.transposed();
+            invt = mat::inverse4x4(invt);
+
+            scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+        }
+
+        static void update_draw_calls(ecs_scene* scene)
+        {
+            u32 num = (u32)scene->num_entities;
+
+            // time is sampled once so every entity in the update sees the same value
+            f32 time_ms = (f32)pen::get_time_ms();
+
+            update_range(0, num, [scene, time_ms](u32 start, u32 end) {
+                for (u32 n = start; n < end; ++n)
+                    update_draw_call(scene, n, time_ms);
+            });
+
+            // buffer writes go through the renderer command buffer in entity order and only for dirty entities. entities
+            // which moved write the transient ring, the frame after they come to rest their own cbuffer is written once
+            // and stays bound until they are dirty again.
+            const u8* update_flags = s_update_hierarchy.update_flags;
+            u32       shared_mcb = PEN_INVALID_HANDLE;
+            for (u32 n = 0; n < num; ++n)
             {
+                bool moved = update_flags[n] & e_update_flags::world;
+                bool dirty = moved || (scene->state_flags[n] & e_state::draw_dirty);
+
+                scene->draw_cbuffer_offsets[n] = PEN_INVALID_HANDLE;
+                scene->state_flags[n] &= ~e_state::draw_dirty;
+
+                if (!dirty)
+                    continue;
+
                 if (scene->entities[n] & e_cmp::material)
                 {
-                    // per node material cbuffer
-                    if (is_valid(scene->materials[n].material_cbuffer))
-                        pen::renderer_update_buffer(scene->materials[n].material_cbuffer, &scene->material_data[n].data[0],
+                    // per node material cbuffer, a shared cbuffer is written once by the first entity of its batch
+                    u32 mcb = scene->materials[n].material_cbuffer;
+                    if (scene->state_flags[n] & e_state::shared_material)
+                    {
+                        if (mcb == shared_mcb)
+                            mcb = PEN_INVALID_HANDLE;
+                        else
+                            shared_mcb = mcb;
+                    }
+
+                    if (is_valid(mcb))
+                        pen::renderer_update_buffer(mcb, &scene->material_data[n].data[0],
                                                     scene->materials[n].material_cbuffer_size);
                 }
 
-                scene->draw_call_data[n].world_matrix = scene->world_matrices[n];
+                if (is_invalid_or_null(scene->cbuffer[n]))
+                    continue;
+
+                if (scene->entities[n] & e_cmp::sub_instance)
+                    continue;
+
+                if (moved)
+                {
+                    scene->draw_cbuffer_offsets[n] =
+                        pen::renderer_write_transient_cbuffer(&scene->draw_call_data[n], sizeof(cmp_draw_call));
+
+                    // the entity's own cbuffer is behind until it is written at rest
+                    scene->state_flags[n] |= e_state::draw_dirty;
+                    continue;
+                }
+
+                if (!is_valid(scene->draw_cbuffers[n]))
+                {
+                    pen::buffer_creation_params bcp;
+                    bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                    bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                    bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                    bcp.buffer_size = sizeof(cmp_draw_call);
+                    bcp.data = nullptr;
+
+                    scene->draw_cbuffers[n] = pen::renderer_create_buffer(bcp);
+                }
+
+                pen::renderer_update_buffer(scene->draw_cbuffers[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
+            }
+        }
+
+        void set_draw_cbuffer(ecs_scene* scene, u32 n, u32 flags)
+        {
+            u32 offset = scene->draw_cbuffer_offsets[n];
+            if (!is_valid(offset))
+            {
+                // at rest and written by the last update
+                if (is_valid(scene->draw_cbuffers[n]) && !(scene->state_flags[n] & e_state::draw_dirty))
+                {
+                    pen::renderer_set_constant_buffer(scene->draw_cbuffers[n], 1, flags);
+                    return;
+                }
+
+                offset = pen::renderer_write_transient_cbuffer(&scene->draw_call_data[n], sizeof(cmp_draw_call));
+            }
+
+            pen::renderer_set_transient_cbuffer(offset, sizeof(cmp_draw_call), 1, flags);
+        }
+
+        static void update_instance_buffers(ecs_scene* scene)
+        {
+            u32* masters = query(scene, {e_cmp::master_instance});
+            u32  num_masters = sb_count(masters);
+            for (u32 i = 0; i < num_masters; ++i)
+            {
+                u32                  n = masters[i];
+                cmp_master_instance& master = scene->master_instances[n];
+
+                u32 instance_data_size = master.num_instances * master.instance_stride;
+                pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+            }
+        }
+
+        void update_scene(ecs_scene* scene, f32 dt)
+        {
+            // static anim time to pass into draw calls etc..
+            f32 anim_time = pen::get_time_ms() / 1000.0f;
+
+            u32 num_controllers = sb_count(scene->controllers);
+            u32 num_extensions = sb_count(scene->extensions);
+
+            // children stored before their parent are moved after it between frames so the hierarchy phases stay
+            // parallel, indices held outside the scene follow entity_remap_generation
+            if (scene->flags & e_scene_flags::invalidate_order)
+            {
+                scene->flags &= ~e_scene_flags::invalidate_order;
+                reorder_entities(scene);
+            }
 
-                // store node index in v1.x
-                scene->draw_call_data[n].v1.x = (f32)n;
-                scene->draw_call_data[n].v1.y = pen::get_time_ms();
+            // pre update controllers
+            for (u32 c = 0; c < num_controllers; ++c)
+                if (scene->controllers[c].update_func)
+                    scene->controllers[c].update_func(scene->controllers[c], scene, dt);
 
-                if (is_invalid_or_null(scene->cbuffer[n]))
-                    continue;
+            // controllers and extensions may set component flags directly
+            invalidate_queries(scene);
 
-                if (scene->entities[n] & e_cmp::sub_instance)
-                    continue;
+            if (scene->flags & e_scene_flags::pause_update)
+            {
+                physics::set_paused(1);
+            }
+            else
+            {
+                physics::set_paused(0);
+                update_animations(scene, dt);
+            }
 
-                // skinned meshes have the world matrix baked into the bones
-                if (scene->entities[n] & e_cmp::skinned || scene->entities[n] & e_cmp::pre_skinned)
-                    scene->draw_call_data[n].world_matrix = mat4::create_identity();
+            // extension component update
+            for (u32 e = 0; e < num_extensions; ++e)
+                if (scene->extensions[e].update_func)
+                    scene->extensions[e].update_func(scene->extensions[e], scene, dt);
 
-                mat4 invt = scene->world_matrices[n];
+            if (num_extensions)
+                invalidate_queries(scene);
 
-                invt = invt.transposed();
-                invt = mat::inverse4x4(invt);
+            static pen::timer* timer = pen::timer_create();
+            pen::timer_start(timer);
 
-                scene->draw_call_data[n].world_matrix_inv_transpose = invt;
+            build_update_hierarchy(scene);
 
-                // todo mark dirty?
-                pen::renderer_update_buffer(scene->cbuffer[n], &scene->draw_call_data[n], sizeof(cmp_draw_call));
-            }
+            // entities were added, removed or moved in memory since the last update
+            bool structural = scene->flags & e_scene_flags::invalidate_transforms;
 
-            // update instance buffers
-            for (size_t n = 0; n < scene->num_entities; ++n)
-            {
-                if (!(scene->entities[n] & e_cmp::master_instance))
-                    continue;
+            // scene node transform
+            update_transforms(scene);
 
-                cmp_master_instance& master = scene->master_instances[n];
+            // bounding volume transform
+            update_bounding_volumes(scene);
+            update_bvh(scene, structural);
 
-                u32 instance_data_size = master.num_instances * master.instance_stride;
-                pen::renderer_update_buffer(master.instance_buffer, &scene->draw_call_data[n + 1], instance_data_size);
+            update_lights(scene, anim_time);
+            update_sdf_shadows(scene);
+            update_shadow_maps(scene);
+            update_pre_skin(scene);
 
-                // stride over sub instances
-                n += scene->master_instances[n].num_instances;
-            }
+            // update draw call data
+            update_draw_calls(scene);
+            update_instance_buffers(scene);
+
+            scene->flags |= e_scene_flags::invalidate_visibility;
 
             // update physics running 1 frame behind to allow the sets to take effect
             physics::step(dt);
@@ -1852,9 +4313,10 @@ namespace put
                 if (scene->controllers[c].post_update_func)
                     scene->controllers[c].post_update_func(scene->controllers[c], scene, dt);
 
-            f64 elapsed = pen::timer_elapsed_ms(timer);
-            PEN_UNUSED(elapsed);
-            // PEN_LOG("scene update: %f(ms)", elapsed);
+            // the update toggles transform flags and post update controllers may set flags directly, render sees both
+            invalidate_queries(scene);
+
+            s_update_time_ms = pen::timer_elapsed_ms(timer);
         }
 
         struct scene_header
@@ -1866,51 +4328,95 @@ namespace put
             s32 num_lookup_strings = 0;
             s32 num_extensions = 0;
             s32 num_base_components = 0;
-            s32 reserved_1[25] = {0};
+            u32 num_sections = 0; // version 10, entries of the section table which follows the header
+            s32 reserved_1[24] = {0};
             u32 view_flags = 0;
             s32 selected_index = 0;
             s32 reserved_2[30] = {0};
         };
 
-        struct lookup_string
+        // version 10 files are the header, a table of sections and then the sections themselves in a single pass.
+        // sections are 64 byte aligned and component arrays of a page or more are page aligned so they can be mapped
+        // straight into the component memory. strings are stored once in a table and referenced by index from the
+        // specialisation stream, which holds everything version 9 wrote after the components in the same order.
+        static const u32 k_scene_section_align = 64;
+        static const u32 k_scene_page_align = 4096;
+
+        namespace e_scene_section
         {
-            Str     name;
-            hash_id id;
+            enum scene_section_t
+            {
+                component,
+                specialisations,
+                strings,
+                extensions,
+                cameras
+            };
+        }
+
+        struct scene_section
+        {
+            u32 type;         // e_scene_section
+            u32 index;        // component index for component sections
+            u32 element_size; // bytes of each element
+            u32 count;        // elements, entities for component sections
+            u64 offset;       // from the start of the file
+            u64 size;         // bytes
         };
-        static lookup_string* s_lookup_strings = nullptr;
 
-        void write_lookup_string(const char* string, std::ofstream& ofs, const c8* strip_project_dir = nullptr)
+        struct scene_string
         {
-            hash_id id = 0;
+            u32     offset; // null terminated characters from the start of the data following the string table
+            hash_id id;
+        };
 
-            Str stripped = string;
-            if (strip_project_dir)
-            {
-                stripped = pen::str_replace_string(stripped, strip_project_dir, "");
-                string = stripped.c_str();
-            }
+        struct scene_extension
+        {
+            u32 name; // string index
+            u32 start_cmp;
+            u32 num_cmp;
+        };
 
-            if (!string)
-            {
-                ofs.write((const c8*)&id, sizeof(hash_id));
-                return;
-            }
+        struct scene_camera
+        {
+            hash_id id;
+            vec3f   pos;
+            vec3f   focus;
+            vec2f   rot;
+            f32     fov;
+            f32     aspect;
+            f32     near_plane;
+            f32     far_plane;
+            f32     zoom;
+        };
 
-            id = PEN_HASH(string);
-            ofs.write((const c8*)&id, sizeof(hash_id));
+        struct scene_writer
+        {
+            scene_string* strings = nullptr;
+            c8*           chars = nullptr;
+            u32*          slots = nullptr; // open addressed by hash, string index + 1 or 0 when empty
+            u32           num_slots = 0;
+            u32*          stream = nullptr; // specialisation stream
+        };
 
-            u32 num_strings = sb_count(s_lookup_strings);
-            for (u32 i = 0; i < num_strings; ++i)
-            {
-                if (id == s_lookup_strings[i].id)
-                {
-                    return;
-                }
-            }
+        struct scene_reader
+        {
+            std::ifstream ifs;
+            s32           version = 0;
+            c8*           string_data = nullptr; // version 10 string table section
+            u32           num_strings = 0;
+            u32*          stream = nullptr; // version 10 specialisation stream
+            u32           stream_size = 0;
+            u32           stream_pos = 0;
+        };
 
-            lookup_string ls = {string, id};
-            sb_push(s_lookup_strings, ls);
-        }
+        // version 9 and earlier store strings by hash and the table of strings in the header
+        struct lookup_string
+        {
+            Str     name;
+            hash_id id;
+        };
+        static lookup_string* s_lookup_strings = nullptr;
 
         Str read_lookup_string(std::ifstream& ifs)
         {
@@ -1943,6 +4449,108 @@ namespace put
             return 0;
         }
 
+        static u32 scene_string_slot(const scene_writer& w, hash_id id)
+        {
+            u32 mask = w.num_slots - 1;
+            for (u32 s = id & mask;; s = (s + 1) & mask)
+            {
+                u32 i = w.slots[s];
+                if (i == 0 || w.strings[i - 1].id == id)
+                    return s;
+            }
+        }
+
+        static u32 scene_string_index(scene_writer& w, const c8* string, const c8* strip_project_dir = nullptr)
+        {
+            if (!string)
+                return PEN_INVALID_HANDLE;
+
+            Str stripped;
+            if (strip_project_dir)
+            {
+                stripped = pen::str_replace_string(string, strip_project_dir, "");
+                string = stripped.c_str();
+            }
+
+            // keep the table at most half full
+            u32 num_strings = sb_count(w.strings);
+            if ((num_strings + 1) * 2 > w.num_slots)
+            {
+                w.num_slots = std::max<u32>(w.num_slots * 2, 1024);
+                w.slots = (u32*)pen::memory_realloc(w.slots, sizeof(u32) * w.num_slots);
+                pen::memory_zero(w.slots, sizeof(u32) * w.num_slots);
+
+                for (u32 i = 0; i < num_strings; ++i)
+                    w.slots[scene_string_slot(w, w.strings[i].id)] = i + 1;
+            }
+
+            hash_id id = PEN_HASH(string);
+            u32     s = scene_string_slot(w, id);
+            if (w.slots[s])
+                return w.slots[s] - 1;
+
+            u32 len = (u32)strlen(string) + 1;
+            u32 offset = sb_count(w.chars);
+            memcpy(sb_add(w.chars, len), string, len);
+
+            scene_string ss = {offset, id};
+            sb_push(w.strings, ss);
+
+            w.slots[s] = num_strings + 1;
+            return num_strings;
+        }
+
+        static void write_scene_string(scene_writer& w, const c8* string, const c8* strip_project_dir = nullptr)
+        {
+            sb_push(w.stream, scene_string_index(w, string, strip_project_dir));
+        }
+
+        static void write_scene_u32(scene_writer& w, u32 value)
+        {
+            sb_push(w.stream, value);
+        }
+
+        static u32 read_scene_u32(scene_reader& r)
+        {
+            u32 value = 0;
+            if (r.version < 10)
+                r.ifs.read((c8*)&value, sizeof(u32));
+            else if (r.stream_pos < r.stream_size)
+                value = r.stream[r.stream_pos++];
+
+            return value;
+        }
+
+        static Str read_scene_string(scene_reader& r)
+        {
+            if (r.version < 10)
+                return read_lookup_string(r.ifs);
+
+            u32 index = read_scene_u32(r);
+            if (index >= r.num_strings)
+                return "";
+
+            const scene_string* strings = (const scene_string*)r.string_data;
+            return r.string_data + sizeof(scene_string) * r.num_strings + strings[index].offset;
+        }
+
+        static void read_scene_section(scene_reader& r, const scene_section& s, void* dst)
+        {
+            r.ifs.seekg(s.offset);
+            r.ifs.read((c8*)dst, s.size);
+        }
+
+        static void write_scene_padding(std::ofstream& ofs, u64& pos, u64 offset)
+        {
+            static const c8 zeros[k_scene_page_align] = {0};
+            while (pos < offset)
+            {
+                u64 size = std::min<u64>(offset - pos, k_scene_page_align);
+                ofs.write(zeros, size);
+                pos += size;
+            }
+        }
+
         void save_sub_scene(ecs_scene* scene, u32 root)
         {
             std::vector<s32> nodes;
@@ -1972,7 +4580,7 @@ namespace put
                     generic_cmp_array& src = scene->get_component_array(c);
                     generic_cmp_array& dst = sub_scene.get_component_array(c);
 
-                    memcpy(dst[ni], src[ii], src.size);
+                    copy_component(dst, ni, src, ii);
                 }
 
                 sub_scene.parents[ni] -= root;
@@ -1988,31 +4596,33 @@ namespace put
             unregister_ecs_extensions(&sub_scene);
         }
 
+        static void add_scene_section(scene_section*& sections, u64& pos, u32 type, u32 index, u32 element_size, u32 count,
+                                      u64 size)
+        {
+            u64 align = size >= k_scene_page_align ? k_scene_page_align : k_scene_section_align;
+            pos = (pos + align - 1) & ~(align - 1);
+
+            scene_section s = {type, index, element_size, count, pos, size};
+            sb_push(sections, s);
+
+            pos += size;
+        }
+
         void save_scene(const c8* filename, ecs_scene* scene)
         {
             const c8* wd = pen::os_get_user_info().working_directory;
             Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
 
-            std::ofstream ofs(filename, std::ofstream::binary);
-
-            sb_free(s_lookup_strings);
-            s_lookup_strings = nullptr;
-
-            // write basic components
-            for (u32 i = 0; i < scene->num_components; ++i)
-            {
-                generic_cmp_array& cmp = scene->get_component_array(i);
-                ofs.write((const c8*)cmp.data, cmp.size * scene->num_entities);
-            }
+            scene_writer w;
 
             // specialisations ------------------------------------------------------------------------------
 
             // names
             for (s32 n = 0; n < scene->num_entities; ++n)
             {
-                write_lookup_string(scene->names[n].c_str(), ofs);
-                write_lookup_string(scene->geometry_names[n].c_str(), ofs);
-                write_lookup_string(scene->material_names[n].c_str(), ofs);
+                write_scene_string(w, scene->names[n].c_str());
+                write_scene_string(w, scene->geometry_names[n].c_str());
+                write_scene_string(w, scene->material_names[n].c_str());
             }
 
             // geometry
@@ -2023,10 +4633,9 @@ namespace put
 
                 geometry_resource* gr = get_geometry_resource(scene->id_geometry[n]);
 
-                ofs.write((const c8*)&gr->submesh_index, sizeof(u32));
-
-                write_lookup_string(gr->filename.c_str(), ofs, project_dir.c_str());
-                write_lookup_string(gr->geometry_name.c_str(), ofs, project_dir.c_str());
+                write_scene_u32(w, gr->submesh_index);
+                write_scene_string(w, gr->filename.c_str(), project_dir.c_str());
+                write_scene_string(w, gr->geometry_name.c_str(), project_dir.c_str());
             }
 
             // animations
@@ -2034,16 +4643,17 @@ namespace put
             {
                 s32 size = 0;
 
-                if (scene->anim_controller_v2[n].anim_instances)
-                    size = sb_count(scene->anim_controller_v2[n].anim_instances);
+                const cmp_anim_controller_v2& controller = scene->anim_controller_v2.get(n);
+                if (controller.anim_instances)
+                    size = sb_count(controller.anim_instances);
 
-                ofs.write((const c8*)&size, sizeof(s32));
+                write_scene_u32(w, size);
 
                 for (s32 i = 0; i < size; ++i)
                 {
                     // todo with anim controller v2
                     // auto* anim = get_animation_resource(scene->anim_controller_v2[n].anim_instances[i].);
-                    write_lookup_string("placeholder", ofs, project_dir.c_str());
+                    write_scene_string(w, "placeholder", project_dir.c_str());
                 }
             }
 
@@ -2059,9 +4669,9 @@ namespace put
                 const char* shader_name = pmfx::get_shader_name(mat.shader);
                 const char* technique_name = pmfx::get_technique_name(mat.shader, mat_res.id_technique);
 
-                write_lookup_string(mat_res.material_name.c_str(), ofs);
-                write_lookup_string(shader_name, ofs);
-                write_lookup_string(technique_name, ofs);
+                write_scene_string(w, mat_res.material_name.c_str());
+                write_scene_string(w, shader_name);
+                write_scene_string(w, technique_name);
             }
 
             // shadow
@@ -2072,7 +4682,7 @@ namespace put
 
                 cmp_shadow& shadow = scene->shadows[n];
 
-                write_lookup_string(put::get_texture_filename(shadow.texture_handle).c_str(), ofs, project_dir.c_str());
+                write_scene_string(w, put::get_texture_filename(shadow.texture_handle).c_str(), project_dir.c_str());
             }
 
             // sampler bindings
@@ -2085,42 +4695,73 @@ namespace put
 
                 for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
                 {
-                    write_lookup_string(put::get_texture_filename(samplers.sb[i].handle).c_str(), ofs, project_dir.c_str());
-                    write_lookup_string(pmfx::get_render_state_name(samplers.sb[i].sampler_state).c_str(), ofs,
-                                        project_dir.c_str());
+                    write_scene_string(w, put::get_texture_filename(samplers.sb[i].handle).c_str(), project_dir.c_str());
+                    write_scene_string(w, pmfx::get_render_state_name(samplers.sb[i].sampler_state).c_str(),
+                                       project_dir.c_str());
                 }
             }
 
+            // extensions
+            scene_extension* exts = nullptr;
+            u32              num_extensions = sb_count(scene->extensions);
+            for (u32 i = 0; i < num_extensions; ++i)
+            {
+                scene_extension ext;
+                ext.name = scene_string_index(w, scene->extensions[i].name.c_str());
+                ext.start_cmp = get_extension_component_offset(scene, i);
+                ext.num_cmp = scene->extensions[i].num_components;
+                sb_push(exts, ext);
+            }
+
             // cameras
-            camera** cams = pmfx::get_cameras();
-            u32      num_cams = sb_count(cams);
+            scene_camera* cams = nullptr;
+            camera**      pmfx_cams = pmfx::get_cameras();
+            u32           num_cams = sb_count(pmfx_cams);
             for (u32 i = 0; i < num_cams; ++i)
             {
-                write_lookup_string(cams[i]->name.c_str(), ofs);
+                camera*      cam = pmfx_cams[i];
+                scene_camera sc;
+                sc.id = PEN_HASH(cam->name);
+                sc.pos = cam->pos;
+                sc.focus = cam->focus;
+                sc.rot = cam->rot;
+                sc.fov = cam->fov;
+                sc.aspect = cam->aspect;
+                sc.near_plane = cam->near_plane;
+                sc.far_plane = cam->far_plane;
+                sc.zoom = cam->zoom;
+                sb_push(cams, sc);
             }
 
-            // call extensions specific save
-            u32 num_extensions = sb_count(scene->extensions);
-            for (u32 i = 0; i < num_extensions; ++i)
-                if (scene->extensions[i].save_func)
-                    scene->extensions[i].save_func(scene->extensions[i], scene);
-
-            ofs.close();
+            // lay out every section up front so the file is written front to back in one pass
+            u32 num_strings = sb_count(w.strings);
+            u32 num_chars = sb_count(w.chars);
+            u32 num_sections = scene->num_components + 4;
 
-            std::ifstream infile(filename, std::ifstream::binary);
+            scene_section* sections = nullptr;
+            u64            pos = sizeof(scene_header) + sizeof(scene_section) * num_sections;
 
-            // get size of file
-            infile.seekg(0, infile.end);
-            u32 scene_data_size = (u32)infile.tellg();
-            infile.seekg(0);
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                u32 size = scene->get_component_array(i).size;
+                add_scene_section(sections, pos, e_scene_section::component, i, size, scene->num_entities,
+                                  (u64)size * scene->num_entities);
+            }
 
-            // allocate memory for file content
-            c8* scene_data = new c8[scene_data_size];
+            add_scene_section(sections, pos, e_scene_section::specialisations, 0, sizeof(u32), sb_count(w.stream),
+                              sizeof(u32) * sb_count(w.stream));
+            add_scene_section(sections, pos, e_scene_section::strings, 0, sizeof(scene_string), num_strings,
+                              sizeof(scene_string) * num_strings + num_chars);
+            add_scene_section(sections, pos, e_scene_section::extensions, 0, sizeof(scene_extension), num_extensions,
+                              sizeof(scene_extension) * num_extensions);
+            add_scene_section(sections, pos, e_scene_section::cameras, 0, sizeof(scene_camera), num_cams,
+                              sizeof(scene_camera) * num_cams);
 
-            // read content of infile
-            infile.read(scene_data, scene_data_size);
+            // written beside the file and renamed over it, arrays loaded from the file may be mapped from its pages
+            Str tmp_filename = filename;
+            tmp_filename.append(".tmp");
 
-            ofs = std::ofstream(filename, std::ofstream::binary);
+            std::ofstream ofs(tmp_filename.c_str(), std::ofstream::binary);
 
             // header
             scene_header sh;
@@ -2129,65 +4770,95 @@ namespace put
             sh.selected_index = scene->selected_index;
             sh.num_components = scene->num_components;
             sh.num_base_components = scene->num_base_components;
-            sh.num_lookup_strings = sb_count(s_lookup_strings);
-            sh.num_extensions = sb_count(scene->extensions);
+            sh.num_lookup_strings = num_strings;
+            sh.num_extensions = num_extensions;
+            sh.num_sections = num_sections;
             ofs.write((const c8*)&sh, sizeof(scene_header));
+            ofs.write((const c8*)sections, sizeof(scene_section) * num_sections);
 
-            // component sizes
-            for (u32 c = 0; c < sh.num_components; ++c)
-            {
-                ofs.write((const c8*)&scene->get_component_array(c).size, sizeof(u32));
-            }
+            pos = sizeof(scene_header) + sizeof(scene_section) * num_sections;
 
-            // extensions
-            for (u32 i = 0; i < sh.num_extensions; ++i)
+            for (u32 s = 0; s < num_sections; ++s)
             {
-                u32 co = get_extension_component_offset(scene, i);
-                write_lookup_string(scene->extensions[i].name.c_str(), ofs);
-                ofs.write((const c8*)&co, sizeof(u32));
-                ofs.write((const c8*)&scene->extensions[i].num_components, sizeof(u32));
-            }
+                const scene_section& section = sections[s];
+                write_scene_padding(ofs, pos, section.offset);
 
-            // string lookups
-            for (u32 l = 0; l < sh.num_lookup_strings; ++l)
-            {
-                write_parsable_string(s_lookup_strings[l].name.c_str(), ofs);
-                ofs.write((const c8*)&s_lookup_strings[l].id, sizeof(hash_id));
+                switch (section.type)
+                {
+                    case e_scene_section::component:
+                    {
+                        generic_cmp_array& cmp = scene->get_component_array(section.index);
+                        if (cmp.flags & e_cmp_array_flags::sparse)
+                        {
+                            // entities without the component write zero, the file layout does not depend on the storage
+                            for (u32 n = 0; n < scene->num_entities; ++n)
+                                ofs.write((const c8*)cmp.get(n), cmp.size);
+                        }
+                        else
+                        {
+                            ofs.write((const c8*)cmp.data, section.size);
+                        }
+                    }
+                    break;
+                    case e_scene_section::specialisations:
+                        ofs.write((const c8*)w.stream, section.size);
+                        break;
+                    case e_scene_section::strings:
+                        ofs.write((const c8*)w.strings, sizeof(scene_string) * num_strings);
+                        ofs.write(w.chars, num_chars);
+                        break;
+                    case e_scene_section::extensions:
+                        ofs.write((const c8*)exts, section.size);
+                        break;
+                    case e_scene_section::cameras:
+                        ofs.write((const c8*)cams, section.size);
+                        break;
+                }
+
+                pos += section.size;
             }
 
-            // write camera info
-            ofs.write((const c8*)&num_cams, sizeof(u32));
-            for (u32 i = 0; i < num_cams; ++i)
+            ofs.close();
+
+            // windows does not rename over an existing file
+            if (std::rename(tmp_filename.c_str(), filename) != 0)
             {
-                hash_id id_cam = PEN_HASH(cams[i]->name);
-                ofs.write((const c8*)&id_cam, sizeof(hash_id));
-                ofs.write((const c8*)&cams[i]->pos, sizeof(vec3f));
-                ofs.write((const c8*)&cams[i]->focus, sizeof(vec3f));
-                ofs.write((const c8*)&cams[i]->rot, sizeof(vec2f));
-                ofs.write((const c8*)&cams[i]->fov, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->aspect, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->near_plane, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->far_plane, sizeof(f32));
-                ofs.write((const c8*)&cams[i]->zoom, sizeof(f32));
+                std::remove(filename);
+                if (std::rename(tmp_filename.c_str(), filename) != 0)
+                    PEN_LOG("[ecs] failed to save scene %s, it was written to %s", filename, tmp_filename.c_str());
             }
 
-            // write scene data
-            ofs.write(scene_data, scene_data_size);
-            ofs.close();
+            // call extensions specific save
+            for (u32 i = 0; i < num_extensions; ++i)
+                if (scene->extensions[i].save_func)
+                    scene->extensions[i].save_func(scene->extensions[i], scene);
+
+            // cleanup
+            sb_free(w.strings);
+            sb_free(w.chars);
+            sb_free(w.stream);
+            pen::memory_free(w.slots);
+            sb_free(sections);
+            sb_free(exts);
+            sb_free(cams);
         }
 
         void load_scene(const c8* filename, ecs_scene* scene, bool merge)
         {
             scene->flags |= e_scene_flags::invalidate_scene_tree;
+            scene->flags |= e_scene_flags::invalidate_transforms | e_scene_flags::invalidate_visibility;
             bool      error = false;
             const c8* wd = pen::os_get_user_info().working_directory;
             Str       project_dir = dev_ui::get_program_preference_filename("project_dir", wd);
+            Str       path = pen::os_path_for_resource(filename);
 
-            std::ifstream ifs(pen::os_path_for_resource(filename).c_str(), std::ofstream::binary);
+            scene_reader r;
+            r.ifs.open(path.c_str(), std::ofstream::binary);
 
             // header
             scene_header sh;
-            ifs.read((c8*)&sh, sizeof(scene_header));
+            r.ifs.read((c8*)&sh, sizeof(scene_header));
+            r.version = sh.version;
 
             if (!merge)
             {
@@ -2223,15 +4894,6 @@ namespace put
 
             scene->num_entities = new_num_nodes;
 
-            // read component sizes
-            u32* component_sizes = nullptr;
-            for (u32 i = 0; i < sh.num_components; ++i)
-            {
-                u32 size;
-                ifs.read((c8*)&size, sizeof(u32));
-                sb_push(component_sizes, size);
-            }
-
             // extensions
             struct ext_components
             {
@@ -2241,66 +4903,155 @@ namespace put
             };
             ext_components* exts = nullptr;
 
-            for (u32 i = 0; i < sh.num_extensions; ++i)
+            u32*                  component_sizes = nullptr;
+            const scene_section** component_sections = nullptr;
+            scene_section*        sections = nullptr;
+            scene_camera*         cams = nullptr;
+
+            if (sh.version >= 10)
             {
-                ext_components ext;
-                ifs.read((c8*)&ext.id, sizeof(hash_id));
-                ifs.read((c8*)&ext.start_cmp, sizeof(u32));
-                ifs.read((c8*)&ext.num_cmp, sizeof(u32));
+                sections = (scene_section*)pen::memory_alloc(sizeof(scene_section) * sh.num_sections);
+                r.ifs.seekg(sh.header_size);
+                r.ifs.read((c8*)sections, sizeof(scene_section) * sh.num_sections);
 
-                sb_push(exts, ext);
-            }
+                // components missing from the file have a size of 0 and are skipped
+                for (u32 i = 0; i < sh.num_components; ++i)
+                {
+                    sb_push(component_sizes, 0);
+                    sb_push(component_sections, nullptr);
+                }
 
-            // read string lookups
-            sb_free(s_lookup_strings);
-            s_lookup_strings = nullptr;
+                const scene_section* ext_section = nullptr;
+                const scene_section* cam_section = nullptr;
 
-            for (u32 n = 0; n < sh.num_lookup_strings; ++n)
-            {
-                lookup_string ls;
-                ls.name = read_parsable_string(ifs);
-                ifs.read((c8*)&ls.id, sizeof(hash_id));
+                for (u32 s = 0; s < sh.num_sections; ++s)
+                {
+                    const scene_section& section = sections[s];
+                    switch (section.type)
+                    {
+                        case e_scene_section::component:
+                            if (section.index < sh.num_components && section.count == num_nodes)
+                            {
+                                component_sizes[section.index] = section.element_size;
+                                component_sections[section.index] = &section;
+                            }
+                            break;
+                        case e_scene_section::specialisations:
+                            r.stream = (u32*)pen::memory_alloc(section.size);
+                            r.stream_size = section.count;
+                            read_scene_section(r, section, r.stream);
+                            break;
+                        case e_scene_section::strings:
+                            r.string_data = (c8*)pen::memory_alloc(section.size);
+                            r.num_strings = section.count;
+                            read_scene_section(r, section, r.string_data);
+                            break;
+                        case e_scene_section::extensions:
+                            ext_section = &section;
+                            break;
+                        case e_scene_section::cameras:
+                            cam_section = &section;
+                            break;
+                    }
+                }
 
-                sb_push(s_lookup_strings, ls);
-            }
+                if (ext_section)
+                {
+                    scene_extension* se = (scene_extension*)pen::memory_alloc(ext_section->size);
+                    read_scene_section(r, *ext_section, se);
 
-            // rehash extension ids
-            for (u32 i = 0; i < sh.num_extensions; ++i)
-            {
-                exts[i].id = rehash_lookup_string(exts[i].id);
+                    for (u32 i = 0; i < ext_section->count; ++i)
+                    {
+                        const scene_string* strings = (const scene_string*)r.string_data;
+                        hash_id             id = se[i].name < r.num_strings ? strings[se[i].name].id : 0;
+
+                        ext_components ext = {id, se[i].start_cmp, se[i].num_cmp};
+                        sb_push(exts, ext);
+                    }
+
+                    pen::memory_free(se);
+                }
+
+                if (cam_section)
+                {
+                    sb_add(cams, cam_section->count);
+                    read_scene_section(r, *cam_section, cams);
+                }
             }
+            else
+            {
+                // read component sizes
+                for (u32 i = 0; i < sh.num_components; ++i)
+                {
+                    u32 size;
+                    r.ifs.read((c8*)&size, sizeof(u32));
+                    sb_push(component_sizes, size);
+                }
+
+                for (u32 i = 0; i < sh.num_extensions; ++i)
+                {
+                    ext_components ext;
+                    r.ifs.read((c8*)&ext.id, sizeof(hash_id));
+                    r.ifs.read((c8*)&ext.start_cmp, sizeof(u32));
+                    r.ifs.read((c8*)&ext.num_cmp, sizeof(u32));
+
+                    sb_push(exts, ext);
+                }
+
+                // read string lookups
+                sb_free(s_lookup_strings);
+                s_lookup_strings = nullptr;
+
+                for (u32 n = 0; n < sh.num_lookup_strings; ++n)
+                {
+                    lookup_string ls;
+                    ls.name = read_parsable_string(r.ifs);
+                    r.ifs.read((c8*)&ls.id, sizeof(hash_id));
+
+                    sb_push(s_lookup_strings, ls);
+                }
+
+                // rehash extension ids
+                for (u32 i = 0; i < sh.num_extensions; ++i)
+                {
+                    exts[i].id = rehash_lookup_string(exts[i].id);
+                }
 
-            // read cameras
-            u32 num_cams;
-            ifs.read((c8*)&num_cams, sizeof(u32));
+                // read cameras
+                u32 num_cams;
+                r.ifs.read((c8*)&num_cams, sizeof(u32));
+
+                for (u32 i = 0; i < num_cams; ++i)
+                {
+                    scene_camera cam;
+                    r.ifs.read((c8*)&cam.id, sizeof(hash_id));
+                    r.ifs.read((c8*)&cam.pos, sizeof(vec3f));
+                    r.ifs.read((c8*)&cam.focus, sizeof(vec3f));
+                    r.ifs.read((c8*)&cam.rot, sizeof(vec2f));
+                    r.ifs.read((c8*)&cam.fov, sizeof(f32));
+                    r.ifs.read((c8*)&cam.aspect, sizeof(f32));
+                    r.ifs.read((c8*)&cam.near_plane, sizeof(f32));
+                    r.ifs.read((c8*)&cam.far_plane, sizeof(f32));
+                    r.ifs.read((c8*)&cam.zoom, sizeof(f32));
+                    sb_push(cams, cam);
+                }
+            }
 
+            // find cameras and set
+            u32 num_cams = sb_count(cams);
             for (u32 i = 0; i < num_cams; ++i)
             {
-                camera  cam;
-                hash_id id_cam;
-
-                ifs.read((c8*)&id_cam, sizeof(hash_id));
-                ifs.read((c8*)&cam.pos, sizeof(vec3f));
-                ifs.read((c8*)&cam.focus, sizeof(vec3f));
-                ifs.read((c8*)&cam.rot, sizeof(vec2f));
-                ifs.read((c8*)&cam.fov, sizeof(f32));
-                ifs.read((c8*)&cam.aspect, sizeof(f32));
-                ifs.read((c8*)&cam.near_plane, sizeof(f32));
-                ifs.read((c8*)&cam.far_plane, sizeof(f32));
-                ifs.read((c8*)&cam.zoom, sizeof(f32));
-
-                // find camera and set
-                camera* _cam = pmfx::get_camera(id_cam);
+                camera* _cam = pmfx::get_camera(cams[i].id);
                 if (_cam && !merge)
                 {
-                    _cam->pos = cam.pos;
-                    _cam->focus = cam.focus;
-                    _cam->rot = cam.rot;
-                    _cam->fov = cam.fov;
-                    _cam->aspect = cam.aspect;
-                    _cam->near_plane = cam.near_plane;
-                    _cam->far_plane = cam.far_plane;
-                    _cam->zoom = cam.zoom;
+                    _cam->pos = cams[i].pos;
+                    _cam->focus = cams[i].focus;
+                    _cam->rot = cams[i].rot;
+                    _cam->fov = cams[i].fov;
+                    _cam->aspect = cams[i].aspect;
+                    _cam->near_plane = cams[i].near_plane;
+                    _cam->far_plane = cams[i].far_plane;
+                    _cam->zoom = cams[i].zoom;
                 }
             }
 
@@ -2331,22 +5082,49 @@ namespace put
                 if (ri != -1)
                 {
                     generic_cmp_array& cmp = scene->get_component_array(ri);
+                    size_t             array_size = (size_t)cmp.size * num_nodes;
+
+                    if (cmp.size == component_sizes[i] && (cmp.flags & e_cmp_array_flags::sparse))
+                    {
+                        // read whole array and only add the elements of entities which have the component
+                        c8* elements = (c8*)pen::memory_alloc(array_size);
+                        if (sh.version >= 10)
+                            read_scene_section(r, *component_sections[i], elements);
+                        else
+                            r.ifs.read(elements, array_size);
+
+                        for (u32 n = 0; n < num_nodes; ++n)
+                            set_component(cmp, zero_offset + n, elements + n * cmp.size);
 
-                    if (cmp.size == component_sizes[i])
+                        pen::memory_free(elements);
+                        read = true;
+                    }
+                    else if (cmp.size == component_sizes[i])
                     {
-                        // read whole array
+                        // read whole array, into a fresh scene with reserved memory the pages of the file are mapped
+                        // in place and only copied when written to
                         c8* data_offset = (c8*)cmp.data + zero_offset * cmp.size;
-                        ifs.read(data_offset, cmp.size * num_nodes);
+                        if (sh.version >= 10)
+                        {
+                            const scene_section& section = *component_sections[i];
+                            if (merge || !scene->reserved_size ||
+                                !pen::memory_map_file(data_offset, array_size, path.c_str(), section.offset))
+                                read_scene_section(r, section, data_offset);
+                        }
+                        else
+                        {
+                            r.ifs.read(data_offset, array_size);
+                        }
                         read = true;
                     }
                 }
 
-                if (!read)
+                if (!read && sh.version < 10)
                 {
                     // read the old size
-                    u32 array_size = component_sizes[i] * num_nodes;
+                    size_t array_size = (size_t)component_sizes[i] * num_nodes;
                     c8* old = (c8*)pen::memory_alloc(array_size);
-                    ifs.read(old, array_size);
+                    r.ifs.read(old, array_size);
 
                     // here any fuxup can be applied old into cmp.data
 
@@ -2354,9 +5132,10 @@ namespace put
                 }
             }
 
-            // fixup parents for scene import / merge
-            for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
-                scene->parents[n] += zero_offset;
+            // fixup parents for scene import / merge, untouched otherwise so mapped pages stay shared with the file
+            if (zero_offset)
+                for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
+                    scene->parents[n] += zero_offset;
 
             // read specialisations
             for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
@@ -2365,22 +5144,22 @@ namespace put
                 memset(&scene->geometry_names[n], 0x0, sizeof(Str));
                 memset(&scene->material_names[n], 0x0, sizeof(Str));
 
-                scene->names[n] = read_lookup_string(ifs);
-                scene->geometry_names[n] = read_lookup_string(ifs);
-                scene->material_names[n] = read_lookup_string(ifs);
+                scene->names[n] = read_scene_string(r);
+                scene->geometry_names[n] = read_scene_string(r);
+                scene->material_names[n] = read_scene_string(r);
             }
 
+
             // geometry
             for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
             {
                 if (scene->entities[n] & e_cmp::geometry)
                 {
-                    u32 submesh;
-                    ifs.read((c8*)&submesh, sizeof(u32));
+                    u32 submesh = read_scene_u32(r);
 
                     Str filename = project_dir;
-                    Str name = read_lookup_string(ifs).c_str();
-                    Str geometry_name = read_lookup_string(ifs);
+                    Str name = read_scene_string(r).c_str();
+                    Str geometry_name = read_scene_string(r);
 
                     hash_id        name_hash = PEN_HASH(name.c_str());
                     static hash_id primitive_id = PEN_HASH("primitive");
@@ -2442,13 +5221,12 @@ namespace put
             // animations
             for (s32 n = zero_offset; n < zero_offset + num_nodes; ++n)
             {
-                s32 size;
-                ifs.read((c8*)&size, sizeof(s32));
+                s32 size = (s32)read_scene_u32(r);
 
                 for (s32 i = 0; i < size; ++i)
                 {
                     Str anim_name = project_dir;
-                    anim_name.append(read_lookup_string(ifs).c_str());
+                    anim_name.append(read_scene_string(r).c_str());
 
                     anim_handle h = load_pma(anim_name.c_str());
 
@@ -2477,9 +5255,9 @@ namespace put
                 memset(&mat_res.shader_name, 0x0, sizeof(Str));
                 mat.material_cbuffer = PEN_INVALID_HANDLE;
 
-                Str material_name = read_lookup_string(ifs);
-                Str shader = read_lookup_string(ifs);
-                Str technique = read_lookup_string(ifs);
+                Str material_name = read_scene_string(r);
+                Str shader = read_scene_string(r);
+                Str technique = read_scene_string(r);
 
                 mat_res.material_name = material_name;
                 mat_res.id_shader = PEN_HASH(shader.c_str());
@@ -2493,7 +5271,7 @@ namespace put
                 if (!(scene->entities[n] & e_cmp::sdf_shadow))
                     continue;
 
-                Str sdf_shadow_volume_file = read_lookup_string(ifs);
+                Str sdf_shadow_volume_file = read_scene_string(r);
                 sdf_shadow_volume_file = pen::str_replace_string(sdf_shadow_volume_file, ".dds", ".pmv");
 
                 dev_console_log("[scene load] %s", sdf_shadow_volume_file.c_str());
@@ -2510,7 +5288,7 @@ namespace put
 
                 for (u32 i = 0; i < e_pmfx_constants::max_technique_sampler_bindings; ++i)
                 {
-                    Str texture_name = read_lookup_string(ifs);
+                    Str texture_name = read_scene_string(r);
 
                     if (!texture_name.empty())
                     {
@@ -2519,7 +5297,7 @@ namespace put
                             pmfx::get_render_state(PEN_HASH("wrap_linear"), pmfx::e_render_state::sampler);
                     }
 
-                    Str sampler_state_name = read_lookup_string(ifs);
+                    Str sampler_state_name = read_scene_string(r);
 
                     if (!sampler_state_name.empty())
                     {
@@ -2529,9 +5307,10 @@ namespace put
                 }
             }
 
-            // read cams strings
-            for (u32 i = 0; i < num_cams; ++i)
-                read_lookup_string(ifs);
+            // version 9 wrote the names of cameras after the specialisations
+            if (sh.version < 10)
+                for (u32 i = 0; i < num_cams; ++i)
+                    read_lookup_string(r.ifs);
 
             // read extensions
             for (u32 i = 0; i < sh.num_extensions; ++i)
@@ -2562,13 +5341,19 @@ namespace put
                     scene->view_flags |= (e_scene_view_flags::matrix | e_scene_view_flags::bones);
             }
 
-            ifs.close();
+            r.ifs.close();
 
             initialise_free_list(scene);
+            invalidate_queries(scene);
 
             // cleanup
             sb_free(component_sizes);
+            sb_free(component_sections);
             sb_free(exts);
+            sb_free(cams);
+            pen::memory_free(sections);
+            pen::memory_free(r.stream);
+            pen::memory_free(r.string_data);
         }
     } // namespace ecs
 } // namespace put
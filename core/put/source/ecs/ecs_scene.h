@@ -28,6 +28,8 @@ namespace put
     {
         struct anim_instance;
         struct ecs_scene;
+        struct ecs_bvh;
+        struct ecs_query_cache;
 
         namespace e_scene_view_flags
         {
@@ -59,7 +61,10 @@ namespace put
             {
                 none = 0,
                 invalidate_scene_tree = 1 << 1,
-                pause_update = 1 << 2
+                pause_update = 1 << 2,
+                invalidate_transforms = 1 << 3, // recompute every world matrix and bounds in the next update
+                invalidate_visibility = 1 << 4, // cull all views again, set by update_scene and structural changes
+                invalidate_order = 1 << 5       // an entity is stored before its parent, reordered by the next update_scene
             };
         }
         typedef u32 scene_flags;
@@ -76,6 +81,10 @@ namespace put
                 samplers_initialised = (1 << 5),
                 apply_anim_transform = (1 << 6),
                 sync_physics_transform = (1 << 7),
+                transform_dirty = (1 << 8),  // set after writing local_matrices or bounding_volumes directly
+                occluder = (1 << 9),         // always rasterized as an occluder when visible, regardless of size
+                shared_material = (1 << 10), // material cbuffer belongs to a spawn_batch and is released with the scene
+                draw_dirty = (1 << 11),      // set after writing draw_call_data or material_data directly
                 alpha_blended = (1 << 0)
             };
         }
@@ -151,7 +160,7 @@ namespace put
                 // 1<<5 unused
                 skinned = (1 << 6),
                 bone = (1 << 7),
-                dynamic = (1 << 8),
+                dynamic = (1 << 8), // moves at run time, shadow caches track it per frame rather than as a static caster
                 anim_controller = (1 << 9),
                 anim_trajectory = (1 << 10),
                 light = (1 << 11),
@@ -178,6 +187,10 @@ namespace put
         };
         typedef u8 light_flags;
 
+        // scene->cbuffer value of entities with per draw constants. entities which moved in an update write them to the
+        // transient cbuffer ring, entities at rest keep them in a cbuffer of their own which is only written when dirty
+        static const u32 k_draw_cbuffer = 1;
+
         struct cmp_draw_call
         {
             mat4  world_matrix;
@@ -275,6 +288,26 @@ namespace put
             hash_id   vertex_shader_class;
         };
 
+        // a simplified level of a geometry_resource, indexing the same vertex buffers as the full mesh
+        struct geometry_lod
+        {
+            f32 error; // bound on the simplification error relative to the mesh extents
+            u32 index_buffer;
+            u32 num_indices;
+            u32 position_index_buffer;
+            u32 num_position_indices;
+        };
+
+        // runtime lod state of an entity, the chain is resolved from id_geometry when it changes
+        struct entity_lod
+        {
+            hash_id             id_geometry;
+            const geometry_lod* lods;
+            u32                 num_lods;
+            u8                  level[2]; // current level in camera and shadow views, 0 is the full mesh
+            u32                 frame[2]; // frame level was selected in, later views that frame reuse it
+        };
+
         struct cmp_pre_skin
         {
             u32 vertex_buffer;
@@ -350,7 +383,7 @@ namespace put
             vec4f pos_radius; // radius = point radius and spot length
             vec4f dir_cutoff; // spot dir and cos cutoff
             vec4f colour;     // w = boolean cast shadow
-            vec4f data;       // x = spot falloff, yzw reserved
+            vec4f data;       // x = spot falloff, clustered lights: y = shadow index, z = type (0 point, 1 spot)
         };
 
         struct forward_light_buffer
@@ -359,6 +392,13 @@ namespace put
             light_data lights[e_scene_limits::max_forward_lights];
         };
 
+        struct light_cluster_buffer
+        {
+            mat4  view_projection; // unjittered, the clusters are found with the matrix they were built with
+            vec4f info;            // xyz = grid dimensions, w = number of clustered lights
+            vec4f depth;           // x = near, y = far, z = slices / log(far / near)
+        };
+
         struct distance_field_shadow
         {
             mat4 world_matrix;
@@ -395,22 +435,81 @@ namespace put
             free_node_list* prev;
         };
 
+        namespace e_cmp_array_flags
+        {
+            enum cmp_array_flags_t
+            {
+                sparse = 1 << 0
+            };
+        }
+        typedef u32 cmp_array_flags;
+
+        // dense arrays reserve address space and commit it in place, doubling up to a chunk and then a chunk at a time
+        static const u32 k_entity_chunk_shift = 14;
+        static const u32 k_entity_chunk_size = 1 << k_entity_chunk_shift;
+        static const u32 k_entity_reserve_default = 1 << 22; // entities every array reserves address space for up front
+        static const u32 k_entity_reserve_scale = 8;         // past the default, reserve this many times the committed size
+
+        static const u32 k_sparse_page_shift = 6;
+        static const u32 k_sparse_page_size = 1 << k_sparse_page_shift; // elements per sparse pool page
+
+        // paged storage of a sparse component array, slot 0 is a zeroed element shared by entities without one
+        struct sparse_pool
+        {
+            u8** pages = nullptr;
+            u32* slots = nullptr;      // entity to pool slot, soa_size entries
+            u32* entities = nullptr;   // pool slot to entity, PEN_INVALID_HANDLE for slot 0 and free slots
+            u32* free_slots = nullptr; // stretchy buffer of released slots
+            u32  num_slots = 0;        // slots handed out including slot 0 and free slots
+            u32  capacity = 0;
+        };
+
+        // one element per entity, indexed directly
         template <typename T>
         struct cmp_array
         {
-            u32 size = sizeof(T);
-            T*  data = nullptr;
+            u32             size = sizeof(T);
+            cmp_array_flags flags = 0;
+            T*              data = nullptr;
+            sparse_pool     pool;
 
             T&       operator[](size_t index);
             const T& operator[](size_t index) const;
+            const T& get(size_t index) const;
+            bool     has(size_t index) const;
+        };
+
+        // elements only for entities which have the component, for large components few entities use
+        template <typename T>
+        struct sparse_cmp_array
+        {
+            u32             size = sizeof(T);
+            cmp_array_flags flags = e_cmp_array_flags::sparse;
+            T*              data = nullptr;
+            sparse_pool     pool;
+
+            T&       get_or_add(size_t index); // adds the element if the entity has none
+            const T& operator[](size_t index) const;
+            const T& get(size_t index) const;
+            bool     has(size_t index) const;
+
+            // iterate the pool, slots which are free or 0 have no entity
+            u32 num_slots() const;
+            u32 slot_entity(u32 slot) const;
+            T&  slot(u32 slot);
         };
 
+        // type erased view of cmp_array and sparse_cmp_array, the layouts must match
         struct generic_cmp_array
         {
-            u32   size;
-            void* data;
+            u32             size;
+            cmp_array_flags flags = 0;
+            void*           data;
+            sparse_pool     pool;
 
-            void* operator[](size_t index);
+            void*       get_or_add(size_t index); // adds the element to sparse arrays
+            const void* get(size_t index) const;
+            bool        has(size_t index) const;
         };
 
         struct ecs_extension
@@ -442,7 +541,7 @@ namespace put
 
         struct ecs_scene
         {
-            static const u32 k_version = 9;
+            static const u32 k_version = 10;
 
             ecs_scene()
             {
@@ -451,45 +550,45 @@ namespace put
             };
 
             // Components version 4
-            cmp_array<u64>                      entities;
-            cmp_array<u64>                      state_flags;
-            cmp_array<hash_id>                  id_name;
-            cmp_array<hash_id>                  id_geometry;
-            cmp_array<hash_id>                  id_material;
-            cmp_array<Str>                      names;
-            cmp_array<Str>                      geometry_names;
-            cmp_array<Str>                      material_names;
-            cmp_array<u32>                      parents;
-            cmp_array<cmp_transform>            transforms;
-            cmp_array<mat4>                     local_matrices;
-            cmp_array<mat4>                     world_matrices;
-            cmp_array<mat4>                     offset_matrices;
-            cmp_array<mat4>                     physics_matrices;
-            cmp_array<cmp_bounding_volume>      bounding_volumes;
-            cmp_array<cmp_light>                lights;
-            cmp_array<u32>                      physics_handles;
-            cmp_array<cmp_master_instance>      master_instances;
-            cmp_array<cmp_geometry>             geometries;
-            cmp_array<cmp_pre_skin>             pre_skin;
-            cmp_array<cmp_physics>              physics_data;
-            cmp_array<cmp_geometry>             position_geometries;
-            cmp_array<u32>                      cbuffer;
-            cmp_array<cmp_draw_call>            draw_call_data;
-            cmp_array<free_node_list>           free_list;
-            cmp_array<cmp_material>             materials;
-            cmp_array<cmp_material_data>        material_data;
-            cmp_array<material_resource>        material_resources;
-            cmp_array<cmp_shadow>               shadows;
-            cmp_array<cmp_samplers>             samplers;             // version 5
-            cmp_array<u32>                      material_permutation; // version 8
-            cmp_array<cmp_transform>            initial_transform;    // version 9
-            cmp_array<cmp_anim_controller_v2>   anim_controller_v2;
-            cmp_array<cmp_transform>            physics_offset;
-            cmp_array<u32>                      physics_debug_cbuffer;
-            cmp_array<cmp_area_light>           area_light;
-            cmp_array<area_light_resource>      area_light_resources;
-            cmp_array<pmfx::scene_render_flags> render_flags;
-            cmp_array<cmp_pos_extent>           pos_extent;
+            cmp_array<u64>                           entities;
+            cmp_array<u64>                           state_flags;
+            cmp_array<hash_id>                       id_name;
+            cmp_array<hash_id>                       id_geometry;
+            cmp_array<hash_id>                       id_material;
+            cmp_array<Str>                           names;
+            cmp_array<Str>                           geometry_names;
+            cmp_array<Str>                           material_names;
+            cmp_array<u32>                           parents;
+            cmp_array<cmp_transform>                 transforms;
+            cmp_array<mat4>                          local_matrices;
+            cmp_array<mat4>                          world_matrices;
+            cmp_array<mat4>                          offset_matrices;
+            cmp_array<mat4>                          physics_matrices;
+            cmp_array<cmp_bounding_volume>           bounding_volumes;
+            cmp_array<cmp_light>                     lights;
+            cmp_array<u32>                           physics_handles;
+            cmp_array<cmp_master_instance>           master_instances;
+            cmp_array<cmp_geometry>                  geometries;
+            cmp_array<cmp_pre_skin>                  pre_skin;
+            sparse_cmp_array<cmp_physics>            physics_data;
+            cmp_array<cmp_geometry>                  position_geometries;
+            cmp_array<u32>                           cbuffer;
+            cmp_array<cmp_draw_call>                 draw_call_data;
+            cmp_array<free_node_list>                free_list;
+            cmp_array<cmp_material>                  materials;
+            cmp_array<cmp_material_data>             material_data;
+            cmp_array<material_resource>             material_resources;
+            cmp_array<cmp_shadow>                    shadows;
+            cmp_array<cmp_samplers>                  samplers;             // version 5
+            cmp_array<u32>                           material_permutation; // version 8
+            cmp_array<cmp_transform>                 initial_transform;    // version 9
+            sparse_cmp_array<cmp_anim_controller_v2> anim_controller_v2;
+            cmp_array<cmp_transform>                 physics_offset;
+            cmp_array<u32>                           physics_debug_cbuffer;
+            cmp_array<cmp_area_light>                area_light;
+            sparse_cmp_array<area_light_resource>    area_light_resources;
+            cmp_array<pmfx::scene_render_flags>      render_flags;
+            cmp_array<cmp_pos_extent>                pos_extent;
 
             // num base components calculates value based on its address - entities address.
             u32 num_base_components;
@@ -502,18 +601,37 @@ namespace put
             // Scene Data
             size_t           num_entities = 0;
             u32              soa_size = 0;
+            u32              reserved_size = 0; // entities reserved arrays can hold, 0 if arrays are reallocated
+            u32              reserve_hint = 0;  // set by reserve_entities, the smallest reservation the scene makes
             free_node_list*  free_list_head = nullptr;
             u32              forward_light_buffer = PEN_INVALID_HANDLE;
             u32              sdf_shadow_buffer = PEN_INVALID_HANDLE;
             u32              area_light_buffer = PEN_INVALID_HANDLE;
             u32              shadow_map_buffer = PEN_INVALID_HANDLE;
             u32              gi_volume_buffer = PEN_INVALID_HANDLE;
+            u32              cluster_info_buffer = PEN_INVALID_HANDLE;
+            u32              cluster_light_buffer = PEN_INVALID_HANDLE;
+            u32              cluster_range_buffer = PEN_INVALID_HANDLE;
+            u32              cluster_index_buffer = PEN_INVALID_HANDLE;
+            u32              cluster_light_capacity = 0;
+            u32              cluster_index_capacity = 0;
+            light_data*      cluster_lights = nullptr; // every point and spot light, not capped like forward lights
             s32              selected_index = -1;
             scene_flags      flags = 0;
             scene_view_flags view_flags = 0;
             extents          renderable_extents;
             extents          shadow_extent_constraints = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
             u32*             selection_list = nullptr;
+            u32*             draw_cbuffer_offsets = nullptr; // transient ring offset of entities which moved this update
+            u32*             draw_cbuffers = nullptr;        // cbuffer holding the draw constants of entities at rest
+            extents*         entity_extents = nullptr; // world space aabb of each entity before children are merged
+            entity_lod*      entity_lods = nullptr;
+            u32*             entity_remap = nullptr;   // old to new entity index from the most recent reorder
+            u32              entity_remap_generation = 0;
+            ecs_bvh*         bvh = nullptr; // spatial index over entity_extents, maintained by update_scene
+            ecs_query_cache* query_cache = nullptr; // entity lists of ecs::query, see ecs_query.h
+            u32*             shared_material_cbuffers = nullptr; // stretchy buffer of cbuffers created by spawn_batch
+            u32              static_caster_version = 0; // bumped when a shadow caster which is not dynamic moves
             u32              version = k_version;
             Str              filename = "";
 
@@ -528,6 +646,66 @@ namespace put
         };
         typedef std::vector<ecs_scene_instance> ecs_scene_list;
 
+        struct draw_stats
+        {
+            u32 draw_calls = 0;
+            u32 technique_changes = 0;
+            u32 material_changes = 0;
+            u32 texture_changes = 0;
+            u32 vertex_buffer_changes = 0;
+            u32 index_buffer_changes = 0;
+        };
+
+        struct occlusion_stats
+        {
+            u32 views = 0;
+            u32 occluders = 0;
+            u32 occluder_triangles = 0;
+            u32 tested = 0;
+            u32 culled = 0;
+            f64 rasterize_ms = 0.0;
+            f64 test_ms = 0.0;
+        };
+
+        struct shadow_stats
+        {
+            u32 slices = 0;          // shadow map slices and cube faces submitted by pmfx
+            u32 cached_slices = 0;   // slices kept from a previous frame
+            u32 static_casters = 0;  // casters in the slices which were checked
+            u32 dynamic_casters = 0;
+            u32 culled_casters = 0; // no_shadow casters and casters whose shadow can not reach a view
+        };
+
+        struct lod_stats
+        {
+            u32 draws = 0;
+            u32 lod_draws = 0;      // draws which used a simplified level
+            u32 lod_changes = 0;    // entities which switched level
+            u64 full_triangles = 0; // triangles the draws would have submitted with full meshes
+            u64 submitted_triangles = 0;
+        };
+
+        struct component_memory
+        {
+            const c8*       name;
+            u32             index;    // for get_component_array
+            u32             size;     // of one element
+            cmp_array_flags flags;
+            u32             elements; // entities with storage, every allocated entity for dense arrays
+            size_t          used_bytes;
+            size_t          allocated_bytes; // elements, pages and indices
+            size_t          dense_bytes;     // the same array stored densely
+        };
+
+        struct light_cluster_stats
+        {
+            u32 views = 0;
+            u32 lights = 0;
+            u32 light_indices = 0;
+            u32 max_cluster_lights = 0;
+            f64 build_ms = 0.0;
+        };
+
         void            init();
         ecs_scene*      create_scene(const c8* name);
         void            destroy_scene(ecs_scene* scene);
@@ -540,13 +718,59 @@ namespace put
         void render_light_volumes(const scene_view& view);
         void render_shadow_views(const scene_view& view);
         void render_omni_shadow_views(const scene_view& view);
+        bool shadow_views_cached(const scene_view& view);
+        bool omni_shadow_views_cached(const scene_view& view);
         void render_area_light_textures(const scene_view& view);
         void compute_volume_gi(const scene_view& view);
 
+        // binds the draw constants of entity n to cbuffer unit 1, entities at rest bind their own cbuffer and entities
+        // created or made dirty since update_scene write theirs to the transient ring here
+        void set_draw_cbuffer(ecs_scene* scene, u32 n, u32 flags);
+
+        // sort scene view draws by technique, material and geometry, disabled draws are submitted in entity order
+        void set_draw_sorting(bool enable);
+        bool get_draw_sorting();
+        void get_draw_stats(draw_stats& stats); // state changes from all scene views in the previous frame
+
+        // test visible entities in perspective views against a cpu depth buffer of the largest visible meshes
+        void set_occlusion_culling(bool enable);
+        bool get_occlusion_culling();
+        void get_occlusion_stats(occlusion_stats& stats); // totals for all scene views in the previous frame
+
+        // draw forward_lit perspective views with forward_lit_clustered, not capped by max_forward_lights
+        void set_light_clustering(bool enable);
+        bool get_light_clustering();
+        void get_light_cluster_stats(light_cluster_stats& stats); // totals for all scene views in the previous frame
+
+        // skip shadow casters outside the light frustum and keep shadow slices whose light and casters did not change
+        void set_shadow_caching(bool enable);
+        bool get_shadow_caching();
+        void set_shadow_caster_culling(bool enable);
+        bool get_shadow_caster_culling();
+        void get_shadow_stats(shadow_stats& stats); // totals for all shadow views in the previous frame
+
+        // draw the coarsest lod whose error projects to less than a pixel, shadow views scale the limit by the bias
+        void set_mesh_lods(bool enable);
+        bool get_mesh_lods();
+        void set_lod_shadow_bias(f32 bias);
+        f32  get_lod_shadow_bias();
+        void get_lod_stats(lod_stats& stats); // totals for all scene views in the previous frame
+
+        // level of a chain for a projected error scale, which is pixels per unit of lod error, starting from current
+        u32 select_geometry_lod(const geometry_lod* lods, u32 num_lods, u32 current, f32 error_scale, f32 max_error);
+
+        // run update_scene phases over the job workers, disabled runs every phase on the caller
+        void set_update_parallel(bool enable);
+        bool get_update_parallel();
+        f64  get_update_time_ms();     // duration of the most recent update_scene
+        u32  get_dirty_entity_count(); // entities whose world matrix was recomputed in the most recent update_scene
+
         void clear_scene(ecs_scene* scene);
         void default_scene(ecs_scene* scene);
 
         void resize_scene_buffers(ecs_scene* scene, s32 size = 1024);
+        void grow_scene_buffers(ecs_scene* scene, u32 count); // room for at least count entities
+        void reserve_entities(ecs_scene* scene, u32 count);   // reserve past k_entity_reserve_default, 64 bit only
         void zero_entity_components(ecs_scene* scene, u32 node_index);
 
         void delete_entity(ecs_scene* scene, u32 node_index);
@@ -560,7 +784,27 @@ namespace put
 
         void register_ecs_controller(ecs_scene* scene, const ecs_controller& controller);
 
+        // access for code which handles dense and sparse component arrays alike
+        void* sparse_cmp_insert(generic_cmp_array& cmp, size_t index);
+        void  zero_component(generic_cmp_array& cmp, u32 index);
+        void  set_component(generic_cmp_array& cmp, u32 index, const void* data);
+        void  copy_component(generic_cmp_array& dst, u32 dst_index, const generic_cmp_array& src, u32 src_index);
+
+        // copied components share the animation buffers and pre skin vertex buffers of src, this gives dst its own
+        void copy_component_buffers(ecs_scene* scene, u32 dst, u32 src);
+
+        // allocated and used bytes of each component array, base components first followed by extensions
+        void get_component_memory(ecs_scene* scene, std::vector<component_memory>& report);
+
+        static_assert(sizeof(cmp_array<u32>) == sizeof(generic_cmp_array), "mismatched component array layout");
+        static_assert(sizeof(sparse_cmp_array<u32>) == sizeof(generic_cmp_array), "mismatched component array layout");
+
         // separate implementations to make clang always inline
+        pen_inline u8* sparse_pool_slot(const sparse_pool& pool, u32 size, u32 slot)
+        {
+            return pool.pages[slot >> k_sparse_page_shift] + (slot & (k_sparse_page_size - 1)) * size;
+        }
+
         template <typename T>
         pen_inline T& cmp_array<T>::operator[](size_t index)
         {
@@ -573,13 +817,110 @@ namespace put
             return data[index];
         }
 
-        pen_inline void* generic_cmp_array::operator[](size_t index)
+        template <typename T>
+        pen_inline const T& cmp_array<T>::get(size_t index) const
+        {
+            return data[index];
+        }
+
+        template <typename T>
+        pen_inline bool cmp_array<T>::has(size_t index) const
+        {
+            return true;
+        }
+
+        template <typename T>
+        pen_inline T& sparse_cmp_array<T>::get_or_add(size_t index)
+        {
+            u32 s = pool.slots[index];
+            if (s)
+                return *(T*)sparse_pool_slot(pool, sizeof(T), s);
+
+            return *(T*)sparse_cmp_insert(*(generic_cmp_array*)this, index);
+        }
+
+        template <typename T>
+        pen_inline const T& sparse_cmp_array<T>::operator[](size_t index) const
+        {
+            return get(index);
+        }
+
+        template <typename T>
+        pen_inline const T& sparse_cmp_array<T>::get(size_t index) const
+        {
+            return *(const T*)sparse_pool_slot(pool, sizeof(T), pool.slots[index]);
+        }
+
+        template <typename T>
+        pen_inline bool sparse_cmp_array<T>::has(size_t index) const
+        {
+            return pool.slots[index] != 0;
+        }
+
+        template <typename T>
+        pen_inline u32 sparse_cmp_array<T>::num_slots() const
+        {
+            return pool.num_slots;
+        }
+
+        template <typename T>
+        pen_inline u32 sparse_cmp_array<T>::slot_entity(u32 slot) const
+        {
+            return pool.entities[slot];
+        }
+
+        template <typename T>
+        pen_inline T& sparse_cmp_array<T>::slot(u32 slot)
+        {
+            return *(T*)sparse_pool_slot(pool, sizeof(T), slot);
+        }
+
+        // calls func(entity, component) for each entity with an element in a sparse array, in pool order
+        template <typename T, typename F>
+        void for_each_component(sparse_cmp_array<T>& cmp, F func)
         {
+            u32 num = cmp.num_slots();
+            for (u32 s = 1; s < num; ++s)
+            {
+                u32 n = cmp.slot_entity(s);
+                if (is_valid(n))
+                    func(n, cmp.slot(s));
+            }
+        }
+
+        pen_inline void* generic_cmp_array::get_or_add(size_t index)
+        {
+            if (flags & e_cmp_array_flags::sparse)
+            {
+                u32 s = pool.slots[index];
+                if (s)
+                    return sparse_pool_slot(pool, size, s);
+
+                return sparse_cmp_insert(*this, index);
+            }
+
             u8* d = (u8*)data;
             u8* di = &d[index * size];
             return (void*)(di);
         }
 
+        pen_inline const void* generic_cmp_array::get(size_t index) const
+        {
+            if (flags & e_cmp_array_flags::sparse)
+                return sparse_pool_slot(pool, size, pool.slots[index]);
+
+            const u8* d = (const u8*)data;
+            return &d[index * size];
+        }
+
+        pen_inline bool generic_cmp_array::has(size_t index) const
+        {
+            if (flags & e_cmp_array_flags::sparse)
+                return pool.slots[index] != 0;
+
+            return true;
+        }
+
         pen_inline u32 get_extension_component_offset(ecs_scene* scene, u32 extension)
         {
             u32 offset = scene->num_base_components;
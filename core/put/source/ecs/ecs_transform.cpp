@@ -0,0 +1,503 @@
+// ecs_transform.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+#include "ecs/ecs_transform.h"
+#include "ecs/ecs_cull.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if __SSE4_1__ || __AVX__ || __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace put
+{
+    namespace ecs
+    {
+        //
+        // scalar float implementation
+        //
+
+        void compose_trs_scalar(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32           e = entities[i];
+                cmp_transform t = transforms[e];
+
+                // generate matrix from transform
+                mat4 rot_mat;
+                t.rotation.get_matrix(rot_mat);
+
+                mat4 translation_mat = mat::create_translation(t.translation);
+
+                mat4 scale_mat = mat::create_scale(t.scale);
+
+                local_matrices[e] = translation_mat * rot_mat * scale_mat;
+            }
+        }
+
+        void multiply_parent_scalar(const mat4* local_matrices, const u32* parents, mat4* world_matrices,
+                                    const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32  e = entities[i];
+                u32  p = parents[e];
+                mat4 local = local_matrices[e];
+
+                if (p == e)
+                {
+                    world_matrices[e] = local;
+                    continue;
+                }
+
+                mat4 parent = world_matrices[p];
+                world_matrices[e] = parent * local;
+            }
+        }
+
+        void transform_aabb_scalar(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                                   u32 count)
+        {
+            static const vec3f corners[] = {vec3f(0.0f, 0.0f, 0.0f),
+
+                                            vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f),
+
+                                            vec3f(1.0f, 1.0f, 0.0f), vec3f(0.0f, 1.0f, 1.0f), vec3f(1.0f, 0.0f, 1.0f),
+
+                                            vec3f(1.0f, 1.0f, 1.0f)};
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32                  e = entities[i];
+                cmp_bounding_volume& bv = bounding_volumes[e];
+                mat4                 wm = world_matrices[e];
+
+                vec3f min = bv.min_extents;
+                vec3f max = bv.max_extents - min;
+
+                vec3f& tmin = bv.transformed_min_extents;
+                vec3f& tmax = bv.transformed_max_extents;
+
+                tmax = -vec3f::flt_max();
+                tmin = vec3f::flt_max();
+
+                for (s32 c = 0; c < 8; ++c)
+                {
+                    vec3f p = wm.transform_vector(min + max * corners[c]);
+
+                    tmax = max_union(tmax, p);
+                    tmin = min_union(tmin, p);
+                }
+            }
+        }
+
+        //
+        // soa implementation shared by sse4 and avx2
+        //
+
+#if __SSE4_1__ || __AVX__ || __AVX2__
+        struct simd128
+        {
+            typedef __m128   type;
+            static const u32 width = 4;
+
+            static type set1(f32 v)
+            {
+                return _mm_set1_ps(v);
+            }
+            static type load(const f32* p)
+            {
+                return _mm_load_ps(p);
+            }
+            static void store(f32* p, type v)
+            {
+                _mm_store_ps(p, v);
+            }
+            static type add(type a, type b)
+            {
+                return _mm_add_ps(a, b);
+            }
+            static type sub(type a, type b)
+            {
+                return _mm_sub_ps(a, b);
+            }
+            static type mul(type a, type b)
+            {
+                return _mm_mul_ps(a, b);
+            }
+            static type madd(type a, type b, type c)
+            {
+                return _mm_add_ps(_mm_mul_ps(a, b), c);
+            }
+            static type abs(type a)
+            {
+                return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+            }
+        };
+#endif
+
+#if __AVX2__
+        struct simd256
+        {
+            typedef __m256   type;
+            static const u32 width = 8;
+
+            static type set1(f32 v)
+            {
+                return _mm256_set1_ps(v);
+            }
+            static type load(const f32* p)
+            {
+                return _mm256_load_ps(p);
+            }
+            static void store(f32* p, type v)
+            {
+                _mm256_store_ps(p, v);
+            }
+            static type add(type a, type b)
+            {
+                return _mm256_add_ps(a, b);
+            }
+            static type sub(type a, type b)
+            {
+                return _mm256_sub_ps(a, b);
+            }
+            static type mul(type a, type b)
+            {
+                return _mm256_mul_ps(a, b);
+            }
+            static type madd(type a, type b, type c)
+            {
+                return _mm256_fmadd_ps(a, b, c);
+            }
+            static type abs(type a)
+            {
+                return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+            }
+        };
+#endif
+
+        // composes the rotation matrix from the quaternion and scales its columns directly instead of two full matrix
+        // multiplies, rows match quat::get_matrix. entities are gathered into soa lanes, the last batch repeats its final
+        // entity in unused lanes.
+        template <typename S>
+        void compose_trs_soa(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count)
+        {
+            typedef typename S::type v;
+            static const u32         w = S::width;
+
+            alignas(32) f32 in[10][w];
+            alignas(32) f32 out[12][w];
+
+            for (u32 i = 0; i < count; i += w)
+            {
+                for (u32 l = 0; l < w; ++l)
+                {
+                    const cmp_transform& t = transforms[entities[std::min<u32>(i + l, count - 1)]];
+
+                    in[0][l] = t.translation.x;
+                    in[1][l] = t.translation.y;
+                    in[2][l] = t.translation.z;
+                    in[3][l] = t.rotation.x;
+                    in[4][l] = t.rotation.y;
+                    in[5][l] = t.rotation.z;
+                    in[6][l] = t.rotation.w;
+                    in[7][l] = t.scale.x;
+                    in[8][l] = t.scale.y;
+                    in[9][l] = t.scale.z;
+                }
+
+                v qx = S::load(in[3]);
+                v qy = S::load(in[4]);
+                v qz = S::load(in[5]);
+                v qw = S::load(in[6]);
+
+                v one = S::set1(1.0f);
+                v two = S::set1(2.0f);
+
+                v xx = S::mul(qx, qx);
+                v yy = S::mul(qy, qy);
+                v zz = S::mul(qz, qz);
+                v xy = S::mul(qx, qy);
+                v xz = S::mul(qx, qz);
+                v yz = S::mul(qy, qz);
+                v wx = S::mul(qw, qx);
+                v wy = S::mul(qw, qy);
+                v wz = S::mul(qw, qz);
+
+                v sx = S::load(in[7]);
+                v sy = S::load(in[8]);
+                v sz = S::load(in[9]);
+
+                // rows of the rotation matrix scaled per column, translation in the 4th column
+                S::store(out[0], S::mul(S::sub(one, S::mul(two, S::add(yy, zz))), sx));
+                S::store(out[1], S::mul(S::mul(two, S::sub(xy, wz)), sy));
+                S::store(out[2], S::mul(S::mul(two, S::add(xz, wy)), sz));
+                S::store(out[3], S::load(in[0]));
+
+                S::store(out[4], S::mul(S::mul(two, S::add(xy, wz)), sx));
+                S::store(out[5], S::mul(S::sub(one, S::mul(two, S::add(xx, zz))), sy));
+                S::store(out[6], S::mul(S::mul(two, S::sub(yz, wx)), sz));
+                S::store(out[7], S::load(in[1]));
+
+                S::store(out[8], S::mul(S::mul(two, S::sub(xz, wy)), sx));
+                S::store(out[9], S::mul(S::mul(two, S::add(yz, wx)), sy));
+                S::store(out[10], S::mul(S::sub(one, S::mul(two, S::add(xx, yy))), sz));
+                S::store(out[11], S::load(in[2]));
+
+                u32 lanes = std::min<u32>(w, count - i);
+                for (u32 l = 0; l < lanes; ++l)
+                {
+                    mat4& m = local_matrices[entities[i + l]];
+                    for (u32 r = 0; r < 12; ++r)
+                        m.m[r] = out[r][l];
+
+                    m.m[12] = 0.0f;
+                    m.m[13] = 0.0f;
+                    m.m[14] = 0.0f;
+                    m.m[15] = 1.0f;
+                }
+            }
+        }
+
+        // transforms the aabb centre by the matrix and the half extent by the absolute of the rotation and scale, which
+        // gives the same box as transforming all 8 corners.
+        template <typename S>
+        void transform_aabb_soa(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                                u32 count)
+        {
+            typedef typename S::type v;
+            static const u32         w = S::width;
+
+            alignas(32) f32 mat[12][w];
+            alignas(32) f32 ext[6][w];
+            alignas(32) f32 out[6][w];
+
+            for (u32 i = 0; i < count; i += w)
+            {
+                for (u32 l = 0; l < w; ++l)
+                {
+                    u32                        e = entities[std::min<u32>(i + l, count - 1)];
+                    const mat4&                m = world_matrices[e];
+                    const cmp_bounding_volume& bv = bounding_volumes[e];
+
+                    for (u32 r = 0; r < 12; ++r)
+                        mat[r][l] = m.m[r];
+
+                    ext[0][l] = bv.min_extents.x;
+                    ext[1][l] = bv.min_extents.y;
+                    ext[2][l] = bv.min_extents.z;
+                    ext[3][l] = bv.max_extents.x;
+                    ext[4][l] = bv.max_extents.y;
+                    ext[5][l] = bv.max_extents.z;
+                }
+
+                v half = S::set1(0.5f);
+
+                v c[3];
+                v h[3];
+                for (u32 a = 0; a < 3; ++a)
+                {
+                    v mn = S::load(ext[a]);
+                    v mx = S::load(ext[a + 3]);
+                    c[a] = S::mul(S::add(mn, mx), half);
+                    h[a] = S::mul(S::sub(mx, mn), half);
+                }
+
+                for (u32 r = 0; r < 3; ++r)
+                {
+                    v m0 = S::load(mat[r * 4 + 0]);
+                    v m1 = S::load(mat[r * 4 + 1]);
+                    v m2 = S::load(mat[r * 4 + 2]);
+                    v m3 = S::load(mat[r * 4 + 3]);
+
+                    v wc = S::madd(m0, c[0], S::madd(m1, c[1], S::madd(m2, c[2], m3)));
+                    v we = S::madd(S::abs(m0), h[0], S::madd(S::abs(m1), h[1], S::mul(S::abs(m2), h[2])));
+
+                    S::store(out[r], S::sub(wc, we));
+                    S::store(out[r + 3], S::add(wc, we));
+                }
+
+                u32 lanes = std::min<u32>(w, count - i);
+                for (u32 l = 0; l < lanes; ++l)
+                {
+                    cmp_bounding_volume& bv = bounding_volumes[entities[i + l]];
+                    bv.transformed_min_extents = vec3f(out[0][l], out[1][l], out[2][l]);
+                    bv.transformed_max_extents = vec3f(out[3][l], out[4][l], out[5][l]);
+                }
+            }
+        }
+
+        //
+        // sse4 128 implementation
+        //
+
+#if __SSE4_1__ || __AVX__ || __AVX2__
+        void compose_trs_simd128(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count)
+        {
+            compose_trs_soa<simd128>(transforms, local_matrices, entities, count);
+        }
+
+        void transform_aabb_simd128(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                                    u32 count)
+        {
+            transform_aabb_soa<simd128>(world_matrices, bounding_volumes, entities, count);
+        }
+
+        // matrix multiply stays aos, each row of the result is the parent row broadcast against the local rows
+        void multiply_parent_simd128(const mat4* local_matrices, const u32* parents, mat4* world_matrices,
+                                     const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32         e = entities[i];
+                u32         p = parents[e];
+                const mat4& local = local_matrices[e];
+
+                if (p == e)
+                {
+                    world_matrices[e] = local;
+                    continue;
+                }
+
+                const f32* pm = &world_matrices[p].m[0];
+                f32*       wm = &world_matrices[e].m[0];
+
+                __m128 l0 = _mm_loadu_ps(&local.m[0]);
+                __m128 l1 = _mm_loadu_ps(&local.m[4]);
+                __m128 l2 = _mm_loadu_ps(&local.m[8]);
+                __m128 l3 = _mm_loadu_ps(&local.m[12]);
+
+                for (u32 r = 0; r < 4; ++r)
+                {
+                    const f32* row = pm + r * 4;
+
+                    __m128 a = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), l0), _mm_mul_ps(_mm_set1_ps(row[1]), l1));
+                    __m128 b = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[2]), l2), _mm_mul_ps(_mm_set1_ps(row[3]), l3));
+
+                    _mm_storeu_ps(wm + r * 4, _mm_add_ps(a, b));
+                }
+            }
+        }
+#endif
+
+        //
+        // avx2 256 implementation
+        //
+
+#if __AVX2__
+        void compose_trs_simd256(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count)
+        {
+            compose_trs_soa<simd256>(transforms, local_matrices, entities, count);
+        }
+
+        void transform_aabb_simd256(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                                    u32 count)
+        {
+            transform_aabb_soa<simd256>(world_matrices, bounding_volumes, entities, count);
+        }
+
+        // two rows of the result per 256 bit register, the local rows are duplicated into both halves
+        void multiply_parent_simd256(const mat4* local_matrices, const u32* parents, mat4* world_matrices,
+                                     const u32* entities, u32 count)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32         e = entities[i];
+                u32         p = parents[e];
+                const mat4& local = local_matrices[e];
+
+                if (p == e)
+                {
+                    world_matrices[e] = local;
+                    continue;
+                }
+
+                const f32* pm = &world_matrices[p].m[0];
+                f32*       wm = &world_matrices[e].m[0];
+
+                __m256 l0 = _mm256_broadcast_ps((const __m128*)&local.m[0]);
+                __m256 l1 = _mm256_broadcast_ps((const __m128*)&local.m[4]);
+                __m256 l2 = _mm256_broadcast_ps((const __m128*)&local.m[8]);
+                __m256 l3 = _mm256_broadcast_ps((const __m128*)&local.m[12]);
+
+                __m256 p01 = _mm256_loadu_ps(pm);
+                __m256 p23 = _mm256_loadu_ps(pm + 8);
+
+                __m256 r01 = _mm256_mul_ps(_mm256_permute_ps(p01, 0x00), l0);
+                r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, 0x55), l1, r01);
+                r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, 0xaa), l2, r01);
+                r01 = _mm256_fmadd_ps(_mm256_permute_ps(p01, 0xff), l3, r01);
+
+                __m256 r23 = _mm256_mul_ps(_mm256_permute_ps(p23, 0x00), l0);
+                r23 = _mm256_fmadd_ps(_mm256_permute_ps(p23, 0x55), l1, r23);
+                r23 = _mm256_fmadd_ps(_mm256_permute_ps(p23, 0xaa), l2, r23);
+                r23 = _mm256_fmadd_ps(_mm256_permute_ps(p23, 0xff), l3, r23);
+
+                _mm256_storeu_ps(wm, r01);
+                _mm256_storeu_ps(wm + 8, r23);
+            }
+        }
+#endif
+
+        //
+        // dispatch
+        //
+
+        typedef void (*compose_trs_func)(const cmp_transform*, mat4*, const u32*, u32);
+        typedef void (*multiply_parent_func)(const mat4*, const u32*, mat4*, const u32*, u32);
+        typedef void (*transform_aabb_func)(const mat4*, cmp_bounding_volume*, const u32*, u32);
+
+        static compose_trs_func     s_compose_trs = compose_trs_scalar;
+        static multiply_parent_func s_multiply_parent = multiply_parent_scalar;
+        static transform_aabb_func  s_transform_aabb = transform_aabb_scalar;
+
+        void compose_trs(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count)
+        {
+            s_compose_trs(transforms, local_matrices, entities, count);
+        }
+
+        void multiply_parent(const mat4* local_matrices, const u32* parents, mat4* world_matrices, const u32* entities,
+                             u32 count)
+        {
+            s_multiply_parent(local_matrices, parents, world_matrices, entities, count);
+        }
+
+        void transform_aabb(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                            u32 count)
+        {
+            s_transform_aabb(world_matrices, bounding_volumes, entities, count);
+        }
+
+        void transform_simd_init(u32 simd_level)
+        {
+            compose_trs_func     compose = compose_trs_scalar;
+            multiply_parent_func multiply = multiply_parent_scalar;
+            transform_aabb_func  aabb = transform_aabb_scalar;
+
+#if __SSE4_1__ || __AVX__ || __AVX2__
+            if (simd_level >= e_simd::sse4)
+            {
+                compose = compose_trs_simd128;
+                multiply = multiply_parent_simd128;
+                aabb = transform_aabb_simd128;
+            }
+#endif
+#if __AVX2__
+            if (simd_level >= e_simd::avx2)
+            {
+                compose = compose_trs_simd256;
+                multiply = multiply_parent_simd256;
+                aabb = transform_aabb_simd256;
+            }
+#endif
+            s_compose_trs = compose;
+            s_multiply_parent = multiply;
+            s_transform_aabb = aabb;
+        }
+    } // namespace ecs
+} // namespace put
@@ -0,0 +1,37 @@
+// ecs_transform.h
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Batch kernels for the transform and bounds phases of update_scene.
+
+#pragma once
+
+#include "ecs/ecs_scene.h"
+
+namespace put
+{
+    namespace ecs
+    {
+        // called from simd_init with the highest extension supported by the cpu, transform_benchmark checks the simd
+        // kernels against the scalar versions.
+        void transform_simd_init(u32 simd_level);
+
+        // local = translation * rotation * scale
+        void compose_trs_scalar(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count);
+
+        // world = world[parent] * local, parents must be up to date before their children are processed
+        void multiply_parent_scalar(const mat4* local_matrices, const u32* parents, mat4* world_matrices,
+                                    const u32* entities, u32 count);
+
+        // transformed_min_extents and transformed_max_extents from min_extents and max_extents and the world matrix
+        void transform_aabb_scalar(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                                   u32 count);
+
+        // xxx functions are replaced by simd where available and fall back to scalar if no simd is available
+        void compose_trs(const cmp_transform* transforms, mat4* local_matrices, const u32* entities, u32 count);
+        void multiply_parent(const mat4* local_matrices, const u32* parents, mat4* world_matrices, const u32* entities,
+                             u32 count);
+        void transform_aabb(const mat4* world_matrices, cmp_bounding_volume* bounding_volumes, const u32* entities,
+                            u32 count);
+    } // namespace ecs
+} // namespace put
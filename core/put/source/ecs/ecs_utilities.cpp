@@ -6,6 +6,7 @@
 #include <fstream>
 
 #include "ecs/ecs_editor.h"
+#include "ecs/ecs_query.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_utilities.h"
 
@@ -93,7 +94,7 @@ namespace put
             // o(1) - appends a bunch of nodes on the end
             u32 max_num = scene->num_entities + num;
             if (max_num >= scene->soa_size || !scene->free_list_head)
-                resize_scene_buffers(scene, max_num * 2);
+                grow_scene_buffers(scene, max_num + 1);
 
             start = scene->num_entities;
             end = start + num;
@@ -116,67 +117,80 @@ namespace put
             }
 
             scene->num_entities = end;
+            invalidate_queries(scene);
         }
 
         void get_new_entities_contiguous(ecs_scene* scene, s32 num, s32& start, s32& end)
         {
             // o(n) - has to find contiguous nodes within the free list, and worst case will allocate more mem and append the
             // new nodes
+            start = end = (s32)scene->num_entities;
+            if (num <= 0)
+                return;
+
             u32 max_num = scene->num_entities + num;
             if (max_num >= scene->soa_size || !scene->free_list_head)
-                resize_scene_buffers(scene, max_num * 2);
-
-            free_node_list* fnl_iter = scene->free_list_head;
-            free_node_list* fnl_start = fnl_iter;
-
-            s32 count = num;
+                grow_scene_buffers(scene, max_num + 1);
 
-            // find contiguous nodes
             for (;;)
             {
-                if (!fnl_iter->next)
-                    break;
-
-                s32 diff = fnl_iter->next->node - fnl_iter->node;
+                // find num consecutive nodes, tracking the node before the run as prev links are not maintained
+                free_node_list* before = nullptr;
+                free_node_list* fnl_start = nullptr;
+                free_node_list* fnl_prev = nullptr;
+                s32             count = 0;
 
-                fnl_iter = fnl_iter->next;
-
-                if (diff == 1)
+                for (free_node_list* fnl_iter = scene->free_list_head; fnl_iter; fnl_iter = fnl_iter->next)
                 {
-                    count--;
+                    if (count > 0 && fnl_iter->node == fnl_prev->node + 1)
+                    {
+                        count++;
+                    }
+                    else
+                    {
+                        before = fnl_prev;
+                        fnl_start = fnl_iter;
+                        count = 1;
+                    }
 
-                    if (count == 0)
+                    fnl_prev = fnl_iter;
+                    if (count == num)
                         break;
                 }
-                else
+
+                if (count < num)
                 {
-                    fnl_start = fnl_iter;
-                    count = num;
+                    // fragmented, new nodes are appended in order
+                    grow_scene_buffers(scene, scene->soa_size + num);
+                    continue;
                 }
-            }
 
-            if (count == 0)
-            {
+                // unlink the run
+                free_node_list* after = fnl_prev->next;
+                if (before)
+                    before->next = after;
+                else
+                    scene->free_list_head = after;
+
+                if (after)
+                    after->prev = before;
+
                 start = fnl_start->node;
                 end = start + num;
 
-                // iterate over nodes allocating
-                fnl_iter = fnl_start;
-                for (s32 i = 0; i < num + 1; ++i)
-                {
-                    scene->entities[fnl_iter->node] |= e_cmp::allocated;
-                    scene->free_list_head = fnl_iter;
-                    fnl_iter = fnl_iter->next;
-                }
+                for (s32 i = start; i < end; ++i)
+                    scene->entities[i] |= e_cmp::allocated;
 
                 scene->num_entities = std::max<u32>(end, scene->num_entities);
+                invalidate_queries(scene);
+                return;
             }
         }
 
         u32 get_next_entity(ecs_scene* scene)
         {
             if (!scene->free_list_head)
-                resize_scene_buffers(scene);
+                grow_scene_buffers(scene, scene->soa_size + 1);
 
             return scene->free_list_head->node;
         }
@@ -186,7 +200,7 @@ namespace put
             // o(1) using free list
 
             if (!scene->free_list_head)
-                resize_scene_buffers(scene, scene->soa_size * 2);
+                grow_scene_buffers(scene, scene->soa_size + 1);
 
             u32 ii = 0;
             ii = scene->free_list_head->node;
@@ -195,10 +209,12 @@ namespace put
             u32 i = ii;
 
             scene->flags |= e_scene_flags::invalidate_scene_tree;
+            invalidate_queries(scene);
 
             scene->num_entities = std::max<u32>(i + 1, scene->num_entities);
 
             scene->entities[i] = e_cmp::allocated;
+            scene->state_flags[i] |= e_state::transform_dirty;
 
             scene->names[i] = "";
             scene->names[i].appendf("entity_%i", i);
@@ -341,6 +357,13 @@ namespace put
             mat4 parent_mat = scene->world_matrices[parent];
 
             scene->local_matrices[child] = mat::inverse4x4(parent_mat) * scene->local_matrices[child];
+
+            // the old parents extents must shrink as well as the child moving
+            scene->flags |= e_scene_flags::invalidate_transforms;
+
+            // update_scene moves the child after its parent before it runs
+            if (child < parent)
+                scene->flags |= e_scene_flags::invalidate_order;
         }
 
         // set parent and also swap nodes to maintain valid heirarchy
@@ -443,6 +466,7 @@ namespace put
                 return;
 
             scene->entities[master] |= e_cmp::master_instance;
+            invalidate_queries(scene);
 
             scene->master_instances[master].num_instances = num_nodes;
             scene->master_instances[master].instance_stride = sizeof(cmp_draw_call);
@@ -474,6 +498,117 @@ namespace put
             dev_console_log("[instance] master instance: %i with %i sub instances", master, num_nodes);
         }
 
+        u32 spawn_batch(ecs_scene* scene, u32 prototype, u32 count, const cmp_transform* transforms)
+        {
+            if (count == 0)
+                return PEN_INVALID_HANDLE;
+
+            s32 start, end;
+            get_new_entities_contiguous(scene, count, start, end);
+
+            // fill each dense component from the prototype doubling the copied range with every memcpy
+            for (u32 i = 0; i < scene->num_components; ++i)
+            {
+                generic_cmp_array& cmp = scene->get_component_array(i);
+
+                if (cmp.flags & e_cmp_array_flags::sparse)
+                {
+                    if (!cmp.has(prototype))
+                        continue;
+
+                    for (s32 n = start; n < end; ++n)
+                        copy_component(cmp, n, cmp, prototype);
+
+                    continue;
+                }
+
+                size_t size = cmp.size;
+                u8*    dst = (u8*)cmp.data + size * start;
+                memcpy(dst, (u8*)cmp.data + size * prototype, size);
+
+                for (u32 filled = 1; filled < count;)
+                {
+                    u32 n = std::min<u32>(filled, count - filled);
+                    memcpy(dst + size * filled, dst, size * n);
+                    filled += n;
+                }
+            }
+
+            // one material cbuffer for the batch, entity constants are identical until edited
+            u32 mcb = PEN_INVALID_HANDLE;
+            u32 mcb_size = scene->materials[prototype].material_cbuffer_size;
+            if ((scene->entities[prototype] & e_cmp::material) && mcb_size)
+            {
+                pen::buffer_creation_params bcp;
+                bcp.usage_flags = PEN_USAGE_DYNAMIC;
+                bcp.bind_flags = PEN_BIND_CONSTANT_BUFFER;
+                bcp.cpu_access_flags = PEN_CPU_ACCESS_WRITE;
+                bcp.buffer_size = mcb_size;
+                bcp.data = nullptr;
+
+                mcb = pen::renderer_create_buffer(bcp);
+                sb_push(scene->shared_material_cbuffers, mcb);
+            }
+
+            // copies are plain entities, instancing and constraints stay with the prototype and rigid bodies are added
+            // for each copy by instantiate_rigid_body
+            u32  proto_parent = scene->parents[prototype];
+            u64  proto_entity = scene->entities[prototype];
+            bool rigid_body = (proto_entity & e_cmp::physics) && !(proto_entity & e_cmp::constraint);
+            proto_entity &= ~(e_cmp::master_instance | e_cmp::constraint | e_cmp::physics);
+
+            // the fill shares what components point to, animation and pre skin buffers are copied for each entity
+            bool deep_copy = scene->anim_controller_v2.has(prototype) || (proto_entity & e_cmp::pre_skinned);
+
+            Str blank;
+            for (s32 n = start; n < end; ++n)
+            {
+                // copied strings share the prototype buffers, copies are unnamed and get names from the scene tree
+                memcpy(&scene->names[n], &blank, sizeof(Str));
+                memcpy(&scene->geometry_names[n], &blank, sizeof(Str));
+                memcpy(&scene->material_names[n], &blank, sizeof(Str));
+                memcpy(&scene->material_resources[n].material_name, &blank, sizeof(Str));
+                memcpy(&scene->material_resources[n].shader_name, &blank, sizeof(Str));
+
+                scene->geometry_names[n] = scene->geometry_names[prototype].c_str();
+                scene->material_names[n] = scene->material_names[prototype].c_str();
+                scene->material_resources[n].material_name = scene->material_resources[prototype].material_name.c_str();
+                scene->material_resources[n].shader_name = scene->material_resources[prototype].shader_name.c_str();
+                scene->id_name[n] = 0;
+
+                scene->parents[n] = proto_parent == prototype ? n : proto_parent;
+                scene->entities[n] = proto_entity;
+                scene->state_flags[n] &= ~(e_state::selected | e_state::child_selected | e_state::shared_material);
+
+                // gpu and physics resources owned by the prototype
+                scene->master_instances[n] = cmp_master_instance();
+                scene->physics_handles[n] = PEN_INVALID_HANDLE;
+                scene->physics_debug_cbuffer[n] = PEN_INVALID_HANDLE;
+                scene->materials[n].material_cbuffer = mcb;
+
+                if (is_valid(mcb))
+                    scene->state_flags[n] |= e_state::shared_material;
+
+                if (transforms)
+                {
+                    scene->transforms[n] = transforms[n - start];
+                    scene->entities[n] |= e_cmp::transform;
+                }
+
+                if (rigid_body)
+                    instantiate_rigid_body(scene, n);
+
+                if (deep_copy)
+                    copy_component_buffers(scene, n, prototype);
+            }
+
+            scene->flags |= e_scene_flags::invalidate_scene_tree | e_scene_flags::invalidate_transforms;
+            scene->flags |= e_scene_flags::invalidate_visibility;
+            invalidate_queries(scene);
+
+            return start;
+        }
+
         void bake_entities_to_vb(ecs_scene* scene, u32 parent, u32* node_list)
         {
             u32 num_nodes = sb_count(node_list);
@@ -624,6 +759,7 @@ namespace put
 
             scene->bounding_volumes[nn].min_extents = scene->bounding_volumes[nn].transformed_min_extents;
             scene->bounding_volumes[nn].max_extents = scene->bounding_volumes[nn].transformed_max_extents;
+            scene->state_flags[nn] |= e_state::transform_dirty;
 
             // todo.. use material.
             material_resource* mr = get_material_resource(PEN_HASH("default_material"));
@@ -639,7 +775,7 @@ namespace put
             anim_instance.soa = anim->soa;
             anim_instance.length = anim->length;
 
-            cmp_anim_controller_v2& controller = scene->anim_controller_v2[node_index];
+            cmp_anim_controller_v2& controller = scene->anim_controller_v2.get_or_add(node_index);
 
             // initialise anim with starting transform
             u32 num_joints = sb_count(controller.joint_indices);
@@ -705,6 +841,7 @@ namespace put
 
             // todo validate
             scene->entities[node_index] |= e_cmp::anim_controller;
+            invalidate_queries(scene);
             return anim_index;
         }
     } // namespace ecs
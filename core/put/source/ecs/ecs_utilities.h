@@ -37,8 +37,15 @@ namespace put
                           clone_mode mode = e_clone_mode::instantiate, vec3f offset = vec3f::zero(),
                           const c8* suffix = "_cloned");
         void swap_entities(ecs_scene* scene, u32 a, s32 b);
+
+        // sorts entities so parents are stored before their children, indices held elsewhere need remap_entity
+        bool reorder_entities(ecs_scene* scene);
+        u32  remap_entity(const ecs_scene* scene, u32 entity);
         void clone_selection_hierarchical(ecs_scene* scene, u32** selection_list, const c8* suffix);
         void instance_entity_range(ecs_scene* scene, u32 master_node, u32 num_nodes);
+
+        // creates count copies of prototype in a contiguous range and returns the first, transforms may be null
+        u32 spawn_batch(ecs_scene* scene, u32 prototype, u32 count, const cmp_transform* transforms);
         void bake_entities_to_vb(ecs_scene* scene, u32 parent, u32* node_list);
         void set_entity_parent(ecs_scene* scene, u32 parent, u32 child);
         void set_entity_parent_validate(ecs_scene* scene, u32& parent, u32& child);
@@ -74,6 +74,8 @@ namespace put
         hash_id         id_technique = 0;
         u32             permutation = 0;
         ecs::ecs_scene* scene = nullptr;
+        hash_id         id_view = 0;
+        u32             target_version = 0; // changes when render targets are recreated and lose their contents
     };
 
     struct scene_view_renderer
@@ -82,6 +84,10 @@ namespace put
         hash_id id_name = 0;
 
         void (*render_function)(const scene_view&) = nullptr;
+
+        // optional, returns true if the array slice of the view still holds what render_function would draw. when
+        // all render functions of a view agree the slice is neither cleared nor rendered.
+        bool (*cached_function)(const scene_view&) = nullptr;
     };
 
     struct technique_constant_data
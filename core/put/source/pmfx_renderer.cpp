@@ -251,6 +251,7 @@ namespace
         put::camera*    camera;
 
         std::vector<void (*)(const put::scene_view&)> render_functions;
+        std::vector<bool (*)(const put::scene_view&)> cached_functions; // parallel to render_functions, may be null
 
         // targets
         u32 render_targets[pen::MAX_MRT] = {PEN_INVALID_HANDLE, PEN_INVALID_HANDLE, PEN_INVALID_HANDLE, PEN_INVALID_HANDLE,
@@ -374,6 +375,7 @@ namespace
     geometry_utility                     s_geometry;
     std::vector<Str>                     s_script_files;
     bool                                 s_reload = false;
+    u32                                  s_target_version = 0; // bumped when render targets are created or replaced
 
     // ids
 } // namespace
@@ -1355,6 +1357,7 @@ namespace put
 
             u32 h = pen::renderer_create_render_target(tcp);
             pen::renderer_replace_resource(current_target->handle, h, pen::RESOURCE_RENDER_TARGET);
+            s_target_version++;
 
             current_target->width = width;
             current_target->height = height;
@@ -1854,6 +1857,7 @@ namespace put
                         {
                             found = true;
                             new_view.render_functions.push_back(sv.render_function);
+                            new_view.cached_functions.push_back(sv.cached_function);
                         }
                     }
 
@@ -2402,6 +2406,9 @@ namespace put
         {
             create_geometry_utilities();
 
+            // targets are recreated, contents kept by cached scene views are lost
+            s_target_version++;
+
             void* config_data;
             u32   config_data_size;
 
@@ -2936,6 +2943,13 @@ namespace put
             sv.cb_2d_view = cb_2d;
             sv.pmfx_shader = v.pmfx_shader;
             sv.permutation = v.technique_permutation;
+            sv.id_view = v.id_name;
+            sv.target_version = s_target_version;
+
+            // slices are kept when every render function reports its output would be unchanged
+            bool cacheable = !v.render_functions.empty() && v.cached_functions.size() == v.render_functions.size();
+            for (auto* cf : v.cached_functions)
+                cacheable &= cf != nullptr;
 
             // render passes.. multi pass for cubemaps or arrays
             for (u32 a = 0; a < v.num_arrays; ++a)
@@ -2943,6 +2957,16 @@ namespace put
                 sv.array_index = a;
                 sv.num_arrays = v.num_arrays;
 
+                if (cacheable)
+                {
+                    bool cached = true;
+                    for (auto* cf : v.cached_functions)
+                        cached &= cf(sv);
+
+                    if (cached)
+                        continue;
+                }
+
                 // generate 3d view proj matrix
                 if (v.camera)
                 {
@@ -8,6 +8,7 @@
 #include "debug_render.h"
 #include "dev_ui.h"
 #include "ecs/ecs_editor.h"
+#include "ecs/ecs_query.h"
 #include "ecs/ecs_resources.h"
 #include "ecs/ecs_scene.h"
 #include "ecs/ecs_utilities.h"
@@ -972,6 +973,7 @@ namespace put
             scene->transforms[new_prim].scale = scale;
             scene->transforms[new_prim].translation = pos;
             scene->entities[new_prim] |= e_cmp::transform | e_cmp::volume;
+            invalidate_queries(scene);
             scene->parents[new_prim] = new_prim;
             scene->samplers[new_prim].sb[0].handle = gv.texture;
             scene->samplers[new_prim].sb[0].sampler_unit = e_texture::volume;
@@ -1325,6 +1327,7 @@ namespace put
                             }
                         }
 
+                        invalidate_queries(s_main_scene);
                         s_rasteriser_job.visible_extents = ve;
                     }
                     else
@@ -1380,6 +1383,7 @@ namespace put
                             s_main_scene->state_flags[n] &= ~e_state::hidden;
                         }
 
+                        invalidate_queries(s_main_scene);
                         sb_clear(hidden_entities);
                     }
 
@@ -1490,6 +1494,7 @@ namespace put
                     s_main_scene->transforms[new_prim].scale = scale;
                     s_main_scene->transforms[new_prim].translation = pos;
                     s_main_scene->entities[new_prim] |= e_cmp::transform | e_cmp::sdf_shadow;
+                    invalidate_queries(s_main_scene);
                     s_main_scene->parents[new_prim] = new_prim;
                     s_main_scene->samplers[new_prim].sb[0].sampler_unit = e_texture::volume;
                     s_main_scene->samplers[new_prim].sb[0].handle = gv.texture;
@@ -0,0 +1,264 @@
+// bvh_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for the ecs_bvh spatial index at 100k and 1M entities, times the sah build, refitting 1% moving entities
+// per frame and a multi view frustum query against a linear scan of every entity, and checks both find the same set.
+
+#include "camera.h"
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_bvh.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "bvh_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_sizes[] = {100000, 1000000};
+    const u32 k_frames = 16;   // refit and query iterations averaged for each size
+    const u32 k_num_views = 4; // main camera and a few shadow or reflection views
+    const f32 k_world_size = 4000.0f;
+    const f32 k_move_fraction = 0.01f;
+
+    u32 s_seed = 0x9e3779b9;
+    u32 s_failures = 0;
+
+    f32 rand_unit()
+    {
+        // lcg, deterministic across platforms
+        s_seed = s_seed * 1664525 + 1013904223;
+        return (f32)(s_seed >> 8) / (f32)(1 << 24);
+    }
+
+    vec3f rand_vec(f32 scale)
+    {
+        return vec3f(rand_unit(), rand_unit(), rand_unit()) * scale;
+    }
+
+    struct bench_data
+    {
+        u32      num = 0;
+        extents* bounds = nullptr;
+        u32*     entities = nullptr;
+        u32*     moved = nullptr;
+        u64*     linear_masks = nullptr;
+        u64*     bvh_masks = nullptr;
+    };
+
+    void create_data(bench_data& bd, u32 num)
+    {
+        bd.num = num;
+        bd.bounds = (extents*)pen::memory_alloc(sizeof(extents) * num);
+        bd.entities = (u32*)pen::memory_alloc(sizeof(u32) * num);
+        bd.moved = (u32*)pen::memory_alloc(sizeof(u32) * num);
+        bd.linear_masks = (u64*)pen::memory_alloc(sizeof(u64) * num);
+        bd.bvh_masks = (u64*)pen::memory_alloc(sizeof(u64) * num);
+
+        // mostly small objects on a flat world with a few large ones, like a typical outdoor scene
+        for (u32 n = 0; n < num; ++n)
+        {
+            vec3f pos = rand_vec(1.0f) * vec3f(k_world_size, 100.0f, k_world_size);
+            vec3f half = rand_vec(2.0f) + vec3f(0.1f, 0.1f, 0.1f);
+
+            if (n % 100 == 0)
+                half *= 20.0f;
+
+            bd.bounds[n] = {pos - half, pos + half};
+            bd.entities[n] = n;
+        }
+    }
+
+    void destroy_data(bench_data& bd)
+    {
+        pen::memory_free(bd.bounds);
+        pen::memory_free(bd.entities);
+        pen::memory_free(bd.moved);
+        pen::memory_free(bd.linear_masks);
+        pen::memory_free(bd.bvh_masks);
+    }
+
+    void create_views(frustum* frustums, u32 frame)
+    {
+        for (u32 v = 0; v < k_num_views; ++v)
+        {
+            f32   angle = (f32)(frame + v * 7) * 0.1f;
+            vec3f centre = vec3f(k_world_size * 0.5f, 50.0f, k_world_size * 0.5f);
+            vec3f pos = centre + vec3f(sinf(angle), 0.0f, cosf(angle)) * 500.0f;
+
+            camera cam;
+            camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 400.0f);
+            camera_update_look_at(&cam, pos, pos + vec3f(cosf(angle), -0.1f, -sinf(angle)));
+            camera_update_frustum(&cam);
+
+            frustums[v] = cam.camera_frustum;
+        }
+    }
+
+    // the same test as frustum_cull_aabb_scalar
+    bool inside_frustum(const extents& e, const frustum& f)
+    {
+        vec3f pos = e.min + (e.max - e.min) * 0.5f;
+        vec3f extent = e.max - pos;
+
+        for (u32 p = 0; p < 6; ++p)
+        {
+            vec3f sign_flip = sgn(f.n[p]) * -1.0f;
+            f32   pd = maths::plane_distance(f.p[p], f.n[p]);
+            f32   d2 = dot(pos + extent * sign_flip, f.n[p]);
+
+            if (d2 > -pd)
+                return false;
+        }
+
+        return true;
+    }
+
+    void linear_query(const bench_data& bd, const frustum* frustums, u32 num_frustums, u64* masks_out)
+    {
+        for (u32 n = 0; n < bd.num; ++n)
+        {
+            u64 mask = 0;
+            for (u32 f = 0; f < num_frustums; ++f)
+                if (inside_frustum(bd.bounds[n], frustums[f]))
+                    mask |= 1ull << f;
+
+            masks_out[n] = mask;
+        }
+    }
+
+    void move_entities(bench_data& bd, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            u32   e = (u32)(rand_unit() * (f32)(bd.num - 1));
+            vec3f delta = (rand_vec(2.0f) - vec3f(1.0f, 1.0f, 1.0f)) * vec3f(1.0f, 0.0f, 1.0f);
+
+            bd.bounds[e].min += delta;
+            bd.bounds[e].max += delta;
+            bd.moved[i] = e;
+        }
+    }
+
+    void benchmark_size(u32 num)
+    {
+        bench_data bd;
+        create_data(bd, num);
+
+        ecs_bvh bvh;
+
+        f64 start = pen::get_time_us();
+        bvh_build(&bvh, bd.bounds, bd.entities, bd.num);
+        f64 build_ms = (pen::get_time_us() - start) / 1000.0;
+
+        PEN_LOG("bvh %u entities: build %.3f(ms), %u nodes, sah cost %.2f", num, build_ms, bvh.num_nodes,
+                bvh_cost(&bvh));
+
+        u32 num_moved = (u32)(num * k_move_fraction);
+        u32 num_rebuilds = 0;
+        u32 num_visible = 0;
+        u32 mismatched = 0;
+        f64 refit_ms = 0.0;
+        f64 bvh_ms = 0.0;
+        f64 linear_ms = 0.0;
+
+        u32* entities = nullptr;
+        u64* masks = nullptr;
+
+        for (u32 frame = 0; frame < k_frames; ++frame)
+        {
+            move_entities(bd, num_moved);
+
+            start = pen::get_time_us();
+            bvh_refit(&bvh, bd.bounds, bd.moved, num_moved);
+            if (bvh_needs_rebuild(&bvh))
+            {
+                bvh_build(&bvh, bd.bounds, bd.entities, bd.num);
+                ++num_rebuilds;
+            }
+            refit_ms += pen::get_time_us() - start;
+
+            frustum frustums[k_num_views];
+            create_views(frustums, frame);
+
+            start = pen::get_time_us();
+            sb_clear(entities);
+            sb_clear(masks);
+            bvh_query_frustums(&bvh, frustums, k_num_views, &entities, &masks);
+            bvh_ms += pen::get_time_us() - start;
+
+            start = pen::get_time_us();
+            linear_query(bd, frustums, k_num_views, bd.linear_masks);
+            linear_ms += pen::get_time_us() - start;
+
+            // compare results
+            pen::memory_zero(bd.bvh_masks, sizeof(u64) * bd.num);
+            for (u32 i = 0; i < sb_count(entities); ++i)
+                bd.bvh_masks[entities[i]] = masks[i];
+
+            for (u32 n = 0; n < bd.num; ++n)
+                if (bd.bvh_masks[n] != bd.linear_masks[n])
+                    ++mismatched;
+
+            num_visible += sb_count(entities);
+        }
+
+        f64 frames = (f64)k_frames * 1000.0;
+        PEN_LOG("bvh %u entities: refit %u moving %.3f(ms), %u rebuilds in %u frames, sah cost %.2f", num, num_moved,
+                refit_ms / frames, num_rebuilds, k_frames, bvh_cost(&bvh));
+        PEN_LOG("bvh %u entities: %u views, bvh %.3f(ms), linear %.3f(ms), speedup %.2fx, %u visible, %u mismatched",
+                num, k_num_views, bvh_ms / frames, linear_ms / frames, linear_ms / bvh_ms, num_visible / k_frames,
+                mismatched);
+
+        if (mismatched)
+            s_failures++;
+
+        sb_free(entities);
+        sb_free(masks);
+        bvh_destroy(&bvh);
+        destroy_data(bd);
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        for (u32 num : k_sizes)
+            benchmark_size(num);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(s_failures ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
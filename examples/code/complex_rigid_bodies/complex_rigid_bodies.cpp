@@ -175,8 +175,8 @@ void example_setup(ecs_scene* scene, camera& cam)
         scene->transforms[bb].scale = vec3f(0.5f, 0.5f, 0.5f);
         scene->entities[bb] |= e_cmp::transform;
         scene->parents[bb] = bb;
-        scene->physics_data[bb].rigid_body.shape = physics::e_shape::box;
-        scene->physics_data[bb].rigid_body.mass = 1.0f;
+        scene->physics_data.get_or_add(bb).rigid_body.shape = physics::e_shape::box;
+        scene->physics_data.get_or_add(bb).rigid_body.mass = 1.0f;
         instantiate_geometry(box, scene, bb);
         instantiate_material(default_material, scene, bb);
         instantiate_model_cbuffer(scene, bb);
@@ -193,10 +193,10 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[convex].scale = vec3f(1.0f, 1.0f, 1.0f);
     scene->entities[convex] |= e_cmp::transform;
     scene->parents[convex] = convex;
-    scene->physics_data[convex].rigid_body.shape = physics::e_shape::hull;
-    scene->physics_data[convex].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(convex).rigid_body.shape = physics::e_shape::hull;
+    scene->physics_data.get_or_add(convex).rigid_body.mass = 1.0f;
 
-    gen_convex_shape(scene->physics_data[convex].rigid_body.mesh_data);
+    gen_convex_shape(scene->physics_data.get_or_add(convex).rigid_body.mesh_data);
 
     instantiate_rigid_body(scene, convex);
 
@@ -208,10 +208,10 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[concave].scale = vec3f(1.0f, 1.0f, 1.0f);
     scene->entities[concave] |= e_cmp::transform;
     scene->parents[concave] = concave;
-    scene->physics_data[concave].rigid_body.shape = physics::e_shape::mesh;
-    scene->physics_data[concave].rigid_body.mass = 0.0f;
+    scene->physics_data.get_or_add(concave).rigid_body.shape = physics::e_shape::mesh;
+    scene->physics_data.get_or_add(concave).rigid_body.mass = 0.0f;
 
-    gen_concave_shape(scene->physics_data[concave].rigid_body.mesh_data);
+    gen_concave_shape(scene->physics_data.get_or_add(concave).rigid_body.mesh_data);
 
     instantiate_rigid_body(scene, concave);
 
@@ -223,8 +223,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[compound].scale = vec3f(1.0f, 1.0f, 1.0f);
     scene->entities[compound] |= e_cmp::transform;
     scene->parents[compound] = compound;
-    scene->physics_data[compound].rigid_body.shape = physics::e_shape::compound;
-    scene->physics_data[compound].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(compound).rigid_body.shape = physics::e_shape::compound;
+    scene->physics_data.get_or_add(compound).rigid_body.mass = 1.0f;
 
     //instantiate_rigid_body(scene, compound);
 
@@ -235,8 +235,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[cc].scale = vec3f(0.5f, 2.0f, 0.5f);
     scene->entities[cc] |= e_cmp::transform;
     scene->parents[cc] = cc;
-    scene->physics_data[cc].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[cc].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(cc).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(cc).rigid_body.mass = 1.0f;
     instantiate_geometry(box, scene, cc);
     instantiate_material(default_material, scene, cc);
     instantiate_model_cbuffer(scene, cc);
@@ -251,8 +251,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[cc].scale = vec3f(2.0f, 0.5f, 0.5f);
     scene->entities[cc] |= e_cmp::transform;
     scene->parents[cc] = cc;
-    scene->physics_data[cc].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[cc].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(cc).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(cc).rigid_body.mass = 1.0f;
     instantiate_geometry(box, scene, cc);
     instantiate_material(default_material, scene, cc);
     instantiate_model_cbuffer(scene, cc);
@@ -269,7 +269,7 @@ void example_setup(ecs_scene* scene, camera& cam)
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 {
     // debug draw shape
-    physics::collision_mesh_data& convex_cmd = scene->physics_data[convex].rigid_body.mesh_data;
+    physics::collision_mesh_data& convex_cmd = scene->physics_data.get_or_add(convex).rigid_body.mesh_data;
     mat4&                         convex_mat = scene->world_matrices[convex];
 
     for (u32 i = 0; i < convex_cmd.num_floats; i += 9)
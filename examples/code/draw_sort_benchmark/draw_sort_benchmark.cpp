@@ -0,0 +1,129 @@
+#include "../example_common.h"
+
+using namespace put;
+using namespace ecs;
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "draw_sort_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::renderer;
+        return p;
+    }
+} // namespace pen
+
+void example_setup(ecs_scene* scene, camera& cam)
+{
+    cam.zoom = 120;
+    cam.rot = vec2f(-0.6, 0.8);
+
+    clear_scene(scene);
+
+    material_resource* simple_light_material = new material_resource;
+    simple_light_material->id_shader = PEN_HASH("forward_render");
+    simple_light_material->id_technique = PEN_HASH("simple_lighting");
+    simple_light_material->material_name = "simple_lighting";
+    simple_light_material->shader_name = "forward_render";
+    simple_light_material->hash = PEN_HASH("simple_lighting");
+
+    static const u32 default_maps[] = {
+        put::load_texture("data/textures/defaults/albedo.dds"), put::load_texture("data/textures/defaults/normal.dds"),
+        put::load_texture("data/textures/defaults/spec.dds"), put::load_texture("data/textures/defaults/black.dds")};
+
+    for (s32 i = 0; i < 4; ++i)
+        simple_light_material->texture_handles[i] = default_maps[i];
+
+    add_material_resource(simple_light_material);
+
+    material_resource* materials[] = {get_material_resource(PEN_HASH("default_material")),
+                                      get_material_resource(PEN_HASH("simple_lighting"))};
+
+    geometry_resource* geometry[] = {get_geometry_resource(PEN_HASH("cube")), get_geometry_resource(PEN_HASH("sphere")),
+                                     get_geometry_resource(PEN_HASH("cylinder")),
+                                     get_geometry_resource(PEN_HASH("capsule")), get_geometry_resource(PEN_HASH("cone"))};
+
+    u32 light = get_new_entity(scene);
+    scene->names[light] = "front_light";
+    scene->id_name[light] = PEN_HASH("front_light");
+    scene->lights[light].colour = vec3f::one();
+    scene->lights[light].direction = vec3f::one();
+    scene->lights[light].type = e_light_type::dir;
+    scene->transforms[light].translation = vec3f::zero();
+    scene->transforms[light].rotation = quat();
+    scene->transforms[light].scale = vec3f::one();
+    scene->entities[light] |= e_cmp::light;
+    scene->entities[light] |= e_cmp::transform;
+
+    // neighbours differ in geometry and material so unsorted submission changes state on most draws
+    static const s32 k_grid = 40;
+    for (s32 i = 0; i < k_grid; ++i)
+    {
+        for (s32 j = 0; j < k_grid; ++j)
+        {
+            s32 n = i * k_grid + j;
+
+            u32 prim = get_new_entity(scene);
+            scene->names[prim] = "prim";
+            scene->names[prim].appendf("%i", n);
+            scene->transforms[prim].rotation = quat();
+            scene->transforms[prim].scale = vec3f::one();
+            scene->transforms[prim].translation = vec3f((f32)(i - k_grid / 2), 0.0f, (f32)(j - k_grid / 2)) * 3.0f;
+            scene->entities[prim] |= e_cmp::transform;
+            scene->parents[prim] = prim;
+            instantiate_geometry(geometry[n % PEN_ARRAY_SIZE(geometry)], scene, prim);
+            instantiate_material(materials[(n / 3) % PEN_ARRAY_SIZE(materials)], scene, prim);
+            instantiate_model_cbuffer(scene, prim);
+        }
+    }
+}
+
+// renders a number of frames with draw sorting off and then on and logs state changes per frame
+void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
+{
+    static const u32 k_frames = 120;
+    static const u32 k_settle_frames = 4;
+    static u32       frame = 0;
+    static f64       totals[2][6] = {};
+
+    if (frame > k_frames * 2)
+        return;
+
+    u32 phase = frame / k_frames;
+    u32 phase_frame = frame % k_frames;
+    frame++;
+
+    if (phase < 2)
+    {
+        ecs::set_draw_sorting(phase == 1);
+
+        // stats lag a couple of frames behind the setting change
+        if (phase_frame < k_settle_frames)
+            return;
+
+        ecs::draw_stats ds;
+        ecs::get_draw_stats(ds);
+
+        u32 values[] = {ds.draw_calls,       ds.technique_changes,     ds.material_changes,
+                        ds.texture_changes,  ds.vertex_buffer_changes, ds.index_buffer_changes};
+
+        for (u32 i = 0; i < 6; ++i)
+            totals[phase][i] += values[i];
+
+        return;
+    }
+
+    const c8* names[] = {"draws", "techniques", "materials", "textures", "vertex buffers", "index buffers"};
+    f64       num_frames = k_frames - k_settle_frames;
+
+    PEN_LOG("draw sort benchmark, average per frame over %i frames (unsorted -> sorted)", (s32)num_frames);
+    for (u32 i = 0; i < 6; ++i)
+        PEN_LOG("    %s: %.1f -> %.1f", names[i], totals[0][i] / num_frames, totals[1][i] / num_frames);
+
+    ecs::set_draw_sorting(true);
+}
@@ -0,0 +1,210 @@
+#include "../example_common.h"
+#include "memory.h"
+#include "os.h"
+#include "threads.h"
+
+using namespace put;
+using namespace ecs;
+
+// Measures ecs::update_scene scaling with the number of job workers on a 64k entity hierarchy and checks the parallel
+// update produces the same transforms, bounds and draw constants as the serial update. Finally the scene is left
+// static to measure the cost of an update where no entities are dirty.
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "ecs_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::renderer;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_num_roots = 4096;
+    const u32 k_num_children = 3;
+    const u32 k_num_grand_children = 4;
+    const u32 k_frames = 60;
+    const u32 k_settle_frames = 4;
+
+    struct snapshot
+    {
+        mat4*                world_matrices = nullptr;
+        cmp_bounding_volume* bounding_volumes = nullptr;
+        cmp_draw_call*       draw_call_data = nullptr;
+    };
+
+    snapshot s_serial;
+    u32      s_failures = 0;
+
+    u32 add_entity(ecs_scene* scene, u32 parent, const vec3f& pos)
+    {
+        u32 e = get_new_entity(scene);
+        scene->transforms[e].rotation = quat();
+        scene->transforms[e].scale = vec3f::one();
+        scene->transforms[e].translation = pos;
+        scene->parents[e] = parent == PEN_INVALID_HANDLE ? e : parent;
+        scene->bounding_volumes[e].min_extents = -vec3f::one();
+        scene->bounding_volumes[e].max_extents = vec3f::one();
+        scene->entities[e] |= e_cmp::transform;
+
+        instantiate_model_cbuffer(scene, e);
+        return e;
+    }
+
+    void take_snapshot(ecs_scene* scene, snapshot& s)
+    {
+        u32 num = (u32)scene->num_entities;
+        s.world_matrices = (mat4*)pen::memory_realloc(s.world_matrices, sizeof(mat4) * num);
+        s.bounding_volumes =
+            (cmp_bounding_volume*)pen::memory_realloc(s.bounding_volumes, sizeof(cmp_bounding_volume) * num);
+        s.draw_call_data = (cmp_draw_call*)pen::memory_realloc(s.draw_call_data, sizeof(cmp_draw_call) * num);
+
+        memcpy(s.world_matrices, &scene->world_matrices[0], sizeof(mat4) * num);
+        memcpy(s.bounding_volumes, &scene->bounding_volumes[0], sizeof(cmp_bounding_volume) * num);
+        memcpy(s.draw_call_data, &scene->draw_call_data[0], sizeof(cmp_draw_call) * num);
+    }
+
+    u32 compare_snapshot(ecs_scene* scene, const snapshot& s)
+    {
+        u32 mismatches = 0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            // v1.y holds the time the update ran so only the matrices are compared in the draw call data
+            const cmp_draw_call& a = s.draw_call_data[n];
+            const cmp_draw_call& b = scene->draw_call_data[n];
+
+            if (memcmp(&s.world_matrices[n], &scene->world_matrices[n], sizeof(mat4)) ||
+                memcmp(&s.bounding_volumes[n], &scene->bounding_volumes[n], sizeof(cmp_bounding_volume)) ||
+                memcmp(&a.world_matrix, &b.world_matrix, sizeof(mat4)) ||
+                memcmp(&a.world_matrix_inv_transpose, &b.world_matrix_inv_transpose, sizeof(mat4)))
+                ++mismatches;
+        }
+
+        return mismatches;
+    }
+} // namespace
+
+void example_setup(ecs::ecs_scene* scene, camera& cam)
+{
+    clear_scene(scene);
+
+    // 4096 roots with 3 children and 4 grand children each, 65536 entities over 3 hierarchy levels
+    for (u32 r = 0; r < k_num_roots; ++r)
+    {
+        vec3f root_pos = vec3f((f32)(r % 64), 0.0f, (f32)(r / 64)) * 10.0f;
+        u32   root = add_entity(scene, PEN_INVALID_HANDLE, root_pos);
+
+        for (u32 c = 0; c < k_num_children; ++c)
+        {
+            u32 child = add_entity(scene, root, vec3f((f32)c * 2.0f, 1.0f, 0.0f));
+
+            for (u32 g = 0; g < k_num_grand_children; ++g)
+                add_entity(scene, child, vec3f(0.0f, 1.0f, (f32)g * 2.0f));
+        }
+    }
+
+    PEN_LOG("ecs_benchmark: %u entities, %u workers", (u32)scene->num_entities, pen::jobs_get_num_workers());
+}
+
+void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
+{
+    static u32 frame = 0;
+    static f64 total_ms = 0.0;
+    static f64 base_ms = 0.0;
+    static u64 dirty_total = 0;
+
+    u32 num_workers = pen::jobs_get_num_workers();
+    u32 bench_frames = k_frames * (num_workers + 1);
+
+    // rotate every entity while timing, the parity check uses the same inputs for both updates
+    if (frame < bench_frames)
+    {
+        quat q;
+        q.euler_angles(0.01f, 0.01f, 0.01f);
+
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            scene->transforms[n].rotation = scene->transforms[n].rotation * q;
+    }
+
+    if (frame < bench_frames + 2)
+    {
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            scene->entities[n] |= e_cmp::transform;
+    }
+
+    if (frame <= bench_frames)
+    {
+        u32 w = frame / k_frames;
+        u32 phase_frame = frame % k_frames;
+
+        // get_update_time_ms reports the previous frame, which ran with the previous frames worker count
+        if (phase_frame > k_settle_frames || (phase_frame == 0 && w > 0))
+            total_ms += ecs::get_update_time_ms();
+
+        if (phase_frame == 0 && w > 0)
+        {
+            f64 ms = total_ms / (k_frames - k_settle_frames);
+            if (w == 1)
+                base_ms = ms;
+
+            PEN_LOG("update_scene: %u worker(s) + caller, %.3f(ms), speedup %.2fx", w - 1, ms, base_ms / ms);
+            total_ms = 0.0;
+        }
+
+        if (frame < bench_frames)
+        {
+            pen::jobs_set_num_active_workers(w);
+        }
+        else
+        {
+            pen::jobs_set_num_active_workers(num_workers);
+            ecs::set_update_parallel(false);
+        }
+    }
+    else if (frame == bench_frames + 1)
+    {
+        take_snapshot(scene, s_serial);
+        ecs::set_update_parallel(true);
+    }
+    else if (frame == bench_frames + 2)
+    {
+        u32 mismatches = compare_snapshot(scene, s_serial);
+        PEN_LOG("update_scene: parallel update %s serial update, %u mismatched entities",
+                mismatches ? "differs from" : "matches", mismatches);
+
+        if (mismatches)
+            s_failures++;
+
+        pen::memory_free(s_serial.world_matrices);
+        pen::memory_free(s_serial.bounding_volumes);
+        pen::memory_free(s_serial.draw_call_data);
+    }
+    else if (frame <= bench_frames + 2 + k_frames)
+    {
+        // nothing is moving, only the cost of visiting clean entities remains
+        u32 static_frame = frame - (bench_frames + 2);
+        if (static_frame > k_settle_frames)
+        {
+            total_ms += ecs::get_update_time_ms();
+            dirty_total += ecs::get_dirty_entity_count();
+        }
+
+        if (static_frame == k_frames)
+        {
+            f64 num_frames = k_frames - k_settle_frames;
+            PEN_LOG("update_scene: static scene, %.3f(ms), %.1f dirty entities per update", total_ms / num_frames,
+                    (f64)dirty_total / num_frames);
+
+            pen::os_terminate(s_failures ? 1 : 0);
+        }
+    }
+
+    frame++;
+}
@@ -215,6 +215,8 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
         scene->entities[i] |= e_cmp::transform;
     }
 
+    example_log_cmd_stream_bytes();
+
 #if 0 // debug / test array cost vs operator [] in component entity system
     static pen::timer* timer = pen::timer_create("perf");
     pen::timer_start(timer);
@@ -0,0 +1,142 @@
+// entity_growth_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for scene buffer growth, a million entities are created one at a time so the scene grows chunk by chunk.
+// Reports the worst single growth against reallocating and zeroing the same bytes in one block as scenes did before,
+// and checks component addresses stay put and the data written to earlier entities survives every growth.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include <algorithm>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "entity_growth_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_entities = 1 << 20;
+
+    struct growth_stats
+    {
+        u32 count = 0;
+        f64 total_ms = 0.0;
+        f64 max_ms = 0.0;
+
+        void add(f64 ms)
+        {
+            count++;
+            total_ms += ms;
+            max_ms = std::max<f64>(max_ms, ms);
+        }
+    };
+
+    // the old growth, every array reallocated at double the size and the new half zeroed
+    growth_stats realloc_growth(size_t entity_bytes)
+    {
+        growth_stats stats;
+
+        u8* mem = nullptr;
+        u32 size = 0;
+        while (size < k_entities)
+        {
+            u32 new_size = size ? size * 2 : 1024;
+
+            f64 t0 = pen::get_time_us();
+            mem = (u8*)pen::memory_realloc(mem, entity_bytes * new_size);
+            pen::memory_zero(mem + entity_bytes * size, entity_bytes * (new_size - size));
+            stats.add((pen::get_time_us() - t0) / 1000.0);
+
+            size = new_size;
+        }
+
+        pen::memory_free(mem);
+        return stats;
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        // the default reservation covers every entity, the arrays must not move while the scene grows
+        ecs_scene* scene = new ecs_scene();
+
+        u32 first = get_new_entity(scene);
+        scene->parents[first] = first;
+
+        const cmp_transform* transforms = &scene->transforms[0];
+        const mat4*          world_matrices = &scene->world_matrices[0];
+
+        // grow entity by entity, timing only the creations which grew the scene
+        growth_stats chunked;
+        for (u32 i = 1; i < k_entities; ++i)
+        {
+            u32 prev_size = scene->soa_size;
+
+            f64 t0 = pen::get_time_us();
+            u32 e = get_new_entity(scene);
+            f64 ms = (pen::get_time_us() - t0) / 1000.0;
+
+            if (scene->soa_size != prev_size)
+                chunked.add(ms);
+
+            scene->parents[e] = e;
+        }
+
+        u32 mismatches = 0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            if (scene->parents[n] != n || !(scene->entities[n] & e_cmp::allocated))
+                mismatches++;
+
+        bool stable = transforms == &scene->transforms[0] && world_matrices == &scene->world_matrices[0];
+
+        size_t entity_bytes = sizeof(u32) + sizeof(extents) + sizeof(entity_lod);
+        for (u32 i = 0; i < scene->num_components; ++i)
+            entity_bytes += scene->get_component_array(i).size;
+
+        PEN_LOG("chunked: %u entities, %u growths, worst %.3f(ms), total %.3f(ms), %u reserved",
+                (u32)scene->num_entities, chunked.count, chunked.max_ms, chunked.total_ms, scene->reserved_size);
+
+        PEN_LOG("chunked: addresses %s, %u mismatched entities (expected 0)",
+                stable ? "stable" : "moved (expected stable)", mismatches);
+
+        growth_stats reallocated = realloc_growth(entity_bytes);
+        PEN_LOG("reallocated: %u bytes per entity, %u growths, worst %.3f(ms), total %.3f(ms)", (u32)entity_bytes,
+                reallocated.count, reallocated.max_ms, reallocated.total_ms);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(mismatches || !stable ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
@@ -26,6 +26,18 @@ using namespace ecs;
 void example_setup(ecs::ecs_scene* scene, camera& cam);
 void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt);
 
+// logs the cmd stream bytes of a frame once the scene has settled, against the fixed size commands the stream replaced
+inline void example_log_cmd_stream_bytes()
+{
+    static u32 frame = 0;
+    if (++frame != 120)
+        return;
+
+    pen::renderer_frame_stats fs = pen::renderer_get_frame_stats();
+    PEN_LOG("cmd stream: frame %llu, %zu bytes, %zu bytes as fixed size commands", (unsigned long long)fs.frame_index,
+            fs.cmd_bytes, fs.cmd_fixed_bytes);
+}
+
 namespace
 {
     void*  user_setup(void* params);
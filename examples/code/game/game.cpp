@@ -70,8 +70,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     instantiate_geometry(box, scene, pitch);
     instantiate_material(default_material, scene, pitch);
     instantiate_model_cbuffer(scene, pitch);
-    scene->physics_data[pitch].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[pitch].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(pitch).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(pitch).rigid_body.mass = 1.0f;
     instantiate_rigid_body(scene, pitch);
 
     u32 pitch_constraint = get_new_entity(scene);
@@ -81,13 +81,13 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[pitch_constraint].rotation = quat();
     scene->transforms[pitch_constraint].scale = vec3f(1.0f, 1.0f, 1.0f);
     scene->entities[pitch_constraint] |= e_cmp::transform;
-    scene->physics_data[pitch_constraint].constraint.type = physics::e_constraint::dof6;
-    scene->physics_data[pitch_constraint].constraint.rb_indices[0] = scene->physics_handles[pitch];
-    scene->physics_data[pitch_constraint].constraint.lower_limit_rotation = vec3f::zero();
-    scene->physics_data[pitch_constraint].constraint.upper_limit_rotation = vec3f::zero();
-    scene->physics_data[pitch_constraint].constraint.lower_limit_translation = -vec3f::unit_z() * 5.0f;
-    scene->physics_data[pitch_constraint].constraint.upper_limit_translation = vec3f::unit_z() * 5.0f;
-    scene->physics_data[pitch_constraint].constraint.linear_damping = 0.999f;
+    scene->physics_data.get_or_add(pitch_constraint).constraint.type = physics::e_constraint::dof6;
+    scene->physics_data.get_or_add(pitch_constraint).constraint.rb_indices[0] = scene->physics_handles[pitch];
+    scene->physics_data.get_or_add(pitch_constraint).constraint.lower_limit_rotation = vec3f::zero();
+    scene->physics_data.get_or_add(pitch_constraint).constraint.upper_limit_rotation = vec3f::zero();
+    scene->physics_data.get_or_add(pitch_constraint).constraint.lower_limit_translation = -vec3f::unit_z() * 5.0f;
+    scene->physics_data.get_or_add(pitch_constraint).constraint.upper_limit_translation = vec3f::unit_z() * 5.0f;
+    scene->physics_data.get_or_add(pitch_constraint).constraint.linear_damping = 0.999f;
     instantiate_constraint(scene, pitch_constraint);
 
     //
@@ -103,8 +103,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     instantiate_geometry(cyl, scene, platter);
     instantiate_material(default_material, scene, platter);
     instantiate_model_cbuffer(scene, platter);
-    scene->physics_data[platter].rigid_body.shape = physics::e_shape::cylinder;
-    scene->physics_data[platter].rigid_body.mass = 1.0f;
+    scene->physics_data.get_or_add(platter).rigid_body.shape = physics::e_shape::cylinder;
+    scene->physics_data.get_or_add(platter).rigid_body.mass = 1.0f;
     instantiate_rigid_body(scene, platter);
 
     u32 platter_constraint = get_new_entity(scene);
@@ -114,12 +114,12 @@ void example_setup(ecs_scene* scene, camera& cam)
     scene->transforms[platter_constraint].rotation = quat();
     scene->transforms[platter_constraint].scale = vec3f(1.0f, 1.0f, 1.0f);
     scene->entities[platter_constraint] |= e_cmp::transform;
-    scene->physics_data[platter_constraint].constraint.type = physics::e_constraint::hinge;
-    scene->physics_data[platter_constraint].constraint.axis = vec3f::unit_y();
-    scene->physics_data[platter_constraint].constraint.rb_indices[0] = scene->physics_handles[platter];
-    scene->physics_data[platter_constraint].constraint.lower_limit_rotation.x = -M_PI;
-    scene->physics_data[platter_constraint].constraint.upper_limit_rotation.x = M_PI;
-    scene->physics_data[platter_constraint].constraint.angular_damping = 1.0f;
+    scene->physics_data.get_or_add(platter_constraint).constraint.type = physics::e_constraint::hinge;
+    scene->physics_data.get_or_add(platter_constraint).constraint.axis = vec3f::unit_y();
+    scene->physics_data.get_or_add(platter_constraint).constraint.rb_indices[0] = scene->physics_handles[platter];
+    scene->physics_data.get_or_add(platter_constraint).constraint.lower_limit_rotation.x = -M_PI;
+    scene->physics_data.get_or_add(platter_constraint).constraint.upper_limit_rotation.x = M_PI;
+    scene->physics_data.get_or_add(platter_constraint).constraint.angular_damping = 1.0f;
     instantiate_constraint(scene, platter_constraint);
 
     // load physics stuff before calling update
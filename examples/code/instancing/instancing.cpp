@@ -137,4 +137,6 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
 
     // PEN_LOG("operator: %f, array: %f\n", operator_cost, array_cost);
 #endif
+
+    example_log_cmd_stream_bytes();
 }
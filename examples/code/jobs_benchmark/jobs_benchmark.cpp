@@ -0,0 +1,143 @@
+// jobs_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Micro benchmark for the task scheduler, measures spawn overhead, steal rate and parallel_for scaling.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include <math.h>
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "jobs_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_spawn_count = 4000;
+    const u32 k_iterations = 16;
+    const u32 k_elements = 1 << 22;
+
+    f32* s_data = nullptr;
+
+    void empty_task(void* user_data)
+    {
+    }
+
+    void spin_task(void* user_data)
+    {
+        // small amount of work so idle workers have time to steal
+        volatile f32 v = 0.0f;
+        for (u32 i = 0; i < 256; ++i)
+            v = v + sqrtf((f32)i);
+    }
+
+    void spawn_tasks(pen::task_func func)
+    {
+        pen::task_handle root = pen::jobs_create_task(nullptr, nullptr);
+
+        for (u32 i = 0; i < k_spawn_count; ++i)
+            pen::jobs_run_task(pen::jobs_create_task(func, nullptr, root));
+
+        pen::jobs_run_task(root);
+        pen::jobs_wait_task(root);
+    }
+
+    void benchmark_spawn()
+    {
+        pen::task_stats stats;
+        pen::jobs_reset_task_stats();
+
+        f64 start = pen::get_time_us();
+        for (u32 i = 0; i < k_iterations; ++i)
+            spawn_tasks(empty_task);
+        f64 us = pen::get_time_us() - start;
+
+        pen::jobs_get_task_stats(stats);
+        PEN_LOG("spawn: %.3f(ns) per empty task, %llu executed, %llu stolen", (us * 1000.0) / (k_spawn_count * k_iterations),
+                stats.executed, stats.stolen);
+
+        pen::jobs_reset_task_stats();
+
+        start = pen::get_time_us();
+        for (u32 i = 0; i < k_iterations; ++i)
+            spawn_tasks(spin_task);
+        us = pen::get_time_us() - start;
+
+        pen::jobs_get_task_stats(stats);
+        PEN_LOG("steal: %.3f(ns) per small task, %llu executed, %llu stolen (%.1f%%)",
+                (us * 1000.0) / (k_spawn_count * k_iterations), stats.executed, stats.stolen,
+                stats.executed ? (f64)stats.stolen / (f64)stats.executed * 100.0 : 0.0);
+    }
+
+    void benchmark_parallel_for()
+    {
+        s_data = (f32*)pen::memory_alloc(sizeof(f32) * k_elements);
+        for (u32 i = 0; i < k_elements; ++i)
+            s_data[i] = (f32)i;
+
+        u32 num_workers = pen::jobs_get_num_workers();
+
+        f64 base_us = 0.0;
+        for (u32 w = 0; w <= num_workers; ++w)
+        {
+            pen::jobs_set_num_active_workers(w);
+
+            f64 start = pen::get_time_us();
+            for (u32 i = 0; i < k_iterations; ++i)
+            {
+                pen::parallel_for(0, k_elements, 4096, [](u32 s, u32 e) {
+                    for (u32 j = s; j < e; ++j)
+                        s_data[j] = sqrtf(s_data[j] * s_data[j] + 1.0f);
+                });
+            }
+            f64 us = (pen::get_time_us() - start) / k_iterations;
+
+            if (w == 0)
+                base_us = us;
+
+            PEN_LOG("parallel_for: %u worker(s) + caller, %.3f(ms), speedup %.2fx", w, us / 1000.0, base_us / us);
+        }
+
+        pen::jobs_set_num_active_workers(num_workers);
+        pen::memory_free(s_data);
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        PEN_LOG("jobs_benchmark: %u workers", pen::jobs_get_num_workers());
+
+        benchmark_spawn();
+        benchmark_parallel_for();
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
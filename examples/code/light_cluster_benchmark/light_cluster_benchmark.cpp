@@ -0,0 +1,215 @@
+// light_cluster_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for ecs_light_cluster, point and spot lights are scattered over a street and assigned to the clusters of a
+// moving camera. Reports the build time and cluster occupancy, every light lighting a sampled position must be listed
+// in that position's cluster and building the same frame twice must give identical lists.
+
+#include "camera.h"
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_light_cluster.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "light_cluster_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_light_counts[] = {256, 1024, 4096, 16384};
+    const u32 k_frames = 8;
+    const u32 k_samples = 4000; // positions per frame checked against every light
+    const f32 k_near = 0.1f;
+    const f32 k_far = 1000.0f;
+
+    u32 s_seed = 0x9e3779b9;
+
+    f32 rand_unit()
+    {
+        // lcg, deterministic across platforms
+        s_seed = s_seed * 1664525 + 1013904223;
+        return (f32)(s_seed >> 8) / (f32)(1 << 24);
+    }
+
+    void create_lights(light_data* lights, u32 count)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            light_data& l = lights[i];
+            vec3f       pos = vec3f(rand_unit() * 400.0f - 200.0f, rand_unit() * 20.0f, rand_unit() * 400.0f - 200.0f);
+            bool        spot = rand_unit() < 0.4f;
+            vec3f       dir = normalized(vec3f(rand_unit() - 0.5f, -1.0f, rand_unit() - 0.5f));
+
+            l.pos_radius = vec4f(pos, spot ? 5.0f + rand_unit() * 20.0f : 1.0f + rand_unit() * 4.0f);
+            l.dir_cutoff = vec4f(dir, 0.05f + rand_unit() * 0.3f);
+            l.colour = vec4f(1.0f, 1.0f, 1.0f, 0.0f);
+            l.data = vec4f(0.05f, 0.0f, (f32)(spot ? e_cluster_light::spot : e_cluster_light::point), 0.0f);
+        }
+    }
+
+    // matches the point attenuation and spot cone of ps_forward_lit_clustered
+    bool light_affects(const light_data& l, const vec3f& p)
+    {
+        vec3f d = p - l.pos_radius.xyz;
+        f32   dist = mag(d);
+
+        if ((u32)l.data.z == e_cluster_light::spot)
+        {
+            if (dist >= l.pos_radius.w || dist <= 0.0f)
+                return false;
+
+            return 1.0f - dot(d / dist, l.dir_cutoff.xyz) < l.dir_cutoff.w;
+        }
+
+        return dist < light_cluster_influence_radius(l);
+    }
+
+    camera create_view(u32 frame)
+    {
+        vec3f pos = vec3f(frame * 10.0f - 40.0f, 5.0f, 50.0f);
+
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, k_near, k_far);
+        camera_update_look_at(&cam, pos, pos + vec3f(0.2f, -0.1f, -1.0f));
+        cam.pos = pos;
+        return cam;
+    }
+
+    u64 hash_clusters(const light_cluster_grid& grid)
+    {
+        // fnv-1a
+        u64 hash = 14695981039346656037ull;
+        for (u32 c = 0; c < k_light_clusters; ++c)
+            hash = (hash ^ grid.ranges[c].count) * 1099511628211ull;
+
+        for (u32 i = 0; i < grid.num_indices; ++i)
+            hash = (hash ^ grid.indices[i]) * 1099511628211ull;
+
+        return hash;
+    }
+
+    bool cluster_contains(const light_cluster_grid& grid, u32 cluster, u32 light)
+    {
+        const light_cluster_range& r = grid.ranges[cluster];
+        for (u32 i = 0; i < r.count; ++i)
+            if (grid.indices[r.offset + i] == light)
+                return true;
+
+        return false;
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        light_cluster_grid grid;
+        u32                failures = 0;
+
+        for (u32 lc = 0; lc < PEN_ARRAY_SIZE(k_light_counts); ++lc)
+        {
+            u32         num_lights = k_light_counts[lc];
+            light_data* lights = (light_data*)pen::memory_alloc(sizeof(light_data) * num_lights);
+            create_lights(lights, num_lights);
+
+            f64 build_ms = 0.0;
+            u32 indices = 0;
+            u32 max_cluster_lights = 0;
+            u32 checked = 0;
+            u32 missing = 0;
+            u32 mismatched = 0;
+
+            for (u32 frame = 0; frame < k_frames; ++frame)
+            {
+                camera cam = create_view(frame);
+
+                light_cluster_build(&grid, cam.view, cam.proj, k_near, k_far, lights, num_lights);
+                build_ms += grid.build_ms;
+                indices += grid.num_indices;
+
+                for (u32 c = 0; c < k_light_clusters; ++c)
+                    max_cluster_lights = std::max(max_cluster_lights, grid.ranges[c].count);
+
+                // brute force, positions inside the frustum against every light
+                mat4       view_proj = cam.proj * cam.view;
+                const f32* m = view_proj.m;
+                for (u32 s = 0; s < k_samples; ++s)
+                {
+                    vec3f p = vec3f(cam.pos.x + rand_unit() * 300.0f - 150.0f, rand_unit() * 20.0f - 5.0f,
+                                    cam.pos.z - rand_unit() * 300.0f);
+
+                    f32 cx = m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3];
+                    f32 cy = m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7];
+                    f32 w = m[12] * p.x + m[13] * p.y + m[14] * p.z + m[15];
+                    if (w < k_near || w > k_far || fabsf(cx / w) > 1.0f || fabsf(cy / w) > 1.0f)
+                        continue;
+
+                    u32 cluster = light_cluster_find(&grid, p);
+                    for (u32 l = 0; l < num_lights; ++l)
+                    {
+                        if (!light_affects(lights[l], p))
+                            continue;
+
+                        checked++;
+                        if (!cluster_contains(grid, cluster, l))
+                            missing++;
+                    }
+                }
+
+                // determinism, the same inputs must give the same lists
+                u64 hash = hash_clusters(grid);
+                light_cluster_build(&grid, cam.view, cam.proj, k_near, k_far, lights, num_lights);
+                if (hash_clusters(grid) != hash)
+                    mismatched++;
+            }
+
+            f64 frames = (f64)k_frames;
+            PEN_LOG("light clusters %ux%ux%u: %u lights, build %.3f(ms), %.1f indices, %u max per cluster",
+                    k_light_cluster_x, k_light_cluster_y, k_light_cluster_z, num_lights, build_ms / frames,
+                    indices / frames, max_cluster_lights);
+            PEN_LOG("light clusters %u lights: %u of %u lit samples missing (expected 0), %u rebuilds differ (expected 0)",
+                    num_lights, missing, checked, mismatched);
+
+            if (missing || mismatched)
+                failures++;
+
+            pen::memory_free(lights);
+        }
+
+        light_cluster_destroy(&grid);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(failures ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
@@ -0,0 +1,346 @@
+// lod_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for mesh lod selection, a sphere is simplified into a chain the same way optimise_pmm does and instanced
+// over a large field which a camera flies across. Reports the triangles submitted with full meshes and with lods for
+// camera and biased shadow selection, and how often levels change while the camera jitters on the spot.
+
+#include "camera.h"
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_scene.h"
+#include "meshoptimizer/meshoptimizer.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "lod_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_rings = 96;
+    const u32 k_segments = 192;
+    const u32 k_lods = 4;
+    const f32 k_lod_error = 0.01f; // matches optimise_pmm
+    const u32 k_entities = 100000;
+    const f32 k_field_size = 2000.0f;
+    const u32 k_frames = 32;
+    const u32 k_jitter_frames = 64;
+    const f32 k_height = 1080.0f; // pixels
+    const f32 k_max_error = 1.0f; // pixels, matches render_scene_view
+    const f32 k_shadow_bias = 4.0f;
+
+    u32 s_seed = 0x9e3779b9;
+
+    f32 rand_unit()
+    {
+        // lcg, deterministic across platforms
+        s_seed = s_seed * 1664525 + 1013904223;
+        return (f32)(s_seed >> 8) / (f32)(1 << 24);
+    }
+
+    struct sphere_mesh
+    {
+        vec4f* positions = nullptr;
+        u32*   indices = nullptr;
+        u32    num_vertices = 0;
+        u32    num_indices = 0;
+        u32*   lod_indices[k_lods] = {};
+        u32    num_lod_indices[k_lods] = {};
+        u32    num_lods = 0;
+    };
+
+    void create_sphere(sphere_mesh& m)
+    {
+        m.num_vertices = (k_rings + 1) * (k_segments + 1);
+        m.num_indices = k_rings * k_segments * 6;
+        m.positions = (vec4f*)pen::memory_alloc(sizeof(vec4f) * m.num_vertices);
+        m.indices = (u32*)pen::memory_alloc(sizeof(u32) * m.num_indices);
+
+        for (u32 r = 0; r <= k_rings; ++r)
+        {
+            f32 theta = (f32)r / (f32)k_rings * (f32)M_PI;
+            for (u32 s = 0; s <= k_segments; ++s)
+            {
+                f32 phi = (f32)s / (f32)k_segments * (f32)M_PI * 2.0f;
+                m.positions[r * (k_segments + 1) + s] =
+                    vec4f(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi), 1.0f);
+            }
+        }
+
+        u32 i = 0;
+        for (u32 r = 0; r < k_rings; ++r)
+        {
+            for (u32 s = 0; s < k_segments; ++s)
+            {
+                u32 a = r * (k_segments + 1) + s;
+                u32 b = a + k_segments + 1;
+
+                m.indices[i++] = a;
+                m.indices[i++] = b;
+                m.indices[i++] = a + 1;
+                m.indices[i++] = a + 1;
+                m.indices[i++] = b;
+                m.indices[i++] = b + 1;
+            }
+        }
+    }
+
+    void create_lods(sphere_mesh& m, geometry_lod* chain)
+    {
+        // welded first, the poles and the seam of the uv sphere would otherwise be locked borders
+        u32* remap = (u32*)pen::memory_alloc(sizeof(u32) * m.num_vertices);
+        u32  unique = (u32)meshopt_generateVertexRemap(remap, m.indices, m.num_indices, m.positions, m.num_vertices,
+                                                      sizeof(vec4f));
+
+        meshopt_remapIndexBuffer(m.indices, m.indices, m.num_indices, remap);
+        meshopt_remapVertexBuffer(m.positions, m.positions, m.num_vertices, sizeof(vec4f), remap);
+        m.num_vertices = unique;
+        pen::memory_free(remap);
+
+        u32 prev_indices = m.num_indices;
+        for (u32 l = 0; l < k_lods; ++l)
+        {
+            u32  target = (m.num_indices >> (l + 1)) / 3 * 3;
+            f32  error = k_lod_error * (f32)(1 << l);
+            u32* lod = (u32*)pen::memory_alloc(sizeof(u32) * m.num_indices);
+
+            u32 count = (u32)meshopt_simplify(lod, m.indices, m.num_indices, (f32*)m.positions, m.num_vertices,
+                                              sizeof(vec4f), target, error);
+
+            if (count == 0 || count >= prev_indices - prev_indices / 10)
+            {
+                pen::memory_free(lod);
+                break;
+            }
+
+            m.lod_indices[l] = lod;
+            m.num_lod_indices[l] = count;
+            m.num_lods++;
+            prev_indices = count;
+
+            chain[l].error = error;
+            chain[l].num_indices = count;
+            chain[l].num_position_indices = count;
+            chain[l].index_buffer = PEN_INVALID_HANDLE;
+            chain[l].position_index_buffer = PEN_INVALID_HANDLE;
+        }
+    }
+
+    void destroy_sphere(sphere_mesh& m)
+    {
+        pen::memory_free(m.positions);
+        pen::memory_free(m.indices);
+        for (u32 l = 0; l < m.num_lods; ++l)
+            pen::memory_free(m.lod_indices[l]);
+    }
+
+    struct field
+    {
+        vec3f* pos = nullptr;
+        f32*   radius = nullptr;
+        u8*    level[2] = {}; // camera and shadow
+    };
+
+    void create_field(field& f)
+    {
+        f.pos = (vec3f*)pen::memory_alloc(sizeof(vec3f) * k_entities);
+        f.radius = (f32*)pen::memory_alloc(sizeof(f32) * k_entities);
+
+        for (u32 i = 0; i < k_entities; ++i)
+        {
+            f.radius[i] = 0.5f + rand_unit() * 4.0f;
+            f.pos[i] = vec3f(rand_unit() * k_field_size, f.radius[i], rand_unit() * k_field_size);
+        }
+
+        for (u32 s = 0; s < 2; ++s)
+        {
+            f.level[s] = (u8*)pen::memory_alloc(k_entities);
+            memset(f.level[s], 0x0, k_entities);
+        }
+    }
+
+    void destroy_field(field& f)
+    {
+        pen::memory_free(f.pos);
+        pen::memory_free(f.radius);
+        for (u32 s = 0; s < 2; ++s)
+            pen::memory_free(f.level[s]);
+    }
+
+    camera create_view(const vec3f& pos)
+    {
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 16.0f / 9.0f, 0.1f, 3000.0f);
+        camera_update_look_at(&cam, pos, pos + vec3f(0.5f, -0.1f, 1.0f));
+        camera_update_frustum(&cam);
+        cam.pos = pos;
+        return cam;
+    }
+
+    bool inside_frustum(const vec3f& pos, f32 radius, const frustum& f)
+    {
+        for (u32 p = 0; p < 6; ++p)
+        {
+            f32 pd = maths::plane_distance(f.p[p], f.n[p]);
+            if (dot(pos, f.n[p]) + pd > radius)
+                return false;
+        }
+
+        return true;
+    }
+
+    // the same projection render_scene_view uses for perspective views
+    f32 error_scale(const camera& cam, const vec3f& pos, f32 radius)
+    {
+        return radius * cam.proj.m[5] * k_height / std::max(mag(pos - cam.pos), radius);
+    }
+
+    struct frame_stats
+    {
+        u64 visible = 0;
+        u64 full_triangles = 0;
+        u64 triangles[2] = {}; // camera and shadow
+        u64 changes[2] = {};
+        u64 levels[k_lods + 1] = {};
+    };
+
+    void select_frame(field& f, const camera& cam, const geometry_lod* chain, u32 num_lods, u32 full_indices,
+                      frame_stats& stats)
+    {
+        for (u32 i = 0; i < k_entities; ++i)
+        {
+            if (!inside_frustum(f.pos[i], f.radius[i], cam.camera_frustum))
+                continue;
+
+            f32 scale = error_scale(cam, f.pos[i], f.radius[i]);
+            stats.visible++;
+            stats.full_triangles += full_indices / 3;
+
+            for (u32 s = 0; s < 2; ++s)
+            {
+                f32 max_error = s ? k_max_error * k_shadow_bias : k_max_error;
+                u32 level = select_geometry_lod(chain, num_lods, f.level[s][i], scale, max_error);
+                if (level != f.level[s][i])
+                    stats.changes[s]++;
+
+                f.level[s][i] = (u8)level;
+                stats.triangles[s] += (level ? chain[level - 1].num_indices : full_indices) / 3;
+
+                if (s == 0)
+                    stats.levels[level]++;
+            }
+        }
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        sphere_mesh  sphere;
+        geometry_lod chain[k_lods];
+        create_sphere(sphere);
+        create_lods(sphere, chain);
+
+        PEN_LOG("lod chain: full %u triangles", sphere.num_indices / 3);
+        for (u32 l = 0; l < sphere.num_lods; ++l)
+            PEN_LOG("lod chain: level %u, %u triangles, error %.3f", l + 1, chain[l].num_indices / 3, chain[l].error);
+
+        field f;
+        create_field(f);
+
+        // fly across the field
+        frame_stats fly;
+        f64         select_ms = 0.0;
+        for (u32 frame = 0; frame < k_frames; ++frame)
+        {
+            camera cam = create_view(vec3f(frame * 20.0f, 10.0f, frame * 40.0f));
+
+            f64 start = pen::get_time_us();
+            select_frame(f, cam, chain, sphere.num_lods, sphere.num_indices, fly);
+            select_ms += (pen::get_time_us() - start) / 1000.0;
+        }
+
+        f64 frames = (f64)k_frames;
+        PEN_LOG("lod fly: %u entities, %.1f visible, select %.3f(ms)", k_entities, fly.visible / frames,
+                select_ms / frames);
+        PEN_LOG("lod fly: %.0f triangles full, %.0f with lods (%.1f%%), %.0f shadow with bias %.1f (%.1f%%)",
+                fly.full_triangles / frames, fly.triangles[0] / frames, 100.0 * fly.triangles[0] / fly.full_triangles,
+                fly.triangles[1] / frames, k_shadow_bias, 100.0 * fly.triangles[1] / fly.full_triangles);
+
+        for (u32 l = 0; l <= sphere.num_lods; ++l)
+            PEN_LOG("lod fly: level %u drawn %.1f times per frame", l, fly.levels[l] / frames);
+
+        // jitter on the spot, with hysteresis levels should settle after the first frame
+        frame_stats settle;
+        frame_stats jitter;
+        frame_stats stateless;
+        u8*         settled = (u8*)pen::memory_alloc(k_entities);
+        memset(settled, 0x0, k_entities);
+
+        for (u32 frame = 0; frame < k_jitter_frames; ++frame)
+        {
+            f32    offset = (frame & 1) ? 0.3f : -0.3f;
+            camera cam = create_view(vec3f(500.0f, 10.0f, 500.0f + offset));
+            select_frame(f, cam, chain, sphere.num_lods, sphere.num_indices, frame ? jitter : settle);
+
+            // selecting from the full mesh every frame, nothing is remembered between frames
+            for (u32 i = 0; i < k_entities; ++i)
+            {
+                if (!inside_frustum(f.pos[i], f.radius[i], cam.camera_frustum))
+                    continue;
+
+                f32 scale = error_scale(cam, f.pos[i], f.radius[i]);
+                u32 level = 0;
+                while (level < sphere.num_lods && chain[level].error * scale < k_max_error)
+                    ++level;
+
+                if (frame > 0 && level != settled[i])
+                    stateless.changes[0]++;
+
+                settled[i] = (u8)level;
+            }
+        }
+
+        PEN_LOG("lod jitter: %llu level changes with hysteresis, %llu without over %u frames", jitter.changes[0],
+                stateless.changes[0], k_jitter_frames - 1);
+
+        pen::memory_free(settled);
+        destroy_field(f);
+        destroy_sphere(sphere);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
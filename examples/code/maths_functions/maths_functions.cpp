@@ -87,6 +87,13 @@ struct debug_extents
 
 material_resource* constant_colour_material = new material_resource;
 
+// draw constants are only written for dirty entities, colour changes mark the entity
+void set_debug_colour(ecs_scene* scene, u32 node, const vec4f& col)
+{
+    scene->draw_call_data[node].v2 = col;
+    scene->state_flags[node] |= e_state::draw_dirty;
+}
+
 // Randomise vector in range of extents
 vec3f random_vec_range(const debug_extents& extents)
 {
@@ -359,7 +366,7 @@ void test_ray_vs_aabb(ecs_scene* scene, bool initialise)
     if (intersect)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
-    scene->draw_call_data[aabb.node].v2 = col;
+    set_debug_colour(scene, aabb.node, col);
 }
 
 void test_ray_vs_obb(ecs_scene* scene, bool initialise)
@@ -437,7 +444,7 @@ void test_ray_vs_obb(ecs_scene* scene, bool initialise)
     if (intersect)
         dbg::add_point(ip, 0.5f, vec4f::white());
 
-    scene->draw_call_data[obb.node].v2 = col;
+    set_debug_colour(scene, obb.node, col);
 }
 
 void test_point_plane_distance(ecs_scene* scene, bool initialise)
@@ -530,7 +537,7 @@ void test_sphere_vs_plane(ecs_scene* scene, bool initialise)
     // debug output
     ImGui::Text("Classification %s", classifications[c]);
 
-    scene->draw_call_data[sphere.node].v2 = vec4f(classification_colours[c]);
+    set_debug_colour(scene, sphere.node, vec4f(classification_colours[c]));
 
     dbg::add_plane(plane.point, plane.normal);
 }
@@ -764,8 +771,8 @@ void test_sphere_vs_sphere(ecs_scene* scene, bool initialise)
     if (i)
         col = vec4f::red();
 
-    scene->draw_call_data[sphere0.node].v2 = vec4f(col);
-    scene->draw_call_data[sphere1.node].v2 = vec4f(col);
+    set_debug_colour(scene, sphere0.node, vec4f(col));
+    set_debug_colour(scene, sphere1.node, vec4f(col));
 }
 
 void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
@@ -794,8 +801,8 @@ void test_sphere_vs_aabb(ecs_scene* scene, bool initialise)
     if (i)
         col = vec4f::red();
 
-    scene->draw_call_data[sphere.node].v2 = vec4f(col);
-    scene->draw_call_data[aabb.node].v2 = vec4f(col);
+    set_debug_colour(scene, sphere.node, vec4f(col));
+    set_debug_colour(scene, aabb.node, vec4f(col));
 }
 
 void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
@@ -824,8 +831,8 @@ void test_aabb_vs_aabb(ecs_scene* scene, bool initialise)
     if (i)
         col = vec4f::red();
 
-    scene->draw_call_data[aabb0.node].v2 = vec4f(col);
-    scene->draw_call_data[aabb1.node].v2 = vec4f(col);
+    set_debug_colour(scene, aabb0.node, vec4f(col));
+    set_debug_colour(scene, aabb1.node, vec4f(col));
 }
 
 void test_sphere_vs_frustum(ecs_scene* scene, bool initialise)
@@ -869,7 +876,7 @@ void test_sphere_vs_frustum(ecs_scene* scene, bool initialise)
     if (!i)
         col = vec4f::red();
 
-    scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    set_debug_colour(scene, sphere.node, vec4f(col));
 }
 
 void test_aabb_vs_frustum(ecs_scene* scene, bool initialise)
@@ -918,7 +925,7 @@ void test_aabb_vs_frustum(ecs_scene* scene, bool initialise)
     if (!i)
         col = vec4f::red();
 
-    scene->draw_call_data[aabb0.node].v2 = vec4f(col);
+    set_debug_colour(scene, aabb0.node, vec4f(col));
 }
 
 void test_point_sphere(ecs_scene* scene, bool initialise)
@@ -954,7 +961,7 @@ void test_point_sphere(ecs_scene* scene, bool initialise)
 
     dbg::add_point(point.point, 0.4f, col);
 
-    scene->draw_call_data[sphere.node].v2 = vec4f(col);
+    set_debug_colour(scene, sphere.node, vec4f(col));
 }
 
 void test_point_cone(ecs_scene* scene, bool initialise)
@@ -991,7 +998,7 @@ void test_point_cone(ecs_scene* scene, bool initialise)
 
     dbg::add_point(point.point, 0.4f, col);
 
-    scene->draw_call_data[cone.node].v2 = vec4f(col);
+    set_debug_colour(scene, cone.node, vec4f(col));
 }
 
 void test_line_vs_line(ecs_scene* scene, bool initialise)
@@ -0,0 +1,312 @@
+// occlusion_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for ecs_occlusion on a synthetic city, a grid of buildings is rasterized as occluders from street level and
+// props scattered between them are tested. Reports the culled fraction and the cost in ms, props placed in front of
+// the camera must stay visible and props hidden inside buildings should be culled.
+
+#include "camera.h"
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_occlusion.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "occlusion_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_blocks = 32;        // blocks x blocks buildings
+    const f32 k_block_size = 40.0f; // building footprint plus street
+    const f32 k_street_width = 12.0f;
+    const u32 k_props = 200000;
+    const u32 k_sentinels = 1000; // props in front of the camera and props inside buildings
+    const u32 k_max_occluders = 32;
+    const u32 k_frames = 16;
+    const u32 k_width = 256;
+    const u32 k_height = 128;
+
+    u32 s_seed = 0x9e3779b9;
+
+    f32 rand_unit()
+    {
+        // lcg, deterministic across platforms
+        s_seed = s_seed * 1664525 + 1013904223;
+        return (f32)(s_seed >> 8) / (f32)(1 << 24);
+    }
+
+    vec4f s_cube_positions[8];
+    u16   s_cube_indices[36] = {0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+                                2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+
+    void create_cube()
+    {
+        for (u32 i = 0; i < 8; ++i)
+            s_cube_positions[i] = vec4f(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f, 1.0f);
+    }
+
+    mat4 box_matrix(const extents& e)
+    {
+        vec3f centre = e.min + (e.max - e.min) * 0.5f;
+        vec3f half = e.max - centre;
+
+        return mat::create_translation(centre) * mat::create_scale(half);
+    }
+
+    struct city
+    {
+        extents* buildings = nullptr;
+        extents* props = nullptr;
+        u32      num_buildings = 0;
+    };
+
+    void create_city(city& c)
+    {
+        c.num_buildings = k_blocks * k_blocks;
+        c.buildings = (extents*)pen::memory_alloc(sizeof(extents) * c.num_buildings);
+        c.props = (extents*)pen::memory_alloc(sizeof(extents) * (k_props + k_sentinels * 2));
+
+        f32 half_footprint = (k_block_size - k_street_width) * 0.5f;
+        for (u32 z = 0; z < k_blocks; ++z)
+        {
+            for (u32 x = 0; x < k_blocks; ++x)
+            {
+                vec3f centre = vec3f((f32)x, 0.0f, (f32)z) * k_block_size;
+                f32   height = 20.0f + rand_unit() * 60.0f;
+
+                c.buildings[z * k_blocks + x] = {centre - vec3f(half_footprint, 0.0f, half_footprint),
+                                                 centre + vec3f(half_footprint, height, half_footprint)};
+            }
+        }
+
+        // props along the streets, which run between the buildings in x and z
+        f32 city_size = k_blocks * k_block_size;
+        for (u32 i = 0; i < k_props; ++i)
+        {
+            f32 street = (floorf(rand_unit() * k_blocks) + 0.5f) * k_block_size;
+            f32 across = street + (rand_unit() - 0.5f) * k_street_width;
+            f32 along = rand_unit() * city_size;
+
+            vec3f pos = rand_unit() < 0.5f ? vec3f(across, 0.0f, along) : vec3f(along, 0.0f, across);
+            vec3f half = vec3f(0.25f, 0.5f + rand_unit(), 0.25f);
+
+            c.props[i] = {pos - vec3f(half.x, 0.0f, half.z), pos + vec3f(half.x, half.y * 2.0f, half.z)};
+        }
+    }
+
+    void destroy_city(city& c)
+    {
+        pen::memory_free(c.buildings);
+        pen::memory_free(c.props);
+    }
+
+    // street level camera walking down the centre of a street
+    camera create_view(u32 frame)
+    {
+        f32   street = k_block_size * 0.5f + k_block_size * (k_blocks / 2);
+        vec3f pos = vec3f(street, 2.0f, 10.0f + frame * 5.0f);
+
+        camera cam;
+        camera_create_perspective(&cam, 60.0f, 2.0f, 0.1f, 1000.0f);
+        camera_update_look_at(&cam, pos, pos + vec3f(0.3f, 0.0f, 1.0f));
+        camera_update_frustum(&cam);
+        cam.pos = pos;
+        return cam;
+    }
+
+    void place_sentinels(city& c, const camera& cam)
+    {
+        vec3f fwd = normalized(vec3f(0.3f, 0.0f, 1.0f));
+
+        // just in front of the camera, nothing can hide these
+        for (u32 i = 0; i < k_sentinels; ++i)
+        {
+            vec3f pos = cam.pos + fwd * (1.0f + rand_unit() * 3.0f) + vec3f(rand_unit() - 0.5f, -0.5f, 0.0f);
+            c.props[k_props + i] = {pos - vec3f(0.1f, 0.1f, 0.1f), pos + vec3f(0.1f, 0.1f, 0.1f)};
+        }
+
+        // inside the building ahead and to the right of the camera, covered by its walls
+        u32 bx = (u32)(cam.pos.x / k_block_size) + 1;
+        u32 bz = (u32)((cam.pos.z + k_block_size * 2.0f) / k_block_size);
+        const extents& b = c.buildings[std::min<u32>(bz, k_blocks - 1) * k_blocks + std::min<u32>(bx, k_blocks - 1)];
+
+        for (u32 i = 0; i < k_sentinels; ++i)
+        {
+            vec3f t = vec3f(0.2f + rand_unit() * 0.6f, 0.2f + rand_unit() * 0.6f, 0.2f + rand_unit() * 0.6f);
+            vec3f pos = b.min + (b.max - b.min) * t;
+            c.props[k_props + k_sentinels + i] = {pos - vec3f(0.1f, 0.1f, 0.1f), pos + vec3f(0.1f, 0.1f, 0.1f)};
+        }
+    }
+
+    bool inside_frustum(const extents& e, const frustum& f)
+    {
+        vec3f pos = e.min + (e.max - e.min) * 0.5f;
+        vec3f extent = e.max - pos;
+
+        for (u32 p = 0; p < 6; ++p)
+        {
+            vec3f sign_flip = sgn(f.n[p]) * -1.0f;
+            f32   pd = maths::plane_distance(f.p[p], f.n[p]);
+            f32   d2 = dot(pos + extent * sign_flip, f.n[p]);
+
+            if (d2 > -pd)
+                return false;
+        }
+
+        return true;
+    }
+
+    struct occluder
+    {
+        f32 size;
+        u32 building;
+    };
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        create_cube();
+
+        city c;
+        create_city(c);
+
+        occlusion_buffer ob;
+        occluder*        occluders = nullptr;
+        u32*             candidates = nullptr;
+        u32*             visible = nullptr;
+
+        u32 tested = 0;
+        u32 culled = 0;
+        u32 num_occluders = 0;
+        u32 num_triangles = 0;
+        u32 front_culled = 0;
+        u32 inside_culled = 0;
+        f64 rasterize_ms = 0.0;
+        f64 test_ms = 0.0;
+
+        for (u32 frame = 0; frame < k_frames; ++frame)
+        {
+            camera cam = create_view(frame);
+            place_sentinels(c, cam);
+
+            // the largest buildings on screen, the same ranking render_scene_view uses
+            sb_clear(occluders);
+            for (u32 i = 0; i < c.num_buildings; ++i)
+            {
+                const extents& e = c.buildings[i];
+                if (!inside_frustum(e, cam.camera_frustum))
+                    continue;
+
+                vec3f    centre = e.min + (e.max - e.min) * 0.5f;
+                occluder o = {mag(e.max - e.min) * 0.5f / std::max(mag(centre - cam.pos), 0.1f), i};
+                sb_push(occluders, o);
+            }
+
+            u32 count = std::min<u32>(sb_count(occluders), k_max_occluders);
+            std::sort(occluders, occluders + sb_count(occluders),
+                      [](const occluder& a, const occluder& b) { return a.size > b.size; });
+
+            sb_clear(candidates);
+            for (u32 i = 0; i < k_props + k_sentinels * 2; ++i)
+                if (inside_frustum(c.props[i], cam.camera_frustum))
+                    sb_push(candidates, i);
+
+            f64 start = pen::get_time_us();
+
+            occlusion_begin(&ob, cam.proj * cam.view, k_width, k_height);
+            for (u32 i = 0; i < count; ++i)
+                occlusion_add_occluder(&ob, box_matrix(c.buildings[occluders[i].building]), s_cube_positions,
+                                       s_cube_indices, 36, 2);
+
+            occlusion_rasterize(&ob);
+            f64 rasterized = pen::get_time_us();
+
+            sb_clear(visible);
+            occlusion_cull_aabb(&ob, c.props, candidates, sb_count(candidates), &visible);
+            f64 end = pen::get_time_us();
+
+            rasterize_ms += (rasterized - start) / 1000.0;
+            test_ms += (end - rasterized) / 1000.0;
+            num_occluders += count;
+            num_triangles += sb_count(ob.triangles);
+            tested += sb_count(candidates);
+            culled += sb_count(candidates) - sb_count(visible);
+
+            // sentinels, visible is in candidate order
+            u32 front_visible = 0;
+            u32 inside_visible = 0;
+            u32 front_tested = 0;
+            u32 inside_tested = 0;
+            for (u32 i = 0; i < sb_count(candidates); ++i)
+            {
+                u32 e = candidates[i];
+                if (e >= k_props + k_sentinels)
+                    inside_tested++;
+                else if (e >= k_props)
+                    front_tested++;
+            }
+
+            for (u32 i = 0; i < sb_count(visible); ++i)
+            {
+                u32 e = visible[i];
+                if (e >= k_props + k_sentinels)
+                    inside_visible++;
+                else if (e >= k_props)
+                    front_visible++;
+            }
+
+            front_culled += front_tested - front_visible;
+            inside_culled += inside_tested - inside_visible;
+        }
+
+        f64 frames = (f64)k_frames;
+        PEN_LOG("occlusion %ux%u: %.1f occluders, %.1f triangles, rasterize %.3f(ms)", ob.width, ob.height,
+                num_occluders / frames, num_triangles / frames, rasterize_ms / frames);
+        PEN_LOG("occlusion %ux%u: %.1f tested, %.1f%% culled, test %.3f(ms)", ob.width, ob.height, tested / frames,
+                tested ? 100.0 * culled / tested : 0.0, test_ms / frames);
+        PEN_LOG("occlusion sentinels: %u in front culled (expected 0), %u of %u inside buildings culled", front_culled,
+                inside_culled, k_sentinels * k_frames);
+
+        sb_free(occluders);
+        sb_free(candidates);
+        sb_free(visible);
+        occlusion_destroy(&ob);
+        destroy_city(c);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(front_culled ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
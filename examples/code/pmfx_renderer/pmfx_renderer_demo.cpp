@@ -64,6 +64,72 @@ void example_update(ecs::ecs_scene* scene, camera& cam, f32 dt)
     ImGui::Text("GPU: %2.2f ms", render_gpu);
     ImGui::Separator();
 
+    bool sort_draws = ecs::get_draw_sorting();
+    if (ImGui::Checkbox("Sort Draws", &sort_draws))
+        ecs::set_draw_sorting(sort_draws);
+
+    ecs::draw_stats ds;
+    ecs::get_draw_stats(ds);
+    ImGui::Text("Draws: %i", ds.draw_calls);
+    ImGui::Text("Technique Changes: %i", ds.technique_changes);
+    ImGui::Text("Material Changes: %i", ds.material_changes);
+    ImGui::Text("Texture Changes: %i", ds.texture_changes);
+    ImGui::Text("Vertex Buffer Changes: %i", ds.vertex_buffer_changes);
+    ImGui::Text("Index Buffer Changes: %i", ds.index_buffer_changes);
+    ImGui::Separator();
+
+    bool occlusion = ecs::get_occlusion_culling();
+    if (ImGui::Checkbox("Occlusion Culling", &occlusion))
+        ecs::set_occlusion_culling(occlusion);
+
+    ecs::occlusion_stats os;
+    ecs::get_occlusion_stats(os);
+    ImGui::Text("Occluders: %i (%i triangles)", os.occluders, os.occluder_triangles);
+    ImGui::Text("Occlusion Culled: %i / %i", os.culled, os.tested);
+    ImGui::Text("Occlusion Rasterize: %2.2f ms", os.rasterize_ms);
+    ImGui::Text("Occlusion Test: %2.2f ms", os.test_ms);
+    ImGui::Separator();
+
+    bool clustering = ecs::get_light_clustering();
+    if (ImGui::Checkbox("Light Clustering", &clustering))
+        ecs::set_light_clustering(clustering);
+
+    ecs::light_cluster_stats lcs;
+    ecs::get_light_cluster_stats(lcs);
+    ImGui::Text("Clustered Lights: %i (%i indices, %i max per cluster)", lcs.lights, lcs.light_indices,
+                lcs.max_cluster_lights);
+    ImGui::Text("Light Cluster Build: %2.2f ms", lcs.build_ms);
+    ImGui::Separator();
+
+    bool shadow_caching = ecs::get_shadow_caching();
+    if (ImGui::Checkbox("Shadow Caching", &shadow_caching))
+        ecs::set_shadow_caching(shadow_caching);
+
+    bool caster_culling = ecs::get_shadow_caster_culling();
+    if (ImGui::Checkbox("Shadow Caster Culling", &caster_culling))
+        ecs::set_shadow_caster_culling(caster_culling);
+
+    ecs::shadow_stats ss;
+    ecs::get_shadow_stats(ss);
+    ImGui::Text("Shadow Slices Cached: %i / %i", ss.cached_slices, ss.slices);
+    ImGui::Text("Shadow Casters: %i static, %i dynamic, %i culled", ss.static_casters, ss.dynamic_casters,
+                ss.culled_casters);
+    ImGui::Separator();
+
+    bool mesh_lods = ecs::get_mesh_lods();
+    if (ImGui::Checkbox("Mesh Lods", &mesh_lods))
+        ecs::set_mesh_lods(mesh_lods);
+
+    f32 lod_shadow_bias = ecs::get_lod_shadow_bias();
+    if (ImGui::SliderFloat("Shadow Lod Bias", &lod_shadow_bias, 1.0f, 16.0f))
+        ecs::set_lod_shadow_bias(lod_shadow_bias);
+
+    ecs::lod_stats ls;
+    ecs::get_lod_stats(ls);
+    ImGui::Text("Lod Draws: %i / %i (%i changes)", ls.lod_draws, ls.draws, ls.lod_changes);
+    ImGui::Text("Triangles: %llu (%llu full)", ls.submitted_triangles, ls.full_triangles);
+    ImGui::Separator();
+
     ImGui::End();
 
     static f32 t = 0.0f;
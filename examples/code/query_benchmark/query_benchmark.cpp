@@ -0,0 +1,263 @@
+// query_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for ecs_query, a million entities with a spread of component and state flags are scanned for lights,
+// renderables, master instances and visible animation controllers. Reports the cost of the branchy loops the scene
+// passes used against the scalar and simd scans and a cached query on a scene, every scan must select the same
+// entities in the same order.
+
+#include "console.h"
+#include "data_struct.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_query.h"
+#include "ecs/ecs_utilities.h"
+
+#include <string.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "query_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_entities = 1 << 20;
+    const u32 k_scene_entities = 1 << 16;
+    const u32 k_passes = 32;
+
+    struct benchmark_query
+    {
+        const c8*    name;
+        entity_query q;
+    };
+
+    const benchmark_query k_queries[] = {
+        {"light", {e_cmp::light, 0, 0, 0}},
+        {"renderable", {e_cmp::geometry | e_cmp::material, e_cmp::sub_instance, 0, 0}},
+        {"master instance", {e_cmp::master_instance, 0, 0, 0}},
+        {"visible anim controller", {e_cmp::anim_controller, 0, 0, e_state::hidden}},
+    };
+
+    u32 s_seed = 0x9e3779b9;
+
+    u32 rand_percent()
+    {
+        // lcg, deterministic across platforms
+        s_seed = s_seed * 1664525 + 1013904223;
+        return (s_seed >> 8) % 1000;
+    }
+
+    void create_flags(u64* entities, u64* state_flags, u32 count)
+    {
+        for (u32 n = 0; n < count; ++n)
+        {
+            u64 e = e_cmp::allocated | e_cmp::transform;
+            u64 s = 0;
+
+            u32 r = rand_percent();
+            if (r < 600)
+            {
+                e |= e_cmp::geometry | e_cmp::material;
+                if (r < 60)
+                    e |= e_cmp::sub_instance;
+                else if (r < 61)
+                    e |= e_cmp::master_instance;
+            }
+            else if (r < 610)
+            {
+                e |= e_cmp::light;
+            }
+
+            if (rand_percent() < 5)
+                e |= e_cmp::anim_controller;
+
+            if (rand_percent() < 50)
+                s |= e_state::hidden;
+
+            entities[n] = e;
+            state_flags[n] = s;
+        }
+    }
+
+    // the per pass loops each query replaces
+    u32 scan_branchy(const u64* entities, const u64* state_flags, u32 count, u32 qi, u32* entities_out)
+    {
+        u32 num = 0;
+        for (u32 n = 0; n < count; ++n)
+        {
+            switch (qi)
+            {
+                case 0:
+                    if (!(entities[n] & e_cmp::light))
+                        continue;
+                    break;
+                case 1:
+                    if ((entities[n] & (e_cmp::geometry | e_cmp::material)) != (e_cmp::geometry | e_cmp::material))
+                        continue;
+                    if (entities[n] & e_cmp::sub_instance)
+                        continue;
+                    break;
+                case 2:
+                    if (!(entities[n] & e_cmp::master_instance))
+                        continue;
+                    break;
+                case 3:
+                    if (!(entities[n] & e_cmp::anim_controller))
+                        continue;
+                    if (state_flags[n] & e_state::hidden)
+                        continue;
+                    break;
+            }
+
+            entities_out[num++] = n;
+        }
+
+        return num;
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        static const c8* k_simd_names[] = {"none", "sse4", "avx2"};
+        ecs::simd_init();
+
+        u64* entities = (u64*)pen::memory_alloc(sizeof(u64) * k_entities);
+        u64* state_flags = (u64*)pen::memory_alloc(sizeof(u64) * k_entities);
+        u32* out[3];
+        for (u32 i = 0; i < 3; ++i)
+            out[i] = (u32*)pen::memory_alloc(sizeof(u32) * k_entities);
+
+        create_flags(entities, state_flags, k_entities);
+
+        u32 failures = 0;
+
+        // uncached scans over flat arrays
+        for (u32 qi = 0; qi < PEN_ARRAY_SIZE(k_queries); ++qi)
+        {
+            const entity_query& q = k_queries[qi].q;
+
+            u32 num[3] = {};
+            f64 ms[3] = {};
+            for (u32 p = 0; p < k_passes; ++p)
+            {
+                f64 t0 = pen::get_time_us();
+                num[0] = scan_branchy(entities, state_flags, k_entities, qi, out[0]);
+                f64 t1 = pen::get_time_us();
+                num[1] = query_entities_scalar(entities, state_flags, k_entities, q, out[1]);
+                f64 t2 = pen::get_time_us();
+                num[2] = query_entities(entities, state_flags, k_entities, q, out[2]);
+                f64 t3 = pen::get_time_us();
+
+                ms[0] += (t1 - t0) / 1000.0;
+                ms[1] += (t2 - t1) / 1000.0;
+                ms[2] += (t3 - t2) / 1000.0;
+            }
+
+            bool match = num[0] == num[1] && num[1] == num[2];
+            match &= memcmp(out[0], out[1], sizeof(u32) * num[0]) == 0;
+            match &= memcmp(out[0], out[2], sizeof(u32) * num[0]) == 0;
+
+            PEN_LOG("%s: %u of %u entities, branchy %.3f(ms), scalar %.3f(ms), %s %.3f(ms), results %s", k_queries[qi].name,
+                    num[0], k_entities, ms[0] / k_passes, ms[1] / k_passes, k_simd_names[simd_get_level()],
+                    ms[2] / k_passes, match ? "match" : "differ (expected match)");
+
+            if (!match)
+                failures++;
+        }
+
+        // cached queries on a scene, rebuilt after invalidation and reused until the next
+        ecs_scene* scene = new ecs_scene();
+        resize_scene_buffers(scene, k_scene_entities);
+
+        s32 start, end;
+        get_new_entities_append(scene, k_scene_entities, start, end);
+        create_flags(&scene->entities[start], &scene->state_flags[start], k_scene_entities);
+
+        for (u32 qi = 0; qi < PEN_ARRAY_SIZE(k_queries); ++qi)
+        {
+            const entity_query& q = k_queries[qi].q;
+
+            f64 rebuild_ms = 0.0;
+            f64 cached_ms = 0.0;
+            u32 mismatches = 0;
+            for (u32 p = 0; p < k_passes; ++p)
+            {
+                invalidate_queries(scene);
+
+                f64 t0 = pen::get_time_us();
+                u32* rebuilt = query(scene, q);
+                f64  t1 = pen::get_time_us();
+                u32* cached = query(scene, q);
+                f64  t2 = pen::get_time_us();
+
+                rebuild_ms += (t1 - t0) / 1000.0;
+                cached_ms += (t2 - t1) / 1000.0;
+
+                u32 num = scan_branchy(scene->entities.data, scene->state_flags.data, (u32)scene->num_entities, qi, out[0]);
+                if (cached != rebuilt || sb_count(cached) != num || memcmp(cached, out[0], sizeof(u32) * num) != 0)
+                    mismatches++;
+            }
+
+            PEN_LOG("scene %s: %u entities, rebuild %.3f(ms), cached %.4f(ms), %u mismatched passes (expected 0)",
+                    k_queries[qi].name, (u32)scene->num_entities, rebuild_ms / k_passes, cached_ms / k_passes, mismatches);
+
+            if (mismatches)
+                failures++;
+        }
+
+        // removing a component is seen by the next query
+        u32* lights = query(scene, k_queries[0].q);
+        u32  num_lights = sb_count(lights);
+        u32  removed = lights[0];
+        zero_entity_components(scene, removed);
+
+        lights = query(scene, k_queries[0].q);
+        bool found = false;
+        for (u32 i = 0; i < sb_count(lights); ++i)
+            found |= lights[i] == removed;
+
+        PEN_LOG("invalidate: %u lights after removing one (expected %u), removed entity %s", sb_count(lights),
+                num_lights - 1, found ? "still listed (expected removed)" : "removed");
+
+        if (found || sb_count(lights) != num_lights - 1)
+            failures++;
+
+        pen::memory_free(entities);
+        pen::memory_free(state_flags);
+        for (u32 i = 0; i < 3; ++i)
+            pen::memory_free(out[i]);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(failures ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
@@ -66,8 +66,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     instantiate_material(default_material, scene, ground);
     instantiate_model_cbuffer(scene, ground);
 
-    scene->physics_data[ground].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[ground].rigid_body.mass = 0.0f;
+    scene->physics_data.get_or_add(ground).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(ground).rigid_body.mass = 0.0f;
     instantiate_rigid_body(scene, ground);
 
     vec3f wall_pos[] = {vec3f(-51.0f, 2.0f, 0.0f), vec3f(51.0f, 2.0f, 0.0f), vec3f(0.0f, 2.0f, -51.0f),
@@ -86,8 +86,8 @@ void example_setup(ecs_scene* scene, camera& cam)
         scene->transforms[wall].scale = wall_size[i];
         scene->entities[wall] |= e_cmp::transform;
         scene->parents[wall] = wall;
-        scene->physics_data[wall].rigid_body.shape = physics::e_shape::box;
-        scene->physics_data[wall].rigid_body.mass = 0.0f;
+        scene->physics_data.get_or_add(wall).rigid_body.shape = physics::e_shape::box;
+        scene->physics_data.get_or_add(wall).rigid_body.mass = 0.0f;
         instantiate_geometry(box, scene, wall);
         instantiate_material(default_material, scene, wall);
         instantiate_model_cbuffer(scene, wall);
@@ -135,8 +135,8 @@ void example_setup(ecs_scene* scene, camera& cam)
                     instantiate_material(default_material, scene, new_prim);
                     instantiate_model_cbuffer(scene, new_prim);
 
-                    scene->physics_data[new_prim].rigid_body.shape = primitive_types[p];
-                    scene->physics_data[new_prim].rigid_body.mass = 1.0f;
+                    scene->physics_data.get_or_add(new_prim).rigid_body.shape = primitive_types[p];
+                    scene->physics_data.get_or_add(new_prim).rigid_body.mass = 1.0f;
                     instantiate_rigid_body(scene, new_prim);
 
                     simple_lighting* m = (simple_lighting*)&scene->material_data[new_prim].data[0];
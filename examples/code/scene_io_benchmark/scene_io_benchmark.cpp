@@ -0,0 +1,142 @@
+// scene_io_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for the version 10 scene format, a scene of a million entities with transforms, bounds, a hierarchy and
+// names is saved and loaded back. A fresh load maps the component arrays from the file and a merge load reads them,
+// reports the time of each and checks the loaded components and names match the saved scene.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "scene_io_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_entities = 1 << 20;
+    const u32 k_children = 16;
+    const c8* k_filename = "scene_io_benchmark.pms";
+
+    void create_scene(ecs_scene* scene)
+    {
+        s32 start, end;
+        get_new_entities_append(scene, k_entities, start, end);
+
+        for (s32 e = start; e < end; ++e)
+        {
+            // groups of children under a root
+            u32 root = e - e % k_children;
+
+            vec3f pos = vec3f((f32)(e % 100), (f32)((e / 100) % 100), (f32)(e / 10000));
+            scene->transforms[e].translation = pos;
+            scene->transforms[e].rotation = quat();
+            scene->transforms[e].scale = vec3f::one();
+            scene->bounding_volumes[e].min_extents = -vec3f::one();
+            scene->bounding_volumes[e].max_extents = vec3f::one();
+            scene->world_matrices[e] = mat::create_translation(pos);
+            scene->parents[e] = root;
+            scene->entities[e] |= e_cmp::transform;
+
+            c8 name[32];
+            snprintf(name, sizeof(name), "node_%i", e);
+            scene->names[e] = name;
+        }
+    }
+
+    u32 count_mismatches(ecs_scene* src, ecs_scene* dst)
+    {
+        if (dst->num_entities != src->num_entities)
+            return k_entities;
+
+        u32 mismatches = 0;
+        for (u32 e = 0; e < k_entities; ++e)
+        {
+            bool match = memcmp(&dst->transforms[e], &src->transforms[e], sizeof(cmp_transform)) == 0;
+            match &= memcmp(&dst->bounding_volumes[e], &src->bounding_volumes[e], sizeof(cmp_bounding_volume)) == 0;
+            match &= memcmp(&dst->world_matrices[e], &src->world_matrices[e], sizeof(mat4)) == 0;
+            match &= dst->parents[e] == src->parents[e];
+            match &= dst->entities[e] == src->entities[e];
+            match &= dst->names[e] == src->names[e];
+
+            if (!match)
+                mismatches++;
+        }
+
+        return mismatches;
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        ecs_scene* scene = new ecs_scene();
+        resize_scene_buffers(scene, 1024);
+        create_scene(scene);
+
+        f64 t0 = pen::get_time_us();
+        save_scene(k_filename, scene);
+        f64 save_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        // fresh scene, component arrays are mapped where the platform allows
+        ecs_scene* mapped = new ecs_scene();
+        resize_scene_buffers(mapped, 1024);
+
+        t0 = pen::get_time_us();
+        load_scene(k_filename, mapped, false);
+        f64 mapped_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        // merging always reads the component arrays
+        ecs_scene* merged = new ecs_scene();
+        resize_scene_buffers(merged, 1024);
+
+        t0 = pen::get_time_us();
+        load_scene(k_filename, merged, true);
+        f64 merged_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        PEN_LOG("scene io %u entities: save %.3f(ms), load %.3f(ms), merge load %.3f(ms)", k_entities, save_ms, mapped_ms,
+                merged_ms);
+
+        u32 mapped_mismatches = count_mismatches(scene, mapped);
+        u32 merged_mismatches = count_mismatches(scene, merged);
+        PEN_LOG("load: %u mismatched entities (expected 0), merge load: %u mismatched entities (expected 0)",
+                mapped_mismatches, merged_mismatches);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(mapped_mismatches || merged_mismatches ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
@@ -61,8 +61,8 @@ void example_setup(ecs_scene* scene, camera& cam)
     instantiate_material(default_material, scene, ground);
     instantiate_model_cbuffer(scene, ground);
 
-    scene->physics_data[ground].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[ground].rigid_body.mass = 0.0f;
+    scene->physics_data.get_or_add(ground).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(ground).rigid_body.mass = 0.0f;
     instantiate_rigid_body(scene, ground);
 
     vec3f start_positions[] = {vec3f(-4.f, 2.0f, -4.f)};
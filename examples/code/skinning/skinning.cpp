@@ -69,9 +69,9 @@ void example_setup(ecs_scene* scene, camera& cam)
     anim_handle ah = load_pma("data/models/characters/testcharacter/anims/testcharacter_idle.pma");
     bind_animation_to_rig(scene, ah, skinned_char);
 
-    scene->anim_controller_v2[skinned_char].blend.anim_a = 0;
-    scene->anim_controller_v2[skinned_char].blend.anim_b = 0;
-    scene->anim_controller_v2[skinned_char].blend.ratio = 0.0f;
+    scene->anim_controller_v2.get_or_add(skinned_char).blend.anim_a = 0;
+    scene->anim_controller_v2.get_or_add(skinned_char).blend.anim_b = 0;
+    scene->anim_controller_v2.get_or_add(skinned_char).blend.ratio = 0.0f;
 
     simple_lighting* m = (simple_lighting*)&scene->material_data[skinned_char].data[0];
     m->m_albedo = vec4f::white();
@@ -0,0 +1,222 @@
+// sparse_component_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for sparse component arrays, a large scene where few entities have physics, animation controllers or
+// area lights. Reports the memory of each sparse component against dense storage, the cost of visiting the physics
+// components by scanning entities and by iterating the pool, and checks the components follow their entities through
+// a reorder.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include <string.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "sparse_component_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_entities = 1 << 17;
+    const u32 k_physics_every = 100;
+    const u32 k_anim_every = 250;
+    const u32 k_area_light_every = 1000;
+    const u32 k_passes = 32;
+
+    void create_entities(ecs_scene* scene)
+    {
+        for (u32 i = 0; i < k_entities; ++i)
+        {
+            u32 e = get_new_entity(scene);
+            scene->transforms[e].scale = vec3f::one();
+
+            // pairs of entities stored child first, reorder_entities moves every child after its parent
+            if (i % 2 == 0)
+                scene->parents[e] = e + 1;
+
+            if (i % k_physics_every == 0)
+            {
+                cmp_physics& p = scene->physics_data.get_or_add(e);
+                p.type = e_physics_type::rigid_body;
+                p.rigid_body.mass = (f32)i;
+                scene->entities[e] |= e_cmp::physics;
+            }
+
+            if (i % k_anim_every == 0)
+            {
+                scene->anim_controller_v2.get_or_add(e).joints_offset = e;
+                scene->entities[e] |= e_cmp::anim_controller;
+            }
+
+            if (i % k_area_light_every == 0)
+                scene->area_light_resources.get_or_add(e).shader_name = "pmfx_utility";
+        }
+    }
+
+    f64 sum_mass_scan(ecs_scene* scene)
+    {
+        f64 mass = 0.0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            if (!(scene->entities[n] & e_cmp::physics))
+                continue;
+
+            mass += scene->physics_data.get(n).rigid_body.mass;
+        }
+
+        return mass;
+    }
+
+    f64 sum_mass_pool(ecs_scene* scene)
+    {
+        f64 mass = 0.0;
+        for_each_component(scene->physics_data, [&mass](u32 n, cmp_physics& p) { mass += p.rigid_body.mass; });
+        return mass;
+    }
+
+    f64 sum_mass_dense(ecs_scene* scene, const cmp_physics* dense)
+    {
+        f64 mass = 0.0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            if (!(scene->entities[n] & e_cmp::physics))
+                continue;
+
+            mass += dense[n].rigid_body.mass;
+        }
+
+        return mass;
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        ecs_scene* scene = new ecs_scene();
+        resize_scene_buffers(scene, k_entities);
+        create_entities(scene);
+
+        // memory
+        std::vector<component_memory> report;
+        get_component_memory(scene, report);
+
+        size_t total = 0;
+        size_t total_dense = 0;
+        for (auto& cm : report)
+        {
+            total += cm.allocated_bytes;
+            total_dense += cm.dense_bytes;
+
+            if (!(cm.flags & e_cmp_array_flags::sparse))
+                continue;
+
+            PEN_LOG("sparse %s: %u elements of %u bytes, %.1f(kb) allocated, %.1f(kb) dense", cm.name, cm.elements,
+                    cm.size, cm.allocated_bytes / 1024.0, cm.dense_bytes / 1024.0);
+        }
+
+        PEN_LOG("components: %u entities, %.1f(mb) allocated, %.1f(mb) if every component was dense",
+                (u32)scene->num_entities, total / (1024.0 * 1024.0), total_dense / (1024.0 * 1024.0));
+
+        // access, a dense copy of physics data is the reference for the old storage
+        cmp_physics* dense = (cmp_physics*)pen::memory_alloc(sizeof(cmp_physics) * scene->soa_size);
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            memcpy(&dense[n], &scene->physics_data.get(n), sizeof(cmp_physics));
+
+        f64 mass[3] = {};
+        f64 ms[3] = {};
+        for (u32 p = 0; p < k_passes; ++p)
+        {
+            f64 t0 = pen::get_time_us();
+            mass[0] = sum_mass_dense(scene, dense);
+            f64 t1 = pen::get_time_us();
+            mass[1] = sum_mass_scan(scene);
+            f64 t2 = pen::get_time_us();
+            mass[2] = sum_mass_pool(scene);
+            f64 t3 = pen::get_time_us();
+
+            ms[0] += (t1 - t0) / 1000.0;
+            ms[1] += (t2 - t1) / 1000.0;
+            ms[2] += (t3 - t2) / 1000.0;
+        }
+
+        bool sums_match = mass[0] == mass[1] && mass[1] == mass[2];
+        PEN_LOG("physics access: dense scan %.3f(ms), sparse scan %.3f(ms), sparse pool %.3f(ms), sums %s",
+                ms[0] / k_passes, ms[1] / k_passes, ms[2] / k_passes, sums_match ? "match" : "differ (expected match)");
+
+        pen::memory_free(dense);
+
+        // reorder, components follow their entities
+        u32* tags = (u32*)pen::memory_alloc(sizeof(u32) * scene->num_entities);
+        for (u32 n = 0; n < scene->num_entities; ++n)
+            tags[n] = scene->physics_data.has(n) ? (u32)scene->physics_data.get(n).rigid_body.mass : PEN_INVALID_HANDLE;
+
+        f64 t0 = pen::get_time_us();
+        bool changed = reorder_entities(scene);
+        f64 reorder_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        u32 mismatches = 0;
+        for (u32 n = 0; n < scene->num_entities; ++n)
+        {
+            u32 r = remap_entity(scene, n);
+            if (scene->anim_controller_v2.has(r) && scene->anim_controller_v2.get(r).joints_offset != r)
+                mismatches++;
+
+            if (!is_valid(tags[n]))
+            {
+                if (scene->physics_data.has(r))
+                    mismatches++;
+
+                continue;
+            }
+
+            if (!scene->physics_data.has(r) || (u32)scene->physics_data.get(r).rigid_body.mass != tags[n])
+                mismatches++;
+        }
+
+        get_component_memory(scene, report);
+        u32 physics_elements = 0;
+        for (auto& cm : report)
+            if (cm.name && strcmp(cm.name, "physics_data") == 0)
+                physics_elements = cm.elements;
+
+        u32 expected_elements = (k_entities + k_physics_every - 1) / k_physics_every;
+        PEN_LOG("reorder: %s in %.3f(ms), %u mismatched entities (expected 0), %u physics elements (expected %u)",
+                changed ? "moved" : "unchanged", reorder_ms, mismatches, physics_elements, expected_elements);
+
+        pen::memory_free(tags);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(!sums_match || mismatches || physics_elements != expected_elements ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
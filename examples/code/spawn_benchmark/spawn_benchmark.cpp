@@ -0,0 +1,138 @@
+// spawn_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Benchmark for spawn_batch, 100k boxes are spawned from a prototype entity one at a time with get_new_entity and
+// clone_entity and in one batch. Reports the time of each and checks the batch places every box at its transform
+// with the prototype components in a single contiguous range.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_resources.h"
+#include "ecs/ecs_scene.h"
+#include "ecs/ecs_utilities.h"
+
+#include <string.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "spawn_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    const u32 k_boxes = 100000;
+
+    u32 create_prototype(ecs_scene* scene)
+    {
+        // a box as load_geometry and instantiate_material would leave it, without gpu buffers
+        u32 e = get_new_entity(scene);
+        scene->names[e] = "box";
+        scene->geometry_names[e] = "cube";
+        scene->material_names[e] = "default_material";
+        scene->id_geometry[e] = PEN_HASH("cube");
+        scene->transforms[e].scale = vec3f::one();
+        scene->bounding_volumes[e].min_extents = -vec3f::one();
+        scene->bounding_volumes[e].max_extents = vec3f::one();
+        scene->parents[e] = e;
+        scene->entities[e] |= e_cmp::geometry | e_cmp::material | e_cmp::transform;
+        instantiate_model_cbuffer(scene, e);
+        return e;
+    }
+
+    void create_transforms(cmp_transform* transforms)
+    {
+        for (u32 i = 0; i < k_boxes; ++i)
+        {
+            transforms[i].translation = vec3f((f32)(i % 100), (f32)((i / 100) % 100), (f32)(i / 10000)) * 2.0f;
+            transforms[i].rotation = quat();
+            transforms[i].scale = vec3f::one();
+        }
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        cmp_transform* transforms = (cmp_transform*)pen::memory_alloc(sizeof(cmp_transform) * k_boxes);
+        create_transforms(transforms);
+
+        // entity by entity
+        ecs_scene* single = new ecs_scene();
+        resize_scene_buffers(single, 1024);
+        u32 single_proto = create_prototype(single);
+
+        f64 t0 = pen::get_time_us();
+        for (u32 i = 0; i < k_boxes; ++i)
+        {
+            u32 e = get_new_entity(single);
+            clone_entity(single, single_proto, e, -1, e_clone_mode::instantiate, vec3f::zero(), "");
+            single->transforms[e] = transforms[i];
+            single->entities[e] |= e_cmp::transform;
+        }
+        f64 single_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        // batched
+        ecs_scene* batch = new ecs_scene();
+        resize_scene_buffers(batch, 1024);
+        u32 batch_proto = create_prototype(batch);
+
+        t0 = pen::get_time_us();
+        u32 start = spawn_batch(batch, batch_proto, k_boxes, transforms);
+        f64 batch_ms = (pen::get_time_us() - t0) / 1000.0;
+
+        u32 mismatches = 0;
+        for (u32 i = 0; i < k_boxes; ++i)
+        {
+            u32 e = start + i;
+
+            bool match = memcmp(&batch->transforms[e], &transforms[i], sizeof(cmp_transform)) == 0;
+            match &= batch->geometry_names[e] == batch->geometry_names[batch_proto];
+            match &= batch->cbuffer[e] == batch->cbuffer[batch_proto];
+            match &= batch->parents[e] == e;
+            match &= (batch->entities[e] & (e_cmp::allocated | e_cmp::geometry | e_cmp::material | e_cmp::transform)) ==
+                     (e_cmp::allocated | e_cmp::geometry | e_cmp::material | e_cmp::transform);
+
+            if (!match)
+                mismatches++;
+        }
+
+        PEN_LOG("spawn %u boxes: entity by entity %.3f(ms), spawn_batch %.3f(ms), %.1fx", k_boxes, single_ms, batch_ms,
+                single_ms / batch_ms);
+
+        PEN_LOG("spawn_batch: entities %u to %u, %u mismatched boxes (expected 0)", start, start + k_boxes - 1,
+                mismatches);
+
+        pen::memory_free(transforms);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(mismatches ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
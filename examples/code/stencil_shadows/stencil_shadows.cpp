@@ -70,7 +70,7 @@ void render_stencil_shadows(const scene_view& view)
 
     for (u32 i = cube_start; i <= cube_end; ++i)
     {
-        pen::renderer_set_constant_buffer(scene->cbuffer[i], 1, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
+        ecs::set_draw_cbuffer(scene, i, pen::CBUFFER_BIND_PS | pen::CBUFFER_BIND_VS);
         pen::renderer_draw_indexed(r.num_indices, 0, 0, PEN_PT_TRIANGLELIST);
     }
 }
@@ -383,8 +383,8 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
     scene->transforms[ground].scale = vec3f(30.0f, 1.0f, 30.0f);
     scene->entities[ground] |= e_cmp::transform;
     scene->parents[ground] = ground;
-    scene->physics_data[ground].rigid_body.shape = physics::e_shape::box;
-    scene->physics_data[ground].rigid_body.mass = 0.0f;
+    scene->physics_data.get_or_add(ground).rigid_body.shape = physics::e_shape::box;
+    scene->physics_data.get_or_add(ground).rigid_body.mass = 0.0f;
     instantiate_geometry(box, scene, ground);
     instantiate_material(default_material, scene, ground);
     instantiate_model_cbuffer(scene, ground);
@@ -420,8 +420,8 @@ void example_setup(ecs::ecs_scene* scene, camera& cam)
                 instantiate_material(default_material, scene, new_prim);
                 instantiate_model_cbuffer(scene, new_prim);
 
-                scene->physics_data[new_prim].rigid_body.shape = physics::e_shape::box;
-                scene->physics_data[new_prim].rigid_body.mass = 1.0f;
+                scene->physics_data.get_or_add(new_prim).rigid_body.shape = physics::e_shape::box;
+                scene->physics_data.get_or_add(new_prim).rigid_body.mass = 1.0f;
                 instantiate_rigid_body(scene, new_prim);
 
                 cube_start = min(new_prim, cube_start);
@@ -0,0 +1,247 @@
+// transform_benchmark.cpp
+// Copyright 2014 - 2019 Alex Dixon.
+// License: https://github.com/polymonster/pmtech/blob/master/license.md
+
+// Micro benchmark for the ecs_transform batch kernels, times the simd dispatch against the scalar path for compose
+// trs, multiply parent and transform aabb at 1k, 64k and 1M entities. Every simd level the cpu supports is checked
+// against scalar first, a kernel outside the tolerance fails the benchmark with a non zero exit code.
+
+#include "console.h"
+#include "memory.h"
+#include "os.h"
+#include "pen.h"
+#include "threads.h"
+#include "timer.h"
+
+#include "ecs/ecs_cull.h"
+#include "ecs/ecs_transform.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace put;
+using namespace ecs;
+
+namespace
+{
+    void* user_setup(void* params);
+} // namespace
+
+namespace pen
+{
+    pen_creation_params pen_entry(int argc, char** argv)
+    {
+        pen::pen_creation_params p;
+        p.window_width = 1280;
+        p.window_height = 720;
+        p.window_title = "transform_benchmark";
+        p.window_sample_count = 4;
+        p.user_thread_function = user_setup;
+        p.flags = pen::e_pen_create_flags::console_app;
+        return p;
+    }
+} // namespace pen
+
+namespace
+{
+    // the first size is not a multiple of the simd width so the padded lanes are checked
+    const u32 k_sizes[] = {(1 << 10) + 3, 1 << 16, 1 << 20};
+    const u32 k_entities_per_size = 1 << 24; // each size runs enough iterations to process this many entities
+    const u32 k_chain_length = 4;            // parent chains of root, child, grand child, great grand child
+    const f32 k_max_error = 1e-4f;           // relative to the scalar result, or absolute below a magnitude of 1
+
+    u32 s_failures = 0;
+
+    struct bench_data
+    {
+        u32                  num = 0;
+        cmp_transform*       transforms = nullptr;
+        u32*                 parents = nullptr;
+        u32*                 entities = nullptr;
+        mat4*                local[2] = {nullptr, nullptr};
+        mat4*                world[2] = {nullptr, nullptr};
+        cmp_bounding_volume* bv[2] = {nullptr, nullptr};
+    };
+
+    void create_data(bench_data& bd, u32 num)
+    {
+        bd.num = num;
+        bd.transforms = (cmp_transform*)pen::memory_alloc(sizeof(cmp_transform) * num);
+        bd.parents = (u32*)pen::memory_alloc(sizeof(u32) * num);
+        bd.entities = (u32*)pen::memory_alloc(sizeof(u32) * num);
+
+        for (u32 i = 0; i < 2; ++i)
+        {
+            bd.local[i] = (mat4*)pen::memory_alloc(sizeof(mat4) * num);
+            bd.world[i] = (mat4*)pen::memory_alloc(sizeof(mat4) * num);
+            bd.bv[i] = (cmp_bounding_volume*)pen::memory_alloc(sizeof(cmp_bounding_volume) * num);
+        }
+
+        for (u32 n = 0; n < num; ++n)
+        {
+            f32 f = (f32)n;
+
+            cmp_transform& t = bd.transforms[n];
+            t.translation = vec3f(sinf(f), cosf(f * 0.5f), sinf(f * 0.25f)) * 10.0f;
+            t.scale = vec3f(1.0f + (n % 3) * 0.5f, 1.0f, 1.0f + (n % 5) * 0.25f);
+            t.rotation.euler_angles(f * 0.01f, f * 0.02f, f * 0.03f);
+
+            bd.parents[n] = n % k_chain_length == 0 ? n : n - 1;
+            bd.entities[n] = n;
+
+            for (u32 i = 0; i < 2; ++i)
+            {
+                bd.bv[i][n].min_extents = vec3f(-1.0f, -0.5f, -2.0f);
+                bd.bv[i][n].max_extents = vec3f(1.0f, 1.5f, 0.5f);
+            }
+        }
+    }
+
+    void destroy_data(bench_data& bd)
+    {
+        pen::memory_free(bd.transforms);
+        pen::memory_free(bd.parents);
+        pen::memory_free(bd.entities);
+
+        for (u32 i = 0; i < 2; ++i)
+        {
+            pen::memory_free(bd.local[i]);
+            pen::memory_free(bd.world[i]);
+            pen::memory_free(bd.bv[i]);
+        }
+    }
+
+    // simd results are not bit exact, the fused and reordered operations differ in the last bits. nan is returned as
+    // an error so it always fails.
+    f32 max_error(const f32* a, const f32* b, u32 count, u32 stride)
+    {
+        f32 e = 0.0f;
+        for (u32 i = 0; i < count; ++i)
+        {
+            for (u32 j = 0; j < stride; ++j)
+            {
+                f32 sa = a[i * stride + j];
+                f32 d = fabs(sa - b[i * stride + j]) / std::max<f32>(fabs(sa), 1.0f);
+                if (!(d <= e))
+                    e = d;
+            }
+        }
+
+        return e;
+    }
+
+    f32 max_aabb_error(const cmp_bounding_volume* a, const cmp_bounding_volume* b, u32 count)
+    {
+        f32 e = 0.0f;
+        for (u32 i = 0; i < count; ++i)
+        {
+            e = std::max<f32>(e, max_error(&a[i].transformed_min_extents.x, &b[i].transformed_min_extents.x, 1, 3));
+            e = std::max<f32>(e, max_error(&a[i].transformed_max_extents.x, &b[i].transformed_max_extents.x, 1, 3));
+        }
+
+        return e;
+    }
+
+    bool check_result(const c8* kernel, const c8* simd, u32 num, f32 error)
+    {
+        if (error < k_max_error)
+            return true;
+
+        PEN_LOG("FAILED %s: %s differs from scalar at %u entities, max error %g (tolerance %g)", kernel, simd, num, error,
+                k_max_error);
+
+        s_failures++;
+        return false;
+    }
+
+    // every kernel at the given simd level against scalar, the simd kernels read the scalar inputs so each error is
+    // only from that kernel
+    void validate_level(bench_data& bd, u32 level, const c8* name)
+    {
+        transform_simd_init(level);
+
+        u32 num = bd.num;
+        compose_trs_scalar(bd.transforms, bd.local[0], bd.entities, num);
+        compose_trs(bd.transforms, bd.local[1], bd.entities, num);
+        check_result("compose_trs", name, num, max_error(bd.local[0][0].m, bd.local[1][0].m, num, 16));
+
+        multiply_parent_scalar(bd.local[0], bd.parents, bd.world[0], bd.entities, num);
+        multiply_parent(bd.local[0], bd.parents, bd.world[1], bd.entities, num);
+        check_result("multiply_parent", name, num, max_error(bd.world[0][0].m, bd.world[1][0].m, num, 16));
+
+        transform_aabb_scalar(bd.world[0], bd.bv[0], bd.entities, num);
+        transform_aabb(bd.world[0], bd.bv[1], bd.entities, num);
+        check_result("transform_aabb", name, num, max_aabb_error(bd.bv[0], bd.bv[1], num));
+    }
+
+    template <typename T>
+    f64 time_ms(u32 iterations, const T& func)
+    {
+        f64 start = pen::get_time_us();
+        for (u32 i = 0; i < iterations; ++i)
+            func();
+
+        return (pen::get_time_us() - start) / (1000.0 * iterations);
+    }
+
+    void log_result(const c8* kernel, u32 num, f64 scalar_ms, f64 simd_ms, f32 error)
+    {
+        PEN_LOG("%s: %u entities, scalar %.3f(ms), simd %.3f(ms), speedup %.2fx, max error %g", kernel, num, scalar_ms,
+                simd_ms, scalar_ms / simd_ms, error);
+    }
+
+    const c8* k_simd_names[] = {"none", "sse4", "avx2"};
+
+    void benchmark_size(u32 num)
+    {
+        bench_data bd;
+        create_data(bd, num);
+
+        u32 simd_level = ecs::simd_get_level();
+        for (u32 level = e_simd::sse4; level <= simd_level; ++level)
+            validate_level(bd, level, k_simd_names[level]);
+
+        transform_simd_init(simd_level);
+
+        u32 iterations = std::max<u32>(k_entities_per_size / num, 1);
+
+        f64 scalar_ms = time_ms(iterations, [&bd]() {
+            compose_trs_scalar(bd.transforms, bd.local[0], bd.entities, bd.num);
+        });
+        f64 simd_ms = time_ms(iterations, [&bd]() { compose_trs(bd.transforms, bd.local[1], bd.entities, bd.num); });
+        log_result("compose_trs", num, scalar_ms, simd_ms, max_error(bd.local[0][0].m, bd.local[1][0].m, num, 16));
+
+        // both use the scalar local matrices so the error is only from this kernel
+        scalar_ms = time_ms(iterations, [&bd]() {
+            multiply_parent_scalar(bd.local[0], bd.parents, bd.world[0], bd.entities, bd.num);
+        });
+        simd_ms = time_ms(iterations, [&bd]() {
+            multiply_parent(bd.local[0], bd.parents, bd.world[1], bd.entities, bd.num);
+        });
+        log_result("multiply_parent", num, scalar_ms, simd_ms, max_error(bd.world[0][0].m, bd.world[1][0].m, num, 16));
+
+        scalar_ms = time_ms(iterations, [&bd]() { transform_aabb_scalar(bd.world[0], bd.bv[0], bd.entities, bd.num); });
+        simd_ms = time_ms(iterations, [&bd]() { transform_aabb(bd.world[0], bd.bv[1], bd.entities, bd.num); });
+        log_result("transform_aabb", num, scalar_ms, simd_ms, max_aabb_error(bd.bv[0], bd.bv[1], num));
+
+        destroy_data(bd);
+    }
+
+    void* user_setup(void* params)
+    {
+        // unpack the params passed to the thread and signal to the engine it ok to proceed
+        pen::job_thread_params* job_params = (pen::job_thread_params*)params;
+        pen::job*               p_thread_info = job_params->job_info;
+        pen::semaphore_post(p_thread_info->p_sem_continue, 1);
+
+        ecs::simd_init();
+        PEN_LOG("transform_benchmark: simd %s", k_simd_names[ecs::simd_get_level()]);
+
+        for (u32 num : k_sizes)
+            benchmark_size(num);
+
+        pen::semaphore_post(p_thread_info->p_sem_terminated, 1);
+        pen::os_terminate(s_failures ? 1 : 0);
+        return PEN_THREAD_OK;
+    }
+} // namespace
@@ -27,6 +27,18 @@ dofile "../core/put/project.lua"
 -- Example projects	
 -- ( project name, current script dir, )
 create_app_example( "empty_project", script_path() ) -- hide
+create_app_example( "jobs_benchmark", script_path() ) -- hide
+create_app_example( "ecs_benchmark", script_path() ) -- hide
+create_app_example( "transform_benchmark", script_path() ) -- hide
+create_app_example( "bvh_benchmark", script_path() ) -- hide
+create_app_example( "occlusion_benchmark", script_path() ) -- hide
+create_app_example( "light_cluster_benchmark", script_path() ) -- hide
+create_app_example( "lod_benchmark", script_path() ) -- hide
+create_app_example( "sparse_component_benchmark", script_path() ) -- hide
+create_app_example( "query_benchmark", script_path() ) -- hide
+create_app_example( "entity_growth_benchmark", script_path() ) -- hide
+create_app_example( "spawn_benchmark", script_path() ) -- hide
+create_app_example( "scene_io_benchmark", script_path() ) -- hide
 create_app_example( "clear", script_path() )
 create_app_example( "basic_triangle", script_path() )
 create_app_example( "basic_texture", script_path() )
@@ -68,6 +80,7 @@ create_app_example( "sss", script_path() )
 create_app_example( "pmfx_renderer", script_path() )
 create_app_example( "dynamic_cubemap", script_path() )
 create_app_example( "entities", script_path() )
+create_app_example( "draw_sort_benchmark", script_path() ) -- hide
 create_app_example( "area_lights", script_path() )
 create_app_example( "ik", script_path() ) -- hide
 create_app_example( "stencil_shadows", script_path() )
@@ -38,6 +38,7 @@ void show_help()
     PEN_LOG("    -i <input file>");
     PEN_LOG("    -o (optional) <output file>");
     PEN_LOG("      if -o is not supplied input file will be overwritten in place.");
+    PEN_LOG("    -lods (optional) <number of simplified levels to generate per submesh>");
 }
 
 void* pen::user_entry(void* params)
@@ -49,6 +50,7 @@ void* pen::user_entry(void* params)
     
     Str input_file = "";
     Str output_file = "";
+    u32 num_lods = 0;
     
     u32 argc = sb_count(s_args);
     for(u32 i = 0; i < argc; ++i)
@@ -65,6 +67,10 @@ void* pen::user_entry(void* params)
         {
             output_file = s_args[i+1];
         }
+        else if(s_args[i] == "-lods" && i+1 < argc)
+        {
+            num_lods = atoi(s_args[i+1].c_str());
+        }
     }
     
     if(input_file.empty())
@@ -80,7 +86,7 @@ void* pen::user_entry(void* params)
     }
     
     PEN_LOG("optimising: %s", input_file.c_str());
-    optimise_pmm(input_file.c_str(), output_file.c_str());
+    optimise_pmm(input_file.c_str(), output_file.c_str(), num_lods);
     
 term:
     // signal to the engine the thread has finished
@@ -232,6 +232,13 @@ if "-mesh_opt" in sys.argv:
         if sys.argv[a] == "-mesh_opt":
             mesh_opt = sys.argv[a+1]
 
+# number of simplified levels mesh_opt generates per submesh
+mesh_lods = ""
+if "-mesh_lods" in sys.argv:
+    for a in range(0, len(sys.argv)):
+        if sys.argv[a] == "-mesh_lods":
+            mesh_lods = sys.argv[a+1]
+
 
 def get_dep_inputs(inputs):
     # add dependency to the build scripts dae
@@ -273,6 +280,8 @@ for file in file_list:
             helpers.output_file.write(base_out_file + ".pmm")
             if len(mesh_opt) > 0:
                 cmd = " -i " + base_out_file + ".pmm"
+                if len(mesh_lods) > 0:
+                    cmd += " -lods " + mesh_lods
                 p = subprocess.Popen(mesh_opt + cmd, shell=True)
                 p.wait()
             dependencies.write_to_file_single(dep, depends_dest + ".dep")
@@ -300,6 +309,8 @@ for file in file_list:
             # apply optimisation
             if len(mesh_opt) > 0:
                 cmd = " -i " + base_out_file + ".pmm"
+                if len(mesh_lods) > 0:
+                    cmd += " -lods " + mesh_lods
                 p = subprocess.Popen(mesh_opt + cmd, shell=True)
                 p.wait()
             dependencies.write_to_file_single(dep, depends_dest + ".dep")
@@ -46,6 +46,16 @@ end
 local function setup_linux()
 	--linux must be linked in order
 	add_pmtech_links()
+	if renderer_dir == "null" then
+		-- headless, no window or gl context
+		links 
+		{ 
+			"pthread",
+			"fmod",
+			"dl"
+		}
+		return
+	end
 	links 
 	{ 
 		"pthread",